@@ -33,6 +33,8 @@ extern int startwin_run(struct startwin_settings *);
 extern int xres, yres, bpp, fullscreen, bytesperline, imageSize;
 extern char offscreenrendering;
 extern intptr_t frameplace;
+extern int threadedblit;	// SDL software modes expand each frame on a thread while the next is drawn
+extern int dirtyblit;		// 8-bit frames are sent only where drawn, and unchanged HUD sprites aren't drawn again
 
 extern void (*baselayer_onvideomodechange)(int);
 
@@ -183,6 +183,77 @@ typedef struct {
 #define SPREXT_NOTMD 1
 #define SPREXT_NOMDANIM 2
 
+	// A ray for hitscanbatch(): what hitscan() is given, and what it finds
+typedef struct {
+	int x, y, z, vx, vy, vz;
+	unsigned int cliptype;
+	short sectnum;
+	short hitsect, hitwall, hitsprite;
+	int hitx, hity, hitz;
+} hitscanraytype;
+
+	// A line of sight for canseebatch(): what cansee() is given, and its answer
+typedef struct {
+	int x1, y1, z1, x2, y2, z2;
+	short sect1, sect2;
+	int result;
+} canseeraytype;
+
+	// What the last drawrooms() did, from getrenderstats()
+typedef struct {
+	int bunches;		// bunches of walls drawn
+	int bunchfronts;	// times two bunches were compared to find the closest
+	int bunchoverlaps;	// of those, the times the two overlapped on screen and their walls were walked
+} renderstatstype;
+
+	// The renderer's stages, timed while profiling is set
+enum {
+	PROFILE_DRAWROOMS,		// setting up and sorting the view, less the stages below
+	PROFILE_SCANSECTOR,		// finding the walls of sectors that face the viewer
+	PROFILE_DRAWALLS,		// drawing walls, less the ceilings and floors
+	PROFILE_CEILSCAN,		// flat ceilings
+	PROFILE_FLORSCAN,		// flat floors
+	PROFILE_FLUSHSPANS,		// drawing the spans recorded for the renderthreads
+	PROFILE_DRAWMASKS,		// sorting sprites and masked walls, less drawing sprites
+	PROFILE_DRAWSPRITE,
+	PROFILE_ROTATESPRITE,
+	PROFILE_LOADTILE,
+	PROFILE_NEXTPAGE,		// less the rotatesprites and overlays it draws
+	PROFILE_NUMTIMERS
+};
+	// The line functions whose pixels are counted
+enum {
+	PROFILE_VLINE,			// walls
+	PROFILE_MVLINE,			// masked walls and sprites
+	PROFILE_TVLINE,			// translucent walls and sprites
+	PROFILE_HLINE,			// flat ceilings and floors
+	PROFILE_MHLINE,			// floor sprites
+	PROFILE_THLINE,			// translucent floor sprites
+	PROFILE_SLOPEVLIN,		// sloped ceilings and floors
+	PROFILE_SPRITEVLINE,	// rotatesprite(), all three kinds
+	PROFILE_DRAWSLAB,		// voxels
+	PROFILE_NUMKERNELS
+};
+	// A frame's profile, from getprofile(). Each stage's time leaves out the
+	// stages it called. Pixels are those the C line functions were asked to
+	// draw, so builds using the assembly ones count none.
+typedef struct {
+	int64_t framensecs;				// from the end of the frame before to the end of this one
+	int64_t nsecs[PROFILE_NUMTIMERS];
+	unsigned int calls[PROFILE_NUMTIMERS];
+	unsigned int pixels[PROFILE_NUMKERNELS];
+	unsigned int tilesloaded, tilebytes;	// by loadtile()
+	unsigned int cachemisses;		// calls to allocache()
+} profiletype;
+extern const char *profiletimernames[PROFILE_NUMTIMERS], *profilekernelnames[PROFILE_NUMKERNELS];
+
+	// A part of the screen drawn since the layer last showed a frame, from
+	// getdirtyrects(). x2 and y2 are one past the last column and row drawn.
+#define MAXDIRTYRECTS 16
+typedef struct {
+	int x1, y1, x2, y2;
+} dirtyrecttype;
+
 EXTERN sectortype sector[MAXSECTORS];
 EXTERN walltype wall[MAXWALLS];
 EXTERN spritetype sprite[MAXSPRITES];
@@ -271,6 +342,12 @@ extern int dommxoverlay, novoxmips;
 
 extern int tiletovox[MAXTILES];
 extern int usevoxels, voxscale[MAXVOXELS];
+extern int renderthreads;
+extern int tilestreaming;	// load tiles in the background, drawing placeholders until they arrive
+extern int usepvs;	// limit scanning to the potentially visible sets in a map's .pvs file, if it has one; needs invalidatesectorgrid() for every wall moved
+extern int useclipcache;	// let clipmove(), getzrange() and pushmove() skip what cannot reach them; needs updateclipcache() every tick
+extern int profiling;	// time the renderer's stages and count its work, frame by frame
+extern int profileoverlay;	// draw the last frame's profile over the screen at nextpage()
 #if USE_POLYMOST && USE_OPENGL
 extern int usemodels, usehightile;
 #endif
@@ -387,9 +464,12 @@ void   initspritelists(void);
 int   loadboard(char *filename, char fromwhere, int *daposx, int *daposy, int *daposz, short *daang, short *dacursectnum);
 int   loadmaphack(char *filename);
 int   saveboard(char *filename, int *daposx, int *daposy, int *daposz, short *daang, short *dacursectnum);
+int   savepvs(const char *mapname, const unsigned char *rows);	// write the .pvs file for the loaded map, (numsectors+7)>>3 bytes a sector
 int   saveoldboard(char *filename, int *daposx, int *daposy, int *daposz, short *daang, short *dacursectnum);
 int   loadpics(char *filename, int askedsize);
 void   loadtile(short tilenume);
+void   prefetchtiles(const short *tiles, int numtiles);
+int    tryloadtile(short tilenume);
 int   qloadkvx(int voxindex, char *filename);
 int   allocatepermanenttile(short tilenume, int xsiz, int ysiz);
 void   copytilepiece(int tilenume1, int sx1, int sy1, int xsiz, int ysiz, int tilenume2, int sx2, int sy2);
@@ -407,6 +487,8 @@ void   flushperms(void);
 
 void   plotpixel(int x, int y, unsigned char col);
 unsigned char   getpixel(int x, int y);
+void   markdirtyrect(int x1, int y1, int x2, int y2);	// for games drawing straight into frameplace with dirtyblit on; x2 and y2 one past the edge
+int    getdirtyrects(dirtyrecttype *rects);	// what was drawn since the last call, in at most MAXDIRTYRECTS rectangles
 void   setviewtotile(short tilenume, int xsiz, int ysiz);
 void   setviewback(void);
 void   preparemirror(int dax, int day, int daz, short daang, int dahoriz, short dawall, short dasector, int *tposx, int *tposy, short *tang);
@@ -414,6 +496,14 @@ void   completemirror(void);
 
 void   drawrooms(int daposx, int daposy, int daposz, short daang, int dahoriz, short dacursectnum);
 void   drawmasks(void);
+void   getrenderstats(renderstatstype *st);
+void   getprofile(profiletype *p);	// the profile of the last frame ended
+void   profileframe(void);	// ends the frame being profiled, as nextpage() does
+int    profilecsv(const char *filename);	// writes each frame's profile to a CSV file from now on, or stops if NULL
+int    tracetofile(const char *filename, int frames);	// records the next frames' events as a Chrome trace, or if NULL stops and writes it now
+void   tracebegin(const char *name);	// the calling thread begins an event in the trace, if one is being recorded
+void   traceend(const char *name);		// and ends it; name must be a string constant
+void   traceinstant(const char *name, int value);	// marks a moment in the trace, with a value
 void   clearview(int dacol);
 void   clearallviews(int dacol);
 void   drawmapview(int dax, int day, int zoome, short ang);
@@ -427,13 +517,17 @@ int   clipinsidebox(int x, int y, short wallnum, int walldist);
 int   clipinsideboxline(int x, int y, int x1, int y1, int x2, int y2, int walldist);
 int   pushmove(int *x, int *y, int *z, short *sectnum, int walldist, int ceildist, int flordist, unsigned int cliptype);
 void   getzrange(int x, int y, int z, short sectnum, int *ceilz, int *ceilhit, int *florz, int *florhit, int walldist, unsigned int cliptype);
+void   updateclipcache(short spritenum);	// with useclipcache, call with -1 each tick before moving anything, and with a sprite moved or reshaped other than by setsprite()
 int    hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz, short *hitsect, short *hitwall, short *hitsprite, int *hitx, int *hity, int *hitz, unsigned int cliptype);
 int   neartag(int xs, int ys, int zs, short sectnum, short ange, short *neartagsector, short *neartagwall, short *neartagsprite, int *neartaghitdist, int neartagrange, unsigned char tagsearch);
 int   cansee(int x1, int y1, int z1, short sect1, int x2, int y2, int z2, short sect2);
+void   hitscanbatch(hitscanraytype *rays, int numrays);	// hitscan() each ray, spread across the renderthreads
+void   canseebatch(canseeraytype *rays, int numrays);	// cansee() each line, likewise
 void   updatesector(int x, int y, short *sectnum);
 void   updatesectorz(int x, int y, int z, short *sectnum);
 int   inside(int x, int y, short sectnum);
 void   dragpoint(short pointhighlight, int dax, int day);
+void   invalidatesectorgrid(short sectnum);	// call when sectnum's walls move other than by dragpoint(), or -1 when the map changes
 void   setfirstwall(short sectnum, short newfirstwall);
 
 void   getmousevalues(int *mousx, int *mousy, int *bstatus);
@@ -12,6 +12,19 @@ void	allocache(void **newhandle, int newbytes, unsigned char *newlockptr);
 void	suckcache(void *suckptr);
 void	agecache(void);
 
+typedef struct {
+	int size;				// bytes under management
+	int blocks;				// including free space
+	int freeblocks, freebytes, largestfree;
+	int lockedblocks, lockedbytes;	// blocks locked at 200 or above
+	unsigned int misses;		// calls to allocache()
+	unsigned int evictsearches;	// misses that had to evict something to fit
+	unsigned int evictions;		// blocks whose handles were cleared to make room
+	int64_t evictedbytes;
+} cachestatstype;
+void	getcachestats(cachestatstype *st);
+void	resetcachestats(void);
+
 enum {
 	PATHSEARCH_GAME  = 0, 	// default
 	PATHSEARCH_SYSTEM = 1,
@@ -21,6 +34,7 @@ enum {
 	KOPEN4LOAD_ANYGRP = 2,
 };
 extern int pathsearchmode;
+extern int usefilemapping;	// map group files into memory as initgroupfile() opens them
 
 int     addsearchpath(const char *p);
 int		findfrompath(const char *fn, char **where);
@@ -37,6 +51,16 @@ int 	klseek(int handle, int offset, int whence);
 int 	kfilelength(int handle);
 int 	ktell(int handle);
 void	kclose(int handle);
+	// Finds the file kopen4load would open and where its bytes lie on disk, so
+	// another thread can read them through its own descriptor. *where must be
+	// freed. Files compressed inside ZIPs have no such place and return -1.
+int		kfilelocation(const char *filename, char searchfirst, char **where, int *offset);
+	// Maps the file kopen4load would open into memory, copy-on-write, returning
+	// NULL if it can't be. Files inside a group file point into the group's own
+	// mapping, made if usefilemapping was set when it was opened, and stay valid
+	// until the group is closed. Release with kunmapfile().
+unsigned char *kmapfile(const char *filename, char searchfirst, int *length);
+void	kunmapfile(unsigned char *ptr, int length);
 
 enum {
 	CACHE1D_FIND_FILE = 1,
@@ -444,6 +444,8 @@ int Bcorrectfilename(char *filename, int removefn);
 int Bcanonicalisefilename(char *filename, int removefn);
 char *Bgetsystemdrives(void);
 boff_t Bfilelength(int fd);
+void *Bmapfile(int fd, bsize_t length);
+void Bunmapfile(void *ptr, bsize_t length);
 char *Bstrtoken(char *s, char *delim, char **ptrptr, int chop);
 int Bwildmatch (const char *i, const char *j);
 
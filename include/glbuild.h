@@ -172,6 +172,7 @@ int glbuild_prepare_8bit_shader(glbuild8bit *state, int resx, int resy, int stri
 void glbuild_delete_8bit_shader(glbuild8bit *state);
 void glbuild_update_8bit_palette(glbuild8bit *state, const GLvoid *pal);
 void glbuild_update_8bit_frame(glbuild8bit *state, const GLvoid *frame, int resx, int resy, int stride);
+void glbuild_update_8bit_rows(glbuild8bit *state, const GLvoid *frame, int stride, int y1, int y2);	// rows y1 to y2-1 only
 void glbuild_draw_8bit_frame(glbuild8bit *state);
 
 #endif //USE_OPENGL
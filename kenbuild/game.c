@@ -2164,6 +2164,7 @@ void tagcode(void)
 			}
 			for(k=1;k<=3;k++)
 				rotatepoint(swingx[i][0],swingy[i][0],swingx[i][k],swingy[i][k],swingang[i],&wall[swingwall[i][k]].x,&wall[swingwall[i][k]].y);
+			invalidatesectorgrid(swingsector[i]);
 
 			if (swinganginc[i] != 0)
 			{
@@ -2196,6 +2197,7 @@ void tagcode(void)
 								}
 								for(k=1;k<=3;k++)
 									rotatepoint(swingx[i][0],swingy[i][0],swingx[i][k],swingy[i][k],swingang[i],&wall[swingwall[i][k]].x,&wall[swingwall[i][k]].y);
+								invalidatesectorgrid(swingsector[i]);
 								if (swingang[i] == swingangclosed[i])
 								{
 									wsayfollow("closdoor.wav",4096L+(krand()&511)-256,256L,&swingx[i][0],&swingy[i][0],0);
@@ -2247,6 +2249,7 @@ void tagcode(void)
 						if (wall[k].x < subwaytrackx2[i])
 							if (wall[k].y < subwaytracky2[i])
 								wall[k].x += subwayvel[i];
+			invalidatesectorgrid(dasector);
 
 			for(j=1;j<subwaynumsectors[i];j++)
 			{
@@ -2256,6 +2259,7 @@ void tagcode(void)
 				endwall = startwall+sector[dasector].wallnum;
 				for(k=startwall;k<endwall;k++)
 					wall[k].x += subwayvel[i];
+				invalidatesectorgrid(dasector);
 
 				for(s=headspritesect[dasector];s>=0;s=nextspritesect[s])
 					sprite[s].x += subwayvel[i];
@@ -5155,6 +5159,8 @@ void doanimations(void)
 		animatevel[i] += animateacc[i];
 
 		*animateptr[i] = j;
+		if ((animateptr[i] >= (int *)&wall[0]) && (animateptr[i] < (int *)&wall[numwalls]))
+			invalidatesectorgrid(sectorofwall((short)(((intptr_t)animateptr[i]-(intptr_t)wall)/sizeof(walltype))));
 
 		if (j == animategoal[i])
 		{
@@ -5638,7 +5644,9 @@ void faketimerhandler(void)
 	if ((totalclock < ototalclock+(TIMERINTSPERSECOND/MOVESPERSECOND)) || (ready2send == 0)) return;
 	ototalclock += (TIMERINTSPERSECOND/MOVESPERSECOND);
 
+	tracebegin("getpackets");
 	getpackets();
+	traceend("getpackets");
 	if (getoutputcirclesize() >= 16) return;
 	getinput();
 
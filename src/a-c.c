@@ -7,11 +7,16 @@
 // See the included license file "BUILDLIC.TXT" for license info.
 
 #include "compat.h"
+#include "build.h"
 #include "a.h"
+#include "a_priv.h"
+
+unsigned int *spanpixelcounts = NULL;
 
 #ifdef ENGINE_USING_A_C
 
 int krecip(int num);	// from engine.c
+void buildprintf(const char *fmt, ...);	// from engine.c
 
 #define BITSOFPRECISION 3
 #define BITSOFPRECISIONPOW 8
@@ -23,6 +28,94 @@ extern void *reciptable;
 static int bpl, transmode = 0;
 static int glogx, glogy, gbxinc, gbyinc, gpinc;
 static unsigned char *gbuf, *gpal, *ghlinepal, *gtrans;
+static const spankerneltype *kern = &spankernels_c;
+
+	//Span recording state. When spannumstrips is non-zero the line functions
+	//below record their work into per-strip command lists instead of drawing.
+enum {
+	SPANCMD_VLINE, SPANCMD_MVLINE, SPANCMD_TVLINE,
+	SPANCMD_HLINE, SPANCMD_MHLINE, SPANCMD_THLINE,
+	SPANCMD_SLOPEVLIN
+};
+typedef struct
+{
+	unsigned char type, logx, logy, trans;
+	int cnt, col, pinc;
+	unsigned int u, v;
+	int uinc, vinc;
+	int bz, bzinc, x3, y3, slopal;
+	unsigned char *buf, *pal, *p;
+} spancmdtype;
+typedef struct
+{
+	spancmdtype *cmd;
+	int numcmds, maxcmds;
+} spanstriptype;
+static spanstriptype spanstrip[MAXSPANSTRIPS];
+static int spannumstrips = 0, spanxdimen;
+static intptr_t spanframeoffs;
+static intptr_t *spanslopal = NULL;
+static int spannumslopal = 0, spanmaxslopal = 0;
+
+static inline int spanstripof(int col)
+{
+	int s = (int)(((int64_t)col*spannumstrips)/spanxdimen);
+	return min(max(s,0),spannumstrips-1);
+}
+
+	//First column owned by strip s, such that spanstripof(x) == s for
+	//spanstripstart(s) <= x < spanstripstart(s+1)
+static inline int spanstripstart(int s)
+{
+	return (int)(((int64_t)s*spanxdimen+spannumstrips-1)/spannumstrips);
+}
+
+	//Files a command with every strip touched by the pixels from p's column
+	//to p's column plus extent
+static void addspancmd(spancmdtype *sc, void *p, int extent)
+{
+	spanstriptype *st;
+	int col, s1, s2;
+
+	col = (int)(((intptr_t)p-spanframeoffs) % bpl);
+	sc->p = (unsigned char *)p;
+	sc->col = col;
+	if (extent < 0) { s1 = spanstripof(col+extent); s2 = spanstripof(col); }
+	else { s1 = spanstripof(col); s2 = spanstripof(col+extent); }
+
+	for(;s1<=s2;s1++)
+	{
+		st = &spanstrip[s1];
+		if (st->numcmds >= st->maxcmds)
+		{
+			st->maxcmds = max(st->maxcmds<<1,1024);
+			st->cmd = (spancmdtype *)Brealloc(st->cmd,st->maxcmds*sizeof(spancmdtype));
+		}
+		st->cmd[st->numcmds++] = *sc;
+	}
+}
+
+	//numstrips > 0 begins recording for the view starting at frameoffs with
+	//daxdimen columns, numstrips = 0 returns to drawing immediately.
+	//Pending commands must be drawn with drawspanstrip() and discarded with
+	//clearspanstrips() before recording ends.
+void setspanrecording(int numstrips, intptr_t frameoffs, int daxdimen)
+{
+	spannumstrips = min(max(numstrips,0),MAXSPANSTRIPS);
+	spanframeoffs = frameoffs;
+	spanxdimen = max(daxdimen,1);
+}
+
+int getspanrecording(void) { return spannumstrips; }
+
+void clearspanstrips(void)
+{
+	int s;
+
+	for(s=0;s<MAXSPANSTRIPS;s++) spanstrip[s].numcmds = 0;
+	spannumslopal = 0;
+}
+
 
 	//Global variable functions
 void setvlinebpl(int dabpl) { bpl = dabpl; }
@@ -36,20 +129,35 @@ void sethlinesizes(int logx, int logy, void *bufplc)
 	{ glogx = logx; glogy = logy; gbuf = (unsigned char *)bufplc; }
 void setpalookupaddress(void *paladdr) { ghlinepal = (unsigned char *)paladdr; }
 void setuphlineasm4(int bxinc, int byinc) { gbxinc = bxinc; gbyinc = byinc; }
+static void dohline(unsigned char *buf, unsigned char *palptr, int logx, int logy,
+	int bxinc, int byinc, int cnt, unsigned int by, unsigned int bx, unsigned char *pp)
+{
+	for(;cnt>=0;cnt--)
+	{
+		*pp = palptr[buf[((bx>>(32-logx))<<logy)+(by>>(32-logy))]];
+		bx -= bxinc;
+		by -= byinc;
+		pp--;
+	}
+}
 void hlineasm4(int cnt, int skiploadincs, int paloffs, unsigned int by, unsigned int bx, void *p)
 {
-	unsigned char *palptr, *pp;
+	spancmdtype sc;
 
-	palptr = &ghlinepal[paloffs];
-	pp = (unsigned char *)p;
 	if (!skiploadincs) { gbxinc = asm1; gbyinc = asm2; }
-	for(;cnt>=0;cnt--)
+	if (spanpixelcounts && cnt >= 0) spanpixelcounts[PROFILE_HLINE] += cnt+1;
+	if (spannumstrips > 0)
 	{
-		*pp = palptr[gbuf[((bx>>(32-glogx))<<glogy)+(by>>(32-glogy))]];
-		bx -= gbxinc;
-		by -= gbyinc;
-		pp--;
+		if (cnt < 0) return;
+		sc.type = SPANCMD_HLINE;
+		sc.buf = gbuf; sc.pal = &ghlinepal[paloffs];
+		sc.logx = glogx; sc.logy = glogy;
+		sc.uinc = gbxinc; sc.vinc = gbyinc;
+		sc.cnt = cnt; sc.u = bx; sc.v = by;
+		addspancmd(&sc,p,-cnt);
+		return;
 	}
+	kern->hline(gbuf,&ghlinepal[paloffs],glogx,glogy,gbxinc,gbyinc,cnt,by,bx,(unsigned char *)p);
 }
 
 
@@ -59,76 +167,89 @@ void setupslopevlin(int logylogx, void *bufplc, int pinc)
 	glogx = (logylogx&255); glogy = (logylogx>>8);
 	gbuf = (unsigned char *)bufplc; gpinc = pinc;
 }
-void slopevlin(void *p, int i, void *slopaloffs, int cnt, int bx, int by)
+static void doslopevlin(unsigned char *buf, intptr_t *slopalptr, int logx, int logy, int pinc,
+	int x3, int y3, int bz, int bzinc, int cnt, int bx, int by, unsigned char *pp)
 {
-	intptr_t *slopalptr;
-	int bz, bzinc;
+	int i;
 	unsigned int u, v;
-	unsigned char *pp;
 
-	bz = asm3; bzinc = (asm1>>3);
-	slopalptr = (intptr_t *)slopaloffs;
-	pp = (unsigned char *)p;
 	for(;cnt>0;cnt--)
 	{
 		i = krecip(bz>>6); bz += bzinc;
-		u = bx+globalx3*i;
-		v = by+globaly3*i;
-		*pp = *(unsigned char *)(slopalptr[0]+gbuf[((u>>(32-glogx))<<glogy)+(v>>(32-glogy))]);
+		u = bx+x3*i;
+		v = by+y3*i;
+		*pp = *(unsigned char *)(slopalptr[0]+buf[((u>>(32-logx))<<logy)+(v>>(32-logy))]);
 		slopalptr--;
-		pp += gpinc;
+		pp += pinc;
+	}
+}
+void slopevlin(void *p, int UNUSED(i), void *slopaloffs, int cnt, int bx, int by)
+{
+	spancmdtype sc;
+	intptr_t *slopalptr;
+
+	if (spanpixelcounts && cnt > 0) spanpixelcounts[PROFILE_SLOPEVLIN] += cnt;
+	if (spannumstrips > 0)
+	{
+		if (cnt <= 0) return;
+			//The slope palookup table is rebuilt per-call, so keep a copy
+		if (spannumslopal+cnt > spanmaxslopal)
+		{
+			spanmaxslopal = max(spanmaxslopal<<1,spannumslopal+cnt+4096);
+			spanslopal = (intptr_t *)Brealloc(spanslopal,spanmaxslopal*sizeof(intptr_t));
+		}
+		slopalptr = (intptr_t *)slopaloffs;
+		Bmemcpy(&spanslopal[spannumslopal],&slopalptr[1-cnt],cnt*sizeof(intptr_t));
+		sc.type = SPANCMD_SLOPEVLIN;
+		sc.buf = gbuf; sc.slopal = spannumslopal+cnt-1;
+		sc.logx = glogx; sc.logy = glogy; sc.pinc = gpinc;
+		sc.x3 = globalx3; sc.y3 = globaly3;
+		sc.bz = (int)asm3; sc.bzinc = (asm1>>3);
+		sc.cnt = cnt; sc.u = bx; sc.v = by;
+		addspancmd(&sc,p,0);
+		spannumslopal += cnt;
+		return;
 	}
+	kern->slopevlin(gbuf,(intptr_t *)slopaloffs,glogx,glogy,gpinc,globalx3,globaly3,
+		(int)asm3,(asm1>>3),cnt,bx,by,(unsigned char *)p);
 }
 
 
 	//Wall,face sprite/wall sprite vertical line functions
-void setupvlineasm(int neglogy) { glogy = neglogy; }
-void vlineasm1(int vinc, void *paloffs, int cnt, unsigned int vplc, void *bufplc, void *p)
+static void dovline(unsigned char *buf, unsigned char *pal, int logy, int dabpl,
+	int vinc, int cnt, unsigned int vplc, unsigned char *pp)
 {
-	unsigned char *pp;
-
-	gbuf = (unsigned char *)bufplc;
-	gpal = (unsigned char *)paloffs;
-	pp = (unsigned char *)p;
 	for(;cnt>=0;cnt--)
 	{
-		*pp = gpal[gbuf[vplc>>glogy]];
-		pp += bpl;
+		*pp = pal[buf[vplc>>logy]];
+		pp += dabpl;
 		vplc += vinc;
 	}
 }
-
-void setupmvlineasm(int neglogy) { glogy = neglogy; }
-void mvlineasm1(int vinc, void *paloffs, int cnt, unsigned int vplc, void *bufplc, void *p)
+static void domvline(unsigned char *buf, unsigned char *pal, int logy, int dabpl,
+	int vinc, int cnt, unsigned int vplc, unsigned char *pp)
 {
-	unsigned char ch, *pp;
+	unsigned char ch;
 
-	gbuf = (unsigned char *)bufplc;
-	gpal = (unsigned char *)paloffs;
-	pp = (unsigned char *)p;
 	for(;cnt>=0;cnt--)
 	{
-		ch = gbuf[vplc>>glogy]; if (ch != 255) *pp = gpal[ch];
-		pp += bpl;
+		ch = buf[vplc>>logy]; if (ch != 255) *pp = pal[ch];
+		pp += dabpl;
 		vplc += vinc;
 	}
 }
-
-void setuptvlineasm(int neglogy) { glogy = neglogy; }
-void tvlineasm1(int vinc, void *paloffs, int cnt, unsigned int vplc, void *bufplc, void *p)
+static void dotvline(unsigned char *buf, unsigned char *pal, unsigned char *trans, int reverse,
+	int logy, int dabpl, int vinc, int cnt, unsigned int vplc, unsigned char *pp)
 {
-	unsigned char ch, *pp;
+	unsigned char ch;
 
-	gbuf = (unsigned char *)bufplc;
-	gpal = (unsigned char *)paloffs;
-	pp = (unsigned char *)p;
-	if (transmode)
+	if (reverse)
 	{
 		for(;cnt>=0;cnt--)
 		{
-			ch = gbuf[vplc>>glogy];
-			if (ch != 255) *pp = gtrans[(*pp)+(gpal[ch]<<8)];
-			pp += bpl;
+			ch = buf[vplc>>logy];
+			if (ch != 255) *pp = trans[(*pp)+(pal[ch]<<8)];
+			pp += dabpl;
 			vplc += vinc;
 		}
 	}
@@ -136,64 +257,130 @@ void tvlineasm1(int vinc, void *paloffs, int cnt, unsigned int vplc, void *bufpl
 	{
 		for(;cnt>=0;cnt--)
 		{
-			ch = gbuf[vplc>>glogy];
-			if (ch != 255) *pp = gtrans[((*pp)<<8)+gpal[ch]];
-			pp += bpl;
+			ch = buf[vplc>>logy];
+			if (ch != 255) *pp = trans[((*pp)<<8)+pal[ch]];
+			pp += dabpl;
 			vplc += vinc;
 		}
 	}
 }
+static void recordvline(int type, int vinc, int cnt, unsigned int vplc, void *p)
+{
+	spancmdtype sc;
+
+	if (cnt < 0) return;
+	sc.type = type;
+	sc.buf = gbuf; sc.pal = gpal; sc.trans = transmode;
+	sc.logy = glogy; sc.pinc = bpl;
+	sc.vinc = vinc; sc.cnt = cnt; sc.v = vplc;
+	addspancmd(&sc,p,0);
+}
 
-	//Floor sprite horizontal line functions
-void msethlineshift(int logx, int logy) { glogx = logx; glogy = logy; }
-void mhline(void *bufplc, unsigned int bx, int cntup16, int UNUSED(junk), unsigned int by, void *p)
+void setupvlineasm(int neglogy) { glogy = neglogy; }
+void vlineasm1(int vinc, void *paloffs, int cnt, unsigned int vplc, void *bufplc, void *p)
 {
-	unsigned char ch, *pp;
+	gbuf = (unsigned char *)bufplc;
+	gpal = (unsigned char *)paloffs;
+	if (spanpixelcounts && cnt >= 0) spanpixelcounts[PROFILE_VLINE] += cnt+1;
+	if (spannumstrips > 0) { recordvline(SPANCMD_VLINE,vinc,cnt,vplc,p); return; }
+	kern->vline(gbuf,gpal,glogy,bpl,vinc,cnt,vplc,(unsigned char *)p);
+}
 
+void setupmvlineasm(int neglogy) { glogy = neglogy; }
+void mvlineasm1(int vinc, void *paloffs, int cnt, unsigned int vplc, void *bufplc, void *p)
+{
 	gbuf = (unsigned char *)bufplc;
-	gpal = (unsigned char *)asm3;
-	pp = (unsigned char *)p;
-	for(cntup16>>=16;cntup16>0;cntup16--)
+	gpal = (unsigned char *)paloffs;
+	if (spanpixelcounts && cnt >= 0) spanpixelcounts[PROFILE_MVLINE] += cnt+1;
+	if (spannumstrips > 0) { recordvline(SPANCMD_MVLINE,vinc,cnt,vplc,p); return; }
+	kern->mvline(gbuf,gpal,glogy,bpl,vinc,cnt,vplc,(unsigned char *)p);
+}
+
+void setuptvlineasm(int neglogy) { glogy = neglogy; }
+void tvlineasm1(int vinc, void *paloffs, int cnt, unsigned int vplc, void *bufplc, void *p)
+{
+	gbuf = (unsigned char *)bufplc;
+	gpal = (unsigned char *)paloffs;
+	if (spanpixelcounts && cnt >= 0) spanpixelcounts[PROFILE_TVLINE] += cnt+1;
+	if (spannumstrips > 0) { recordvline(SPANCMD_TVLINE,vinc,cnt,vplc,p); return; }
+	kern->tvline(gbuf,gpal,gtrans,transmode,glogy,bpl,vinc,cnt,vplc,(unsigned char *)p);
+}
+
+	//Floor sprite horizontal line functions
+static void domhline(unsigned char *buf, unsigned char *pal, int logx, int logy,
+	int bxinc, int byinc, int cnt, unsigned int bx, unsigned int by, unsigned char *pp)
+{
+	unsigned char ch;
+
+	for(;cnt>0;cnt--)
 	{
-		ch = gbuf[((bx>>(32-glogx))<<glogy)+(by>>(32-glogy))];
-		if (ch != 255) *pp = gpal[ch];
-		bx += asm1;
-		by += asm2;
+		ch = buf[((bx>>(32-logx))<<logy)+(by>>(32-logy))];
+		if (ch != 255) *pp = pal[ch];
+		bx += bxinc;
+		by += byinc;
 		pp++;
 	}
 }
-
-void tsethlineshift(int logx, int logy) { glogx = logx; glogy = logy; }
-void thline(void *bufplc, unsigned int bx, int cntup16, int UNUSED(junk), unsigned int by, void *p)
+static void dothline(unsigned char *buf, unsigned char *pal, unsigned char *trans, int reverse,
+	int logx, int logy, int bxinc, int byinc, int cnt, unsigned int bx, unsigned int by, unsigned char *pp)
 {
-	unsigned char ch, *pp;
+	unsigned char ch;
 
-	gbuf = (unsigned char *)bufplc;
-	gpal = (unsigned char *)asm3;
-	pp = (unsigned char *)p;
-	if (transmode)
+	if (reverse)
 	{
-		for(cntup16>>=16;cntup16>0;cntup16--)
+		for(;cnt>0;cnt--)
 		{
-			ch = gbuf[((bx>>(32-glogx))<<glogy)+(by>>(32-glogy))];
-			if (ch != 255) *pp = gtrans[(*pp)+(gpal[ch]<<8)];
-			bx += asm1;
-			by += asm2;
+			ch = buf[((bx>>(32-logx))<<logy)+(by>>(32-logy))];
+			if (ch != 255) *pp = trans[(*pp)+(pal[ch]<<8)];
+			bx += bxinc;
+			by += byinc;
 			pp++;
 		}
 	}
 	else
 	{
-		for(cntup16>>=16;cntup16>0;cntup16--)
+		for(;cnt>0;cnt--)
 		{
-			ch = gbuf[((bx>>(32-glogx))<<glogy)+(by>>(32-glogy))];
-			if (ch != 255) *pp = gtrans[((*pp)<<8)+gpal[ch]];
-			bx += asm1;
-			by += asm2;
+			ch = buf[((bx>>(32-logx))<<logy)+(by>>(32-logy))];
+			if (ch != 255) *pp = trans[((*pp)<<8)+pal[ch]];
+			bx += bxinc;
+			by += byinc;
 			pp++;
 		}
 	}
 }
+static void recordmhline(int type, unsigned int bx, int cnt, unsigned int by, void *p)
+{
+	spancmdtype sc;
+
+	if (cnt <= 0) return;
+	sc.type = type;
+	sc.buf = gbuf; sc.pal = gpal; sc.trans = transmode;
+	sc.logx = glogx; sc.logy = glogy;
+	sc.uinc = asm1; sc.vinc = asm2;
+	sc.cnt = cnt; sc.u = bx; sc.v = by;
+	addspancmd(&sc,p,cnt-1);
+}
+
+void msethlineshift(int logx, int logy) { glogx = logx; glogy = logy; }
+void mhline(void *bufplc, unsigned int bx, int cntup16, int UNUSED(junk), unsigned int by, void *p)
+{
+	gbuf = (unsigned char *)bufplc;
+	gpal = (unsigned char *)asm3;
+	if (spanpixelcounts && cntup16 > 0) spanpixelcounts[PROFILE_MHLINE] += cntup16>>16;
+	if (spannumstrips > 0) { recordmhline(SPANCMD_MHLINE,bx,cntup16>>16,by,p); return; }
+	domhline(gbuf,gpal,glogx,glogy,asm1,asm2,cntup16>>16,bx,by,(unsigned char *)p);
+}
+
+void tsethlineshift(int logx, int logy) { glogx = logx; glogy = logy; }
+void thline(void *bufplc, unsigned int bx, int cntup16, int UNUSED(junk), unsigned int by, void *p)
+{
+	gbuf = (unsigned char *)bufplc;
+	gpal = (unsigned char *)asm3;
+	if (spanpixelcounts && cntup16 > 0) spanpixelcounts[PROFILE_THLINE] += cntup16>>16;
+	if (spannumstrips > 0) { recordmhline(SPANCMD_THLINE,bx,cntup16>>16,by,p); return; }
+	dothline(gbuf,gpal,gtrans,transmode,glogx,glogy,asm1,asm2,cntup16>>16,bx,by,(unsigned char *)p);
+}
 
 
 	//Rotatesprite vertical line functions
@@ -204,20 +391,23 @@ void setupspritevline(void *paloffs, int bxinc, int byinc, int ysiz)
 	gbyinc = byinc;
 	glogy = ysiz;
 }
-void spritevline(int bx, int by, int cnt, void *bufplc, void *p)
+static void dospritevline(unsigned char *buf, unsigned char *pal, int ysiz, int dabpl,
+	int bxinc, int byinc, int cnt, int bx, int by, unsigned char *pp)
 {
-	unsigned char *pp;
-
-	gbuf = (unsigned char *)bufplc;
-	pp = (unsigned char *)p;
 	for(;cnt>1;cnt--)
 	{
-		*pp = gpal[gbuf[(bx>>16)*glogy+(by>>16)]];
-		bx += gbxinc;
-		by += gbyinc;
-		pp += bpl;
+		*pp = pal[buf[(bx>>16)*ysiz+(by>>16)]];
+		bx += bxinc;
+		by += byinc;
+		pp += dabpl;
 	}
 }
+void spritevline(int bx, int by, int cnt, void *bufplc, void *p)
+{
+	if (spanpixelcounts && cnt > 1) spanpixelcounts[PROFILE_SPRITEVLINE] += cnt-1;
+	gbuf = (unsigned char *)bufplc;
+	kern->spritevline(gbuf,gpal,glogy,bpl,gbxinc,gbyinc,cnt,bx,by,(unsigned char *)p);
+}
 
 	//Rotatesprite vertical line functions
 void msetupspritevline(void *paloffs, int bxinc, int byinc, int ysiz)
@@ -231,6 +421,7 @@ void mspritevline(int bx, int by, int cnt, void *bufplc, void *p)
 {
 	unsigned char ch, *pp;
 
+	if (spanpixelcounts && cnt > 1) spanpixelcounts[PROFILE_SPRITEVLINE] += cnt-1;
 	gbuf = (unsigned char *)bufplc;
 	pp = (unsigned char *)p;
 	for(;cnt>1;cnt--)
@@ -254,6 +445,7 @@ void tspritevline(int bx, int by, int cnt, void *bufplc, void *p)
 {
 	unsigned char ch, *pp;
 
+	if (spanpixelcounts && cnt > 1) spanpixelcounts[PROFILE_SPRITEVLINE] += cnt-1;
 	gbuf = (unsigned char *)bufplc;
 	pp = (unsigned char *)p;
 	if (transmode)
@@ -290,6 +482,7 @@ void drawslab (int dx, int v, int dy, int vi, void *vptr, void *p)
 	
 	pp = (unsigned char *)p;
 	vpptr = (unsigned char *)vptr;
+	if (spanpixelcounts && dx > 0 && dy > 0) spanpixelcounts[PROFILE_DRAWSLAB] += dx*dy;
 	while (dy > 0)
 	{
 		for(x=0;x<dx;x++) *(pp+x) = gpal[(int)(*(vpptr+(v>>16)))];
@@ -312,7 +505,73 @@ void stretchhline (void * UNUSED(p0), int u, int cnt, int uinc, void *rptr, void
 }
 
 
-void mmxoverlay() { }
+const spankerneltype spankernels_c = {
+	"C", dovline, domvline, dotvline, dohline, doslopevlin, dospritevline
+};
+
+void setspankernels(const spankerneltype *k) { kern = k ? k : &spankernels_c; }
+const spankerneltype *getspankernels(void) { return kern; }
+
+	//Picks the fastest span kernels the processor supports
+void mmxoverlay()
+{
+	const spankerneltype *k = getspankernelsets()[0];
+
+	if (k != &spankernels_c) buildprintf("Using %s span kernels.\n", k->name);
+	setspankernels(k);
+}
+
+	//Executes the commands recorded for one strip in the order they were
+	//issued, clipping horizontal spans to the strip's columns. Distinct
+	//strips touch distinct pixels so may be drawn concurrently.
+void drawspanstrip(int strip)
+{
+	spancmdtype *sc, *endsc;
+	int x1, x2, k1, k2;
+
+	if ((unsigned)strip >= (unsigned)spannumstrips) return;
+
+	x1 = (strip == 0) ? -(1<<30) : spanstripstart(strip);
+	x2 = (strip == spannumstrips-1) ? (1<<30) : spanstripstart(strip+1)-1;
+
+	sc = spanstrip[strip].cmd;
+	for(endsc=sc+spanstrip[strip].numcmds;sc<endsc;sc++)
+	{
+		switch(sc->type)
+		{
+			case SPANCMD_VLINE:
+				kern->vline(sc->buf,sc->pal,sc->logy,sc->pinc,sc->vinc,sc->cnt,sc->v,sc->p);
+				break;
+			case SPANCMD_MVLINE:
+				kern->mvline(sc->buf,sc->pal,sc->logy,sc->pinc,sc->vinc,sc->cnt,sc->v,sc->p);
+				break;
+			case SPANCMD_TVLINE:
+				kern->tvline(sc->buf,sc->pal,gtrans,sc->trans,sc->logy,sc->pinc,sc->vinc,sc->cnt,sc->v,sc->p);
+				break;
+			case SPANCMD_SLOPEVLIN:
+				kern->slopevlin(sc->buf,&spanslopal[sc->slopal],sc->logx,sc->logy,sc->pinc,
+					sc->x3,sc->y3,sc->bz,sc->bzinc,sc->cnt,sc->u,sc->v,sc->p);
+				break;
+			case SPANCMD_HLINE:	//draws leftwards from col for cnt+1 pixels
+				k1 = max(0,sc->col-x2); k2 = min(sc->cnt,sc->col-x1);
+				if (k1 > k2) break;
+				kern->hline(sc->buf,sc->pal,sc->logx,sc->logy,sc->uinc,sc->vinc,k2-k1,
+					sc->v-(unsigned int)k1*sc->vinc,sc->u-(unsigned int)k1*sc->uinc,sc->p-k1);
+				break;
+			case SPANCMD_MHLINE:	//draws rightwards from col for cnt pixels
+			case SPANCMD_THLINE:
+				k1 = max(0,x1-sc->col); k2 = min(sc->cnt-1,x2-sc->col);
+				if (k1 > k2) break;
+				if (sc->type == SPANCMD_MHLINE)
+					domhline(sc->buf,sc->pal,sc->logx,sc->logy,sc->uinc,sc->vinc,k2-k1+1,
+						sc->u+(unsigned int)k1*sc->uinc,sc->v+(unsigned int)k1*sc->vinc,sc->p+k1);
+				else
+					dothline(sc->buf,sc->pal,gtrans,sc->trans,sc->logx,sc->logy,sc->uinc,sc->vinc,k2-k1+1,
+						sc->u+(unsigned int)k1*sc->uinc,sc->v+(unsigned int)k1*sc->vinc,sc->p+k1);
+				break;
+		}
+	}
+}
 
 #endif
 /*
@@ -0,0 +1,304 @@
+// SIMD span kernels for the C rasterizer
+// for the Build Engine
+//
+// Each kernel computes several pixels' texture coordinates at once and
+// hands any remainder to the scalar kernel in a-c.c, which it must match
+// byte for byte. SSE2 and NEON have no gather instructions so fetch the
+// texels and palookup entries a lane at a time; AVX2 gathers them too.
+//
+// Only kernels that beat their scalar versions are here. The vertical line
+// functions write one byte per framebuffer row, and without a scatter store
+// to go with the gathers they measured slower in SIMD than in C.
+
+#include "compat.h"
+#include "a.h"
+#include "a_priv.h"
+
+#ifdef ENGINE_USING_A_C
+
+extern int reciptable[2048];	// from engine.c
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define SPAN_SSE2
+# include <emmintrin.h>
+# if defined(_MSC_VER) || defined(__clang__) || \
+	(defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#  define SPAN_AVX2
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#   include <intrin.h>
+#   define AVX2_TARGET
+#  else
+#   define AVX2_TARGET __attribute__((target("avx2")))
+#  endif
+# endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define SPAN_NEON
+# include <arm_neon.h>
+#endif
+
+	// A texture shift of 32 (e.g. for a tile one pixel high) is reduced
+	// mod 32 by x86 and ARM64 shift instructions, but not by 32-bit ARM's,
+	// so mimic whatever the scalar kernels get.
+#if defined(__arm__) && !defined(__aarch64__)
+# define SHIFTCNT(n) (n)
+#else
+# define SHIFTCNT(n) ((n)&31)
+#endif
+
+
+#ifdef SPAN_SSE2
+
+	//SSE2 lacks a 32-bit multiply keeping the low halves
+static inline __m128i mullo_sse2(__m128i a, __m128i b)
+{
+	__m128i even, odd;
+
+	even = _mm_mul_epu32(a, b);
+	odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+	//Draws leftwards, so lane j holds the pixel at pp-3+j
+static void hline_sse2(unsigned char *buf, unsigned char *pal, int logx, int logy,
+	int bxinc, int byinc, int cnt, unsigned int by, unsigned int bx, unsigned char *pp)
+{
+	__m128i u, v, shx, shy, sly, idxv;
+	unsigned int idx[4];
+
+	shx = _mm_cvtsi32_si128(SHIFTCNT(32-logx));
+	shy = _mm_cvtsi32_si128(SHIFTCNT(32-logy));
+	sly = _mm_cvtsi32_si128(SHIFTCNT(logy));
+	u = _mm_sub_epi32(_mm_set1_epi32((int)bx), mullo_sse2(_mm_set1_epi32(bxinc), _mm_setr_epi32(3,2,1,0)));
+	v = _mm_sub_epi32(_mm_set1_epi32((int)by), mullo_sse2(_mm_set1_epi32(byinc), _mm_setr_epi32(3,2,1,0)));
+	for(;cnt>=3;cnt-=4)
+	{
+		idxv = _mm_add_epi32(_mm_sll_epi32(_mm_srl_epi32(u, shx), sly), _mm_srl_epi32(v, shy));
+		_mm_storeu_si128((__m128i *)idx, idxv);
+		pp[-3] = pal[buf[idx[0]]];
+		pp[-2] = pal[buf[idx[1]]];
+		pp[-1] = pal[buf[idx[2]]];
+		pp[0] = pal[buf[idx[3]]];
+		pp -= 4;
+		bx -= ((unsigned int)bxinc<<2); u = _mm_sub_epi32(u, _mm_set1_epi32((int)((unsigned int)bxinc<<2)));
+		by -= ((unsigned int)byinc<<2); v = _mm_sub_epi32(v, _mm_set1_epi32((int)((unsigned int)byinc<<2)));
+	}
+	if (cnt >= 0) spankernels_c.hline(buf,pal,logx,logy,bxinc,byinc,cnt,by,bx,pp);
+}
+
+#endif	// SPAN_SSE2
+
+
+#ifdef SPAN_AVX2
+
+	//Fetches base[idx] for each lane. The dwords gathered are aligned so
+	//that none can straddle the end of the buffer into an unmapped page.
+static inline AVX2_TARGET __m256i gatherbytes_avx2(const unsigned char *base, __m256i idx)
+{
+	const int *abase;
+	__m256i off, w;
+
+	abase = (const int *)((intptr_t)base & ~(intptr_t)3);
+	off = _mm256_add_epi32(idx, _mm256_set1_epi32((int)((intptr_t)base & 3)));
+	w = _mm256_i32gather_epi32(abase, _mm256_srli_epi32(off, 2), 4);
+	w = _mm256_srlv_epi32(w, _mm256_slli_epi32(_mm256_and_si256(off, _mm256_set1_epi32(3)), 3));
+	return _mm256_and_si256(w, _mm256_set1_epi32(255));
+}
+
+	//Narrows eight lanes holding byte values to eight consecutive bytes
+static inline AVX2_TARGET __m128i packbytes_avx2(__m256i a)
+{
+	a = _mm256_packus_epi32(a, a);
+	a = _mm256_packus_epi16(a, a);
+	return _mm_unpacklo_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+}
+
+static inline AVX2_TARGET __m256i ramp_avx2(int start, int inc)
+{
+	return _mm256_add_epi32(_mm256_set1_epi32(start),
+		_mm256_mullo_epi32(_mm256_set1_epi32(inc), _mm256_setr_epi32(0,1,2,3,4,5,6,7)));
+}
+
+static inline AVX2_TARGET __m256i krecip_avx2(__m256i a)
+{
+	__m256i f, r, sh;
+
+	f = _mm256_castps_si256(_mm256_cvtepi32_ps(a));
+	r = _mm256_i32gather_epi32(reciptable, _mm256_and_si256(_mm256_srai_epi32(f, 12), _mm256_set1_epi32(2047)), 4);
+	sh = _mm256_and_si256(_mm256_srai_epi32(_mm256_sub_epi32(f, _mm256_set1_epi32(0x3f800000)), 23), _mm256_set1_epi32(31));
+	return _mm256_xor_si256(_mm256_srav_epi32(r, sh), _mm256_srai_epi32(f, 31));
+}
+
+static AVX2_TARGET void slopevlin_avx2(unsigned char *buf, intptr_t *slopalptr, int logx, int logy, int pinc,
+	int x3, int y3, int bz, int bzinc, int cnt, int bx, int by, unsigned char *pp)
+{
+	__m256i z, zi, r, u, v, idx;
+	__m128i shx, shy, sly;
+	unsigned char tex[8];
+	int k;
+
+	shx = _mm_cvtsi32_si128(SHIFTCNT(32-logx));
+	shy = _mm_cvtsi32_si128(SHIFTCNT(32-logy));
+	sly = _mm_cvtsi32_si128(SHIFTCNT(logy));
+	z = ramp_avx2(bz, bzinc);
+	zi = _mm256_set1_epi32((int)((unsigned int)bzinc<<3));
+	for(;cnt>=8;cnt-=8)
+	{
+		r = krecip_avx2(_mm256_srai_epi32(z, 6));
+		u = _mm256_add_epi32(_mm256_set1_epi32(bx), _mm256_mullo_epi32(_mm256_set1_epi32(x3), r));
+		v = _mm256_add_epi32(_mm256_set1_epi32(by), _mm256_mullo_epi32(_mm256_set1_epi32(y3), r));
+		idx = _mm256_add_epi32(_mm256_sll_epi32(_mm256_srl_epi32(u, shx), sly), _mm256_srl_epi32(v, shy));
+		_mm_storel_epi64((__m128i *)tex, packbytes_avx2(gatherbytes_avx2(buf, idx)));
+		for(k=0;k<8;k++,pp+=pinc) *pp = *(unsigned char *)(slopalptr[-k]+tex[k]);
+		slopalptr -= 8;
+		z = _mm256_add_epi32(z, zi);
+	}
+	if (cnt > 0) spankernels_c.slopevlin(buf,slopalptr,logx,logy,pinc,x3,y3,
+		_mm_cvtsi128_si32(_mm256_castsi256_si128(z)),bzinc,cnt,bx,by,pp);
+}
+
+static int haveavx2(void)
+{
+#ifdef _MSC_VER
+	int r[4];
+
+	__cpuid(r, 0);
+	if (r[0] < 7) return 0;
+	__cpuid(r, 1);
+	if ((r[2] & ((1<<27)|(1<<28))) != ((1<<27)|(1<<28))) return 0;	// OSXSAVE, AVX
+	if ((_xgetbv(0) & 6) != 6) return 0;	// OS saves the YMM registers
+	__cpuidex(r, 7, 0);
+	return (r[1] & (1<<5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif	// SPAN_AVX2
+
+
+#ifdef SPAN_NEON
+
+static inline int32x4_t ramp_neon(int start, int inc)
+{
+	static const int32_t lanes[4] = { 0,1,2,3 };
+	return vmlaq_s32(vdupq_n_s32(start), vdupq_n_s32(inc), vld1q_s32(lanes));
+}
+
+	//Draws leftwards, so lane j holds the pixel at pp-3+j
+static void hline_neon(unsigned char *buf, unsigned char *pal, int logx, int logy,
+	int bxinc, int byinc, int cnt, unsigned int by, unsigned int bx, unsigned char *pp)
+{
+	static const int32_t rev[4] = { 3,2,1,0 };
+	uint32x4_t u, v, ui, vi;
+	int32x4_t shx, shy, sly;
+	uint32_t idx[4];
+
+	shx = vdupq_n_s32(-SHIFTCNT(32-logx));
+	shy = vdupq_n_s32(-SHIFTCNT(32-logy));
+	sly = vdupq_n_s32(SHIFTCNT(logy));
+	u = vreinterpretq_u32_s32(vmlsq_s32(vdupq_n_s32((int)bx), vdupq_n_s32(bxinc), vld1q_s32(rev)));
+	v = vreinterpretq_u32_s32(vmlsq_s32(vdupq_n_s32((int)by), vdupq_n_s32(byinc), vld1q_s32(rev)));
+	ui = vdupq_n_u32((unsigned int)bxinc<<2);
+	vi = vdupq_n_u32((unsigned int)byinc<<2);
+	for(;cnt>=3;cnt-=4)
+	{
+		vst1q_u32(idx, vaddq_u32(vshlq_u32(vshlq_u32(u, shx), sly), vshlq_u32(v, shy)));
+		pp[-3] = pal[buf[idx[0]]];
+		pp[-2] = pal[buf[idx[1]]];
+		pp[-1] = pal[buf[idx[2]]];
+		pp[0] = pal[buf[idx[3]]];
+		pp -= 4;
+		bx -= ((unsigned int)bxinc<<2); u = vsubq_u32(u, ui);
+		by -= ((unsigned int)byinc<<2); v = vsubq_u32(v, vi);
+	}
+	if (cnt >= 0) spankernels_c.hline(buf,pal,logx,logy,bxinc,byinc,cnt,by,bx,pp);
+}
+
+static void slopevlin_neon(unsigned char *buf, intptr_t *slopalptr, int logx, int logy, int pinc,
+	int x3, int y3, int bz, int bzinc, int cnt, int bx, int by, unsigned char *pp)
+{
+	int32x4_t z, zi, f, r, sh, shx, shy, sly;
+	uint32x4_t u, v;
+	int32_t ridx[4], rec[4];
+	uint32_t idx[4];
+	int k;
+
+	shx = vdupq_n_s32(-SHIFTCNT(32-logx));
+	shy = vdupq_n_s32(-SHIFTCNT(32-logy));
+	sly = vdupq_n_s32(SHIFTCNT(logy));
+	z = ramp_neon(bz, bzinc);
+	zi = vdupq_n_s32((int)((unsigned int)bzinc<<2));
+	for(;cnt>=4;cnt-=4)
+	{
+		f = vreinterpretq_s32_f32(vcvtq_f32_s32(vshrq_n_s32(z, 6)));
+		vst1q_s32(ridx, vandq_s32(vshrq_n_s32(f, 12), vdupq_n_s32(2047)));
+		for(k=0;k<4;k++) rec[k] = reciptable[ridx[k]];
+		sh = vandq_s32(vshrq_n_s32(vsubq_s32(f, vdupq_n_s32(0x3f800000)), 23), vdupq_n_s32(31));
+		r = veorq_s32(vshlq_s32(vld1q_s32(rec), vnegq_s32(sh)), vshrq_n_s32(f, 31));
+
+		u = vreinterpretq_u32_s32(vmlaq_s32(vdupq_n_s32(bx), vdupq_n_s32(x3), r));
+		v = vreinterpretq_u32_s32(vmlaq_s32(vdupq_n_s32(by), vdupq_n_s32(y3), r));
+		vst1q_u32(idx, vaddq_u32(vshlq_u32(vshlq_u32(u, shx), sly), vshlq_u32(v, shy)));
+		for(k=0;k<4;k++,pp+=pinc) *pp = *(unsigned char *)(slopalptr[-k]+buf[idx[k]]);
+		slopalptr -= 4;
+		z = vaddq_s32(z, zi);
+	}
+	if (cnt > 0) spankernels_c.slopevlin(buf,slopalptr,logx,logy,pinc,x3,y3,vgetq_lane_s32(z,0),bzinc,cnt,bx,by,pp);
+}
+
+#endif	// SPAN_NEON
+
+
+#ifdef SPAN_SSE2
+static spankerneltype spankernels_sse2;
+#endif
+#ifdef SPAN_AVX2
+static spankerneltype spankernels_avx2;
+#endif
+#ifdef SPAN_NEON
+static spankerneltype spankernels_neon;
+#endif
+
+const spankerneltype * const *getspankernelsets(void)
+{
+	static const spankerneltype *sets[5];
+	static int numsets = 0;
+
+	if (numsets) return sets;
+
+		//Each set starts as a copy of the scalar kernels
+#ifdef SPAN_AVX2
+	if (haveavx2()) {
+		spankernels_avx2 = spankernels_c;
+		spankernels_avx2.name = "AVX2";
+		spankernels_avx2.hline = hline_sse2;
+		spankernels_avx2.slopevlin = slopevlin_avx2;
+		sets[numsets++] = &spankernels_avx2;
+	}
+#endif
+#ifdef SPAN_SSE2
+	spankernels_sse2 = spankernels_c;
+	spankernels_sse2.name = "SSE2";
+	spankernels_sse2.hline = hline_sse2;
+	sets[numsets++] = &spankernels_sse2;
+#endif
+#ifdef SPAN_NEON
+	spankernels_neon = spankernels_c;
+	spankernels_neon.name = "NEON";
+	spankernels_neon.hline = hline_neon;
+	spankernels_neon.slopevlin = slopevlin_neon;
+	sets[numsets++] = &spankernels_neon;
+#endif
+	sets[numsets++] = &spankernels_c;
+	sets[numsets] = NULL;
+
+	return sets;
+}
+
+#endif	// ENGINE_USING_A_C
@@ -190,6 +190,12 @@ void stretchhline (void *p0, int u, int cnt, int uinc, void *rptr, void *p);
 
 void mmxoverlay(void);
 
+#define MAXSPANSTRIPS 64
+void setspanrecording(int numstrips, intptr_t frameoffs, int daxdimen);
+int getspanrecording(void);
+void drawspanstrip(int strip);
+void clearspanstrips(void);
+
 #endif	// else
 
 #endif // __a_h__
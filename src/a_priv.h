@@ -0,0 +1,62 @@
+// Span kernel selection for the C rasterizer
+// for the Build Engine
+
+#ifndef A_PRIV_H
+#define A_PRIV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A set of span drawing kernels. The parameters follow the a-c.c line
+ * functions, with the state they normally take from their setup calls
+ * passed explicitly. Pixel counts use each line function's own convention:
+ * vline, mvline, tvline and hline draw cnt+1 pixels, slopevlin draws cnt,
+ * and spritevline draws cnt-1.
+ */
+typedef struct {
+	const char *name;
+	void (*vline)(unsigned char *buf, unsigned char *pal, int logy, int dabpl,
+		int vinc, int cnt, unsigned int vplc, unsigned char *pp);
+	void (*mvline)(unsigned char *buf, unsigned char *pal, int logy, int dabpl,
+		int vinc, int cnt, unsigned int vplc, unsigned char *pp);
+	void (*tvline)(unsigned char *buf, unsigned char *pal, unsigned char *trans, int reverse,
+		int logy, int dabpl, int vinc, int cnt, unsigned int vplc, unsigned char *pp);
+	void (*hline)(unsigned char *buf, unsigned char *pal, int logx, int logy,
+		int bxinc, int byinc, int cnt, unsigned int by, unsigned int bx, unsigned char *pp);
+	void (*slopevlin)(unsigned char *buf, intptr_t *slopalptr, int logx, int logy, int pinc,
+		int x3, int y3, int bz, int bzinc, int cnt, int bx, int by, unsigned char *pp);
+	void (*spritevline)(unsigned char *buf, unsigned char *pal, int ysiz, int dabpl,
+		int bxinc, int byinc, int cnt, int bx, int by, unsigned char *pp);
+} spankerneltype;
+
+/**
+ * The scalar kernels, which are the reference the others must match byte for byte.
+ */
+extern const spankerneltype spankernels_c;
+
+/**
+ * Returns the kernel sets usable on this processor, best first, as a
+ * NULL-terminated list which always ends with spankernels_c.
+ */
+const spankerneltype * const *getspankernelsets(void);
+
+/**
+ * Selects the kernels used by the line functions.
+ * @param k the kernel set, or NULL for spankernels_c
+ */
+void setspankernels(const spankerneltype *k);
+const spankerneltype *getspankernels(void);
+
+/**
+ * When not NULL, the line functions add the pixels they are asked to draw
+ * to these counts, indexed by the PROFILE_ kernel numbers in build.h.
+ */
+extern unsigned int *spanpixelcounts;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
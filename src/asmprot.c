@@ -1,3 +1,4 @@
+#include "compat.h"
 #include "a.h"
 
 #if defined _WIN32
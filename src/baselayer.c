@@ -8,6 +8,8 @@
 #include "build.h"
 #include "osd.h"
 #include "baselayer.h"
+#include "cache1d.h"
+#include "kplib.h"
 
 #ifdef RENDERTYPEWIN
 #include "winlayer.h"
@@ -21,6 +23,9 @@ baselayer_glinfo glinfo;
 static void onvideomodechange(int UNUSED(newmode)) { }
 void (*baselayer_onvideomodechange)(int) = onvideomodechange;
 
+int threadedblit = 0;
+int dirtyblit = 0;
+
 #if USE_POLYMOST
 static int osdfunc_setrendermode(const osdfuncparm_t *parm)
 {
@@ -83,6 +88,90 @@ static int osdcmd_glinfo(const osdfuncparm_t *parm)
 }
 #endif //USE_OPENGL
 
+static int osdcmd_cachestats(const osdfuncparm_t *parm)
+{
+	cachestatstype st;
+
+	if (parm->numparms == 1 && !Bstrcasecmp(parm->parms[0], "reset")) {
+		resetcachestats();
+		return OSDCMD_OK;
+	} else if (parm->numparms > 0) {
+		return OSDCMD_SHOWHELP;
+	}
+
+	getcachestats(&st);
+	buildprintf("Cache: %d bytes in %d blocks\n", st.size, st.blocks);
+	buildprintf("  free: %d bytes in %d blocks, largest %d (%d%% fragmented)\n",
+		st.freebytes, st.freeblocks, st.largestfree,
+		st.freebytes ? (int)(100 - (int64_t)st.largestfree * 100 / st.freebytes) : 0);
+	buildprintf("  locked: %d bytes in %d blocks\n", st.lockedbytes, st.lockedblocks);
+	buildprintf("  %u misses, %u of which evicted %u blocks (%.1f MB)\n",
+		st.misses, st.evictsearches, st.evictions, (double)st.evictedbytes / 1048576.0);
+	return OSDCMD_OK;
+}
+
+static int osdcmd_profile(const osdfuncparm_t *parm)
+{
+	profiletype p;
+	int i;
+
+	if (parm->numparms == 0) {
+		if (!profiling) {
+			buildputs("Profiling is off. Use \"profile on\" to begin.\n");
+			return OSDCMD_OK;
+		}
+		getprofile(&p);
+		buildprintf("Last frame: %.2f ms, %u tiles loaded (%u bytes), %u cache misses\n",
+			(double)p.framensecs / 1000000.0, p.tilesloaded, p.tilebytes, p.cachemisses);
+		for (i=0; i<PROFILE_NUMTIMERS; i++)
+			buildprintf("  %-12s %7.3f ms in %u calls\n", profiletimernames[i], (double)p.nsecs[i] / 1000000.0, p.calls[i]);
+		for (i=0; i<PROFILE_NUMKERNELS; i++)
+			buildprintf("  %-12s %9u pixels\n", profilekernelnames[i], p.pixels[i]);
+		return OSDCMD_OK;
+	}
+
+	if (!Bstrcasecmp(parm->parms[0], "on") && parm->numparms == 1) {
+		profiling = 1;
+	} else if (!Bstrcasecmp(parm->parms[0], "off") && parm->numparms == 1) {
+		profiling = 0;
+		profileoverlay = 0;
+		profilecsv(NULL);
+	} else if (!Bstrcasecmp(parm->parms[0], "overlay") && parm->numparms == 1) {
+		profileoverlay = !profileoverlay;
+		if (profileoverlay) profiling = 1;
+	} else if (!Bstrcasecmp(parm->parms[0], "csv") && parm->numparms == 2) {
+		if (profilecsv(parm->parms[1])) {
+			buildprintf("Could not create %s\n", parm->parms[1]);
+		} else {
+			buildprintf("Writing each frame's profile to %s until \"profile off\"\n", parm->parms[1]);
+		}
+	} else {
+		return OSDCMD_SHOWHELP;
+	}
+	return OSDCMD_OK;
+}
+
+static int osdcmd_trace(const osdfuncparm_t *parm)
+{
+	int frames = 60;
+
+	if (parm->numparms == 1 && !Bstrcasecmp(parm->parms[0], "stop")) {
+		tracetofile(NULL, 0);
+		return OSDCMD_OK;
+	}
+	if (parm->numparms < 1 || parm->numparms > 2) return OSDCMD_SHOWHELP;
+	if (parm->numparms == 2) frames = Batol(parm->parms[1]);
+
+	if (tracetofile(parm->parms[0], frames)) {
+		buildprintf("Could not begin a trace\n");
+	} else if (frames > 0) {
+		buildprintf("Tracing the next %d frames into %s\n", frames, parm->parms[0]);
+	} else {
+		buildprintf("Tracing into %s until \"trace stop\"\n", parm->parms[0]);
+	}
+	return OSDCMD_OK;
+}
+
 static int osdcmd_vars(const osdfuncparm_t *parm)
 {
 	int showval = (parm->numparms < 1);
@@ -110,6 +199,36 @@ static int osdcmd_vars(const osdfuncparm_t *parm)
 		else { usevoxels = (atoi(parm->parms[0]) != 0); }
 		return OSDCMD_OK;
 	}
+	else if (!Bstrcasecmp(parm->name, "renderthreads")) {
+		if (showval) { buildprintf("renderthreads is %d\n", renderthreads); }
+		else { renderthreads = max(0, min(64, atoi(parm->parms[0]))); }
+		return OSDCMD_OK;
+	}
+	else if (!Bstrcasecmp(parm->name, "tilestreaming")) {
+		if (showval) { buildprintf("tilestreaming is %d\n", tilestreaming); }
+		else { tilestreaming = (atoi(parm->parms[0]) != 0); }
+		return OSDCMD_OK;
+	}
+	else if (!Bstrcasecmp(parm->name, "usepvs")) {
+		if (showval) { buildprintf("usepvs is %d\n", usepvs); }
+		else { usepvs = (atoi(parm->parms[0]) != 0); }
+		return OSDCMD_OK;
+	}
+	else if (!Bstrcasecmp(parm->name, "threadedblit")) {
+		if (showval) { buildprintf("threadedblit is %d\n", threadedblit); }
+		else { threadedblit = (atoi(parm->parms[0]) != 0); }
+		return OSDCMD_OK;
+	}
+	else if (!Bstrcasecmp(parm->name, "dirtyblit")) {
+		if (showval) { buildprintf("dirtyblit is %d\n", dirtyblit); }
+		else { dirtyblit = (atoi(parm->parms[0]) != 0); }
+		return OSDCMD_OK;
+	}
+	else if (!Bstrcasecmp(parm->name, "zipcheckpoints")) {
+		if (showval) { buildprintf("zipcheckpoints is %d\n", kzsetcheckpoints(-1)); }
+		else { kzsetcheckpoints(max(0, atoi(parm->parms[0]))); }
+		return OSDCMD_OK;
+	}
 #if defined(DEBUGGINGAIDS) && USE_OPENGL
 	else if (!Bstrcasecmp(parm->name, "debuggllogseverity")) {
 		const char *levels[] = {"none", "notification", "low", "medium", "high"};
@@ -133,6 +252,19 @@ int baselayer_init(void)
 
 	OSD_RegisterFunction("novoxmips","novoxmips: turn off/on the use of mipmaps when rendering 8-bit voxels",osdcmd_vars);
 	OSD_RegisterFunction("usevoxels","usevoxels: enable/disable automatic sprite->voxel rendering",osdcmd_vars);
+	OSD_RegisterFunction("renderthreads","renderthreads: number of threads drawing the classic renderer's walls, ceilings and floors (0 = one per CPU)",osdcmd_vars);
+	OSD_RegisterFunction("tilestreaming","tilestreaming: enable/disable loading tiles in the background while the classic renderer draws placeholders",osdcmd_vars);
+	OSD_RegisterFunction("usepvs","usepvs: enable/disable skipping sectors outside the potentially visible sets of a map's .pvs file",osdcmd_vars);
+	OSD_RegisterFunction("threadedblit","threadedblit: enable/disable expanding software frames to 32 bits on a thread of their own while the next frame is drawn (from the next video mode change)",osdcmd_vars);
+	OSD_RegisterFunction("dirtyblit","dirtyblit: enable/disable sending only the parts of the screen drawn since the last frame, and skipping HUD sprites drawn the same as last frame (games writing into frameplace must then call markdirtyrect())",osdcmd_vars);
+	OSD_RegisterFunction("zipcheckpoints","zipcheckpoints: Kbytes between the snapshots that let seeks in zipped files resume nearby (0 = none)",osdcmd_vars);
+	OSD_RegisterFunction("profile","profile [on|off|overlay|csv <file>]: times the renderer's stages and counts its work, showing the last frame's\n"
+			"   on/off - starts or stops profiling\n"
+			"   overlay - shows or hides the last frame's profile on screen\n"
+			"   csv <file> - writes every frame's profile to a CSV file\n",
+			osdcmd_profile);
+	OSD_RegisterFunction("trace","trace <file> [frames]|stop: records the engine's events over the next frames (default 60, 0 = until stopped) as a trace for chrome://tracing",osdcmd_trace);
+	OSD_RegisterFunction("cachestats","cachestats [reset]: shows the tile cache's usage, misses and evictions",osdcmd_cachestats);
 
 #if USE_POLYMOST
 	OSD_RegisterFunction("setrendermode","setrendermode <number>: sets the engine's rendering mode.\n"
@@ -0,0 +1,218 @@
+// Portable threading primitives
+// for the Build Engine
+
+#include "compat.h"
+#include "bthread.h"
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
+struct bthread_typ {
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	int (*func)(void *);
+	void *arg;
+	int result;
+};
+
+struct bmutex_typ {
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mtx;
+#endif
+};
+
+struct bcond_typ {
+#ifdef _WIN32
+	CONDITION_VARIABLE cv;
+#else
+	pthread_cond_t cv;
+#endif
+};
+
+#ifdef _WIN32
+static DWORD WINAPI threadproc(LPVOID param)
+{
+	bthread_t thr = (bthread_t)param;
+	thr->result = thr->func(thr->arg);
+	return 0;
+}
+#else
+static void *threadproc(void *param)
+{
+	bthread_t thr = (bthread_t)param;
+	thr->result = thr->func(thr->arg);
+	return NULL;
+}
+#endif
+
+bthread_t bthread_create(int (*func)(void *), void *arg)
+{
+	bthread_t thr;
+
+	thr = (bthread_t)Bmalloc(sizeof(struct bthread_typ));
+	if (!thr) return NULL;
+
+	thr->func = func;
+	thr->arg = arg;
+	thr->result = 0;
+
+#ifdef _WIN32
+	thr->handle = CreateThread(NULL, 0, threadproc, thr, 0, NULL);
+	if (!thr->handle) {
+		Bfree(thr);
+		return NULL;
+	}
+#else
+	if (pthread_create(&thr->handle, NULL, threadproc, thr)) {
+		Bfree(thr);
+		return NULL;
+	}
+#endif
+
+	return thr;
+}
+
+int bthread_join(bthread_t thr)
+{
+	int result;
+
+	if (!thr) return 0;
+
+#ifdef _WIN32
+	WaitForSingleObject(thr->handle, INFINITE);
+	CloseHandle(thr->handle);
+#else
+	pthread_join(thr->handle, NULL);
+#endif
+
+	result = thr->result;
+	Bfree(thr);
+	return result;
+}
+
+int bthread_numcpus(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return max(1, (int)si.dwNumberOfProcessors);
+#elif defined(_SC_NPROCESSORS_ONLN)
+	return max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+#else
+	return 1;
+#endif
+}
+
+bmutex_t bmutex_create(void)
+{
+	bmutex_t mtx;
+
+	mtx = (bmutex_t)Bmalloc(sizeof(struct bmutex_typ));
+	if (!mtx) return NULL;
+
+#ifdef _WIN32
+	InitializeCriticalSection(&mtx->cs);
+#else
+	pthread_mutex_init(&mtx->mtx, NULL);
+#endif
+	return mtx;
+}
+
+void bmutex_destroy(bmutex_t mtx)
+{
+	if (!mtx) return;
+#ifdef _WIN32
+	DeleteCriticalSection(&mtx->cs);
+#else
+	pthread_mutex_destroy(&mtx->mtx);
+#endif
+	Bfree(mtx);
+}
+
+void bmutex_lock(bmutex_t mtx)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&mtx->cs);
+#else
+	pthread_mutex_lock(&mtx->mtx);
+#endif
+}
+
+void bmutex_unlock(bmutex_t mtx)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&mtx->cs);
+#else
+	pthread_mutex_unlock(&mtx->mtx);
+#endif
+}
+
+bcond_t bcond_create(void)
+{
+	bcond_t cond;
+
+	cond = (bcond_t)Bmalloc(sizeof(struct bcond_typ));
+	if (!cond) return NULL;
+
+#ifdef _WIN32
+	InitializeConditionVariable(&cond->cv);
+#else
+	pthread_cond_init(&cond->cv, NULL);
+#endif
+	return cond;
+}
+
+void bcond_destroy(bcond_t cond)
+{
+	if (!cond) return;
+#ifndef _WIN32
+	pthread_cond_destroy(&cond->cv);
+#endif
+	Bfree(cond);
+}
+
+void bcond_wait(bcond_t cond, bmutex_t mtx)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(&cond->cv, &mtx->cs, INFINITE);
+#else
+	pthread_cond_wait(&cond->cv, &mtx->mtx);
+#endif
+}
+
+void bcond_signal(bcond_t cond)
+{
+#ifdef _WIN32
+	WakeConditionVariable(&cond->cv);
+#else
+	pthread_cond_signal(&cond->cv);
+#endif
+}
+
+void bcond_broadcast(bcond_t cond)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(&cond->cv);
+#else
+	pthread_cond_broadcast(&cond->cv);
+#endif
+}
+
+int bthread_atomicadd(volatile int *ptr, int val)
+{
+#ifdef _WIN32
+	return (int)InterlockedExchangeAdd((volatile LONG *)ptr, (LONG)val) + val;
+#else
+	return __sync_add_and_fetch(ptr, val);
+#endif
+}
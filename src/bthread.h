@@ -0,0 +1,61 @@
+// Portable threading primitives
+// for the Build Engine
+
+#ifndef BTHREAD_H
+#define BTHREAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bthread_typ * bthread_t;
+typedef struct bmutex_typ * bmutex_t;
+typedef struct bcond_typ * bcond_t;
+
+/**
+ * Starts a new thread.
+ * @param func the thread's entry point
+ * @param arg the argument passed to func
+ * @return the thread handle, or NULL on failure
+ */
+bthread_t bthread_create(int (*func)(void *), void *arg);
+
+/**
+ * Waits for a thread to finish and releases its handle.
+ * @param thr the thread handle
+ * @return the value returned by the thread's entry point
+ */
+int bthread_join(bthread_t thr);
+
+/**
+ * Returns the number of processors available to the process, at least 1.
+ */
+int bthread_numcpus(void);
+
+bmutex_t bmutex_create(void);
+void bmutex_destroy(bmutex_t mtx);
+void bmutex_lock(bmutex_t mtx);
+void bmutex_unlock(bmutex_t mtx);
+
+bcond_t bcond_create(void);
+void bcond_destroy(bcond_t cond);
+
+/**
+ * Atomically releases mtx and waits for cond to be signalled, then reacquires mtx.
+ * Spurious wakeups are possible so callers must re-test their predicate.
+ */
+void bcond_wait(bcond_t cond, bmutex_t mtx);
+void bcond_signal(bcond_t cond);
+void bcond_broadcast(bcond_t cond);
+
+/**
+ * Atomically adds val to *ptr.
+ * @return the new value of *ptr
+ */
+int bthread_atomicadd(volatile int *ptr, int val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -410,6 +410,7 @@ int app_main(int argc, char const * const argv[])
 		}
 
 		OSD_DispatchQueued();
+		invalidatesectorgrid(-1);	// the editor changes walls in too many ways to follow
 
 		ExtPreCheckKeys();
 
@@ -2756,6 +2757,7 @@ void overheadeditor(void)
 		}
 
 		OSD_DispatchQueued();
+		invalidatesectorgrid(-1);	// the editor changes walls in too many ways to follow
 
 		oldmousebstatus = bstatus;
 		getmousevalues(&mousx,&mousy,&bstatus);
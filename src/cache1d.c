@@ -16,7 +16,7 @@
 
 	//Insert '|' in front of filename
 	//Doing this tells kzopen to load the file only if inside a .ZIP file
-static int kzipopen(const char *filnam)
+static void *kzipopen(const char *filnam)
 {
 	unsigned int i;
 	char newst[BMAX_PATH+4];
@@ -24,7 +24,7 @@ static int kzipopen(const char *filnam)
 	newst[0] = '|';
 	for(i=0;filnam[i] && (i < sizeof(newst)-2);i++) newst[i+1] = filnam[i];
 	newst[i+1] = 0;
-	return(kzopen(newst));
+	return(kzstreamopen(newst));
 }
 
 #endif
@@ -59,15 +59,33 @@ static int kzipopen(const char *filnam)
 //           without first calling initcache.
 
 #define MAXCACHEOBJECTS 9216
+#define CACHEBINS 32
+#define CACHEHASHSIZE 8192
 
 static int cachesize = 0;
 int cachecount = 0;
 unsigned char zerochar = 0;
 intptr_t cachestart = 0;
-int cacnum = 0, agecount = 0;
-typedef struct { void **hand; int leng; unsigned char *lock; } cactype;
+int cacnum = 0, agecount = -1;
+
+	//The blocks tile the cache and are linked in address order. Free space,
+	//marked by a lock pointer of &zerochar, is also kept on lists binned by
+	//the log2 of its size, and allocated blocks are hashed by their offset.
+typedef struct {
+	void **hand;
+	int ofs, leng;
+	unsigned char *lock;
+	int prev, next;		// neighbours in address order, or -1
+	int fprev, fnext;	// free list links, or the next unused slot
+	int hnext;			// next allocated block in the same hash chain
+} cactype;
 cactype cac[MAXCACHEOBJECTS];
+static int cachehead = -1, cachetail = -1, unusedcac = -1;
+static int freebin[CACHEBINS];
+static unsigned int freebinmask = 0;
+static int cachehash[CACHEHASHSIZE];
 static int lockrecip[200];
+static cachestatstype stats;
 
 static char toupperlookup[256];
 
@@ -79,6 +97,86 @@ static void reportandexit(char *errormessage);
 extern char pow2char[8];
 
 
+static int cachebin(int leng)
+{
+	int b = 0;
+
+	for(leng>>=5;leng;leng>>=1) b++;
+	return(b);
+}
+
+static void linkfree(int z)
+{
+	int b = cachebin(cac[z].leng);
+
+	cac[z].hand = NULL;
+	cac[z].lock = &zerochar;
+	cac[z].fprev = -1;
+	cac[z].fnext = freebin[b];
+	if (freebin[b] >= 0) cac[freebin[b]].fprev = z;
+	freebin[b] = z;
+	freebinmask |= (1u<<b);
+}
+
+static void unlinkfree(int z)
+{
+	int b = cachebin(cac[z].leng);
+
+	if (cac[z].fprev >= 0) cac[cac[z].fprev].fnext = cac[z].fnext;
+	else if ((freebin[b] = cac[z].fnext) < 0) freebinmask &= ~(1u<<b);
+	if (cac[z].fnext >= 0) cac[cac[z].fnext].fprev = cac[z].fprev;
+}
+
+static inline int cachehashofs(int ofs)
+{
+	return((int)((((unsigned int)ofs>>4)*2654435761u)>>19));
+}
+
+static void hashblock(int z)
+{
+	int h = cachehashofs(cac[z].ofs);
+
+	cac[z].hnext = cachehash[h];
+	cachehash[h] = z;
+}
+
+static void unhashblock(int z)
+{
+	int *p;
+
+	for(p=&cachehash[cachehashofs(cac[z].ofs)];*p!=z;p=&cac[*p].hnext) ;
+	*p = cac[z].hnext;
+}
+
+	//Takes an unused slot and links it into the address order after 'after'
+static int insertblock(int after)
+{
+	int z;
+
+	if ((z = unusedcac) < 0)
+		reportandexit("Too many objects in cache! (cacnum > MAXCACHEOBJECTS)");
+	unusedcac = cac[z].fnext;
+	cacnum++;
+
+	cac[z].prev = after;
+	cac[z].next = cac[after].next;
+	if (cac[z].next >= 0) cac[cac[z].next].prev = z; else cachetail = z;
+	cac[after].next = z;
+	return(z);
+}
+
+static void removeblock(int z)
+{
+	if (agecount == z) agecount = cac[z].prev;
+
+	if (cac[z].prev >= 0) cac[cac[z].prev].next = cac[z].next; else cachehead = cac[z].next;
+	if (cac[z].next >= 0) cac[cac[z].next].prev = cac[z].prev; else cachetail = cac[z].prev;
+
+	cac[z].fnext = unusedcac;
+	unusedcac = z;
+	cacnum--;
+}
+
 void initcache(void *dacachestart, int dacachesize)
 {
 	int i;
@@ -88,16 +186,86 @@ void initcache(void *dacachestart, int dacachesize)
 	cachestart = ((intptr_t)dacachestart + 15) & ~15;
 	cachesize = (dacachesize - ((-(intptr_t)dacachestart) & 15)) & ~15;
 
+	for(i=0;i<MAXCACHEOBJECTS;i++) cac[i].fnext = i+1;
+	cac[MAXCACHEOBJECTS-1].fnext = -1;
+	for(i=0;i<CACHEBINS;i++) freebin[i] = -1;
+	for(i=0;i<CACHEHASHSIZE;i++) cachehash[i] = -1;
+	freebinmask = 0;
+	memset(&stats, 0, sizeof(stats));
+
+	cac[0].ofs = 0;
 	cac[0].leng = cachesize;
-	cac[0].lock = &zerochar;
+	cac[0].prev = cac[0].next = -1;
+	linkfree(0);
+	cachehead = cachetail = 0;
+	unusedcac = 1;
 	cacnum = 1;
+	agecount = -1;
 
 	buildprintf("initcache(): Initialised with %d bytes\n", cachesize);
 }
 
+	//Finds free space big enough, preferring the smallest size class that
+	//can hold it, or returns -1 if no free block is big enough
+static int findfreeblock(int newbytes)
+{
+	int z, b;
+	unsigned int mask;
+
+	b = cachebin(newbytes);
+	for(z=freebin[b];z>=0;z=cac[z].fnext)
+		if (cac[z].leng >= newbytes) return(z);
+
+		//Everything in a larger class fits
+	mask = freebinmask & ~((2u<<b)-1);
+	if (!mask) return(-1);
+	for(b++;!(mask&(1u<<b));b++) ;
+	return(freebin[b]);
+}
+
+static inline int blockcost(int z, int *locked, int dir)
+{
+	unsigned char l = *cac[z].lock;
+
+	if (l == 0) return(0);
+	if (l >= 200) { *locked += dir; return(0); }
+	return(mulscale32(cac[z].leng+65536,lockrecip[l]));
+}
+
+	//Finds the run of blocks which is cheapest to evict to make room. Each
+	//block costs more the bigger it is and the more recently it was used, and
+	//blocks locked at 200 or above may not be evicted. The window slides down
+	//from the top of the cache keeping a running cost, so this chooses the
+	//same place as summing the cost of every candidate afresh would.
+static int findevictwindow(int newbytes)
+{
+	int z, e, o2, bestz = -1, locked = 0;
+	int64_t daval = 0, bestval = INT_MAX;
+
+	for(z=e=cachetail;z>=0;z=cac[z].prev)
+	{
+		daval += blockcost(z,&locked,1);
+		o2 = cac[z].ofs+newbytes;
+		for(;cac[e].ofs>=o2;e=cac[e].prev) daval -= blockcost(e,&locked,-1);
+		if ((o2 > cachesize) || locked) continue;
+
+		if (daval < bestval)
+		{
+			bestval = daval; bestz = z;
+			if (bestval == 0) break;
+		}
+	}
+
+	if (bestz < 0)
+		reportandexit("CACHE SPACE ALL LOCKED UP!");
+
+	return(bestz);
+}
+
 void allocache(void **newhandle, int newbytes, unsigned char *newlockptr)
 {
-	int i, z, zz, bestz=0, daval, bestval, besto=0, o1, o2, sucklen, suckz;
+	int z, zz, nz, sucklen;
+	int64_t evictedbytes;
 
 	newbytes = ((newbytes+15)& ~15);
 
@@ -113,89 +281,98 @@ void allocache(void **newhandle, int newbytes, unsigned char *newlockptr)
 		reportandexit("ALLOCACHE CALLED WITH LOCK OF 0!");
 	}
 
-		//Find best place
-	bestval = INT_MAX; o1 = cachesize;
-	for(z=cacnum-1;z>=0;z--)
+	stats.misses++;
+
+	if ((z = findfreeblock(newbytes)) >= 0)
 	{
-		o1 -= cac[z].leng;
-		o2 = o1+newbytes; if (o2 > cachesize) continue;
+		unlinkfree(z);
+	}
+	else
+	{
+		z = findevictwindow(newbytes);
+		stats.evictsearches++;
+		evictedbytes = stats.evictedbytes;
 
-		daval = 0;
-		for(i=o1,zz=z;i<o2;i+=cac[zz++].leng)
-		{
-			if (*cac[zz].lock == 0) continue;
-			if (*cac[zz].lock >= 200) { daval = INT_MAX; break; }
-			daval += mulscale32(cac[zz].leng+65536,lockrecip[*cac[zz].lock]);
-			if (daval >= bestval) break;
-		}
-		if (daval < bestval)
+			//Suck things out, merging the window into its first block
+		for(sucklen=-newbytes,zz=z;sucklen<0;zz=nz)
 		{
-			bestval = daval; besto = o1; bestz = z;
-			if (bestval == 0) break;
+			nz = cac[zz].next;
+			sucklen += cac[zz].leng;
+
+			if (cac[zz].lock == &zerochar) unlinkfree(zz);
+			else
+			{
+				if (*cac[zz].lock)
+				{
+					*cac[zz].hand = 0;
+					stats.evictions++;
+					stats.evictedbytes += cac[zz].leng;
+				}
+				unhashblock(zz);
+			}
+			if (zz != z) { cac[z].leng += cac[zz].leng; removeblock(zz); }
 		}
+		traceinstant("evict", (int)(stats.evictedbytes - evictedbytes));
 	}
 
-	//printf("%ld %ld %ld\n",besto,newbytes,*newlockptr);
-
-	if (bestval == INT_MAX)
-		reportandexit("CACHE SPACE ALL LOCKED UP!");
-
-		//Suck things out
-	for(sucklen=-newbytes,suckz=bestz;sucklen<0;sucklen+=cac[suckz++].leng)
-		if (*cac[suckz].lock) *cac[suckz].hand = 0;
-
-		//Remove all blocks except 1
-	suckz -= (bestz+1); cacnum -= suckz;
-	copybufbyte(&cac[bestz+suckz],&cac[bestz],(cacnum-bestz)*sizeof(cactype));
-	cac[bestz].hand = newhandle; *newhandle = (void*)(cachestart+besto);
-	cac[bestz].leng = newbytes;
-	cac[bestz].lock = newlockptr;
-	cachecount++;
-
-		//Add new empty block if necessary
-	if (sucklen <= 0) return;
-
-	bestz++;
-	if (bestz == cacnum)
+		//Return what's left over to free space
+	if ((sucklen = cac[z].leng-newbytes) > 0)
 	{
-		cacnum++; if (cacnum > MAXCACHEOBJECTS) reportandexit("Too many objects in cache! (cacnum > MAXCACHEOBJECTS)");
-		cac[bestz].leng = sucklen;
-		cac[bestz].lock = &zerochar;
-		return;
+		zz = cac[z].next;
+		if ((zz >= 0) && (cac[zz].lock == &zerochar))
+		{
+			unlinkfree(zz);
+			cac[zz].ofs -= sucklen;
+			cac[zz].leng += sucklen;
+		}
+		else
+		{
+			zz = insertblock(z);
+			cac[zz].ofs = cac[z].ofs+newbytes;
+			cac[zz].leng = sucklen;
+		}
+		linkfree(zz);
+		cac[z].leng = newbytes;
 	}
 
-	if (*cac[bestz].lock == 0) { cac[bestz].leng += sucklen; return; }
-
-	cacnum++; if (cacnum > MAXCACHEOBJECTS) reportandexit("Too many objects in cache! (cacnum > MAXCACHEOBJECTS)");
-	for(z=cacnum-1;z>bestz;z--) cac[z] = cac[z-1];
-	cac[bestz].leng = sucklen;
-	cac[bestz].lock = &zerochar;
+	cac[z].hand = newhandle; *newhandle = (void*)(cachestart+cac[z].ofs);
+	cac[z].lock = newlockptr;
+	hashblock(z);
+	cachecount++;
 }
 
 void suckcache(void *suckptr)
 {
-	int i;
+	int z, zz;
+	intptr_t ofs;
 
-		//Can't exit early, because invalid pointer might be same even though lock = 0
-	for(i=0;i<cacnum;i++)
-		if (*cac[i].hand == suckptr)
-		{
-			if (*cac[i].lock) *cac[i].hand = 0;
-			cac[i].lock = &zerochar;
-			cac[i].hand = 0;
+	ofs = (intptr_t)suckptr - cachestart;
+	if ((ofs < 0) || (ofs >= cachesize)) return;
 
-				//Combine empty blocks
-			if ((i > 0) && (*cac[i-1].lock == 0))
-			{
-				cac[i-1].leng += cac[i].leng;
-				cacnum--; copybuf(&cac[i+1],&cac[i],(cacnum-i)*sizeof(cactype));
-			}
-			else if ((i < cacnum-1) && (*cac[i+1].lock == 0))
-			{
-				cac[i+1].leng += cac[i].leng;
-				cacnum--; copybuf(&cac[i+1],&cac[i],(cacnum-i)*sizeof(cactype));
-			}
-		}
+	for(z=cachehash[cachehashofs((int)ofs)];z>=0;z=cac[z].hnext)
+		if (cac[z].ofs == (int)ofs) break;
+	if ((z < 0) || (*cac[z].hand != suckptr)) return;
+
+	if (*cac[z].lock) *cac[z].hand = 0;
+	unhashblock(z);
+
+		//Combine empty blocks
+	zz = cac[z].prev;
+	if ((zz >= 0) && (cac[zz].lock == &zerochar))
+	{
+		unlinkfree(zz);
+		cac[zz].leng += cac[z].leng;
+		removeblock(z);
+		z = zz;
+	}
+	zz = cac[z].next;
+	if ((zz >= 0) && (cac[zz].lock == &zerochar))
+	{
+		unlinkfree(zz);
+		cac[z].leng += cac[zz].leng;
+		removeblock(zz);
+	}
+	linkfree(z);
 }
 
 void agecache(void)
@@ -203,38 +380,67 @@ void agecache(void)
 	int cnt;
 	unsigned char ch;
 
-	if (agecount >= cacnum) agecount = cacnum-1;
-	if (agecount < 0) return;
+	if (cachetail < 0) return;
 	for(cnt=(cacnum>>4);cnt>=0;cnt--)
 	{
+		if (agecount < 0) agecount = cachetail;
+
 		ch = (*cac[agecount].lock);
 		if (((ch-2)&255) < 198)
 			(*cac[agecount].lock) = ch-1;
 
-		agecount--; if (agecount < 0) agecount = cacnum-1;
+		agecount = cac[agecount].prev;
+	}
+}
+
+void getcachestats(cachestatstype *st)
+{
+	int z;
+
+	*st = stats;
+	st->size = cachesize;
+	st->blocks = cacnum;
+	for(z=cachehead;z>=0;z=cac[z].next)
+	{
+		if (cac[z].lock == &zerochar)
+		{
+			st->freeblocks++;
+			st->freebytes += cac[z].leng;
+			st->largestfree = max(st->largestfree, cac[z].leng);
+		}
+		else if (*cac[z].lock >= 200)
+		{
+			st->lockedblocks++;
+			st->lockedbytes += cac[z].leng;
+		}
 	}
 }
 
+void resetcachestats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
 static void reportandexit(char *errormessage)
 {
-    int i, j;
+    int i, j, z;
 
     j = 0;
-    for(i=0;i<cacnum;i++)
+    for(i=0,z=cachehead;z>=0;i++,z=cac[z].next)
     {
         buildprintf("%d- ",i);
-        if (cac[i].hand) {
-            buildprintf("ptr: 0x%p, ",*cac[i].hand);
+        if (cac[z].hand) {
+            buildprintf("ptr: 0x%p, ",*cac[z].hand);
         } else {
             buildprintf("ptr: NULL, ");
         }
-        buildprintf("leng: %d, ",cac[i].leng);
-        if (cac[i].lock) {
-            buildprintf("lock: %d\n",*cac[i].lock);
+        buildprintf("leng: %d, ",cac[z].leng);
+        if (cac[z].lock) {
+            buildprintf("lock: %d\n",*cac[z].lock);
         } else {
             buildprintf("lock: NULL\n");
         }
-        j += cac[i].leng;
+        j += cac[z].leng;
     }
 	buildprintf("Cachesize = %d\n",cachesize);
 	buildprintf("Cacnum = %d\n",cacnum);
@@ -380,9 +586,6 @@ BFILE* fopenfrompath(const char *fn, const char *mode)
 }
 
 
-#define MAXGROUPFILES 4     //Warning: Fix groupfil if this is changed
-#define MAXOPENFILES 64     //Warning: Fix filehan if this is changed
-
 static char toupperlookup[256] =
 {
 	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,
@@ -403,98 +606,158 @@ static char toupperlookup[256] =
 	0xf0,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa,0xfb,0xfc,0xfd,0xfe,0xff
 };
 
-static int numgroupfiles = 0;
-static int gnumfiles[MAXGROUPFILES];
-static int groupfil[MAXGROUPFILES] = {-1,-1,-1,-1};
-static int groupfilpos[MAXGROUPFILES];
-static char *gfilelist[MAXGROUPFILES];
-static int *gfileoffs[MAXGROUPFILES];
+	// Where kopen4load() looks for a file, first to last:
+	//   searchfirst 0: loose files on the search paths, then ZIPs, then group files
+	//   searchfirst 1: the first group file opened, only
+	//   searchfirst 2: ZIPs, then group files
+	// Of the ZIPs and of the group files, those opened later are searched first.
+	// There is no limit to how many may be opened, nor to how many files.
+
+typedef struct {
+	int fil;			// descriptor
+	int numfiles;
+	int filpos;			// where the descriptor is, relative to the first member
+	char *list;			// 16 bytes per member, the name NUL terminated at 12
+	int *offs;			// numfiles+1 offsets of each member from the first
+	char *name;			// where the group file is
+	int *hash, hashmask;	// buckets of list indices, chained by hash[hashmask+1+i]
+	unsigned char *map;		// if usefilemapping was on when it was opened
+	int maplen;
+} grouptype;
+
+static grouptype *groups = NULL;
+static int numgroupfiles = 0, groupsalloced = 0;
+int usefilemapping = 0;
+
+enum {
+	KFILE_CLOSED = 0,
+	KFILE_LOOSE,		// han is a descriptor
+	KFILE_ZIP,			// zip is a kplib stream with its own decompression state
+	KFILE_GROUP,		// han is a member of group grp
+};
+typedef struct {
+	int type;
+	int grp, han, pos;
+	void *zip;
+} openfiletype;
+
+static openfiletype *openfiles = NULL;
+static int openfilesalloced = 0;
 
-static unsigned char filegrp[MAXOPENFILES];
-static int filepos[MAXOPENFILES];
-static int filehan[MAXOPENFILES] =
+	//Hashes a name as kopen4load compares it: case-folded, up to 12 characters
+static unsigned int hashgroupname(const char *name)
 {
-	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
-};
-#ifdef WITHKPLIB
-static char filenamsav[MAXOPENFILES][260];
-static int kzcurhand = -1;
-#endif
+	unsigned int h = 0;
+	int j;
+
+	for(j=0;j<12 && name[j];j++)
+		h = h*31 + (unsigned char)toupperlookup[(int)(unsigned char)name[j]];
+	return h;
+}
+
+	//Indexes a group file's names. Entries are pushed in order, so each chain
+	//holds the later of any duplicate names first, as the old backwards scan found.
+static void hashgroupfile(grouptype *g)
+{
+	int i, b, numbuckets, *next;
+
+	for(numbuckets=16;numbuckets<g->numfiles;numbuckets<<=1);
+	if ((g->hash = (int *)kmalloc((numbuckets+g->numfiles)*sizeof(int))) == 0)
+		{ buildprintf("Not enough memory for file grouping system\n"); exit(0); }
+	g->hashmask = numbuckets-1;
+	next = &g->hash[numbuckets];
+
+	for(b=0;b<numbuckets;b++) g->hash[b] = -1;
+	for(i=0;i<g->numfiles;i++)
+	{
+		b = hashgroupname(&g->list[i<<4]) & g->hashmask;
+		next[i] = g->hash[b];
+		g->hash[b] = i;
+	}
+}
+
+static void freegroupfile(grouptype *g)
+{
+	kfree(g->list);
+	kfree(g->offs);
+	kfree(g->hash);
+	free(g->name);
+	Bunmapfile(g->map,g->maplen);
+	Bclose(g->fil);
+	memset(g, 0, sizeof(grouptype));
+	g->fil = -1;
+}
 
 int initgroupfile(const char *filename)
 {
 	char buf[16];
-	int i, j, k;
-#ifdef WITHKPLIB
+	int i, j, k, fil;
 	char *zfn;
-	searchpath_t *sp = NULL;
-#endif	
+	grouptype *g;
 
 #ifdef _WIN32
 	// on Windows, translate all backslashes (0x5c) to forward slashes (0x2f)
 	toupperlookup[0x5c] = 0x2f;
 #endif
-	
-#ifdef WITHKPLIB
+
 	if (findfrompath(filename, &zfn) < 0) return -1;
-	
-	// check to see if the file passed is a ZIP and pass it on to kplib if it is
-	i = Bopen(zfn,BO_BINARY|BO_RDONLY,BS_IREAD);
-	if (i < 0) { free(zfn); return -1; }
+	fil = Bopen(zfn,BO_BINARY|BO_RDONLY,BS_IREAD);
+	if (fil < 0) { free(zfn); return -1; }
+
+	if (Bread(fil,buf,16) != 16) { Bclose(fil); free(zfn); return -1; }
 
-	Bread(i, buf, 4);
+#ifdef WITHKPLIB
+	// check to see if the file passed is a ZIP and pass it on to kplib if it is
 	if (buf[0] == 0x50 && buf[1] == 0x4B && buf[2] == 0x03 && buf[3] == 0x04) {
-		Bclose(i);
+		Bclose(fil);
 		j = kzaddstack(zfn);
 		free(zfn);
 		return j;
 	}
-	free(zfn);
+#endif
 
-	if (numgroupfiles >= MAXGROUPFILES) return(-1);
+	if (memcmp(buf, "KenSilverman", 12)) { Bclose(fil); free(zfn); return -1; }
 
-	Blseek(i,0,BSEEK_SET);
-	groupfil[numgroupfiles] = i;
-#else
-	groupfil[numgroupfiles] = openfrompath(filename,BO_BINARY|BO_RDONLY,BS_IREAD);
-	if (groupfil[numgroupfiles] != -1)
-#endif
+	if (numgroupfiles == groupsalloced)
 	{
-		groupfilpos[numgroupfiles] = 0;
-		Bread(groupfil[numgroupfiles],buf,16);
-		if ((buf[0] != 'K') || (buf[1] != 'e') || (buf[2] != 'n') ||
-			 (buf[3] != 'S') || (buf[4] != 'i') || (buf[5] != 'l') ||
-			 (buf[6] != 'v') || (buf[7] != 'e') || (buf[8] != 'r') ||
-			 (buf[9] != 'm') || (buf[10] != 'a') || (buf[11] != 'n'))
-		{
-			Bclose(groupfil[numgroupfiles]);
-			groupfil[numgroupfiles] = -1;
-			return(-1);
-		}
-		gnumfiles[numgroupfiles] = B_LITTLE32(*((int *)&buf[12]));
+		k = groupsalloced ? groupsalloced*2 : 4;
+		g = (grouptype *)realloc(groups, k*sizeof(grouptype));
+		if (!g) { Bclose(fil); free(zfn); return -1; }
+		groups = g;
+		groupsalloced = k;
+	}
+	g = &groups[numgroupfiles];
+	memset(g, 0, sizeof(grouptype));
+	g->fil = fil;
+	g->name = zfn;
+	g->numfiles = B_LITTLE32(*((int *)&buf[12]));
 
-		if ((gfilelist[numgroupfiles] = (char *)kmalloc(gnumfiles[numgroupfiles]<<4)) == 0)
-			{ buildprintf("Not enough memory for file grouping system\n"); exit(0); }
-		if ((gfileoffs[numgroupfiles] = (int *)kmalloc((gnumfiles[numgroupfiles]+1)<<2)) == 0)
-			{ buildprintf("Not enough memory for file grouping system\n"); exit(0); }
+	if ((g->list = (char *)kmalloc(g->numfiles<<4)) == 0)
+		{ buildprintf("Not enough memory for file grouping system\n"); exit(0); }
+	if ((g->offs = (int *)kmalloc((g->numfiles+1)<<2)) == 0)
+		{ buildprintf("Not enough memory for file grouping system\n"); exit(0); }
 
-		Bread(groupfil[numgroupfiles],gfilelist[numgroupfiles],gnumfiles[numgroupfiles]<<4);
+	Bread(fil,g->list,g->numfiles<<4);
 
-		j = 0;
-		for(i=0;i<gnumfiles[numgroupfiles];i++)
-		{
-			k = B_LITTLE32(*((int *)&gfilelist[numgroupfiles][(i<<4)+12]));
-			gfilelist[numgroupfiles][(i<<4)+12] = 0;
-			gfileoffs[numgroupfiles][i] = j;
-			j += k;
-		}
-		gfileoffs[numgroupfiles][gnumfiles[numgroupfiles]] = j;
+	j = 0;
+	for(i=0;i<g->numfiles;i++)
+	{
+		k = B_LITTLE32(*((int *)&g->list[(i<<4)+12]));
+		g->list[(i<<4)+12] = 0;
+		g->offs[i] = j;
+		j += k;
 	}
+	g->offs[g->numfiles] = j;
+	g->filpos = 0;
+
+	hashgroupfile(g);
+
+	g->maplen = ((g->numfiles+1)<<4)+j;
+	if (usefilemapping && Bfilelength(fil) >= g->maplen)
+		g->map = (unsigned char *)Bmapfile(fil,g->maplen);
+
 	numgroupfiles++;
-	return(groupfil[numgroupfiles-1]);
+	return(fil);
 }
 
 void uninitsinglegroupfile(int grphandle)
@@ -502,12 +765,9 @@ void uninitsinglegroupfile(int grphandle)
 	int i, grpnum = -1;
 
 	for(i=numgroupfiles-1;i>=0;i--)
-		if (groupfil[i] != -1 && groupfil[i] == grphandle)
+		if (groups[i].fil == grphandle)
 		{
-			kfree(gfilelist[i]);
-			kfree(gfileoffs[i]);
-			Bclose(groupfil[i]);
-			groupfil[i] = -1;
+			freegroupfile(&groups[i]);
 			grpnum = i;
 			break;
 		}
@@ -518,24 +778,16 @@ void uninitsinglegroupfile(int grphandle)
 	numgroupfiles--;
 
 	// move any group files following this one back
-	for (i=grpnum+1; i<MAXGROUPFILES; i++)
-		if (groupfil[i] != -1) {
-			groupfil[i-1]    = groupfil[i];
-			gnumfiles[i-1]   = gnumfiles[i];
-			groupfilpos[i-1] = groupfilpos[i];
-			gfilelist[i-1]   = gfilelist[i];
-			gfileoffs[i-1]   = gfileoffs[i];
-			groupfil[i] = -1;
-		}
+	memmove(&groups[grpnum], &groups[grpnum+1], (numgroupfiles-grpnum)*sizeof(grouptype));
 
 	// fix up the open files that need attention
-	for(i=0;i<MAXOPENFILES;i++) {
-		if (filegrp[i] >= 254)         // external file (255) or ZIPped file (254)
+	for(i=0;i<openfilesalloced;i++) {
+		if (openfiles[i].type != KFILE_GROUP)
 			continue;
-		else if (filegrp[i] == grpnum)   // close file in group we closed
-			filehan[i] = -1;
-		else if (filegrp[i] > grpnum)   // move back a file in a group after the one we closed
-			filegrp[i]--;
+		else if (openfiles[i].grp == grpnum)   // close file in group we closed
+			openfiles[i].type = KFILE_CLOSED;
+		else if (openfiles[i].grp > grpnum)   // move back a file in a group after the one we closed
+			openfiles[i].grp--;
 	}
 }
 
@@ -544,90 +796,99 @@ void uninitgroupfile(void)
 	int i;
 
 	for(i=numgroupfiles-1;i>=0;i--)
-		if (groupfil[i] != -1)
-		{
-			kfree(gfilelist[i]);
-			kfree(gfileoffs[i]);
-			Bclose(groupfil[i]);
-			groupfil[i] = -1;
-		}
+		freegroupfile(&groups[i]);
 	numgroupfiles = 0;
+	free(groups);
+	groups = NULL;
+	groupsalloced = 0;
 
 	// JBF 20040111: "close" any files open in groups
-	for(i=0;i<MAXOPENFILES;i++) {
-		if (filegrp[i] < 254)   // JBF 20040130: not external or ZIPped
-			filehan[i] = -1;
+	for(i=0;i<openfilesalloced;i++) {
+		if (openfiles[i].type == KFILE_GROUP)
+			openfiles[i].type = KFILE_CLOSED;
 	}
 }
 
+	//Finds a free handle, making more if they are all taken
+static int newopenfile(void)
+{
+	int i, n;
+	openfiletype *o;
+
+	for(i=0;i<openfilesalloced;i++)
+		if (openfiles[i].type == KFILE_CLOSED) return(i);
+
+	n = openfilesalloced ? openfilesalloced*2 : 64;
+	o = (openfiletype *)realloc(openfiles, n*sizeof(openfiletype));
+	if (!o) return(-1);
+	memset(&o[openfilesalloced], 0, (n-openfilesalloced)*sizeof(openfiletype));
+	openfiles = o;
+	i = openfilesalloced;
+	openfilesalloced = n;
+	return(i);
+}
+
 int kopen4load(const char *filename, char searchfirst)
 {
-	int i, j, k, fil, newhandle;
+	int i, j, k, fil, newhandle, *next;
 	char bad, *gfileptr;
+	unsigned int hash;
+	openfiletype *o;
 
-	newhandle = MAXOPENFILES-1;
-	while (filehan[newhandle] != -1)
+	newhandle = newopenfile();
+	if (newhandle < 0)
 	{
-		newhandle--;
-		if (newhandle < 0)
-		{
-			buildprintf("TOO MANY FILES OPEN IN FILE GROUPING SYSTEM!");
-			exit(0);
-		}
+		buildprintf("TOO MANY FILES OPEN IN FILE GROUPING SYSTEM!");
+		exit(0);
 	}
+	o = &openfiles[newhandle];
+	o->pos = 0;
 
 	if (searchfirst == 0)
 		if ((fil = openfrompath(filename,BO_BINARY|BO_RDONLY,S_IREAD)) >= 0)
 		{
-			filegrp[newhandle] = 255;
-			filehan[newhandle] = fil;
-			filepos[newhandle] = 0;
+			o->type = KFILE_LOOSE;
+			o->han = fil;
 			return(newhandle);
 		}
 
 	for (; toupperlookup[(int)(unsigned char)*filename] == '/'; filename++);
-	
+
 #ifdef WITHKPLIB
-	if ((kzcurhand != newhandle) && (kztell() >= 0))
-	{
-		if (kzcurhand >= 0) filepos[kzcurhand] = kztell();
-		kzclose();
-	}
-	if (searchfirst != 1 && (i = kzipopen(filename)) != 0) {
-		kzcurhand = newhandle;
-		filegrp[newhandle] = 254;
-		filehan[newhandle] = i;
-		filepos[newhandle] = 0;
-		strcpy(filenamsav[newhandle],filename);
+	if (searchfirst != 1 && (o->zip = kzipopen(filename)) != 0) {
+		o->type = KFILE_ZIP;
 		return newhandle;
 	}
 #endif
 
+	if (strlen(filename) > 12) return(-1);	// too long for any group entry
+	hash = hashgroupname(filename);
+
 	for(k=numgroupfiles-1;k>=0;k--)
 	{
 		if (searchfirst == 1) k = 0;
-		if (groupfil[k] >= 0)
+		if (k >= numgroupfiles) break;
+
+		next = &groups[k].hash[groups[k].hashmask+1];
+		for(i=groups[k].hash[hash&groups[k].hashmask];i>=0;i=next[i])
 		{
-			for(i=gnumfiles[k]-1;i>=0;i--)
-			{
-				gfileptr = (char *)&gfilelist[k][i<<4];
+			gfileptr = (char *)&groups[k].list[i<<4];
 
-				bad = 0;
-				for(j=0;j<13;j++)
-				{
-					if (!filename[j]) break;
-					if (toupperlookup[(int)(unsigned char)filename[j]] != toupperlookup[(int)(unsigned char)gfileptr[j]])
-						{ bad = 1; break; }
-				}
-				if (bad) continue;
-				if (j<13 && gfileptr[j]) continue;   // JBF: because e1l1.map might exist before e1l1
-				if (j==13 && filename[j]) continue;   // JBF: long file name
-
-				filegrp[newhandle] = k;
-				filehan[newhandle] = i;
-				filepos[newhandle] = 0;
-				return(newhandle);
+			bad = 0;
+			for(j=0;j<13;j++)
+			{
+				if (!filename[j]) break;
+				if (toupperlookup[(int)(unsigned char)filename[j]] != toupperlookup[(int)(unsigned char)gfileptr[j]])
+					{ bad = 1; break; }
 			}
+			if (bad) continue;
+			if (j<13 && gfileptr[j]) continue;   // JBF: because e1l1.map might exist before e1l1
+			if (j==13 && filename[j]) continue;   // JBF: long file name
+
+			o->type = KFILE_GROUP;
+			o->grp = k;
+			o->han = i;
+			return(newhandle);
 		}
 	}
 	return(-1);
@@ -635,38 +896,48 @@ int kopen4load(const char *filename, char searchfirst)
 
 int kread(int handle, void *buffer, int leng)
 {
-	int i, filenum, groupnum;
+	int i;
+	openfiletype *o = &openfiles[handle];
+	grouptype *g;
 
-	filenum = filehan[handle];
-	groupnum = filegrp[handle];
-	if (groupnum == 255) return(Bread(filenum,buffer,leng));
-#ifdef WITHKPLIB
-	else if (groupnum == 254)
+	switch (o->type)
 	{
-		if (kzcurhand != handle)
+		case KFILE_LOOSE:
+			return(Bread(o->han,buffer,leng));
+#ifdef WITHKPLIB
+		case KFILE_ZIP:
 		{
-			if (kztell() >= 0) { filepos[kzcurhand] = kztell(); kzclose(); }
-			kzcurhand = handle;
-			kzipopen(filenamsav[handle]);
-			kzseek(filepos[handle],SEEK_SET);
+			void *ozip = kzstreamselect(o->zip);
+			tracebegin("kread");
+			i = kzread(buffer,leng);
+			traceend("kread");
+			kzstreamselect(ozip);
+			return(i);
 		}
-		return(kzread(buffer,leng));
-	}
 #endif
-
-	if (groupfil[groupnum] != -1)
-	{
-		i = gfileoffs[groupnum][filenum]+filepos[handle];
-		if (i != groupfilpos[groupnum])
-		{
-			Blseek(groupfil[groupnum],i+((gnumfiles[groupnum]+1)<<4),BSEEK_SET);
-			groupfilpos[groupnum] = i;
-		}
-		leng = min(leng,(gfileoffs[groupnum][filenum+1]-gfileoffs[groupnum][filenum])-filepos[handle]);
-		leng = Bread(groupfil[groupnum],buffer,leng);
-		filepos[handle] += leng;
-		groupfilpos[groupnum] += leng;
-		return(leng);
+		case KFILE_GROUP:
+			g = &groups[o->grp];
+			leng = min(leng,(g->offs[o->han+1]-g->offs[o->han])-o->pos);
+			if (leng <= 0) return(0);
+			i = g->offs[o->han]+o->pos;
+			if (g->map)
+			{
+				memcpy(buffer,&g->map[i+((g->numfiles+1)<<4)],leng);
+				o->pos += leng;
+				return(leng);
+			}
+			tracebegin("kread");
+			if (i != g->filpos)
+			{
+				Blseek(g->fil,i+((g->numfiles+1)<<4),BSEEK_SET);
+				g->filpos = i;
+			}
+			leng = Bread(g->fil,buffer,leng);
+			traceend("kread");
+			if (leng < 0) { g->filpos = -1; return(0); }
+			o->pos += leng;
+			g->filpos += leng;
+			return(leng);
 	}
 
 	return(0);
@@ -684,105 +955,157 @@ int kgetc(int handle)
 
 int klseek(int handle, int offset, int whence)
 {
-	int i, groupnum;
-
-	groupnum = filegrp[handle];
+	int i;
+	openfiletype *o = &openfiles[handle];
+	grouptype *g;
 
-	if (groupnum == 255) return(Blseek(filehan[handle],offset,whence));
-#ifdef WITHKPLIB
-	else if (groupnum == 254)
+	switch (o->type)
 	{
-		if (kzcurhand != handle)
+		case KFILE_LOOSE:
+			return(Blseek(o->han,offset,whence));
+#ifdef WITHKPLIB
+		case KFILE_ZIP:
 		{
-			if (kztell() >= 0) { filepos[kzcurhand] = kztell(); kzclose(); }
-			kzcurhand = handle;
-			kzipopen(filenamsav[handle]);
-			kzseek(filepos[handle],SEEK_SET);
+			void *ozip = kzstreamselect(o->zip);
+			i = kzseek(offset,whence);
+			kzstreamselect(ozip);
+			return(i);
 		}
-		return(kzseek(offset,whence));
-	}
 #endif
-
-	if (groupfil[groupnum] != -1)
-	{
-		switch(whence)
-		{
-			case BSEEK_SET: filepos[handle] = offset; break;
-			case BSEEK_END: i = filehan[handle];
-				filepos[handle] = (gfileoffs[groupnum][i+1]-gfileoffs[groupnum][i])+offset;
-				break;
-			case BSEEK_CUR: filepos[handle] += offset; break;
-		}
-		return(filepos[handle]);
+		case KFILE_GROUP:
+			g = &groups[o->grp];
+			switch(whence)
+			{
+				case BSEEK_SET: o->pos = offset; break;
+				case BSEEK_END: o->pos = (g->offs[o->han+1]-g->offs[o->han])+offset; break;
+				case BSEEK_CUR: o->pos += offset; break;
+			}
+			return(o->pos);
 	}
 	return(-1);
 }
 
 int kfilelength(int handle)
 {
-	int i, groupnum;
+	int i;
+	openfiletype *o = &openfiles[handle];
 
-	groupnum = filegrp[handle];
-	if (groupnum == 255) {
-		// return(filelength(filehan[handle]))
-		return Bfilelength(filehan[handle]);
-	}
-#ifdef WITHKPLIB
-	else if (groupnum == 254)
+	switch (o->type)
 	{
-		if (kzcurhand != handle)
+		case KFILE_LOOSE:
+			return Bfilelength(o->han);
+#ifdef WITHKPLIB
+		case KFILE_ZIP:
 		{
-			if (kztell() >= 0) { filepos[kzcurhand] = kztell(); kzclose(); }
-			kzcurhand = handle;
-			kzipopen(filenamsav[handle]);
-			kzseek(filepos[handle],SEEK_SET);
+			void *ozip = kzstreamselect(o->zip);
+			i = kzfilelength();
+			kzstreamselect(ozip);
+			return(i);
 		}
-		return kzfilelength();
-	}
 #endif
-	i = filehan[handle];
-	return(gfileoffs[groupnum][i+1]-gfileoffs[groupnum][i]);
+		case KFILE_GROUP:
+			return(groups[o->grp].offs[o->han+1]-groups[o->grp].offs[o->han]);
+	}
+	return(0);
 }
 
 int ktell(int handle)
 {
-	int i, groupnum;
-
-	groupnum = filegrp[handle];
+	int i;
+	openfiletype *o = &openfiles[handle];
 
-	if (groupnum == 255) return(Blseek(filehan[handle],0,BSEEK_CUR));
-#ifdef WITHKPLIB
-	else if (groupnum == 254)
+	switch (o->type)
 	{
-		if (kzcurhand != handle)
+		case KFILE_LOOSE:
+			return(Blseek(o->han,0,BSEEK_CUR));
+#ifdef WITHKPLIB
+		case KFILE_ZIP:
 		{
-			if (kztell() >= 0) { filepos[kzcurhand] = kztell(); kzclose(); }
-			kzcurhand = handle;
-			kzipopen(filenamsav[handle]);
-			kzseek(filepos[handle],SEEK_SET);
+			void *ozip = kzstreamselect(o->zip);
+			i = kztell();
+			kzstreamselect(ozip);
+			return(i);
 		}
-		return kztell();
-	}
 #endif
-	if (groupfil[groupnum] != -1)
-		return filepos[handle];
+		case KFILE_GROUP:
+			return(o->pos);
+	}
 	return(-1);
 }
 
 void kclose(int handle)
 {
-	if (handle < 0) return;
-	if (filegrp[handle] == 255) Bclose(filehan[handle]);
+	openfiletype *o;
+
+	if (handle < 0 || handle >= openfilesalloced) return;
+	o = &openfiles[handle];
+	if (o->type == KFILE_LOOSE) Bclose(o->han);
 #ifdef WITHKPLIB
-	else if (filegrp[handle] == 254)
+	else if (o->type == KFILE_ZIP) kzstreamclose(o->zip);
+#endif
+	o->type = KFILE_CLOSED;
+	o->zip = NULL;
+}
+
+int kfilelocation(const char *filename, char searchfirst, char **where, int *offset)
+{
+	int handle, type, grp, han;
+
+	if ((handle = kopen4load(filename,searchfirst)) < 0) return(-1);
+	type = openfiles[handle].type;
+	grp = openfiles[handle].grp;
+	han = openfiles[handle].han;
+	kclose(handle);
+
+	if (type == KFILE_LOOSE)
 	{
-		kzclose();
-		kzcurhand = -1;
+		*offset = 0;
+		return(findfrompath(filename,where));
 	}
-#endif
-	filehan[handle] = -1;
+	if (type != KFILE_GROUP) return(-1);	// compressed in a ZIP
+
+	if (!(*where = strdup(groups[grp].name))) return(-1);
+	*offset = groups[grp].offs[han]+((groups[grp].numfiles+1)<<4);
+	return(0);
+}
+
+unsigned char *kmapfile(const char *filename, char searchfirst, int *length)
+{
+	int handle;
+	openfiletype *o;
+	grouptype *g;
+	unsigned char *ptr = NULL;
+
+	if ((handle = kopen4load(filename,searchfirst)) < 0) return(NULL);
+	o = &openfiles[handle];
+
+	if (o->type == KFILE_LOOSE)
+	{
+		*length = (int)Bfilelength(o->han);
+		if (*length > 0) ptr = (unsigned char *)Bmapfile(o->han,*length);
+	}
+	else if (o->type == KFILE_GROUP && groups[o->grp].map)
+	{
+		g = &groups[o->grp];
+		*length = g->offs[o->han+1]-g->offs[o->han];
+		ptr = &g->map[g->offs[o->han]+((g->numfiles+1)<<4)];
+	}
+	kclose(handle);
+
+	return(ptr);
 }
 
+void kunmapfile(unsigned char *ptr, int length)
+{
+	int i;
+
+	if (!ptr) return;
+	for(i=0;i<numgroupfiles;i++)	// part of a group file's mapping
+		if (groups[i].map && ptr >= groups[i].map && ptr < groups[i].map+groups[i].maplen) return;
+	Bunmapfile(ptr,length);
+}
+
+
 static int klistaddentry(CACHE1D_FIND_REC **rec, char *name, int type, int source)
 {
 	CACHE1D_FIND_REC *r = NULL, *attach = NULL;
@@ -1003,11 +1326,10 @@ CACHE1D_FIND_REC *klistpath(const char *_path, const char *mask, int type)
 		char buf[13];
 		int i,j;
 		buf[12] = 0;
-		for (i=0;i<MAXGROUPFILES;i++) {
-			if (groupfil[i] == -1) continue;
-			for(j=gnumfiles[i]-1;j>=0;j--)
+		for (i=0;i<numgroupfiles;i++) {
+			for(j=groups[i].numfiles-1;j>=0;j--)
 			{
-				Bmemcpy(buf,&gfilelist[i][j<<4],12);
+				Bmemcpy(buf,&groups[i].list[j<<4],12);
 				if (!Bwildmatch(buf,mask)) continue;
 				switch (klistaddentry(&rec, buf, CACHE1D_FIND_FILE, CACHE1D_SOURCE_GRP)) {
 					case -1: goto failure;
@@ -53,6 +53,10 @@
 #include <3ds.h>
 #endif
 
+#if !defined(_WIN32) && !defined(_3DS)
+# include <sys/mman.h>
+#endif
+
 #include "compat.h"
 
 #ifndef __compat_h_macrodef__
@@ -592,6 +596,48 @@ boff_t Bfilelength(int fd)
 }
 
 
+//
+// Bmapfile() -- maps the first length bytes of an open file into memory
+//   The mapping is copy-on-write, so it may be written to without changing
+//   the file. Returns NULL if the file can't be mapped.
+//
+void *Bmapfile(int fd, bsize_t length)
+{
+#if defined(_WIN32)
+	HANDLE fh, mh;
+	void *ptr;
+
+	if (length == 0) return NULL;
+	fh = (HANDLE)_get_osfhandle(fd);
+	if (fh == INVALID_HANDLE_VALUE) return NULL;
+	mh = CreateFileMapping(fh, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (!mh) return NULL;
+	ptr = MapViewOfFile(mh, FILE_MAP_COPY, 0, 0, length);
+	CloseHandle(mh);	// the view keeps the mapping alive
+	return ptr;
+#elif defined(_3DS)
+	return NULL;
+#else
+	void *ptr;
+
+	if (length == 0) return NULL;
+	ptr = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (ptr == MAP_FAILED) return NULL;
+	return ptr;
+#endif
+}
+
+void Bunmapfile(void *ptr, bsize_t length)
+{
+	if (!ptr) return;
+#if defined(_WIN32)
+	UnmapViewOfFile(ptr);
+#elif !defined(_3DS)
+	munmap(ptr, length);
+#endif
+}
+
+
 typedef struct {
 #ifdef _MSC_VER
 	HANDLE hfind;
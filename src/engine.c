@@ -14,6 +14,7 @@
 #include "a.h"
 #include "osd.h"
 #include "crc32.h"
+#include "workpool.h"
 
 #include "baselayer.h"
 
@@ -45,6 +46,10 @@ int usevoxels = 1;
 
 int novoxmips = 0;
 
+int renderthreads = 1;
+static workpool *renderpool = NULL;
+static int renderpoolthreads = 1;
+
 	//These variables need to be copied into BUILD
 #define MAXXSIZ 256
 #define MAXYSIZ 256
@@ -511,6 +516,7 @@ int hitallsprites = 0;
 typedef struct { int x1, y1, x2, y2; } linetype;
 static linetype clipit[MAXCLIPNUM];
 static short clipsectorlist[MAXCLIPNUM], clipsectnum;
+static int clipsectorstamp[MAXSECTORS], clipstamp = 0;	// marks the sectors on clipsectorlist
 static short clipobjectval[MAXCLIPNUM];
 
 typedef struct
@@ -548,11 +554,47 @@ double msens = 1.0;
 
 static char artfilename[20];
 static int numtilefiles, artfil = -1, artfilnum, artfilplc;
+static unsigned char *artfilemap[MAXTILEFILES];	// ART files mapped into memory if usefilemapping is on
+static int artfilemaplen[MAXTILEFILES];
+static void unmapartfiles(void);
+static void freesectorgrid(void);
+static void freepvs(void);
+static void movedpvs(short sectnum);
+static void loadpvs(const char *mapname, char fromwhere);
+static const unsigned char *pvsrow = NULL;	// the camera sector's potentially visible set, if scans are limited to it
+static int sectorgridcandidates(int x, int y, short **list);
+static void clipcacheforget(int spritenum);
+static void clipcachesectlink(short spritenum, short sectnum);
+static void clipcachesectunlink(short spritenum);
 
 char inpreparemirror = 0;
 static int mirrorsx1, mirrorsy1, mirrorsx2, mirrorsy2;
 
 static int setviewcnt = 0;	// interface layers use this now
+static dirtyrecttype dirtyrects[MAXDIRTYRECTS];
+static int numdirtyrects = 0;
+
+	//Rotatesprites drawn on screen last frame and this one. With dirtyblit, one
+	//drawn the same as last frame onto pixels nothing has touched since isn't
+	//drawn again.
+#define MAXHUDSPRITES 128
+typedef struct {
+	struct {
+		int sx, sy, z, cx1, cy1, cx2, cy2;
+		short a, picnum;
+		signed char dashade;
+		unsigned char dapalnum, dastat;
+		intptr_t bufplc;
+		unsigned int tilecrc;
+		int xdimen, ydimen, xyaspect, yxaspect;
+	} key;
+	int x1, y1, x2, y2;	//what it drew, if anything
+	char stale;	//drawn over since
+} hudspritetype;
+static hudspritetype hudsprites[2][MAXHUDSPRITES];
+static int numhudsprites[2] = { 0, 0 }, hudframe = 0;
+static hudspritetype *hudsprite(int sx, int sy, int z, short a, short picnum, signed char dashade,
+	unsigned char dapalnum, unsigned char dastat, int cx1, int cy1, int cx2, int cy2, int *same);
 static intptr_t bakframeplace[4];
 static int bakxsiz[4], bakysiz[4];
 static int bakwindowx1[4], bakwindowy1[4];
@@ -596,6 +638,8 @@ static void scansector(short sectnum)
 	short nextsectnum;
 
 	if (sectnum < 0) return;
+	if (pvsrow && !(pvsrow[sectnum>>3]&pow2char[sectnum&7])) return;
+	profilebegin(PROFILE_SCANSECTOR);
 
 	if (automapping) show2dsector[sectnum>>3] |= pow2char[sectnum&7];
 
@@ -638,6 +682,7 @@ static void scansector(short sectnum)
 
 			if ((nextsectnum >= 0) && ((wal->cstat&32) == 0))
 				if ((gotsector[nextsectnum>>3]&pow2char[nextsectnum&7]) == 0)
+				if ((!pvsrow) || (pvsrow[nextsectnum>>3]&pow2char[nextsectnum&7]))
 				{
 					templong = x1*y2-x2*y1;
 					if (((unsigned)templong+262144) < 524288)
@@ -720,6 +765,19 @@ skipitaddwall:
 			bunchlast[z] = zz;
 		}
 	} while (sectorbordercnt > 0);
+
+	profileend(PROFILE_SCANSECTOR);
+}
+
+
+//
+// drawtile (internal) -- makes a tile ready for the classic renderer, drawing
+//   with a placeholder while it loads in the background if tilestreaming is on
+//
+static void drawtile(short tilenume)
+{
+	if (tilestreaming && tilestream_placehold(tilenume)) return;
+	loadtile(tilenume);
 }
 
 
@@ -740,7 +798,7 @@ static void maskwallscan(int x1, int x2, short *uwal, short *dwal, int *swal, in
 	if ((uwal[x1] > ydimen) && (uwal[x2] > ydimen)) return;
 	if ((dwal[x1] < 0) && (dwal[x2] < 0)) return;
 
-	if (waloff[globalpicnum] == 0) loadtile(globalpicnum);
+	if (waloff[globalpicnum] == 0) drawtile(globalpicnum);
 
 	startx = x1;
 
@@ -935,15 +993,24 @@ static int spritewallfront(spritetype *s, int w)
 //
 // bunchfront (internal)
 //
+renderstatstype renderstats;	// counts for the last drawrooms()
+
+void getrenderstats(renderstatstype *st)
+{
+	memcpy(st, &renderstats, sizeof(renderstatstype));
+}
+
 static int bunchfront(int b1, int b2)
 {
 	int x1b1, x2b1, x1b2, x2b2, b1f, b2f, i;
 
+	renderstats.bunchfronts++;
 	b1f = bunchfirst[b1]; x1b1 = xb1[b1f]; x2b2 = xb2[bunchlast[b2]]+1;
 	if (x1b1 >= x2b2) return(-1);
 	b2f = bunchfirst[b2]; x1b2 = xb1[b2f]; x2b1 = xb2[bunchlast[b1]]+1;
 	if (x1b2 >= x2b1) return(-1);
 
+	renderstats.bunchoverlaps++;
 	if (x1b1 >= x1b2)
 	{
 		for(i=b2f;xb2[i]<x1b1;i=p2[i]);
@@ -1373,7 +1440,7 @@ static void ceilscan(int x1, int x2, int sectnum)
 	if ((tilesizx[globalpicnum] <= 0) || (tilesizy[globalpicnum] <= 0)) return;
 	if (picanm[globalpicnum]&192) globalpicnum += animateoffs((short)globalpicnum,(short)sectnum);
 
-	if (waloff[globalpicnum] == 0) loadtile(globalpicnum);
+	if (waloff[globalpicnum] == 0) drawtile(globalpicnum);
 	globalbufplc = waloff[globalpicnum];
 
 	globalshade = (int)sec->ceilingshade;
@@ -1544,7 +1611,7 @@ static void florscan(int x1, int x2, int sectnum)
 	if ((tilesizx[globalpicnum] <= 0) || (tilesizy[globalpicnum] <= 0)) return;
 	if (picanm[globalpicnum]&192) globalpicnum += animateoffs((short)globalpicnum,(short)sectnum);
 
-	if (waloff[globalpicnum] == 0) loadtile(globalpicnum);
+	if (waloff[globalpicnum] == 0) drawtile(globalpicnum);
 	globalbufplc = waloff[globalpicnum];
 
 	globalshade = (int)sec->floorshade;
@@ -1710,7 +1777,7 @@ static void wallscan(int x1, int x2, short *uwal, short *dwal, int *swal, int *l
 	if ((uwal[x1] > ydimen) && (uwal[x2] > ydimen)) return;
 	if ((dwal[x1] < 0) && (dwal[x2] < 0)) return;
 
-	if (waloff[globalpicnum] == 0) loadtile(globalpicnum);
+	if (waloff[globalpicnum] == 0) drawtile(globalpicnum);
 
 	xnice = (pow2long[picsiz[globalpicnum]&15] == tsizx);
 	if (xnice) tsizx--;
@@ -1960,7 +2027,7 @@ static void transmaskwallscan(int x1, int x2)
 	setgotpic(globalpicnum);
 	if ((tilesizx[globalpicnum] <= 0) || (tilesizy[globalpicnum] <= 0)) return;
 
-	if (waloff[globalpicnum] == 0) loadtile(globalpicnum);
+	if (waloff[globalpicnum] == 0) drawtile(globalpicnum);
 
 	setuptvlineasm(globalshiftval);
 
@@ -2085,7 +2152,7 @@ static void grouscan(int dax1, int dax2, int sectnum, unsigned char dastat)
 	if ((picanm[globalpicnum]&192) != 0) globalpicnum += animateoffs(globalpicnum,sectnum);
 	setgotpic(globalpicnum);
 	if ((tilesizx[globalpicnum] <= 0) || (tilesizy[globalpicnum] <= 0)) return;
-	if (waloff[globalpicnum] == 0) loadtile(globalpicnum);
+	if (waloff[globalpicnum] == 0) drawtile(globalpicnum);
 
 	wal = &wall[sec->wallptr];
 	wx = wall[wal->point2].x - wal->x;
@@ -2372,6 +2439,8 @@ static void drawalls(int bunch)
 	int startsmostwallcnt, startsmostcnt, gotswall;
 	unsigned char andwstat1, andwstat2;
 
+	profilebegin(PROFILE_DRAWALLS);
+
 	z = bunchfirst[bunch];
 	sectnum = thesector[z]; sec = &sector[sectnum];
 
@@ -2387,7 +2456,11 @@ static void drawalls(int bunch)
 		if ((sec->ceilingstat&3) == 2)
 			grouscan(xb1[bunchfirst[bunch]],xb2[bunchlast[bunch]],sectnum,0);
 		else if ((sec->ceilingstat&1) == 0)
+		{
+			profilebegin(PROFILE_CEILSCAN);
 			ceilscan(xb1[bunchfirst[bunch]],xb2[bunchlast[bunch]],sectnum);
+			profileend(PROFILE_CEILSCAN);
+		}
 		else
 			parascan(xb1[bunchfirst[bunch]],xb2[bunchlast[bunch]],sectnum,0,bunch);
 	}
@@ -2396,7 +2469,11 @@ static void drawalls(int bunch)
 		if ((sec->floorstat&3) == 2)
 			grouscan(xb1[bunchfirst[bunch]],xb2[bunchlast[bunch]],sectnum,1);
 		else if ((sec->floorstat&1) == 0)
+		{
+			profilebegin(PROFILE_FLORSCAN);
 			florscan(xb1[bunchfirst[bunch]],xb2[bunchlast[bunch]],sectnum);
+			profileend(PROFILE_FLORSCAN);
+		}
 		else
 			parascan(xb1[bunchfirst[bunch]],xb2[bunchlast[bunch]],sectnum,1,bunch);
 	}
@@ -2645,7 +2722,7 @@ static void drawalls(int bunch)
 					}
 				}
 			}
-			if (numhits < 0) return;
+			if (numhits < 0) { profileend(PROFILE_DRAWALLS); return; }
 			if ((!(wal->cstat&32)) && ((gotsector[nextsectnum>>3]&pow2char[nextsectnum&7]) == 0))
 			{
 				if (umost[x2] < dmost[x2])
@@ -2717,6 +2794,8 @@ static void drawalls(int bunch)
 			}
 		}
 	}
+
+	profileend(PROFILE_DRAWALLS);
 }
 
 
@@ -2949,9 +3028,9 @@ static void drawvox(int dasprx, int daspry, int dasprz, int dasprang,
 
 
 //
-// drawsprite (internal)
+// dodrawsprite (internal)
 //
-static void drawsprite(int snum)
+static void dodrawsprite(int snum)
 {
 	spritetype *tspr;
 	sectortype *sec;
@@ -3700,7 +3779,7 @@ static void drawsprite(int snum)
 		if ((unsigned)globalpicnum >= (unsigned)MAXTILES) globalpicnum = 0;
 		//if (picanm[globalpicnum]&192) globalpicnum += animateoffs((short)globalpicnum,spritenum+32768);
 
-		if (waloff[globalpicnum] == 0) loadtile(globalpicnum);
+		if (waloff[globalpicnum] == 0) drawtile(globalpicnum);
 		setgotpic(globalpicnum);
 		globalbufplc = waloff[globalpicnum];
 
@@ -3869,6 +3948,17 @@ static void drawsprite(int snum)
 }
 
 
+//
+// drawsprite (internal)
+//
+static void drawsprite(int snum)
+{
+	profilebegin(PROFILE_DRAWSPRITE);
+	dodrawsprite(snum);
+	profileend(PROFILE_DRAWSPRITE);
+}
+
+
 //
 // drawmaskwall (internal)
 //
@@ -4359,6 +4449,8 @@ static void dorotatesprite(int sx, int sy, int z, short a, short picnum, signed
 	int xsiz, ysiz, xoff, yoff, npoints, yplc, yinc, lx, rx, xx, xend;
 	int xv, yv, xv2, yv2, obuffermode, qlinemode=0, y1ve[4], y2ve[4], u4, d4;
 	char bad;
+	hudspritetype *hs;
+	int same;
 
 	//============================================================================= //POLYMOST BEGINS
 #if USE_POLYMOST
@@ -4366,6 +4458,9 @@ static void dorotatesprite(int sx, int sy, int z, short a, short picnum, signed
 #endif
 	//============================================================================= //POLYMOST ENDS
 
+	hs = hudsprite(sx,sy,z,a,picnum,dashade,dapalnum,dastat,cx1,cy1,cx2,cy2,&same);
+	if (same) { setgotpic(picnum); return; }	//still on screen from last frame
+
 	if (cx1 < 0) cx1 = 0;
 	if (cy1 < 0) cy1 = 0;
 	if (cx2 > xres-1) cx2 = xres-1;
@@ -4469,7 +4564,9 @@ static void dorotatesprite(int sx, int sy, int z, short a, short picnum, signed
 		nextv = v;
 	}
 
-	if (waloff[picnum] == 0) loadtile(picnum);
+		//Permanent sprites aren't drawn again once the pages have them, so
+		//they can't wait for the tile to stream in
+	if (waloff[picnum] == 0) { if (dastat&128) loadtile(picnum); else drawtile(picnum); }
 	setgotpic(picnum);
 	bufplc = waloff[picnum];
 
@@ -4491,6 +4588,15 @@ static void dorotatesprite(int sx, int sy, int z, short a, short picnum, signed
 
 	x1 = (lx>>16); x2 = (rx>>16);
 
+	y1 = y2 = nry1[0];
+	for(v=npoints-1;v>0;v--)
+	{
+		if (nry1[v] < y1) y1 = nry1[v];
+		if (nry1[v] > y2) y2 = nry1[v];
+	}
+	markdirtyrect(x1,y1>>16,x2+1,(y2>>16)+1);
+	if (hs) { hs->x1 = x1; hs->y1 = (y1>>16); hs->x2 = x2+1; hs->y2 = (y2>>16)+1; }
+
 	oy = 0;
 	x = (x1<<16)-1-gx1; y = (oy<<16)+65535-gy1;
 	bx = dmulscale16(x,xv2,y,xv);
@@ -5100,6 +5206,7 @@ static int insertspritesect(short sectnum)
 	headspritesect[sectnum] = blanktouse;
 
 	sprite[blanktouse].sectnum = sectnum;
+	clipcachesectlink(blanktouse, sectnum);
 
 	return(blanktouse);
 }
@@ -5141,6 +5248,7 @@ static int deletespritesect(short deleteme)
 	if (sprite[deleteme].sectnum == MAXSECTORS)
 		return(-1);
 
+	clipcachesectunlink(deleteme);
 	if (headspritesect[sprite[deleteme].sectnum] == deleteme)
 		headspritesect[sprite[deleteme].sectnum] = nextspritesect[deleteme];
 
@@ -5485,6 +5593,15 @@ void uninitengine(void)
 	logfile = NULL;
 
 	if (artfil != -1) kclose(artfil);
+	tilestream_reset();
+	unmapartfiles();
+	freesectorgrid();
+	freepvs();
+
+	workpool_destroy(renderpool);
+	renderpool = NULL;
+	renderpoolthreads = 1;
+	uninitprofile();
 
 	if (transluc != NULL) { kfree(transluc); transluc = NULL; }
 	if (pic != NULL) { kfree(pic); pic = NULL; }
@@ -5525,7 +5642,52 @@ void initspritelists(void)
 	}
 	prevspritestat[0] = -1;
 	nextspritestat[MAXSPRITES-1] = -1;
+
+	clipcacheforget(-1);
+}
+
+
+//
+// setuprenderpool (internal)
+//
+static void setuprenderpool(void)
+{
+	workpool_destroy(renderpool);
+	renderpool = NULL;
+	renderpoolthreads = renderthreads;
+
+	if (renderthreads != 1) {
+		renderpool = workpool_create(renderthreads);
+		if (renderpool && workpool_numthreads(renderpool) < 2) {
+			workpool_destroy(renderpool);
+			renderpool = NULL;
+		}
+	}
+}
+
+#ifdef ENGINE_USING_A_C
+static void drawspanstripjob(void *UNUSED(ctx), int strip)
+{
+	tracebegin("drawspanstrip");
+	drawspanstrip(strip);
+	traceend("drawspanstrip");
+}
+
+//
+// flushspans (internal)
+//
+static void flushspans(void)
+{
+	int numstrips;
+
+	numstrips = getspanrecording();
+	if (numstrips <= 0) return;
+	profilebegin(PROFILE_FLUSHSPANS);
+	workpool_run(renderpool, drawspanstripjob, NULL, numstrips);
+	clearspanstrips();
+	profileend(PROFILE_FLUSHSPANS);
 }
+#endif
 
 
 //
@@ -5537,8 +5699,11 @@ void drawrooms(int daposx, int daposy, int daposz,
 	int i, j, z, cz, fz, closest;
 	short *shortptr1, *shortptr2;
 
+	profilebegin(PROFILE_DRAWROOMS);
 	beforedrawrooms = 0;
 
+	tilestream_update();
+
 	globalposx = daposx; globalposy = daposy; globalposz = daposz;
 	globalang = (daang&2047);
 
@@ -5565,6 +5730,7 @@ void drawrooms(int daposx, int daposy, int daposz,
 
 	//clearbufbyte(&gotsector[0],(int)((numsectors+7)>>3),0L);
 	Bmemset(&gotsector[0],0,(int)((numsectors+7)>>3));
+	Bmemset(&renderstats, 0, sizeof(renderstats));
 
 	shortptr1 = (short *)&startumost[windowx1];
 	shortptr2 = (short *)&startdmost[windowx1];
@@ -5580,13 +5746,20 @@ void drawrooms(int daposx, int daposy, int daposz,
 
 	//============================================================================= //POLYMOST BEGINS
 #if USE_POLYMOST
-	polymost_drawrooms(); if (rendmode) { return; }
+	polymost_drawrooms(); if (rendmode) { profileend(PROFILE_DRAWROOMS); return; }
 #endif
 	//============================================================================= //POLYMOST ENDS
 
 	begindrawing();	//{{{
 
 	frameoffset = frameplace + windowy1*bytesperline + windowx1;
+	markdirtyrect(windowx1,windowy1,windowx2+1,windowy2+1);
+
+#ifdef ENGINE_USING_A_C
+		//Record the spans and draw them in parallel vertical strips afterwards
+	if (renderthreads != renderpoolthreads) setuprenderpool();
+	if (renderpool) setspanrecording(workpool_numthreads(renderpool),frameoffset,xdimen);
+#endif
 
 	numhits = xdimen; numscans = 0; numbunches = 0;
 	maskwallcnt = 0; smostwallcnt = 0; smostcnt = 0; spritesortcnt = 0;
@@ -5606,6 +5779,7 @@ void drawrooms(int daposx, int daposy, int daposz,
 	if (globalposz < cz) globparaceilclip = 0;
 	if (globalposz > fz) globparaflorclip = 0;
 
+	pvsrow = getpvsrow(globalcursectnum);
 	scansector(globalcursectnum);
 
 	if (inpreparemirror)
@@ -5627,6 +5801,7 @@ void drawrooms(int daposx, int daposy, int daposz,
 				{ umost[i] = 1; dmost[i] = 0; numhits--; }
 
 		drawalls(0L);
+		renderstats.bunches++;
 		numbunches--;
 		bunchfirst[0] = bunchfirst[numbunches];
 		bunchlast[0] = bunchlast[numbunches];
@@ -5656,6 +5831,7 @@ void drawrooms(int daposx, int daposy, int daposz,
 		}
 
 		drawalls(closest);
+		renderstats.bunches++;
 
 		if (automapping)
 		{
@@ -5668,7 +5844,14 @@ void drawrooms(int daposx, int daposy, int daposz,
 		bunchlast[closest] = bunchlast[numbunches];
 	}
 
+#ifdef ENGINE_USING_A_C
+	flushspans();
+	setspanrecording(0,0,0);
+#endif
+
 	enddrawing();	//}}}
+
+	profileend(PROFILE_DRAWROOMS);
 }
 
 
@@ -5679,6 +5862,9 @@ void drawmasks(void)
 {
 	int i, j, k, l, gap, xs, ys, xp, yp, yoff, yspan;
 
+	profilebegin(PROFILE_DRAWMASKS);
+	markdirtyrect(windowx1,windowy1,windowx2+1,windowy2+1);
+
 	for(i=spritesortcnt-1;i>=0;i--) tspriteptr[i] = &tsprite[i];
 	for(i=spritesortcnt-1;i>=0;i--)
 	{
@@ -5872,6 +6058,8 @@ killsprite:
 	while (maskwallcnt > 0) drawmaskwall(--maskwallcnt);
 
 	enddrawing();	//}}}
+
+	profileend(PROFILE_DRAWMASKS);
 }
 
 
@@ -5906,6 +6094,7 @@ void drawmapview(int dax, int day, int zoome, short ang)
 	sortnum = 0;
 
 	begindrawing();	//{{{
+	markdirtyrect(windowx1,windowy1,windowx2+1,windowy2+1);
 
 	for(s=0,sec=&sector[s];s<numsectors;s++,sec++)
 		if (show2dsector[s>>3]&pow2char[s&7])
@@ -5977,7 +6166,7 @@ void drawmapview(int dax, int day, int zoome, short ang)
 			setgotpic(globalpicnum);
 			if ((tilesizx[globalpicnum] <= 0) || (tilesizy[globalpicnum] <= 0)) continue;
 			if ((picanm[globalpicnum]&192) != 0) globalpicnum += animateoffs((short)globalpicnum,s);
-			if (waloff[globalpicnum] == 0) loadtile(globalpicnum);
+			if (waloff[globalpicnum] == 0) drawtile(globalpicnum);
 			globalbufplc = waloff[globalpicnum];
 			globalshade = max(min(sec->floorshade,numpalookups-1),0);
 			globvis = globalhisibility;
@@ -6111,7 +6300,7 @@ void drawmapview(int dax, int day, int zoome, short ang)
 			setgotpic(globalpicnum);
 			if ((tilesizx[globalpicnum] <= 0) || (tilesizy[globalpicnum] <= 0)) continue;
 			if ((picanm[globalpicnum]&192) != 0) globalpicnum += animateoffs((short)globalpicnum,s);
-			if (waloff[globalpicnum] == 0) loadtile(globalpicnum);
+			if (waloff[globalpicnum] == 0) drawtile(globalpicnum);
 			globalbufplc = waloff[globalpicnum];
 			if ((sector[spr->sectnum].ceilingstat&1) > 0)
 				globalshade = ((int)sector[spr->sectnum].ceilingshade);
@@ -6266,10 +6455,13 @@ int loadboard(char *filename, char fromwhere, int *daposx, int *daposy, int *dap
 		insertsprite(sprite[i].sectnum,sprite[i].statnum);
 	}
 
+	invalidatesectorgrid(-1);
+
 		//Must be after loading sectors, etc!
 	updatesector(*daposx,*daposy,dacursectnum);
 
 	kclose(fil);
+	loadpvs(filename,fromwhere);
 
 #if USE_POLYMOST && USE_OPENGL
 	memset(spriteext, 0, sizeof(spriteext));
@@ -7199,10 +7391,13 @@ int loadoldboard(char *filename, char fromwhere, int *daposx, int *daposy, int *
 		insertsprite(sprite[i].sectnum,sprite[i].statnum);
 	}
 
+	invalidatesectorgrid(-1);
+
 		//Must be after loading sectors, etc!
 	updatesector(*daposx,*daposy,dacursectnum);
 
 	kclose(fil);
+	loadpvs(filename,fromwhere);
 
 #if USE_POLYMOST && USE_OPENGL
 	memset(spriteext, 0, sizeof(spriteext));
@@ -7574,6 +7769,10 @@ int setgamemode(char davidoption, int daxdim, int daydim, int dabpp)
 
 	xdim = daxdim; ydim = daydim;
 
+	numdirtyrects = 0;
+	numhudsprites[0] = numhudsprites[1] = 0;
+	markdirtyrect(0,0,xdim,ydim);
+
 	// determine the corrective factor for pixel-squareness. Build
 	// is built around the non-square pixels of Mode 13h, so to get
 	// things back square on VGA screens, things need to be "compressed"
@@ -7647,6 +7846,8 @@ void nextpage(void)
 	int i;
 	permfifotype *per;
 
+	profilebegin(PROFILE_NEXTPAGE);
+
 	//char snotbuf[32];
 	//j = 0; k = 0;
 	//for(i=0;i<4096;i++)
@@ -7668,12 +7869,17 @@ void nextpage(void)
 			{
 				per = &permfifo[i];
 				if ((per->pagesleft > 0) && (per->pagesleft <= numpages))
+				{
+					profilebegin(PROFILE_ROTATESPRITE);
 					dorotatesprite(per->sx,per->sy,per->z,per->a,per->picnum,
 							per->dashade,per->dapalnum,per->dastat,
 							per->cx1,per->cy1,per->cx2,per->cy2,per->uniqid);
+					profileend(PROFILE_ROTATESPRITE);
+				}
 			}
 			enddrawing();	//}}}
 
+			drawprofile();
 			OSD_Draw();
 #if USE_POLYMOST
 			polymost_nextpage();
@@ -7689,6 +7895,8 @@ void nextpage(void)
 #if USE_POLYMOST && USE_OPENGL
 			polymost_aftershowframe();
 #endif
+			hudframe ^= 1;
+			numhudsprites[hudframe] = 0;
 
 			/*
 			if (ratelimit > 0) {
@@ -7717,9 +7925,13 @@ void nextpage(void)
 			{
 				per = &permfifo[i];
 				if (per->pagesleft >= 130)
+				{
+					profilebegin(PROFILE_ROTATESPRITE);
 					dorotatesprite(per->sx,per->sy,per->z,per->a,per->picnum,
 										per->dashade,per->dapalnum,per->dastat,
 										per->cx1,per->cy1,per->cx2,per->cy2,per->uniqid);
+					profileend(PROFILE_ROTATESPRITE);
+				}
 
 				if ((per->pagesleft&127) && (numpages < 127)) per->pagesleft--;
 				if (((per->pagesleft&127) == 0) && (i == permtail))
@@ -7743,10 +7955,36 @@ void nextpage(void)
 #endif
 
 	beforedrawrooms = 1;
+
+	profileend(PROFILE_NEXTPAGE);
+	profileframe();
 	numframes++;
 }
 
 
+//
+// unmapartfiles (internal) -- releases the mapped ART files and forgets the
+//   tiles that pointed into them
+//
+static void unmapartfiles(void)
+{
+	int i, k;
+
+	for(i=0;i<MAXTILES;i++)
+	{
+		k = tilefilenum[i];
+		if (artfilemap[k] && (unsigned char *)waloff[i] >= artfilemap[k] &&
+				(unsigned char *)waloff[i] < artfilemap[k]+artfilemaplen[k])
+			waloff[i] = 0;
+	}
+	for(k=0;k<MAXTILEFILES;k++)
+	{
+		kunmapfile(artfilemap[k], artfilemaplen[k]);
+		artfilemap[k] = NULL;
+	}
+}
+
+
 //
 // loadpics
 //
@@ -7756,6 +7994,8 @@ int loadpics(char *filename, int askedsize)
 	short fil, i, j, k;
 
 	Bstrcpy(artfilename,filename);
+	tilestream_reset();
+	unmapartfiles();
 
 	for(i=0;i<MAXTILES;i++)
 	{
@@ -7803,6 +8043,9 @@ int loadpics(char *filename, int askedsize)
 				artsize += ((dasiz+15)&0xfffffff0);
 			}
 			kclose(fil);
+			tilestream_setartfile(k, artfilename);
+			if (usefilemapping)
+				artfilemap[k] = kmapfile(artfilename, 0, &artfilemaplen[k]);
 
 			numtilefiles++;
 		}
@@ -7832,6 +8075,17 @@ int loadpics(char *filename, int askedsize)
 	}
 	initcache(pic, cachesize);
 
+		//Mapped tiles are used where they lie, taking no cache space. Walls
+		//whose height isn't a power of two read past the end of each column,
+		//so the last few tiles of a file may still need loading into the cache.
+	for(i=0;i<MAXTILES;i++)
+	{
+		k = tilefilenum[i];
+		dasiz = tilesizx[i]*tilesizy[i];
+		if (artfilemap[k] && dasiz > 0 && tilefileoffs[i]+dasiz+tilesizy[i] <= artfilemaplen[k])
+			waloff[i] = (intptr_t)&artfilemap[k][tilefileoffs[i]];
+	}
+
 	for(i=0;i<MAXTILES;i++)
 	{
 		j = 15;
@@ -7857,12 +8111,34 @@ char cachedebug = 0;
 void loadtile(short tilenume)
 {
 	char *ptr;
+	unsigned char *staged;
 	int i, dasiz;
 
 	if ((unsigned)tilenume >= (unsigned)MAXTILES) return;
 	dasiz = tilesizx[tilenume]*tilesizy[tilenume];
 	if (dasiz <= 0) return;
 
+	profilebegin(PROFILE_LOADTILE);
+	if (profiling) profiletile(dasiz);
+
+		//The background loader may have read it already
+	staged = tilestream_claim(tilenume);
+	if (staged)
+	{
+#ifdef ENGINE_USING_A_C
+		flushspans();
+#endif
+		if (waloff[tilenume] == 0)
+		{
+			walock[tilenume] = 199;
+			allocache((void **)&waloff[tilenume],dasiz,&walock[tilenume]);
+		}
+		memcpy((void *)waloff[tilenume],staged,dasiz);
+		Bfree(staged);
+		profileend(PROFILE_LOADTILE);
+		return;
+	}
+
 	i = tilefilenum[tilenume];
 	if (i != artfilnum)
 	{
@@ -7879,6 +8155,11 @@ void loadtile(short tilenume)
 
 	if (cachedebug) buildprintf("Tile:%d\n",tilenume);
 
+#ifdef ENGINE_USING_A_C
+		//Recorded spans may point at tiles the cache is about to evict
+	flushspans();
+#endif
+
 	if (waloff[tilenume] == 0)
 	{
 		walock[tilenume] = 199;
@@ -7894,6 +8175,8 @@ void loadtile(short tilenume)
 	kread(artfil,ptr,dasiz);
 	faketimerhandler();
 	artfilplc = tilefileoffs[tilenume]+dasiz;
+
+	profileend(PROFILE_LOADTILE);
 }
 
 
@@ -7909,6 +8192,8 @@ int allocatepermanenttile(short tilenume, int xsiz, int ysiz)
 
 	dasiz = xsiz*ysiz;
 
+	tilestream_cancel(tilenume);
+
 	walock[tilenume] = 255;
 	allocache((void **)&waloff[tilenume],dasiz,&walock[tilenume]);
 
@@ -8143,6 +8428,7 @@ int setsprite(short spritenum, int newx, int newy, int newz)
 		return(-1);
 	if (tempsectnum != sprite[spritenum].sectnum)
 		changespritesect(spritenum,tempsectnum);
+	updateclipcache(spritenum);
 
 	return(0);
 }
@@ -8164,6 +8450,7 @@ int setspritez(short spritenum, int newx, int newy, int newz)
 		return(-1);
 	if (tempsectnum != sprite[spritenum].sectnum)
 		changespritesect(spritenum,tempsectnum);
+	updateclipcache(spritenum);
 
 	return(0);
 }
@@ -8174,8 +8461,12 @@ int setspritez(short spritenum, int newx, int newy, int newz)
 //
 int insertsprite(short sectnum, short statnum)
 {
+	int i;
+
 	insertspritestat(statnum);
-	return(insertspritesect(sectnum));
+	i = insertspritesect(sectnum);
+	if (i >= 0) clipcacheforget(i);
+	return(i);
 }
 
 
@@ -8288,7 +8579,9 @@ int nextsectorneighborz(short sectnum, int thez, short topbottom, short directio
 //
 // cansee
 //
-int cansee(int x1, int y1, int z1, short sect1, int x2, int y2, int z2, short sect2)
+	// The sectors the line crosses are collected in sectlist, so callers on
+	// other threads can give their own
+static int canseeray(int x1, int y1, int z1, short sect1, int x2, int y2, int z2, short sect2, short *sectlist)
 {
 	sectortype *sec;
 	walltype *wal, *wal2;
@@ -8299,10 +8592,10 @@ int cansee(int x1, int y1, int z1, short sect1, int x2, int y2, int z2, short se
 
 	x21 = x2-x1; y21 = y2-y1; z21 = z2-z1;
 
-	clipsectorlist[0] = sect1; danum = 1;
+	sectlist[0] = sect1; danum = 1;
 	for(dacnt=0;dacnt<danum;dacnt++)
 	{
-		dasectnum = clipsectorlist[dacnt]; sec = &sector[dasectnum];
+		dasectnum = sectlist[dacnt]; sec = &sector[dasectnum];
 		for(cnt=sec->wallnum,wal=&wall[sec->wallptr];cnt>0;cnt--,wal++)
 		{
 			wal2 = &wall[wal->point2];
@@ -8326,25 +8619,117 @@ int cansee(int x1, int y1, int z1, short sect1, int x2, int y2, int z2, short se
 			getzsofslope((short)nexts,x,y,&cz,&fz);
 			if ((z <= cz) || (z >= fz)) return(0);
 
-			for(i=danum-1;i>=0;i--) if (clipsectorlist[i] == nexts) break;
-			if (i < 0) clipsectorlist[danum++] = nexts;
+			for(i=danum-1;i>=0;i--) if (sectlist[i] == nexts) break;
+			if (i < 0) sectlist[danum++] = nexts;
 		}
 	}
-	for(i=danum-1;i>=0;i--) if (clipsectorlist[i] == sect2) return(1);
+	for(i=danum-1;i>=0;i--) if (sectlist[i] == sect2) return(1);
 	return(0);
 }
 
+int cansee(int x1, int y1, int z1, short sect1, int x2, int y2, int z2, short sect2)
+{
+	return canseeray(x1,y1,z1,sect1,x2,y2,z2,sect2,clipsectorlist);
+}
+
 
 //
 // hitscan
 //
-int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
+	// Works out where a sprite's corners are (the two ends of a wall sprite,
+	// the four of a floor sprite, or the centre of a face sprite) and its
+	// height, the way clipmove(), getzrange() and hitscan() each do. Returns
+	// the number of corners.
+static int spriteshape(spritetype *spr, int *x, int *y, int *zbot, int *ztop)
+{
+	int k, l, dax, day, tilenum, xoff, yoff, cosang, sinang, n;
+
+	tilenum = spr->picnum;
+	switch (spr->cstat&48) {
+		case 16:
+			xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
+			if ((spr->cstat&4) > 0) xoff = -xoff;
+			k = spr->ang; l = spr->xrepeat;
+			dax = sintable[k&2047]*l; day = sintable[(k+1536)&2047]*l;
+			l = tilesizx[tilenum]; k = (l>>1)+xoff;
+			x[0] = spr->x - mulscale16(dax,k); x[1] = x[0]+mulscale16(dax,l);
+			y[0] = spr->y - mulscale16(day,k); y[1] = y[0]+mulscale16(day,l);
+			n = 2;
+			break;
+		case 32:
+			xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
+			yoff = (int)((signed char)((picanm[tilenum]>>16)&255))+((int)spr->yoffset);
+			if ((spr->cstat&4) > 0) xoff = -xoff;
+			if ((spr->cstat&8) > 0) yoff = -yoff;
+
+			k = spr->ang;
+			cosang = sintable[(k+512)&2047]; sinang = sintable[k];
+			dax = ((tilesizx[tilenum]>>1)+xoff)*spr->xrepeat; day = ((tilesizy[tilenum]>>1)+yoff)*spr->yrepeat;
+			x[0] = spr->x + dmulscale16(sinang,dax,cosang,day);
+			y[0] = spr->y + dmulscale16(sinang,day,-cosang,dax);
+			l = tilesizx[tilenum]*spr->xrepeat;
+			x[1] = x[0] - mulscale16(sinang,l);
+			y[1] = y[0] + mulscale16(cosang,l);
+			l = tilesizy[tilenum]*spr->yrepeat;
+			k = -mulscale16(cosang,l); x[2] = x[1]+k; x[3] = x[0]+k;
+			k = -mulscale16(sinang,l); y[2] = y[1]+k; y[3] = y[0]+k;
+			n = 4;
+			break;
+		default:
+			x[0] = spr->x; y[0] = spr->y;
+			n = 1;
+			break;
+	}
+
+	k = ((tilesizy[tilenum]*spr->yrepeat)<<2);
+	if (spr->cstat&128) *zbot = spr->z+(k>>1); else *zbot = spr->z;
+	if (picanm[tilenum]&0x00ff0000) *zbot -= ((int)((signed char)((picanm[tilenum]>>16)&255))*spr->yrepeat<<2);
+	*ztop = *zbot-k;
+
+	return n;
+}
+
+	// Works out the slope of a sector's ceiling (0) or floor (1) along its
+	// first wall, as hitscan() uses it, or returns 0 if that wall has no length
+static int hitscanslope(sectortype *sec, int floor, int *dax, int *day)
+{
+	walltype *wal, *wal2;
+	int i;
+
+	wal = &wall[sec->wallptr]; wal2 = &wall[wal->point2];
+	*dax = wal2->x-wal->x; *day = wal2->y-wal->y;
+	i = nsqrtasm((*dax)*(*dax)+(*day)*(*day)); if (i == 0) return 0;
+	i = divscale15(floor ? sec->floorheinum : sec->ceilingheinum,i);
+	*dax *= i; *day *= i;
+	return 1;
+}
+
+	// What hitscanbatch() works out once for the sectors many of its rays
+	// start in or first cross: the slopes, and the shapes of the sprites
+typedef struct {
+	int dax[2], day[2];
+	int haslength;
+} rayslopetype;
+
+typedef struct {
+	int zbot, ztop;
+	int x[4], y[4];
+} rayspritetype;
+
+static int raybatchstamp = 0;
+static int raysectstamp[MAXSECTORS], rayspritestamp[MAXSPRITES];
+static rayslopetype rayslope[MAXSECTORS];
+static rayspritetype rayshape[MAXSPRITES];
+
+	// With shared set, uses what hitscanbatch() has worked out for this batch
+static int hitscanray(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 	short *hitsect, short *hitwall, short *hitsprite,
-	int *hitx, int *hity, int *hitz, unsigned int cliptype)
+	int *hitx, int *hity, int *hitz, unsigned int cliptype, short *sectlist, int shared)
 {
 	sectortype *sec;
 	walltype *wal, *wal2;
 	spritetype *spr;
+	rayspritetype *rs;
 	int z, zz, x1, y1=0, z1=0, x2, y2, x3, y3, x4, y4, intx, inty, intz;
 	int topt, topu, bot, dist, offx, offy, cstat;
 	int i, j, k, l, tilenum, xoff, yoff, dax, day, daz, daz2;
@@ -8362,20 +8747,22 @@ int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 	dawalclipmask = (cliptype&65535);
 	dasprclipmask = (cliptype>>16);
 
-	clipsectorlist[0] = sectnum;
+	sectlist[0] = sectnum;
 	tempshortcnt = 0; tempshortnum = 1;
 	do
 	{
-		dasector = clipsectorlist[tempshortcnt]; sec = &sector[dasector];
+		dasector = sectlist[tempshortcnt]; sec = &sector[dasector];
 
 		x1 = 0x7fffffff;
 		if (sec->ceilingstat&2)
 		{
-			wal = &wall[sec->wallptr]; wal2 = &wall[wal->point2];
-			dax = wal2->x-wal->x; day = wal2->y-wal->y;
-			i = nsqrtasm(dax*dax+day*day); if (i == 0) continue;
-			i = divscale15(sec->ceilingheinum,i);
-			dax *= i; day *= i;
+			wal = &wall[sec->wallptr];
+			if (shared && raysectstamp[dasector] == raybatchstamp)
+			{
+				dax = rayslope[dasector].dax[0]; day = rayslope[dasector].day[0];
+				if (!rayslope[dasector].haslength) continue;
+			}
+			else if (!hitscanslope(sec,0,&dax,&day)) continue;
 
 			j = (vz<<8)-dmulscale15(dax,vy,-day,vx);
 			if (j != 0)
@@ -8410,11 +8797,13 @@ int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 		x1 = 0x7fffffff;
 		if (sec->floorstat&2)
 		{
-			wal = &wall[sec->wallptr]; wal2 = &wall[wal->point2];
-			dax = wal2->x-wal->x; day = wal2->y-wal->y;
-			i = nsqrtasm(dax*dax+day*day); if (i == 0) continue;
-			i = divscale15(sec->floorheinum,i);
-			dax *= i; day *= i;
+			wal = &wall[sec->wallptr];
+			if (shared && raysectstamp[dasector] == raybatchstamp)
+			{
+				dax = rayslope[dasector].dax[1]; day = rayslope[dasector].day[1];
+				if (!rayslope[dasector].haslength) continue;
+			}
+			else if (!hitscanslope(sec,1,&dax,&day)) continue;
 
 			j = (vz<<8)-dmulscale15(dax,vy,-day,vx);
 			if (j != 0)
@@ -8473,8 +8862,8 @@ int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 			}
 
 			for(zz=tempshortnum-1;zz>=0;zz--)
-				if (clipsectorlist[zz] == nextsector) break;
-			if (zz < 0) clipsectorlist[tempshortnum++] = nextsector;
+				if (sectlist[zz] == nextsector) break;
+			if (zz < 0) sectlist[tempshortnum++] = nextsector;
 		}
 
 		for(z=headspritesect[dasector];z>=0;z=nextspritesect[z])
@@ -8486,6 +8875,9 @@ int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 #endif
 			if ((cstat&dasprclipmask) == 0) continue;
 
+			rs = NULL;
+			if (shared && rayspritestamp[z] == raybatchstamp) rs = &rayshape[z];
+
 			x1 = spr->x; y1 = spr->y; z1 = spr->z;
 			switch(cstat&48)
 			{
@@ -8495,10 +8887,17 @@ int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 
 					intz = zs+scale(vz,topt,bot);
 
-					i = (tilesizy[spr->picnum]*spr->yrepeat<<2);
-					if (cstat&128) z1 += (i>>1);
-					if (picanm[spr->picnum]&0x00ff0000) z1 -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
-					if ((intz > z1) || (intz < z1-i)) continue;
+					if (rs)
+					{
+						if ((intz > rs->zbot) || (intz < rs->ztop)) continue;
+					}
+					else
+					{
+						i = (tilesizy[spr->picnum]*spr->yrepeat<<2);
+						if (cstat&128) z1 += (i>>1);
+						if (picanm[spr->picnum]&0x00ff0000) z1 -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
+						if ((intz > z1) || (intz < z1-i)) continue;
+					}
 					topu = vx*(y1-ys) - vy*(x1-xs);
 
 					offx = scale(vx,topu,bot);
@@ -8517,14 +8916,22 @@ int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 				case 16:
 						//These lines get the 2 points of the rotated sprite
 						//Given: (x1, y1) starts out as the center point
-					tilenum = spr->picnum;
-					xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
-					if ((cstat&4) > 0) xoff = -xoff;
-					k = spr->ang; l = spr->xrepeat;
-					dax = sintable[k&2047]*l; day = sintable[(k+1536)&2047]*l;
-					l = tilesizx[tilenum]; k = (l>>1)+xoff;
-					x1 -= mulscale16(dax,k); x2 = x1+mulscale16(dax,l);
-					y1 -= mulscale16(day,k); y2 = y1+mulscale16(day,l);
+					if (rs)
+					{
+						x1 = rs->x[0]; x2 = rs->x[1];
+						y1 = rs->y[0]; y2 = rs->y[1];
+					}
+					else
+					{
+						tilenum = spr->picnum;
+						xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
+						if ((cstat&4) > 0) xoff = -xoff;
+						k = spr->ang; l = spr->xrepeat;
+						dax = sintable[k&2047]*l; day = sintable[(k+1536)&2047]*l;
+						l = tilesizx[tilenum]; k = (l>>1)+xoff;
+						x1 -= mulscale16(dax,k); x2 = x1+mulscale16(dax,l);
+						y1 -= mulscale16(day,k); y2 = y1+mulscale16(day,l);
+					}
 
 					if ((cstat&64) != 0)   //back side of 1-way sprite
 						if ((x1-xs)*(y2-ys) < (x2-xs)*(y1-ys)) continue;
@@ -8533,9 +8940,16 @@ int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 
 					if (klabs(intx-xs)+klabs(inty-ys) > klabs((*hitx)-xs)+klabs((*hity)-ys)) continue;
 
-					k = ((tilesizy[spr->picnum]*spr->yrepeat)<<2);
-					if (cstat&128) daz = spr->z+(k>>1); else daz = spr->z;
-					if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
+					if (rs)
+					{
+						daz = rs->zbot; k = rs->zbot-rs->ztop;
+					}
+					else
+					{
+						k = ((tilesizy[spr->picnum]*spr->yrepeat)<<2);
+						if (cstat&128) daz = spr->z+(k>>1); else daz = spr->z;
+						if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
+					}
 					if ((intz < daz) && (intz > daz-k))
 					{
 						*hitsect = dasector; *hitwall = -1; *hitsprite = z;
@@ -8554,26 +8968,34 @@ int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 
 					if (klabs(intx-xs)+klabs(inty-ys) > klabs((*hitx)-xs)+klabs((*hity)-ys)) continue;
 
-					tilenum = spr->picnum;
-					xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
-					yoff = (int)((signed char)((picanm[tilenum]>>16)&255))+((int)spr->yoffset);
-					if ((cstat&4) > 0) xoff = -xoff;
-					if ((cstat&8) > 0) yoff = -yoff;
-
-					ang = spr->ang;
-					cosang = sintable[(ang+512)&2047]; sinang = sintable[ang];
-					xspan = tilesizx[tilenum]; xrepeat = spr->xrepeat;
-					yspan = tilesizy[tilenum]; yrepeat = spr->yrepeat;
-
-					dax = ((xspan>>1)+xoff)*xrepeat; day = ((yspan>>1)+yoff)*yrepeat;
-					x1 += dmulscale16(sinang,dax,cosang,day)-intx;
-					y1 += dmulscale16(sinang,day,-cosang,dax)-inty;
-					l = xspan*xrepeat;
-					x2 = x1 - mulscale16(sinang,l);
-					y2 = y1 + mulscale16(cosang,l);
-					l = yspan*yrepeat;
-					k = -mulscale16(cosang,l); x3 = x2+k; x4 = x1+k;
-					k = -mulscale16(sinang,l); y3 = y2+k; y4 = y1+k;
+					if (rs)
+					{
+						x1 = rs->x[0]-intx; x2 = rs->x[1]-intx; x3 = rs->x[2]-intx; x4 = rs->x[3]-intx;
+						y1 = rs->y[0]-inty; y2 = rs->y[1]-inty; y3 = rs->y[2]-inty; y4 = rs->y[3]-inty;
+					}
+					else
+					{
+						tilenum = spr->picnum;
+						xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
+						yoff = (int)((signed char)((picanm[tilenum]>>16)&255))+((int)spr->yoffset);
+						if ((cstat&4) > 0) xoff = -xoff;
+						if ((cstat&8) > 0) yoff = -yoff;
+
+						ang = spr->ang;
+						cosang = sintable[(ang+512)&2047]; sinang = sintable[ang];
+						xspan = tilesizx[tilenum]; xrepeat = spr->xrepeat;
+						yspan = tilesizy[tilenum]; yrepeat = spr->yrepeat;
+
+						dax = ((xspan>>1)+xoff)*xrepeat; day = ((yspan>>1)+yoff)*yrepeat;
+						x1 += dmulscale16(sinang,dax,cosang,day)-intx;
+						y1 += dmulscale16(sinang,day,-cosang,dax)-inty;
+						l = xspan*xrepeat;
+						x2 = x1 - mulscale16(sinang,l);
+						y2 = y1 + mulscale16(cosang,l);
+						l = yspan*yrepeat;
+						k = -mulscale16(cosang,l); x3 = x2+k; x4 = x1+k;
+						k = -mulscale16(sinang,l); y3 = y2+k; y4 = y1+k;
+					}
 
 					clipyou = 0;
 					if ((y1^y2) < 0)
@@ -8609,62 +9031,240 @@ int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
 	} while (tempshortcnt < tempshortnum);
 	return(0);
 }
+int hitscan(int xs, int ys, int zs, short sectnum, int vx, int vy, int vz,
+	short *hitsect, short *hitwall, short *hitsprite,
+	int *hitx, int *hity, int *hitz, unsigned int cliptype)
+{
+	return hitscanray(xs,ys,zs,sectnum,vx,vy,vz,hitsect,hitwall,hitsprite,hitx,hity,hitz,cliptype,clipsectorlist,0);
+}
 
 
 //
-// neartag
+// hitscanbatch / canseebatch
 //
-int neartag(int xs, int ys, int zs, short sectnum, short ange, short *neartagsector, short *neartagwall,
-	short *neartagsprite, int *neartaghitdist, int neartagrange, unsigned char tagsearch)
+// Rays are independent, so a batch is put in order of the sector each ray
+// starts in and cut into runs that are shared out over the renderer's
+// threads, each run keeping its own list of sectors crossed. Runs are about
+// a quarter of a thread's share, and never fewer than RAYSPERJOB rays.
+//
+// Before a hitscan batch starts, the sectors at least RAYSHARE of its rays
+// start in, and the sectors next to those that the rays flood into first,
+// have their sloped ceilings and floors and the shapes of their sprites
+// worked out once. Every ray still gets exactly the answer the single call
+// gives.
+//
+#define RAYSPERJOB 32
+#define RAYSHARE 4
+
+typedef struct {
+	void *rays;
+	int *order;		// ray numbers in the order to trace them, or NULL
+	int numrays, perjob;
+} raybatchtype;
+
+	// Works out a sector's slopes and the shapes of those of its sprites
+	// that the batch's rays can hit
+static void sharehitscansector(short sectnum, int sprclipmask)
 {
-	walltype *wal, *wal2;
-	spritetype *spr;
-	int i, z, zz, xe, ye, ze, x1, y1, z1, x2, y2, intx, inty, intz;
-	int topt, topu, bot, dist, offx, offy, vx, vy, vz;
-	short tempshortcnt, tempshortnum, dasector, startwall, endwall;
-	short nextsector, good;
+	sectortype *sec = &sector[sectnum];
+	rayslopetype *rsl = &rayslope[sectnum];
+	int i;
 
-	*neartagsector = -1; *neartagwall = -1; *neartagsprite = -1;
-	*neartaghitdist = 0;
+	if (raysectstamp[sectnum] == raybatchstamp) return;
+	raysectstamp[sectnum] = raybatchstamp;
 
-	if (sectnum < 0) return(0);
-	if ((tagsearch < 1) || (tagsearch > 3)) return(0);
+	rsl->haslength = 1;
+	if (sec->ceilingstat&2) rsl->haslength = hitscanslope(sec,0,&rsl->dax[0],&rsl->day[0]);
+	if ((sec->floorstat&2) && rsl->haslength) rsl->haslength = hitscanslope(sec,1,&rsl->dax[1],&rsl->day[1]);
 
-	vx = mulscale14(sintable[(ange+2560)&2047],neartagrange); xe = xs+vx;
-	vy = mulscale14(sintable[(ange+2048)&2047],neartagrange); ye = ys+vy;
-	vz = 0; ze = 0;
+	for (i=headspritesect[sectnum];i>=0;i=nextspritesect[i]) {
+#if USE_POLYMOST
+		if (!hitallsprites)
+#endif
+		if ((sprite[i].cstat&sprclipmask) == 0) continue;
+		spriteshape(&sprite[i], rayshape[i].x, rayshape[i].y, &rayshape[i].zbot, &rayshape[i].ztop);
+		rayspritestamp[i] = raybatchstamp;
+	}
+}
 
-	clipsectorlist[0] = sectnum;
-	tempshortcnt = 0; tempshortnum = 1;
+	// Puts the rays in order of the sector they start in, the sector number
+	// being a short at sectoffs in each ray. Returns the order and, after it,
+	// how many rays start in each sector, or NULL if there is no memory.
+static int *sortrays(void *rays, int numrays, int raysize, int sectoffs)
+{
+	int *order, *count, i, s, n;
 
-	do
-	{
-		dasector = clipsectorlist[tempshortcnt];
+	order = (int *)Bmalloc((numrays + numsectors + 1) * sizeof(int));
+	if (!order) return NULL;
+	count = order + numrays;
 
-		startwall = sector[dasector].wallptr;
-		endwall = startwall + sector[dasector].wallnum - 1;
-		for(z=startwall,wal=&wall[startwall];z<=endwall;z++,wal++)
-		{
-			wal2 = &wall[wal->point2];
-			x1 = wal->x; y1 = wal->y; x2 = wal2->x; y2 = wal2->y;
+	memset(count, 0, (numsectors + 1) * sizeof(int));
+	for (i=0; i<numrays; i++) {
+		s = *(short *)((char *)rays + i*raysize + sectoffs);
+		if ((unsigned)s >= (unsigned)numsectors) s = numsectors;
+		count[s]++;
+	}
+	for (s=0, n=0; s<=numsectors; s++) {
+		i = count[s]; count[s] = n; n += i;
+	}
+	for (i=0; i<numrays; i++) {
+		s = *(short *)((char *)rays + i*raysize + sectoffs);
+		if ((unsigned)s >= (unsigned)numsectors) s = numsectors;
+		order[count[s]++] = i;
+	}
+	for (s=numsectors; s>0; s--) count[s] = count[s] - count[s-1];
 
-			nextsector = wal->nextsector;
+	return order;
+}
 
-			good = 0;
-			if (nextsector >= 0)
-			{
-				if ((tagsearch&1) && sector[nextsector].lotag) good |= 1;
-				if ((tagsearch&2) && sector[nextsector].hitag) good |= 1;
-			}
-			if ((tagsearch&1) && wal->lotag) good |= 2;
-			if ((tagsearch&2) && wal->hitag) good |= 2;
+static void setupraybatch(raybatchtype *batch, void *rays, int numrays, int *order)
+{
+	int runs;
 
-			if ((good == 0) && (nextsector < 0)) continue;
-			if ((x1-xs)*(y2-ys) < (x2-xs)*(y1-ys)) continue;
+	runs = (renderpool ? workpool_numthreads(renderpool) : 1) * 4;
+	batch->rays = rays;
+	batch->numrays = numrays;
+	batch->order = order;
+	batch->perjob = max(RAYSPERJOB, (numrays + runs - 1) / runs);
+}
 
-			if (lintersect(xs,ys,zs,xe,ye,ze,x1,y1,x2,y2,&intx,&inty,&intz) == 1)
-			{
-				if (good != 0)
+static void hitscanjob(void *ctx, int job)
+{
+	raybatchtype *batch = (raybatchtype *)ctx;
+	hitscanraytype *ray;
+	short sectlist[MAXSECTORS];
+	int i, end;
+
+	end = min((job+1)*batch->perjob, batch->numrays);
+	for (i=job*batch->perjob; i<end; i++) {
+		ray = &((hitscanraytype *)batch->rays)[batch->order ? batch->order[i] : i];
+		hitscanray(ray->x, ray->y, ray->z, ray->sectnum, ray->vx, ray->vy, ray->vz,
+			&ray->hitsect, &ray->hitwall, &ray->hitsprite,
+			&ray->hitx, &ray->hity, &ray->hitz, ray->cliptype, sectlist, batch->order != NULL);
+	}
+}
+
+static void canseejob(void *ctx, int job)
+{
+	raybatchtype *batch = (raybatchtype *)ctx;
+	canseeraytype *ray;
+	short sectlist[MAXSECTORS];
+	int i, end;
+
+	end = min((job+1)*batch->perjob, batch->numrays);
+	for (i=job*batch->perjob; i<end; i++) {
+		ray = &((canseeraytype *)batch->rays)[batch->order ? batch->order[i] : i];
+		ray->result = canseeray(ray->x1, ray->y1, ray->z1, ray->sect1,
+			ray->x2, ray->y2, ray->z2, ray->sect2, sectlist);
+	}
+}
+
+void hitscanbatch(hitscanraytype *rays, int numrays)
+{
+	raybatchtype batch;
+	int *order, *count, i, s, sprclipmask;
+	walltype *wal;
+
+	if (numrays <= 0) return;
+	if (renderthreads != renderpoolthreads) setuprenderpool();
+
+	order = sortrays(rays, numrays, sizeof(hitscanraytype), offsetof(hitscanraytype, sectnum));
+	if (order) {
+		if (++raybatchstamp <= 0) {
+			memset(raysectstamp, 0, sizeof(raysectstamp));
+			memset(rayspritestamp, 0, sizeof(rayspritestamp));
+			raybatchstamp = 1;
+		}
+
+		sprclipmask = 0;
+		for (i=0; i<numrays; i++) sprclipmask |= (rays[i].cliptype>>16);
+
+		count = order + numrays;
+		for (s=0; s<numsectors; s++) {
+			if (count[s] < RAYSHARE) continue;
+			sharehitscansector((short)s, sprclipmask);
+			for (i=sector[s].wallnum,wal=&wall[sector[s].wallptr]; i>0; i--,wal++)
+				if (wal->nextsector >= 0) sharehitscansector(wal->nextsector, sprclipmask);
+		}
+	}
+
+	setupraybatch(&batch, rays, numrays, order);
+	workpool_run(renderpool, hitscanjob, &batch, (numrays+batch.perjob-1)/batch.perjob);
+
+	if (order) Bfree(order);
+}
+
+void canseebatch(canseeraytype *rays, int numrays)
+{
+	raybatchtype batch;
+	int *order;
+
+	if (numrays <= 0) return;
+	if (renderthreads != renderpoolthreads) setuprenderpool();
+
+	order = sortrays(rays, numrays, sizeof(canseeraytype), offsetof(canseeraytype, sect1));
+
+	setupraybatch(&batch, rays, numrays, order);
+	workpool_run(renderpool, canseejob, &batch, (numrays+batch.perjob-1)/batch.perjob);
+
+	if (order) Bfree(order);
+}
+
+
+//
+// neartag
+//
+int neartag(int xs, int ys, int zs, short sectnum, short ange, short *neartagsector, short *neartagwall,
+	short *neartagsprite, int *neartaghitdist, int neartagrange, unsigned char tagsearch)
+{
+	walltype *wal, *wal2;
+	spritetype *spr;
+	int i, z, zz, xe, ye, ze, x1, y1, z1, x2, y2, intx, inty, intz;
+	int topt, topu, bot, dist, offx, offy, vx, vy, vz;
+	short tempshortcnt, tempshortnum, dasector, startwall, endwall;
+	short nextsector, good;
+
+	*neartagsector = -1; *neartagwall = -1; *neartagsprite = -1;
+	*neartaghitdist = 0;
+
+	if (sectnum < 0) return(0);
+	if ((tagsearch < 1) || (tagsearch > 3)) return(0);
+
+	vx = mulscale14(sintable[(ange+2560)&2047],neartagrange); xe = xs+vx;
+	vy = mulscale14(sintable[(ange+2048)&2047],neartagrange); ye = ys+vy;
+	vz = 0; ze = 0;
+
+	clipsectorlist[0] = sectnum;
+	tempshortcnt = 0; tempshortnum = 1;
+
+	do
+	{
+		dasector = clipsectorlist[tempshortcnt];
+
+		startwall = sector[dasector].wallptr;
+		endwall = startwall + sector[dasector].wallnum - 1;
+		for(z=startwall,wal=&wall[startwall];z<=endwall;z++,wal++)
+		{
+			wal2 = &wall[wal->point2];
+			x1 = wal->x; y1 = wal->y; x2 = wal2->x; y2 = wal2->y;
+
+			nextsector = wal->nextsector;
+
+			good = 0;
+			if (nextsector >= 0)
+			{
+				if ((tagsearch&1) && sector[nextsector].lotag) good |= 1;
+				if ((tagsearch&2) && sector[nextsector].hitag) good |= 1;
+			}
+			if ((tagsearch&1) && wal->lotag) good |= 2;
+			if ((tagsearch&2) && wal->hitag) good |= 2;
+
+			if ((good == 0) && (nextsector < 0)) continue;
+			if ((x1-xs)*(y2-ys) < (x2-xs)*(y1-ys)) continue;
+
+			if (lintersect(xs,ys,zs,xe,ye,ze,x1,y1,x2,y2,&intx,&inty,&intz) == 1)
+			{
+				if (good != 0)
 				{
 					if (good&1) *neartagsector = nextsector;
 					if (good&2) *neartagwall = z;
@@ -8743,6 +9343,7 @@ void dragpoint(short pointhighlight, int dax, int day)
 
 	wall[pointhighlight].x = dax;
 	wall[pointhighlight].y = day;
+	invalidatesectorgrid(sectorofwall(pointhighlight));
 
 	cnt = MAXWALLS;
 	tempshort = pointhighlight;    //search points CCW
@@ -8753,6 +9354,7 @@ void dragpoint(short pointhighlight, int dax, int day)
 			tempshort = wall[wall[tempshort].nextwall].point2;
 			wall[tempshort].x = dax;
 			wall[tempshort].y = day;
+			invalidatesectorgrid(sectorofwall(tempshort));
 		}
 		else
 		{
@@ -8764,6 +9366,7 @@ void dragpoint(short pointhighlight, int dax, int day)
 					tempshort = wall[lastwall(tempshort)].nextwall;
 					wall[tempshort].x = dax;
 					wall[tempshort].y = day;
+					invalidatesectorgrid(sectorofwall(tempshort));
 				}
 				else
 				{
@@ -8812,6 +9415,228 @@ int lastwall(short point)
 	}                           \
 }                                                        \
 
+	// Starts clipsectorlist afresh with sectnum. Sectors are marked as they
+	// go on the list so clipsectoradd() knows in constant time whether a
+	// sector is on it already.
+static void clipsectorbegin(short sectnum)
+{
+	if (++clipstamp <= 0)
+	{
+		memset(clipsectorstamp, 0, sizeof(clipsectorstamp));
+		clipstamp = 1;
+	}
+	clipsectorlist[0] = sectnum; clipsectnum = 1;
+	if (sectnum >= 0) clipsectorstamp[sectnum] = clipstamp;	// pushmove() can lose its sector midway
+}
+
+static void clipsectoradd(short sectnum)
+{
+	if (clipsectorstamp[sectnum] == clipstamp) return;
+	clipsectorstamp[sectnum] = clipstamp;
+	clipsectorlist[clipsectnum++] = sectnum;
+}
+
+//
+// clip cache
+//
+// With useclipcache set, clipmove(), getzrange() and pushmove() skip the
+// sprites and walls that cannot reach the box they test before working
+// out anything about them, and take the shape of those that can from a
+// copy made earlier instead of working it out from the sprite's tile
+// each time. Each sector's sprites are kept in a bucket beside its list,
+// last first, holding the box around each one's shape, so passing over
+// the ones out of reach is a walk down an array rather than the list.
+// Sprites joining a sector go on the end of its bucket and ones leaving
+// are blanked, which keeps the buckets in the lists' order, so what the
+// queries find and the order they find it in are unchanged; a bucket
+// that fills is given up until the next rebuild and its sector's list
+// walked instead. The engine cannot see a game moving a sprite or
+// changing its shape by writing to sprite[] directly, so the game calls
+// updateclipcache(-1) at the start of each tick, which rebuilds it all,
+// and updateclipcache() with a sprite's number after changing one
+// mid-tick. setsprite() and setspritez() update theirs, and sprites made
+// by insertsprite() are looked at and worked out afresh until they have
+// been updated.
+//
+#define CLIPBUCKETSIZE (MAXSPRITES*2)
+
+typedef struct {
+	int box[4];	// around everything the shape can touch
+	int zbot, ztop;	// face and wall sprites' vertical extent
+	int x[4], y[4];	// wall sprites' ends, floor sprites' corners
+	int valid, slot;
+} clipspritetype;
+
+typedef struct {
+	int box[4];
+	int spritenum;	// -1 once it has left
+} clipbuckettype;
+
+typedef struct {
+	int pos, stop, next;
+} clipspriteiter;
+
+int useclipcache = 0;
+static int clipcachevalid = 0;
+static clipspritetype clipsprite[MAXSPRITES];
+static clipbuckettype clipbucket[CLIPBUCKETSIZE];
+static int clipbucketstart[MAXSECTORS], clipbucketend[MAXSECTORS], clipbucketlimit[MAXSECTORS];
+
+static int wallboxvalid = 0, wallboxnumwalls;
+static int wallbox[MAXWALLS][4];
+
+	// Keeps a sprite's shape, and its box in the sector's bucket
+static void setclipsprite(int spritenum)
+{
+	clipspritetype *cs = &clipsprite[spritenum];
+	int i, n;
+
+	n = spriteshape(&sprite[spritenum], cs->x, cs->y, &cs->zbot, &cs->ztop);
+	cs->box[0] = cs->box[2] = cs->x[0];
+	cs->box[1] = cs->box[3] = cs->y[0];
+	for (i=1;i<n;i++) {
+		cs->box[0] = min(cs->box[0], cs->x[i]); cs->box[2] = max(cs->box[2], cs->x[i]);
+		cs->box[1] = min(cs->box[1], cs->y[i]); cs->box[3] = max(cs->box[3], cs->y[i]);
+	}
+
+	cs->valid = 1;
+	if (cs->slot >= 0) memcpy(clipbucket[cs->slot].box, cs->box, sizeof(cs->box));
+}
+
+static void setwallbox(int i)
+{
+	walltype *wal = &wall[i], *wal2 = &wall[wal->point2];
+
+	wallbox[i][0] = min(wal->x, wal2->x); wallbox[i][1] = min(wal->y, wal2->y);
+	wallbox[i][2] = max(wal->x, wal2->x); wallbox[i][3] = max(wal->y, wal2->y);
+}
+
+	// Has a sprite looked at and worked out afresh until it is updated, or
+	// with -1, forgets everything
+static void clipcacheforget(int spritenum)
+{
+	clipspritetype *cs;
+
+	if (spritenum >= 0) {
+		cs = &clipsprite[spritenum];
+		cs->valid = 0;
+		cs->box[0] = cs->box[1] = 0x80000000;
+		cs->box[2] = cs->box[3] = 0x7fffffff;
+		if (cs->slot >= 0) memcpy(clipbucket[cs->slot].box, cs->box, sizeof(cs->box));
+		return;
+	}
+	clipcachevalid = 0;
+	wallboxvalid = 0;
+}
+
+	// Notes a sprite joining the head of a sector's list, or leaving it
+static void clipcachesectlink(short spritenum, short sectnum)
+{
+	int i;
+
+	if (!clipcachevalid) return;
+	if (clipbucketstart[sectnum] < 0) return;
+	if (clipbucketend[sectnum] == clipbucketlimit[sectnum]) {
+		for (i=clipbucketstart[sectnum];i<clipbucketend[sectnum];i++)
+			if (clipbucket[i].spritenum >= 0) clipsprite[clipbucket[i].spritenum].slot = -1;
+		clipbucketstart[sectnum] = -1;
+		return;
+	}
+	i = clipbucketend[sectnum]++;
+	memcpy(clipbucket[i].box, clipsprite[spritenum].box, sizeof(clipsprite[spritenum].box));
+	clipbucket[i].spritenum = spritenum;
+	clipsprite[spritenum].slot = i;
+}
+
+static void clipcachesectunlink(short spritenum)
+{
+	if (!clipcachevalid || clipsprite[spritenum].slot < 0) return;
+	clipbucket[clipsprite[spritenum].slot].spritenum = -1;
+	clipsprite[spritenum].slot = -1;
+}
+
+void updateclipcache(short spritenum)
+{
+	int i, j, n, pos;
+
+	if (!useclipcache) return;
+	if (spritenum >= 0) {
+		if (spritenum < MAXSPRITES && sprite[spritenum].statnum < MAXSTATUS) setclipsprite(spritenum);
+		return;
+	}
+
+	for (i=0;i<numwalls;i++) setwallbox(i);
+	wallboxnumwalls = numwalls;
+	wallboxvalid = 1;
+
+		// Lay the buckets out with room for each to grow by half again
+	for (i=0;i<MAXSPRITES;i++) clipsprite[i].slot = -1;
+	for (i=0,pos=0;i<numsectors;i++) {
+		for (j=headspritesect[i],n=0;j>=0;j=nextspritesect[j]) n++;
+		if (pos+n+(n>>1)+8 > CLIPBUCKETSIZE) {
+			clipbucketstart[i] = -1;
+			continue;
+		}
+		clipbucketstart[i] = pos;
+		clipbucketend[i] = pos+n;
+		clipbucketlimit[i] = pos+n+(n>>1)+8;
+		pos = clipbucketlimit[i];
+
+		for (j=headspritesect[i];j>=0;j=nextspritesect[j]) {
+			clipsprite[j].slot = --n + clipbucketstart[i];
+			clipbucket[clipsprite[j].slot].spritenum = j;
+			setclipsprite(j);
+		}
+	}
+	for (i=0;i<numsectors;i++)
+		if (clipbucketstart[i] < 0)
+			for (j=headspritesect[i];j>=0;j=nextspritesect[j])
+				setclipsprite(j);
+	clipcachevalid = 1;
+}
+
+	// Steps through a sector's sprites in the order of its list, leaving
+	// out any the clip cache knows cannot reach the box
+static void clipspritesbegin(short sectnum, clipspriteiter *it)
+{
+	if (useclipcache && clipcachevalid && clipbucketstart[sectnum] >= 0) {
+		it->pos = clipbucketend[sectnum];
+		it->stop = clipbucketstart[sectnum];
+	} else {
+		it->pos = -1;
+		it->next = headspritesect[sectnum];
+	}
+}
+
+static inline int nextclipsprite(clipspriteiter *it, int xmin, int ymin, int xmax, int ymax)
+{
+	clipbuckettype *b;
+	int j, *box;
+
+	if (it->pos < 0) {
+		while ((j = it->next) >= 0) {
+			it->next = nextspritesect[j];
+			if (!useclipcache || !clipcachevalid) return j;
+			box = clipsprite[j].box;
+			if ((box[0] <= xmax) && (box[2] >= xmin) && (box[1] <= ymax) && (box[3] >= ymin)) return j;
+		}
+		return -1;
+	}
+	while (--it->pos >= it->stop) {
+		b = &clipbucket[it->pos];
+		if (b->spritenum < 0) continue;
+		if ((b->box[0] > xmax) || (b->box[2] < xmin) || (b->box[1] > ymax) || (b->box[3] < ymin)) continue;
+		return b->spritenum;
+	}
+	return -1;
+}
+
+	// The copy of sprite j's shape, if there is one to use
+#define cachedclipsprite(j) ((useclipcache && clipcachevalid && clipsprite[j].valid) ? &clipsprite[j] : NULL)
+	// Whether the wall boxes can stand in for the walls
+#define usewallboxes() (useclipcache && wallboxvalid && wallboxnumwalls == numwalls)
+
+
 int clipmoveboxtracenum = 3;
 
 //
@@ -8823,6 +9648,8 @@ int clipmove (int *x, int *y, int *z, short *sectnum,
 {
 	walltype *wal, *wal2;
 	spritetype *spr;
+	clipspritetype *cs;
+	clipspriteiter it;
 	sectortype *sec, *sec2;
 	int i, j, templong1, templong2;
 	int oxvect, oyvect, goalx, goaly, intx, inty, lx, ly, retval;
@@ -8830,7 +9657,8 @@ int clipmove (int *x, int *y, int *z, short *sectnum,
 	int x1, y1, x2, y2, cx, cy, rad, xmin, ymin, xmax, ymax, daz, daz2;
 	int bsz, dax, day, xoff, yoff, xspan, yspan, cosang, sinang, tilenum;
 	int xrepeat, yrepeat, gx, gy, dx, dy, dasprclipmask, dawalclipmask;
-	int hitwall, cnt, clipyou;
+	int hitwall, cnt, clipyou, usebox;
+	short *cands;
 
 	if (((xvect|yvect) == 0) || (*sectnum < 0)) return(0);
 	retval = 0;
@@ -8851,12 +9679,13 @@ int clipmove (int *x, int *y, int *z, short *sectnum,
 	rad = nsqrtasm(gx*gx + gy*gy) + MAXCLIPDIST+walldist + 8;
 	xmin = cx-rad; ymin = cy-rad;
 	xmax = cx+rad; ymax = cy+rad;
+	usebox = usewallboxes();
 
 	dawalclipmask = (cliptype&65535);        //CLIPMASK0 = 0x00010001
 	dasprclipmask = (cliptype>>16);          //CLIPMASK1 = 0x01000040
 
-	clipsectorlist[0] = (*sectnum);
-	clipsectcnt = 0; clipsectnum = 1;
+	clipsectorbegin(*sectnum);
+	clipsectcnt = 0;
 	do
 	{
 		dasect = clipsectorlist[clipsectcnt++];
@@ -8864,11 +9693,20 @@ int clipmove (int *x, int *y, int *z, short *sectnum,
 		startwall = sec->wallptr; endwall = startwall + sec->wallnum;
 		for(j=startwall,wal=&wall[startwall];j<endwall;j++,wal++)
 		{
-			wal2 = &wall[wal->point2];
-			if ((wal->x < xmin) && (wal2->x < xmin)) continue;
-			if ((wal->x > xmax) && (wal2->x > xmax)) continue;
-			if ((wal->y < ymin) && (wal2->y < ymin)) continue;
-			if ((wal->y > ymax) && (wal2->y > ymax)) continue;
+			if (usebox)
+			{
+				if ((wallbox[j][2] < xmin) || (wallbox[j][0] > xmax)) continue;
+				if ((wallbox[j][3] < ymin) || (wallbox[j][1] > ymax)) continue;
+				wal2 = &wall[wal->point2];
+			}
+			else
+			{
+				wal2 = &wall[wal->point2];
+				if ((wal->x < xmin) && (wal2->x < xmin)) continue;
+				if ((wal->x > xmax) && (wal2->x > xmax)) continue;
+				if ((wal->y < ymin) && (wal2->y < ymin)) continue;
+				if ((wal->y > ymax) && (wal2->y > ymax)) continue;
+			}
 
 			x1 = wal->x; y1 = wal->y; x2 = wal2->x; y2 = wal2->y;
 
@@ -8917,15 +9755,13 @@ int clipmove (int *x, int *y, int *z, short *sectnum,
 				addclipline(x1+dax,y1+day,x2+dax,y2+day,(short)j+32768);
 			}
 			else
-			{
-				for(i=clipsectnum-1;i>=0;i--)
-					if (wal->nextsector == clipsectorlist[i]) break;
-				if (i < 0) clipsectorlist[clipsectnum++] = wal->nextsector;
-			}
+				clipsectoradd(wal->nextsector);
 		}
 
-		for(j=headspritesect[dasect];j>=0;j=nextspritesect[j])
+		clipspritesbegin(dasect,&it);
+		while ((j = nextclipsprite(&it,xmin,ymin,xmax,ymax)) >= 0)
 		{
+			cs = cachedclipsprite(j);
 			spr = &sprite[j];
 			cstat = spr->cstat;
 			if ((cstat&dasprclipmask) == 0) continue;
@@ -8935,9 +9771,13 @@ int clipmove (int *x, int *y, int *z, short *sectnum,
 				case 0:
 					if ((x1 >= xmin) && (x1 <= xmax) && (y1 >= ymin) && (y1 <= ymax))
 					{
-						k = ((tilesizy[spr->picnum]*spr->yrepeat)<<2);
-						if (cstat&128) daz = spr->z+(k>>1); else daz = spr->z;
-						if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
+						if (cs) daz = cs->zbot, k = cs->zbot-cs->ztop;
+						else
+						{
+							k = ((tilesizy[spr->picnum]*spr->yrepeat)<<2);
+							if (cstat&128) daz = spr->z+(k>>1); else daz = spr->z;
+							if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
+						}
 						if (((*z) < daz+ceildist) && ((*z) > daz-k-flordist))
 						{
 							bsz = (spr->clipdist<<2)+walldist; if (gx < 0) bsz = -bsz;
@@ -8948,23 +9788,31 @@ int clipmove (int *x, int *y, int *z, short *sectnum,
 					}
 					break;
 				case 16:
-					k = ((tilesizy[spr->picnum]*spr->yrepeat)<<2);
-					if (cstat&128) daz = spr->z+(k>>1); else daz = spr->z;
-					if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
-					daz2 = daz-k;
+					if (cs) daz = cs->zbot, daz2 = cs->ztop;
+					else
+					{
+						k = ((tilesizy[spr->picnum]*spr->yrepeat)<<2);
+						if (cstat&128) daz = spr->z+(k>>1); else daz = spr->z;
+						if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
+						daz2 = daz-k;
+					}
 					daz += ceildist; daz2 -= flordist;
 					if (((*z) < daz) && ((*z) > daz2))
 					{
-							//These lines get the 2 points of the rotated sprite
-							//Given: (x1, y1) starts out as the center point
-						tilenum = spr->picnum;
-						xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
-						if ((cstat&4) > 0) xoff = -xoff;
-						k = spr->ang; l = spr->xrepeat;
-						dax = sintable[k&2047]*l; day = sintable[(k+1536)&2047]*l;
-						l = tilesizx[tilenum]; k = (l>>1)+xoff;
-						x1 -= mulscale16(dax,k); x2 = x1+mulscale16(dax,l);
-						y1 -= mulscale16(day,k); y2 = y1+mulscale16(day,l);
+						if (cs) x1 = cs->x[0], y1 = cs->y[0], x2 = cs->x[1], y2 = cs->y[1];
+						else
+						{
+								//These lines get the 2 points of the rotated sprite
+								//Given: (x1, y1) starts out as the center point
+							tilenum = spr->picnum;
+							xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
+							if ((cstat&4) > 0) xoff = -xoff;
+							k = spr->ang; l = spr->xrepeat;
+							dax = sintable[k&2047]*l; day = sintable[(k+1536)&2047]*l;
+							l = tilesizx[tilenum]; k = (l>>1)+xoff;
+							x1 -= mulscale16(dax,k); x2 = x1+mulscale16(dax,l);
+							y1 -= mulscale16(day,k); y2 = y1+mulscale16(day,l);
+						}
 						if (clipinsideboxline(cx,cy,x1,y1,x2,y2,rad) != 0)
 						{
 							dax = mulscale14(sintable[(spr->ang+256+512)&2047],walldist);
@@ -8996,26 +9844,33 @@ int clipmove (int *x, int *y, int *z, short *sectnum,
 						if ((cstat&64) != 0)
 							if (((*z) > spr->z) == ((cstat&8)==0)) continue;
 
-						tilenum = spr->picnum;
-						xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
-						yoff = (int)((signed char)((picanm[tilenum]>>16)&255))+((int)spr->yoffset);
-						if ((cstat&4) > 0) xoff = -xoff;
-						if ((cstat&8) > 0) yoff = -yoff;
-
-						k = spr->ang;
-						cosang = sintable[(k+512)&2047]; sinang = sintable[k];
-						xspan = tilesizx[tilenum]; xrepeat = spr->xrepeat;
-						yspan = tilesizy[tilenum]; yrepeat = spr->yrepeat;
-
-						dax = ((xspan>>1)+xoff)*xrepeat; day = ((yspan>>1)+yoff)*yrepeat;
-						rxi[0] = x1 + dmulscale16(sinang,dax,cosang,day);
-						ryi[0] = y1 + dmulscale16(sinang,day,-cosang,dax);
-						l = xspan*xrepeat;
-						rxi[1] = rxi[0] - mulscale16(sinang,l);
-						ryi[1] = ryi[0] + mulscale16(cosang,l);
-						l = yspan*yrepeat;
-						k = -mulscale16(cosang,l); rxi[2] = rxi[1]+k; rxi[3] = rxi[0]+k;
-						k = -mulscale16(sinang,l); ryi[2] = ryi[1]+k; ryi[3] = ryi[0]+k;
+						if (cs)
+						{
+							for(k=0;k<4;k++) rxi[k] = cs->x[k], ryi[k] = cs->y[k];
+						}
+						else
+						{
+							tilenum = spr->picnum;
+							xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
+							yoff = (int)((signed char)((picanm[tilenum]>>16)&255))+((int)spr->yoffset);
+							if ((cstat&4) > 0) xoff = -xoff;
+							if ((cstat&8) > 0) yoff = -yoff;
+
+							k = spr->ang;
+							cosang = sintable[(k+512)&2047]; sinang = sintable[k];
+							xspan = tilesizx[tilenum]; xrepeat = spr->xrepeat;
+							yspan = tilesizy[tilenum]; yrepeat = spr->yrepeat;
+
+							dax = ((xspan>>1)+xoff)*xrepeat; day = ((yspan>>1)+yoff)*yrepeat;
+							rxi[0] = x1 + dmulscale16(sinang,dax,cosang,day);
+							ryi[0] = y1 + dmulscale16(sinang,day,-cosang,dax);
+							l = xspan*xrepeat;
+							rxi[1] = rxi[0] - mulscale16(sinang,l);
+							ryi[1] = ryi[0] + mulscale16(cosang,l);
+							l = yspan*yrepeat;
+							k = -mulscale16(cosang,l); rxi[2] = rxi[1]+k; rxi[3] = rxi[0]+k;
+							k = -mulscale16(sinang,l); ryi[2] = ryi[1]+k; ryi[3] = ryi[0]+k;
+						}
 
 						dax = mulscale14(sintable[(spr->ang-256+512)&2047],walldist);
 						day = mulscale14(sintable[(spr->ang-256)&2047],walldist);
@@ -9103,8 +9958,9 @@ int clipmove (int *x, int *y, int *z, short *sectnum,
 		}
 
 	*sectnum = -1; templong1 = 0x7fffffff;
-	for(j=numsectors-1;j>=0;j--)
-		if (inside(*x,*y,j) == 1)
+	k = sectorgridcandidates(*x,*y,&cands);
+	for(l=0;l<k;l++)
+		if (inside(*x,*y,j = cands[l]) == 1)
 		{
 			if (sector[j].ceilingstat&2)
 				templong2 = (getceilzofslope((short)j,*x,*y)-(*z));
@@ -9147,7 +10003,7 @@ int pushmove (int *x, int *y, int *z, short *sectnum,
 	walltype *wal, *wal2;
 	spritetype *spr;
 	int i, j, k, t, dx, dy, dax, day, daz, daz2, bad, dir;
-	int dasprclipmask, dawalclipmask;
+	int dasprclipmask, dawalclipmask, usebox;
 	short startwall, endwall, clipsectcnt;
 	char bad2;
 
@@ -9155,6 +10011,7 @@ int pushmove (int *x, int *y, int *z, short *sectnum,
 
 	dawalclipmask = (cliptype&65535);
 	dasprclipmask = (cliptype>>16);
+	usebox = usewallboxes();
 
 	k = 32;
 	dir = 1;
@@ -9162,8 +10019,8 @@ int pushmove (int *x, int *y, int *z, short *sectnum,
 	{
 		bad = 0;
 
-		clipsectorlist[0] = *sectnum;
-		clipsectcnt = 0; clipsectnum = 1;
+		clipsectorbegin(*sectnum);
+		clipsectcnt = 0;
 		do
 		{
 			/*Push FACE sprites
@@ -9207,6 +10064,13 @@ int pushmove (int *x, int *y, int *z, short *sectnum,
 				endwall = sec->wallptr, startwall = endwall + sec->wallnum;
 
 			for(i=startwall,wal=&wall[startwall];i!=endwall;i+=dir,wal+=dir)
+			{
+					//The same rejection clipinsidebox() starts with
+				if (usebox && i < numwalls)
+				{
+					if ((wallbox[i][2] < (*x)-(walldist-4)) || (wallbox[i][0] >= (*x)+(walldist-4))) continue;
+					if ((wallbox[i][3] < (*y)-(walldist-4)) || (wallbox[i][1] >= (*y)+(walldist-4))) continue;
+				}
 				if (clipinsidebox(*x,*y,i,walldist-4) == 1)
 				{
 					j = 0;
@@ -9258,12 +10122,9 @@ int pushmove (int *x, int *y, int *z, short *sectnum,
 						updatesector(*x,*y,sectnum);
 					}
 					else
-					{
-						for(j=clipsectnum-1;j>=0;j--)
-							if (wal->nextsector == clipsectorlist[j]) break;
-						if (j < 0) clipsectorlist[clipsectnum++] = wal->nextsector;
-					}
+						clipsectoradd(wal->nextsector);
 				}
+			}
 
 			clipsectcnt++;
 		} while (clipsectcnt < clipsectnum);
@@ -9274,6 +10135,385 @@ int pushmove (int *x, int *y, int *z, short *sectnum,
 }
 
 
+//
+// sector grid
+//
+// A uniform grid over the map listing, for each cell, the sectors whose
+// bounding boxes touch it in descending order, so the sector containing a
+// point is found by testing a handful of candidates instead of every
+// sector, with the same answer the full scan gives. It is built when first
+// needed. Sectors whose walls have moved since are kept on a short list
+// that is always tested as well, and the grid is rebuilt once that fills.
+//
+#define SECTGRIDMAXDIM 128
+#define SECTGRIDMAXLOOSE 64
+
+static int sectgridvalid = 0, sectgridnumsectors, sectgridnumwalls;
+static int sectgridx0, sectgridy0, sectgridshift, sectgridxdim, sectgridydim;
+static int *sectgridstart = NULL, sectgridcells = 0;
+static short *sectgridlist = NULL;
+static int sectgridlistsize = 0;
+static int sectgridbox[MAXSECTORS][4];
+static short sectgridloose[SECTGRIDMAXLOOSE], sectgridnumloose = 0;
+static unsigned char sectgridisloose[(MAXSECTORS+7)>>3];
+static short sectgridcands[MAXSECTORS+SECTGRIDMAXLOOSE];
+
+static void buildsectorgrid(void)
+{
+	int i, j, s, x, y, cx0, cy0, cx1, cy1, x0, y0, x1, y1, n, *cnt;
+	walltype *wal;
+
+	sectgridvalid = 0;
+	sectgridnumsectors = numsectors;
+	sectgridnumwalls = numwalls;
+	sectgridnumloose = 0;
+	memset(sectgridisloose, 0, sizeof(sectgridisloose));
+
+	x0 = y0 = 0x7fffffff; x1 = y1 = 0x80000000;
+	for (s=0;s<numsectors;s++) {
+		sectgridbox[s][0] = sectgridbox[s][1] = 0x7fffffff;
+		sectgridbox[s][2] = sectgridbox[s][3] = 0x80000000;
+		wal = &wall[sector[s].wallptr];
+		for (j=sector[s].wallnum;j>0;j--,wal++) {
+			sectgridbox[s][0] = min(sectgridbox[s][0], wal->x);
+			sectgridbox[s][1] = min(sectgridbox[s][1], wal->y);
+			sectgridbox[s][2] = max(sectgridbox[s][2], wal->x);
+			sectgridbox[s][3] = max(sectgridbox[s][3], wal->y);
+		}
+		if (sectgridbox[s][0] > sectgridbox[s][2]) continue;	// no walls
+		x0 = min(x0, sectgridbox[s][0]); y0 = min(y0, sectgridbox[s][1]);
+		x1 = max(x1, sectgridbox[s][2]); y1 = max(y1, sectgridbox[s][3]);
+	}
+	if (x0 > x1) { x0 = y0 = x1 = y1 = 0; }
+
+		// Aim for about two cells per sector
+	n = max(1, min(numsectors*2, SECTGRIDMAXDIM*SECTGRIDMAXDIM));
+	for (sectgridshift=4; sectgridshift<31; sectgridshift++) {
+		sectgridxdim = (int)(((unsigned)x1-(unsigned)x0) >> sectgridshift) + 1;
+		sectgridydim = (int)(((unsigned)y1-(unsigned)y0) >> sectgridshift) + 1;
+		if (sectgridxdim <= SECTGRIDMAXDIM && sectgridydim <= SECTGRIDMAXDIM &&
+			sectgridxdim*sectgridydim <= n) break;
+	}
+	sectgridx0 = x0; sectgridy0 = y0;
+
+	if (sectgridxdim*sectgridydim+1 > sectgridcells) {
+		sectgridcells = sectgridxdim*sectgridydim+1;
+		Bfree(sectgridstart);
+		sectgridstart = (int *)Bmalloc(sectgridcells * sizeof(int));
+		if (!sectgridstart) { sectgridcells = 0; return; }
+	}
+	cnt = sectgridstart;
+	memset(cnt, 0, (sectgridxdim*sectgridydim+1) * sizeof(int));
+
+		// Count each cell's sectors, then lay the lists out one after another
+	for (s=0;s<numsectors;s++) {
+		if (sectgridbox[s][0] > sectgridbox[s][2]) continue;
+		cx0 = (int)(((unsigned)sectgridbox[s][0]-(unsigned)x0) >> sectgridshift);
+		cy0 = (int)(((unsigned)sectgridbox[s][1]-(unsigned)y0) >> sectgridshift);
+		cx1 = (int)(((unsigned)sectgridbox[s][2]-(unsigned)x0) >> sectgridshift);
+		cy1 = (int)(((unsigned)sectgridbox[s][3]-(unsigned)y0) >> sectgridshift);
+		for (y=cy0;y<=cy1;y++)
+			for (x=cx0;x<=cx1;x++)
+				cnt[y*sectgridxdim+x+1]++;
+	}
+	for (i=1;i<=sectgridxdim*sectgridydim;i++) cnt[i] += cnt[i-1];
+
+	n = cnt[sectgridxdim*sectgridydim];
+	if (n > sectgridlistsize) {
+		Bfree(sectgridlist);
+		sectgridlist = (short *)Bmalloc(n * sizeof(short));
+		sectgridlistsize = sectgridlist ? n : 0;
+		if (!sectgridlist) return;
+	}
+
+		// Fill from the highest sector down, advancing each cell's start
+		// as it goes, then shift the starts back into place
+	for (s=numsectors-1;s>=0;s--) {
+		if (sectgridbox[s][0] > sectgridbox[s][2]) continue;
+		cx0 = (int)(((unsigned)sectgridbox[s][0]-(unsigned)x0) >> sectgridshift);
+		cy0 = (int)(((unsigned)sectgridbox[s][1]-(unsigned)y0) >> sectgridshift);
+		cx1 = (int)(((unsigned)sectgridbox[s][2]-(unsigned)x0) >> sectgridshift);
+		cy1 = (int)(((unsigned)sectgridbox[s][3]-(unsigned)y0) >> sectgridshift);
+		for (y=cy0;y<=cy1;y++)
+			for (x=cx0;x<=cx1;x++)
+				sectgridlist[cnt[y*sectgridxdim+x]++] = (short)s;
+	}
+	for (i=sectgridxdim*sectgridydim;i>0;i--) cnt[i] = cnt[i-1];
+	cnt[0] = 0;
+
+	sectgridvalid = 1;
+}
+
+static void freesectorgrid(void)
+{
+	Bfree(sectgridstart); sectgridstart = NULL; sectgridcells = 0;
+	Bfree(sectgridlist); sectgridlist = NULL; sectgridlistsize = 0;
+	sectgridvalid = 0;
+}
+
+void invalidatesectorgrid(short sectnum)
+{
+	int i;
+
+	movedpvs(sectnum);
+	if (sectnum < 0 || sectnum >= numsectors) wallboxvalid = 0;
+	else if (wallboxvalid)
+		for (i=sector[sectnum].wallnum-1;i>=0;i--) setwallbox(sector[sectnum].wallptr+i);
+	if (!sectgridvalid) return;
+	if (sectnum < 0 || sectnum >= sectgridnumsectors || sectgridnumloose >= SECTGRIDMAXLOOSE) {
+		sectgridvalid = 0;
+		return;
+	}
+	if (sectgridisloose[sectnum>>3] & pow2char[sectnum&7]) return;
+	sectgridisloose[sectnum>>3] |= pow2char[sectnum&7];
+	sectgridloose[sectgridnumloose++] = sectnum;
+}
+
+	// Brings the grid up to date with the map, returning 0 if it could not
+	// be built
+static int checksectorgrid(void)
+{
+	if (!sectgridvalid || sectgridnumsectors != numsectors || sectgridnumwalls != numwalls)
+		buildsectorgrid();
+	return sectgridvalid;
+}
+
+	// Returns the highest numbered sector containing (x,y), and z too if
+	// usez is set, or -1 if there is none
+static int findsectorgrid(int x, int y, int z, int usez)
+{
+	int i, s, cx, cy, cz, fz, best = -1;
+
+	if (!checksectorgrid()) {	// out of memory, so fall back on scanning everything
+		for (s=numsectors-1;s>=0;s--) {
+			if (usez) {
+				getzsofslope((short)s, x, y, &cz, &fz);
+				if ((z < cz) || (z > fz)) continue;
+			}
+			if (inside(x,y,(short)s) == 1) return s;
+		}
+		return -1;
+	}
+
+	cx = (int)(((unsigned)x-(unsigned)sectgridx0) >> sectgridshift);
+	cy = (int)(((unsigned)y-(unsigned)sectgridy0) >> sectgridshift);
+	if (x >= sectgridx0 && y >= sectgridy0 && cx < sectgridxdim && cy < sectgridydim) {
+		for (i=sectgridstart[cy*sectgridxdim+cx]; i<sectgridstart[cy*sectgridxdim+cx+1]; i++) {
+			s = sectgridlist[i];
+			if (usez) {
+				getzsofslope((short)s, x, y, &cz, &fz);
+				if ((z < cz) || (z > fz)) continue;
+			}
+			if (inside(x,y,(short)s) == 1) { best = s; break; }
+		}
+	}
+
+		// Moved sectors may be anywhere now
+	for (i=0; i<sectgridnumloose; i++) {
+		s = sectgridloose[i];
+		if (s <= best) continue;
+		if (usez) {
+			getzsofslope((short)s, x, y, &cz, &fz);
+			if ((z < cz) || (z > fz)) continue;
+		}
+		if (inside(x,y,(short)s) == 1) best = s;
+	}
+
+	return best;
+}
+
+
+	// Points *list at every sector that might contain (x,y), highest
+	// numbered first, and returns how many there are
+static int sectorgridcandidates(int x, int y, short **list)
+{
+	int i, j, n = 0, cx, cy, c0 = 0, c1 = 0;
+	short loose[SECTGRIDMAXLOOSE], s;
+
+	*list = sectgridcands;
+	if (!checksectorgrid()) {
+		for (i=numsectors-1;i>=0;i--) sectgridcands[n++] = (short)i;
+		return n;
+	}
+
+	cx = (int)(((unsigned)x-(unsigned)sectgridx0) >> sectgridshift);
+	cy = (int)(((unsigned)y-(unsigned)sectgridy0) >> sectgridshift);
+	if (x >= sectgridx0 && y >= sectgridy0 && cx < sectgridxdim && cy < sectgridydim) {
+		c0 = sectgridstart[cy*sectgridxdim+cx];
+		c1 = sectgridstart[cy*sectgridxdim+cx+1];
+	}
+
+		// Merge the moved sectors into the cell's list, keeping the order
+	for (i=0;i<sectgridnumloose;i++) {
+		s = sectgridloose[i];
+		for (j=i;j>0 && loose[j-1]<s;j--) loose[j] = loose[j-1];
+		loose[j] = s;
+	}
+	for (i=0;c0<c1 || i<sectgridnumloose;) {
+		if (c0<c1 && (i>=sectgridnumloose || sectgridlist[c0]>loose[i]))
+			sectgridcands[n++] = sectgridlist[c0++];
+		else if (c0<c1 && sectgridlist[c0]==loose[i])
+			{ sectgridcands[n++] = sectgridlist[c0++]; i++; }
+		else
+			sectgridcands[n++] = loose[i++];
+	}
+	return n;
+}
+
+//
+// potentially visible sets
+//
+// A map may come with a .pvs file beside it, made by the pvsbuild tool,
+// giving for each sector a bit for every sector that could possibly be
+// seen from somewhere inside it. When the camera is inside its sector the
+// renderers skip scanning any sector outside that sector's set. The file
+// records a CRC of the map's walls. Sectors whose walls move afterwards are
+// noted, and a set holding any of them is no longer trusted, since sectors
+// beyond might then be seen; the sets are dropped when the map changes.
+// That relies on the game reporting every wall it moves, so it is off
+// unless the game asks for it.
+//
+#define PVSMAGIC "PVS1"
+
+int usepvs = 0;
+static unsigned char *pvsdata = NULL;
+static int pvsnumsectors = 0, pvsnumwalls = 0;
+static unsigned char pvsmoved[(MAXSECTORS+7)>>3];
+static int pvsanymoved = 0;
+
+static void freepvs(void)
+{
+	Bfree(pvsdata); pvsdata = NULL;
+	pvsnumsectors = pvsnumwalls = 0;
+	if (pvsanymoved) memset(pvsmoved, 0, sizeof(pvsmoved));
+	pvsanymoved = 0;
+}
+
+static void movedpvs(short sectnum)
+{
+	if (!pvsdata) return;
+	if (sectnum < 0 || sectnum >= pvsnumsectors) { freepvs(); return; }
+	pvsmoved[sectnum>>3] |= pow2char[sectnum&7];
+	pvsanymoved = 1;
+}
+
+	// The name of the .pvs file that goes with a map
+static void pvsfilename(char *buf, int len, const char *mapname)
+{
+	int i;
+
+	Bstrncpy(buf, mapname, len-5); buf[len-5] = 0;
+	i = strlen(buf);
+	if (i >= 4 && !Bstrcasecmp(&buf[i-4], ".map")) i -= 4;
+	strcpy(&buf[i], ".pvs");
+}
+
+	// A CRC of the walls and how the sectors are made from them, which is
+	// all the sets depend on
+static unsigned int pvsgeometrycrc(void)
+{
+	unsigned int crc;
+	int i, v[5];
+
+	crc32init(&crc);
+	for (i=0;i<numsectors;i++) {
+		v[0] = B_LITTLE32((int)sector[i].wallptr);
+		v[1] = B_LITTLE32((int)sector[i].wallnum);
+		crc32block(&crc, (unsigned char *)v, 2*sizeof(int));
+	}
+	for (i=0;i<numwalls;i++) {
+		v[0] = B_LITTLE32(wall[i].x);
+		v[1] = B_LITTLE32(wall[i].y);
+		v[2] = B_LITTLE32((int)wall[i].point2);
+		v[3] = B_LITTLE32((int)wall[i].nextwall);
+		v[4] = B_LITTLE32((int)wall[i].nextsector);
+		crc32block(&crc, (unsigned char *)v, 5*sizeof(int));
+	}
+	crc32finish(&crc);
+	return crc;
+}
+
+static void loadpvs(const char *mapname, char fromwhere)
+{
+	char fn[BMAX_PATH], magic[4];
+	int fil, i, head[3], rowbytes;
+
+	freepvs();
+
+	pvsfilename(fn, sizeof(fn), mapname);
+	if ((fil = kopen4load(fn,fromwhere)) == -1) return;
+
+	rowbytes = (numsectors+7)>>3;
+	if (kread(fil,magic,4) != 4 || memcmp(magic,PVSMAGIC,4) ||
+		kread(fil,head,sizeof(head)) != sizeof(head)) {
+		kclose(fil);
+		buildprintf("%s is not a PVS file\n", fn);
+		return;
+	}
+	for (i=0;i<3;i++) head[i] = B_LITTLE32(head[i]);
+	if (head[0] != numsectors || head[1] != numwalls || (unsigned int)head[2] != pvsgeometrycrc()) {
+		kclose(fil);
+		buildprintf("%s does not match the map, ignoring it\n", fn);
+		return;
+	}
+
+	pvsdata = (unsigned char *)Bmalloc(max(1, numsectors*rowbytes));
+	if (!pvsdata || kread(fil,pvsdata,numsectors*rowbytes) != numsectors*rowbytes) {
+		kclose(fil);
+		freepvs();
+		buildprintf("%s could not be read\n", fn);
+		return;
+	}
+	kclose(fil);
+
+	pvsnumsectors = numsectors;
+	pvsnumwalls = numwalls;
+}
+
+	// Writes the sets for the loaded map to the .pvs file beside mapname,
+	// rows being (numsectors+7)>>3 bytes for each sector in turn
+int savepvs(const char *mapname, const unsigned char *rows)
+{
+	char fn[BMAX_PATH];
+	int fil, head[3], len;
+
+	pvsfilename(fn, sizeof(fn), mapname);
+	if ((fil = Bopen(fn,BO_BINARY|BO_TRUNC|BO_CREAT|BO_WRONLY,BS_IREAD|BS_IWRITE)) == -1)
+		return(-1);
+
+	head[0] = B_LITTLE32(numsectors);
+	head[1] = B_LITTLE32(numwalls);
+	head[2] = B_LITTLE32((int)pvsgeometrycrc());
+	len = numsectors*((numsectors+7)>>3);
+	if (Bwrite(fil,PVSMAGIC,4) != 4 || Bwrite(fil,head,sizeof(head)) != sizeof(head) ||
+		Bwrite(fil,rows,len) != len) {
+		Bclose(fil);
+		return(-1);
+	}
+	Bclose(fil);
+	return(0);
+}
+
+	// The set to scan with when drawing from the camera position in
+	// sectnum, or NULL to scan everything
+const unsigned char *getpvsrow(short sectnum)
+{
+	const unsigned char *row;
+	int i;
+
+	if (!usepvs || !pvsdata) return NULL;
+	if (pvsnumsectors != numsectors || pvsnumwalls != numwalls) { freepvs(); return NULL; }
+	if ((unsigned)sectnum >= (unsigned)numsectors) return NULL;
+	if (inside(globalposx,globalposy,sectnum) != 1) return NULL;	// eg. a mirror's reflected camera
+
+	row = &pvsdata[sectnum*((numsectors+7)>>3)];
+	if (pvsanymoved)
+		for (i=(numsectors+7)>>3;i>0;i--)
+			if (row[i-1] & pvsmoved[i-1]) return NULL;
+	return row;
+}
+
+
 //
 // updatesector[z]
 //
@@ -9302,14 +10542,7 @@ void updatesector(int x, int y, short *sectnum)
 		} while (j != 0);
 	}
 
-	for(i=numsectors-1;i>=0;i--)
-		if (inside(x,y,(short)i) == 1)
-		{
-			*sectnum = i;
-			return;
-		}
-
-	*sectnum = -1;
+	*sectnum = findsectorgrid(x,y,0,0);
 }
 
 void updatesectorz(int x, int y, int z, short *sectnum)
@@ -9317,12 +10550,12 @@ void updatesectorz(int x, int y, int z, short *sectnum)
 	walltype *wal;
 	int i, j, cz, fz;
 
-	getzsofslope(*sectnum, x, y, &cz, &fz);
-	if ((z >= cz) && (z <= fz))
-		if (inside(x,y,*sectnum) != 0) return;
-
 	if ((*sectnum >= 0) && (*sectnum < numsectors))
 	{
+		getzsofslope(*sectnum, x, y, &cz, &fz);
+		if ((z >= cz) && (z <= fz))
+			if (inside(x,y,*sectnum) == 1) return;
+
 		wal = &wall[sector[*sectnum].wallptr];
 		j = sector[*sectnum].wallnum;
 		do
@@ -9339,15 +10572,7 @@ void updatesectorz(int x, int y, int z, short *sectnum)
 		} while (j != 0);
 	}
 
-	for (i=numsectors-1;i>=0;i--)
-	{
-		getzsofslope(i, x, y, &cz, &fz);
-		if ((z >= cz) && (z <= fz))
-			if (inside(x,y,(short)i) == 1)
-				{ *sectnum = i; return; }
-	}
-
-	*sectnum = -1;
+	*sectnum = findsectorgrid(x,y,z,1);
 }
 
 
@@ -9397,10 +10622,13 @@ void getzrange(int x, int y, int z, short sectnum,
 	sectortype *sec;
 	walltype *wal, *wal2;
 	spritetype *spr;
+	clipspritetype *cs;
+	clipspriteiter it;
 	int clipsectcnt, startwall, endwall, tilenum, xoff, yoff, dax, day;
 	int xmin, ymin, xmax, ymax, i, j, k, l, daz, daz2, dx, dy;
 	int x1, y1, x2, y2, x3, y3, x4, y4, ang, cosang, sinang;
 	int xspan, yspan, xrepeat, yrepeat, dasprclipmask, dawalclipmask;
+	int usebox;
 	short cstat;
 	unsigned char clipyou;
 
@@ -9415,6 +10643,7 @@ void getzrange(int x, int y, int z, short sectnum,
 	i = walldist+MAXCLIPDIST+1;
 	xmin = x-i; ymin = y-i;
 	xmax = x+i; ymax = y+i;
+	usebox = usewallboxes();
 
 	getzsofslope(sectnum,x,y,ceilz,florz);
 	*ceilhit = sectnum+16384; *florhit = sectnum+16384;
@@ -9422,8 +10651,8 @@ void getzrange(int x, int y, int z, short sectnum,
 	dawalclipmask = (cliptype&65535);
 	dasprclipmask = (cliptype>>16);
 
-	clipsectorlist[0] = sectnum;
-	clipsectcnt = 0; clipsectnum = 1;
+	clipsectorbegin(sectnum);
+	clipsectcnt = 0;
 
 	do  //Collect sectors inside your square first
 	{
@@ -9434,6 +10663,11 @@ void getzrange(int x, int y, int z, short sectnum,
 			k = wal->nextsector;
 			if (k >= 0)
 			{
+				if (usebox)
+				{
+					if ((wallbox[j][2] < xmin) || (wallbox[j][0] > xmax)) continue;
+					if ((wallbox[j][3] < ymin) || (wallbox[j][1] > ymax)) continue;
+				}
 				wal2 = &wall[wal->point2];
 				x1 = wal->x; x2 = wal2->x;
 				if ((x1 < xmin) && (x2 < xmin)) continue;
@@ -9456,8 +10690,7 @@ void getzrange(int x, int y, int z, short sectnum,
 					if (((sec->floorstat&1) == 0) && (z >= sec->floorz-(3<<8))) continue;
 				}
 
-				for(i=clipsectnum-1;i>=0;i--) if (clipsectorlist[i] == k) break;
-				if (i < 0) clipsectorlist[clipsectnum++] = k;
+				clipsectoradd((short)k);
 
 				if ((x1 < xmin+MAXCLIPDIST) && (x2 < xmin+MAXCLIPDIST)) continue;
 				if ((x1 > xmax-MAXCLIPDIST) && (x2 > xmax-MAXCLIPDIST)) continue;
@@ -9478,8 +10711,10 @@ void getzrange(int x, int y, int z, short sectnum,
 
 	for(i=0;i<clipsectnum;i++)
 	{
-		for(j=headspritesect[clipsectorlist[i]];j>=0;j=nextspritesect[j])
+		clipspritesbegin(clipsectorlist[i],&it);
+		while ((j = nextclipsprite(&it,xmin,ymin,xmax,ymax)) >= 0)
 		{
+			cs = cachedclipsprite(j);
 			spr = &sprite[j];
 			cstat = spr->cstat;
 			if (cstat&dasprclipmask)
@@ -9493,29 +10728,41 @@ void getzrange(int x, int y, int z, short sectnum,
 						k = walldist+(spr->clipdist<<2)+1;
 						if ((klabs(x1-x) <= k) && (klabs(y1-y) <= k))
 						{
-							daz = spr->z;
-							k = ((tilesizy[spr->picnum]*spr->yrepeat)<<1);
-							if (cstat&128) daz += k;
-							if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
-							daz2 = daz - (k<<1);
+							if (cs) daz = cs->zbot, daz2 = cs->ztop;
+							else
+							{
+								daz = spr->z;
+								k = ((tilesizy[spr->picnum]*spr->yrepeat)<<1);
+								if (cstat&128) daz += k;
+								if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
+								daz2 = daz - (k<<1);
+							}
 							clipyou = 1;
 						}
 						break;
 					case 16:
-						tilenum = spr->picnum;
-						xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
-						if ((cstat&4) > 0) xoff = -xoff;
-						k = spr->ang; l = spr->xrepeat;
-						dax = sintable[k&2047]*l; day = sintable[(k+1536)&2047]*l;
-						l = tilesizx[tilenum]; k = (l>>1)+xoff;
-						x1 -= mulscale16(dax,k); x2 = x1+mulscale16(dax,l);
-						y1 -= mulscale16(day,k); y2 = y1+mulscale16(day,l);
+						if (cs) x1 = cs->x[0], y1 = cs->y[0], x2 = cs->x[1], y2 = cs->y[1];
+						else
+						{
+							tilenum = spr->picnum;
+							xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
+							if ((cstat&4) > 0) xoff = -xoff;
+							k = spr->ang; l = spr->xrepeat;
+							dax = sintable[k&2047]*l; day = sintable[(k+1536)&2047]*l;
+							l = tilesizx[tilenum]; k = (l>>1)+xoff;
+							x1 -= mulscale16(dax,k); x2 = x1+mulscale16(dax,l);
+							y1 -= mulscale16(day,k); y2 = y1+mulscale16(day,l);
+						}
 						if (clipinsideboxline(x,y,x1,y1,x2,y2,walldist+1) != 0)
 						{
-							daz = spr->z; k = ((tilesizy[spr->picnum]*spr->yrepeat)<<1);
-							if (cstat&128) daz += k;
-							if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
-							daz2 = daz-(k<<1);
+							if (cs) daz = cs->zbot, daz2 = cs->ztop;
+							else
+							{
+								daz = spr->z; k = ((tilesizy[spr->picnum]*spr->yrepeat)<<1);
+								if (cstat&128) daz += k;
+								if (picanm[spr->picnum]&0x00ff0000) daz -= ((int)((signed char)((picanm[spr->picnum]>>16)&255))*spr->yrepeat<<2);
+								daz2 = daz-(k<<1);
+							}
 							clipyou = 1;
 						}
 						break;
@@ -9525,26 +10772,34 @@ void getzrange(int x, int y, int z, short sectnum,
 						if ((cstat&64) != 0)
 							if ((z > daz) == ((cstat&8)==0)) continue;
 
-						tilenum = spr->picnum;
-						xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
-						yoff = (int)((signed char)((picanm[tilenum]>>16)&255))+((int)spr->yoffset);
-						if ((cstat&4) > 0) xoff = -xoff;
-						if ((cstat&8) > 0) yoff = -yoff;
-
-						ang = spr->ang;
-						cosang = sintable[(ang+512)&2047]; sinang = sintable[ang];
-						xspan = tilesizx[tilenum]; xrepeat = spr->xrepeat;
-						yspan = tilesizy[tilenum]; yrepeat = spr->yrepeat;
-
-						dax = ((xspan>>1)+xoff)*xrepeat; day = ((yspan>>1)+yoff)*yrepeat;
-						x1 += dmulscale16(sinang,dax,cosang,day)-x;
-						y1 += dmulscale16(sinang,day,-cosang,dax)-y;
-						l = xspan*xrepeat;
-						x2 = x1 - mulscale16(sinang,l);
-						y2 = y1 + mulscale16(cosang,l);
-						l = yspan*yrepeat;
-						k = -mulscale16(cosang,l); x3 = x2+k; x4 = x1+k;
-						k = -mulscale16(sinang,l); y3 = y2+k; y4 = y1+k;
+						if (cs)
+						{
+							x1 = cs->x[0]-x; x2 = cs->x[1]-x; x3 = cs->x[2]-x; x4 = cs->x[3]-x;
+							y1 = cs->y[0]-y; y2 = cs->y[1]-y; y3 = cs->y[2]-y; y4 = cs->y[3]-y;
+						}
+						else
+						{
+							tilenum = spr->picnum;
+							xoff = (int)((signed char)((picanm[tilenum]>>8)&255))+((int)spr->xoffset);
+							yoff = (int)((signed char)((picanm[tilenum]>>16)&255))+((int)spr->yoffset);
+							if ((cstat&4) > 0) xoff = -xoff;
+							if ((cstat&8) > 0) yoff = -yoff;
+
+							ang = spr->ang;
+							cosang = sintable[(ang+512)&2047]; sinang = sintable[ang];
+							xspan = tilesizx[tilenum]; xrepeat = spr->xrepeat;
+							yspan = tilesizy[tilenum]; yrepeat = spr->yrepeat;
+
+							dax = ((xspan>>1)+xoff)*xrepeat; day = ((yspan>>1)+yoff)*yrepeat;
+							x1 += dmulscale16(sinang,dax,cosang,day)-x;
+							y1 += dmulscale16(sinang,day,-cosang,dax)-y;
+							l = xspan*xrepeat;
+							x2 = x1 - mulscale16(sinang,l);
+							y2 = y1 + mulscale16(cosang,l);
+							l = yspan*yrepeat;
+							k = -mulscale16(cosang,l); x3 = x2+k; x4 = x1+k;
+							k = -mulscale16(sinang,l); y3 = y2+k; y4 = y1+k;
+						}
 
 						dax = mulscale14(sintable[(spr->ang-256+512)&2047],walldist+4);
 						day = mulscale14(sintable[(spr->ang-256)&2047],walldist+4);
@@ -9661,7 +10916,9 @@ void rotatesprite(int sx, int sy, int z, short a, short picnum, signed char dash
 
 	if (((dastat&128) == 0) || (numpages < 2) || (beforedrawrooms != 0)) {
 		begindrawing();	//{{{
+		profilebegin(PROFILE_ROTATESPRITE);
 		dorotatesprite(sx,sy,z,a,picnum,dashade,dapalnum,dastat,cx1,cy1,cx2,cy2,guniqhudid);
+		profileend(PROFILE_ROTATESPRITE);
 		enddrawing();	//}}}
 	}
 
@@ -9763,6 +11020,9 @@ int makepalookup(int palnum, unsigned char *remapbuf, signed char r, signed char
 	if (dastat == 0) return 0;
 	if ((r|g|b|63) != 63) return 0;
 
+		//Rotatesprites drawn with the old table have to be drawn again
+	numhudsprites[0] = numhudsprites[1] = 0;
+
 	if ((r|g|b) == 0)
 	{
 		for(i=0;i<256;i++)
@@ -9938,6 +11198,7 @@ void clearview(int dacol)
 #endif
 
 	begindrawing();	//{{{
+	markdirtyrect(windowx1,windowy1,windowx2+1,windowy2+1);
 	dx = windowx2-windowx1+1;
 	//dacol += (dacol<<8); dacol += (dacol<<16);
 	p = frameplace+ylookup[windowy1]+windowx1;
@@ -9980,6 +11241,7 @@ void clearallviews(int dacol)
 #endif
 
 	begindrawing();	//{{{
+	markdirtyrect(0,0,xdim,ydim);
 	//clearbufbyte((void*)frameplace,imageSize,0L);
 	Bmemset((void*)frameplace,dacol,imageSize);
 	enddrawing();	//}}}
@@ -10001,6 +11263,7 @@ void plotpixel(int x, int y, unsigned char col)
 	begindrawing();	//{{{
 	drawpixel((void*)(ylookup[y]+x+frameplace),(int)col);
 	enddrawing();	//}}}
+	markdirtyrect(x,y,x+1,y+1);
 }
 
 
@@ -10022,6 +11285,126 @@ unsigned char getpixel(int x, int y)
 }
 
 
+//
+// markdirtyrect
+//
+void markdirtyrect(int x1, int y1, int x2, int y2)
+{
+	dirtyrecttype *r;
+	hudspritetype *hs;
+	int i, r2, best, grow, bestgrow;
+
+	if (setviewcnt > 0) return;	// drawing into a tile
+
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 > xdim) x2 = xdim;
+	if (y2 > ydim) y2 = ydim;
+	if ((x1 >= x2) || (y1 >= y2)) return;
+
+		//Rotatesprites this draws over have to be drawn again
+	for(i=0;i<2;i++)
+		for(r2=0;r2<numhudsprites[i];r2++)
+		{
+			hs = &hudsprites[i][r2];
+			if ((x1 < hs->x2) && (x2 > hs->x1) && (y1 < hs->y2) && (y2 > hs->y1)) hs->stale = 1;
+		}
+
+		//Join a rectangle this touches, or once there's no room for another,
+		//the one it grows least
+	best = -1; bestgrow = 0x7fffffff;
+	for(i=0;i<numdirtyrects;i++)
+	{
+		r = &dirtyrects[i];
+		if ((x1 >= r->x1) && (y1 >= r->y1) && (x2 <= r->x2) && (y2 <= r->y2)) return;
+		if ((x1 <= r->x2) && (x2 >= r->x1) && (y1 <= r->y2) && (y2 >= r->y1)) { best = i; break; }
+		if (numdirtyrects == MAXDIRTYRECTS)
+		{
+			grow = (max(x2,r->x2)-min(x1,r->x1))*(max(y2,r->y2)-min(y1,r->y1)) - (r->x2-r->x1)*(r->y2-r->y1);
+			if (grow < bestgrow) { bestgrow = grow; best = i; }
+		}
+	}
+
+	if (best < 0)
+	{
+		r = &dirtyrects[numdirtyrects++];
+		r->x1 = x1; r->y1 = y1; r->x2 = x2; r->y2 = y2;
+		return;
+	}
+	r = &dirtyrects[best];
+	r->x1 = min(r->x1,x1); r->y1 = min(r->y1,y1);
+	r->x2 = max(r->x2,x2); r->y2 = max(r->y2,y2);
+}
+
+
+//
+// getdirtyrects
+//
+int getdirtyrects(dirtyrecttype *rects)
+{
+	int n;
+
+	if (qsetmode != 200)
+	{
+			//The 2D editor modes draw everywhere without saying
+		rects[0].x1 = 0; rects[0].y1 = 0;
+		rects[0].x2 = xdim; rects[0].y2 = ydim;
+		n = 1;
+	}
+	else
+	{
+		n = numdirtyrects;
+		memcpy(rects, dirtyrects, n * sizeof(dirtyrecttype));
+	}
+	numdirtyrects = 0;
+	return n;
+}
+
+
+//
+// hudsprite (internal)
+//  Notes a rotatesprite about to be drawn on screen, returning where to keep
+//  what it draws, or NULL if it isn't kept. *same is set if it was drawn the
+//  same last frame and nothing has drawn over it since, so needn't be drawn.
+//
+static hudspritetype *hudsprite(int sx, int sy, int z, short a, short picnum, signed char dashade,
+	unsigned char dapalnum, unsigned char dastat, int cx1, int cy1, int cx2, int cy2, int *same)
+{
+	hudspritetype *hs, *last;
+	int i;
+
+	*same = 0;
+		//Only a single page persists, and translucency doesn't draw the same twice
+	if ((!dirtyblit) || (qsetmode != 200) || (setviewcnt > 0) || (numpages != 1)) return NULL;
+	if ((dastat&1) || (waloff[picnum] == 0)) return NULL;
+	if (numhudsprites[hudframe] >= MAXHUDSPRITES) return NULL;
+
+	hs = &hudsprites[hudframe][numhudsprites[hudframe]++];
+	memset(hs, 0, sizeof(hudspritetype));
+	hs->key.sx = sx; hs->key.sy = sy; hs->key.z = z; hs->key.a = a;
+	hs->key.picnum = picnum; hs->key.dashade = dashade;
+	hs->key.dapalnum = dapalnum; hs->key.dastat = dastat;
+	hs->key.cx1 = cx1; hs->key.cy1 = cy1; hs->key.cx2 = cx2; hs->key.cy2 = cy2;
+		//Games change tiles in place, so the pixels are part of the key
+	hs->key.bufplc = waloff[picnum];
+	hs->key.tilecrc = crc32once((unsigned char *)waloff[picnum], tilesizx[picnum]*tilesizy[picnum]);
+	hs->key.xdimen = xdimen; hs->key.ydimen = ydimen;
+	hs->key.xyaspect = xyaspect; hs->key.yxaspect = yxaspect;
+
+	for(i=numhudsprites[hudframe^1]-1;i>=0;i--)
+	{
+		last = &hudsprites[hudframe^1][i];
+		if (last->stale) continue;
+		if (memcmp(&last->key, &hs->key, sizeof(hs->key))) continue;
+		last->stale = 1;	//matches once
+		hs->x1 = last->x1; hs->y1 = last->y1; hs->x2 = last->x2; hs->y2 = last->y2;
+		*same = 1;
+		break;
+	}
+	return hs;
+}
+
+
 	//MUST USE RESTOREFORDRAWROOMS AFTER DRAWING
 
 //
@@ -10380,6 +11763,7 @@ void drawline256(int x1, int y1, int x2, int y2, unsigned char col)
 	intptr_t p, plc;
 
 	col = palookup[0][col];
+	markdirtyrect(min(x1,x2)>>12,min(y1,y2)>>12,(max(x1,x2)>>12)+1,(max(y1,y2)>>12)+1);
 
 	dx = x2-x1; dy = y2-y1;
 	if (dx >= 0)
@@ -11128,6 +12512,7 @@ void printext256(int xpos, int ypos, short col, short backcol, const char *name,
 		stx += charxsiz;
 	}
 	enddrawing();	//}}}
+	markdirtyrect(xpos-fontsize,ypos,stx-fontsize,ypos+8);
 }
 
 
@@ -11446,6 +12831,7 @@ int setrendermode(int renderer)
 	}
 
 	rendmode = renderer;
+	if (rendmode) tilestream_resolveplaceholders();
 
 	return 0;
 }
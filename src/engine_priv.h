@@ -57,7 +57,31 @@ extern palette_t palookupfog[MAXPALOOKUPS];
 
 int wallmost(short *mostbuf, int w, int sectnum, unsigned char dastat);
 int wallfront(int l1, int l2);
+extern renderstatstype renderstats;
 int animateoffs(short tilenum, short fakevar);
+const unsigned char *getpvsrow(short sectnum);
+
+	// tilestream.c
+extern unsigned char tilefilenum[MAXTILES];
+extern int tilefileoffs[MAXTILES];
+unsigned char *tilestream_claim(short tilenume);
+void tilestream_cancel(short tilenume);
+int tilestream_placehold(short tilenume);
+void tilestream_update(void);
+void tilestream_resolveplaceholders(void);
+void tilestream_setartfile(int filenum, const char *filename);
+void tilestream_reset(void);
+
+	// profile.c
+extern int profiling;
+int64_t profileclock(void);	// nanoseconds from some fixed point
+void profilepush(int timer);
+void profilepop(int timer);
+void profiletile(int bytes);
+void drawprofile(void);
+void uninitprofile(void);
+static inline void profilebegin(int timer) { if (profiling) profilepush(timer); }
+static inline void profileend(int timer) { if (profiling) profilepop(timer); }
 
 
 #if defined(__WATCOMC__) && USE_ASM
@@ -452,6 +452,21 @@ void glbuild_update_8bit_frame(glbuild8bit *state, const GLvoid *frame, int resx
 	glfunc.glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, stride, resy, extfmt, GL_UNSIGNED_BYTE, frame);
 }
 
+void glbuild_update_8bit_rows(glbuild8bit *state, const GLvoid *frame, int stride, int y1, int y2)
+{
+#if (USE_OPENGL == USE_GLES2)
+	GLenum extfmt = GL_LUMINANCE;
+#else
+	GLenum extfmt = GL_RED;
+#endif
+
+	// Whole rows, as GLES2 can't unpack part of one from a wider image.
+	glfunc.glActiveTexture(GL_TEXTURE0);
+	glfunc.glBindTexture(GL_TEXTURE_2D, state->frametex);
+	glfunc.glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y1, stride, y2 - y1, extfmt, GL_UNSIGNED_BYTE,
+		(const GLubyte *)frame + y1 * stride);
+}
+
 void glbuild_draw_8bit_frame(glbuild8bit *state)
 {
 #if (USE_OPENGL == USE_GLES2)
@@ -95,8 +95,29 @@ static __inline int filelength (int h)
 #define _inline inline
 #endif
 
-static int bytesperline, xres, yres, globxoffs, globyoffs;
-static INT_PTR frameplace;
+	//Every thread gets its own copy of the decoders' state, so pictures and ZIP
+	//streams can be decoded on several threads at once. The x86 assembly takes
+	//the address of some of it, so builds using that share one copy instead.
+#if defined(_MSC_VER) && !(defined(_M_IX86) && USE_ASM)
+#define KPTHREAD __declspec(thread)
+#elif defined(__GNUC__) && !(defined(__i386__) && USE_ASM)
+#define KPTHREAD __thread
+#else
+#define KPTHREAD
+#define KPNOTHREADS
+#endif
+
+static KPTHREAD int bytesperline, xres, yres, globxoffs, globyoffs;
+static KPTHREAD INT_PTR frameplace;
+
+int kpthreadsafe ()
+{
+#ifdef KPNOTHREADS
+	return(0);
+#else
+	return(1);
+#endif
+}
 
 static const int pow2mask[32] =
 {
@@ -124,7 +145,7 @@ static const int pow2long[32] =
 	//Hack for peekbits,getbits,suckbits (to prevent lots of duplicate code)
 	//   0: PNG: do 12-byte chunk_header removal hack
 	// !=0: ZIP: use 64K buffer (olinbuf)
-static int zipfilmode;
+static KPTHREAD int zipfilmode;
 typedef struct
 {
 	FILE *fil;   //0:no file open, !=0:open file (either stand-alone or zip)
@@ -139,8 +160,111 @@ typedef struct
 	int i;       //For stand-alone/ZIP comptyp#0, this is like "uncomptell"
 					  //For ZIP comptyp#8&btype==0 "<64K store", this saves i state
 	int bfinal;  //LZ77 decompression state (for later calls)
+	struct kzsnap *snap; //Decoder state saved while another stream or PNG uses it, or 0
+	int snapvalid;
+	int combase; //Compressed offset of olinbuf[0]
+	struct kzchk *chk; //Checkpoints to resume *flate from, in order of position
+	int numchk, maxchk;
 } kzfilestate;
-static kzfilestate kzfs;
+static KPTHREAD kzfilestate kzdefaultfs, *kzfs = 0; //Current stream for kzread(), kzseek(), etc.. 0:kzdefaultfs
+static KPTHREAD kzfilestate *kzdecoder = 0; //Stream whose *flate state is in this thread's decoder globals
+
+	//Variables to speed up dynamic Huffman decoding:
+#define LOGQHUFSIZ0 9
+#define LOGQHUFSIZ1 6
+
+	//The *flate decoder's tables and window, which a paused ZIP stream keeps
+typedef struct
+{
+	int ibuf0[288], nbuf0[32], ibuf1[32], nbuf1[32];
+	int qhufval0[1<<LOGQHUFSIZ0], qhufval1[1<<LOGQHUFSIZ1];
+	unsigned char qhufbit0[1<<LOGQHUFSIZ0], qhufbit1[1<<LOGQHUFSIZ1];
+	unsigned char slidebuf[32768];
+} kzflate;
+
+	//The decoders' tables and buffers. Together they are too big to give
+	//every thread a copy, so each thread that decodes allocates its own the
+	//first time (see kpgetctx), and only the pointer is thread-local.
+typedef struct
+{
+		//.PNG & ZIP:
+	kzflate fl;
+	int clen[320], cclen[19], hxbit[59][2];
+	unsigned int kphlitval[288], kphdistval[32];
+	unsigned char pnginited;
+#ifndef KPNOTHREADS
+	unsigned char olinbuf[65536]; //WARNING:max xres is: 65536/bpp-1
+	int abstab10[1024], palcol[256];
+#endif
+
+		//.JPG:
+	int kpeginited;
+	int hufmaxatbit[8][20], hufvalatbit[8][20];
+	unsigned char hufnumatbit[8][20], huftable[8][256];
+	int hufquickval[8][1024], hufquickbits[8][1024];
+	int quantab[4][64], dct[12][64], unzig[64], zigit[64]; //dct:10=MAX (says spec);+2 for hacks
+	unsigned char dcflagor[64];
+	int colclip[1024], colclipup8[1024], colclipup16[1024];
+	int crmul[4096], cbmul[4096];
+
+		//.GIF:
+	unsigned char suffix[4100], filbuffer[768], tempstack[4096];
+	int prefix[4100];
+} kpctxtype;
+static KPTHREAD kpctxtype *kpctx = 0;
+
+#define ibuf0 (kpctx->fl.ibuf0)
+#define nbuf0 (kpctx->fl.nbuf0)
+#define ibuf1 (kpctx->fl.ibuf1)
+#define nbuf1 (kpctx->fl.nbuf1)
+#define qhufval0 (kpctx->fl.qhufval0)
+#define qhufval1 (kpctx->fl.qhufval1)
+#define qhufbit0 (kpctx->fl.qhufbit0)
+#define qhufbit1 (kpctx->fl.qhufbit1)
+#define slidebuf (kpctx->fl.slidebuf)
+#define clen (kpctx->clen)
+#define cclen (kpctx->cclen)
+#define hxbit (kpctx->hxbit)
+#define kphlitval (kpctx->kphlitval)
+#define kphdistval (kpctx->kphdistval)
+#define pnginited (kpctx->pnginited)
+#ifdef KPNOTHREADS
+	//The x86 assembly addresses these directly, so they stay static
+static unsigned char olinbuf[65536]; //WARNING:max xres is: 65536/bpp-1
+static int abstab10[1024], palcol[256];
+#else
+#define olinbuf (kpctx->olinbuf)
+#define abstab10 (kpctx->abstab10)
+#define palcol (kpctx->palcol)
+#endif
+#define kpeginited (kpctx->kpeginited)
+#define hufmaxatbit (kpctx->hufmaxatbit)
+#define hufvalatbit (kpctx->hufvalatbit)
+#define hufnumatbit (kpctx->hufnumatbit)
+#define huftable (kpctx->huftable)
+#define hufquickval (kpctx->hufquickval)
+#define hufquickbits (kpctx->hufquickbits)
+#define quantab (kpctx->quantab)
+#define dct (kpctx->dct)
+#define unzig (kpctx->unzig)
+#define zigit (kpctx->zigit)
+#define dcflagor (kpctx->dcflagor)
+#define colclip (kpctx->colclip)
+#define colclipup8 (kpctx->colclipup8)
+#define colclipup16 (kpctx->colclipup16)
+#define crmul (kpctx->crmul)
+#define cbmul (kpctx->cbmul)
+#define suffix (kpctx->suffix)
+#define filbuffer (kpctx->filbuffer)
+#define tempstack (kpctx->tempstack)
+#define prefix (kpctx->prefix)
+
+	//Allocates the calling thread's decoder state if it has none yet
+static int kpgetctx ()
+{
+	if (!kpctx) kpctx = (kpctxtype *)calloc(1,sizeof(kpctxtype));
+	return(kpctx != 0);
+}
 
 //Initialized tables (can't be in union)
 //jpg:                png:
@@ -154,8 +278,8 @@ static kzfilestate kzfs;
 //   pow2mask     128*
 //   dcflagor      64
 
-int palcol[256], paleng, bakcol, numhufblocks, zlibcompflags;
-signed char coltype, filtype, bitdepth;
+KPTHREAD int paleng, bakcol, numhufblocks, zlibcompflags;
+KPTHREAD signed char coltype, filtype, bitdepth;
 
 //============================ KPNGILIB begins ===============================
 
@@ -170,23 +294,88 @@ signed char coltype, filtype, bitdepth;
 //   * Some useless ancillary chunks, like: gAMA(gamma) & pHYs(aspect ratio)
 
 	//.PNG specific variables:
-static int bakr = 0x80, bakg = 0x80, bakb = 0x80; //this used to be public...
-static int gslidew = 0, gslider = 0, xm, xmn[4], xr0, xr1, xplc, yplc;
-static INT_PTR nfplace;
-static int clen[320], cclen[19], bitpos, filt, xsiz, ysiz;
-static int xsizbpl, ixsiz, ixoff, iyoff, ixstp, iystp, intlac, nbpl, trnsrgb;
+static KPTHREAD int bakr = 0x80, bakg = 0x80, bakb = 0x80; //this used to be public...
+static KPTHREAD int gslidew = 0, gslider = 0, xm, xmn[4], xr0, xr1, xplc, yplc;
+static KPTHREAD INT_PTR nfplace;
+static KPTHREAD int bitpos, filt, xsiz, ysiz;
+static KPTHREAD int xsizbpl, ixsiz, ixoff, iyoff, ixstp, iystp, intlac, nbpl, trnsrgb;
 static int ccind[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
-static int hxbit[59][2], ibuf0[288], nbuf0[32], ibuf1[32], nbuf1[32];
-static const unsigned char *filptr;
-static unsigned char slidebuf[32768], opixbuf0[4], opixbuf1[4];
-static unsigned char pnginited = 0, olinbuf[65536]; //WARNING:max xres is: 65536/bpp-1
-static int gotcmov = -2, abstab10[1024];
+static KPTHREAD const unsigned char *filptr;
+static KPTHREAD unsigned char opixbuf0[4], opixbuf1[4];
+static KPTHREAD int gotcmov = -2;
+
+	//Everything a paused *flate stream needs to carry on where it left off.
+	//The decoder globals are shared by every ZIP stream and the PNG decoder,
+	//so a stream's state is saved when something else wants them, and put
+	//back the next time the stream is read.
+typedef struct kzsnap
+{
+	int gslidew, gslider, bitpos, filptrofs;
+	kzflate fl;
+	unsigned char linbuf[65536];
+} kzsnap;
 
-	//Variables to speed up dynamic Huffman decoding:
-#define LOGQHUFSIZ0 9
-#define LOGQHUFSIZ1 6
-static int qhufval0[1<<LOGQHUFSIZ0], qhufval1[1<<LOGQHUFSIZ1];
-static unsigned char qhufbit0[1<<LOGQHUFSIZ0], qhufbit1[1<<LOGQHUFSIZ1];
+static void kzsavesnap (kzsnap *sn)
+{
+	sn->gslidew = gslidew; sn->gslider = gslider; sn->bitpos = bitpos;
+	sn->filptrofs = (int)(filptr-olinbuf);
+	memcpy(&sn->fl,&kpctx->fl,sizeof(kzflate)); memcpy(sn->linbuf,olinbuf,sizeof(olinbuf));
+}
+
+static void kzloadsnap (const kzsnap *sn)
+{
+	gslidew = sn->gslidew; gslider = sn->gslider; bitpos = sn->bitpos;
+	filptr = &olinbuf[sn->filptrofs];
+	memcpy(&kpctx->fl,&sn->fl,sizeof(kzflate)); memcpy(olinbuf,sn->linbuf,sizeof(olinbuf));
+}
+
+	//Saves the state of whichever stream has the decoder, if any
+static void kzsuspend ()
+{
+	kzfilestate *fs = kzdecoder;
+
+	if (!fs) return;
+	kzdecoder = 0;
+	fs->snapvalid = 0;
+	if ((!fs->fil) || (fs->comptyp != 8)) return;
+	if (!fs->snap) { fs->snap = (kzsnap *)malloc(sizeof(kzsnap)); if (!fs->snap) return; }
+	kzsavesnap(fs->snap);
+	fs->snapvalid = 1;
+}
+
+	//A stream whose state goes with it starts over if it is read again
+void kpthreadfree ()
+{
+	if (kzdecoder) { kzdecoder->snapvalid = 0; kzdecoder = 0; }
+	if (kpctx) { free(kpctx); kpctx = 0; }
+}
+
+	//Gives the decoder to the current stream. If its state was lost it starts over.
+static void kzresume ()
+{
+	if (kzdecoder == kzfs) return;
+	kzsuspend();
+	kzdecoder = kzfs;
+	if (kzfs->snapvalid) kzloadsnap(kzfs->snap);
+	else gslidew = 0x7fffffff; //Force reload at beginning
+}
+
+	//Periodic snapshots of a stream's *flate state, so seeking backwards (or
+	//forwards past what was decoded before) resumes from the nearest one rather
+	//than unzipping from the beginning. Each is taken where kzread() could
+	//have paused, so loading one is the same as having paused there.
+typedef struct kzchk
+{
+	int gslidew, gslider, jmpplc, i, bfinal, compofs, bitofs;
+	kzflate fl;
+} kzchk;
+static int kzchkinterval = 0; //Uncompressed bytes between checkpoints, 0:off
+
+static void kzfreecheckpoints ()
+{
+	if (kzfs->chk) { free(kzfs->chk); kzfs->chk = 0; }
+	kzfs->numchk = kzfs->maxchk = 0;
+}
 
 #if defined(__WATCOMC__) && USE_ASM
 
@@ -405,8 +594,8 @@ static int getcputype ()
 	return(i);
 }
 
-static unsigned char fakebuf[8], *nfilptr;
-static int nbitpos;
+static KPTHREAD unsigned char fakebuf[8], *nfilptr;
+static KPTHREAD int nbitpos;
 static void suckbitsnextblock ()
 {
 	int n;
@@ -436,9 +625,10 @@ static void suckbitsnextblock ()
 	{
 			//NOTE: should only read bytes inside compsize, not 64K!!! :/
 		*(int *)&olinbuf[0] = *(int *)&olinbuf[sizeof(olinbuf)-4];
-		n = min((unsigned)(kzfs.compleng-kzfs.comptell),sizeof(olinbuf)-4);
-		fread(&olinbuf[4],n,1,kzfs.fil);
-		kzfs.comptell += n;
+		n = min((unsigned)(kzfs->compleng-kzfs->comptell),sizeof(olinbuf)-4);
+		fread(&olinbuf[4],n,1,kzfs->fil);
+		kzfs->comptell += n;
+		kzfs->combase += sizeof(olinbuf)-4;
 		bitpos -= ((sizeof(olinbuf)-4)<<3);
 	}
 }
@@ -853,7 +1043,7 @@ static inline void pal8hlineasm (int x, int xr1, INT_PTR p, int ixstp)
 	//    /f3: 3333333...
 	//    /f4: 4444444...
 	//    /f5: 0142321...
-static int filter1st, filterest;
+static KPTHREAD int filter1st, filterest;
 static void putbuf (const unsigned char *buf, int leng)
 {
 	int i, x;
@@ -983,6 +1173,515 @@ static void putbuf (const unsigned char *buf, int leng)
 	}
 }
 
+	//Fast path for kpngrend(), on by default (see kpngsetfast()). The IDAT
+	//chunks are inflated in one go with table-driven Huffman decoding, whole
+	//rows are unfiltered at a time (SSE2 where the compiler allows), and each
+	//is converted straight into the frame. Output is identical to the
+	//original decoder, which stays as the reference and for kpngsetfast(0).
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define KPNGSSE2 1
+#include <emmintrin.h>
+#endif
+
+static int kpngfast = 1;
+
+#define KPH_SUB 0x8000 //Huffman table entry: points to a subtable
+#define KPH_LIT 0x4000 //                     literal (or code length code) in bits 16-23
+#define KPH_EOB 0x2000 //                     end of block
+	//Otherwise bits 16-31 are a length/distance base, 8-11 its extra bits.
+	//Bits 0-4 are the code length, 0 meaning an invalid code.
+#define KPHLITBITS 10
+#define KPHDISTBITS 8
+
+#define KPNGHIST 32768 //*flate window
+#define KPNGCHUNK 131072 //Inflated bytes between row flushes
+#define KPNGSLACK 528 //Room for a match overrun and reading past a row
+
+typedef struct
+{
+	unsigned int lit[(1<<KPHLITBITS)+288*(1<<(15-KPHLITBITS))];
+	unsigned int dist[(1<<KPHDISTBITS)+32*(1<<(15-KPHDISTBITS))];
+	unsigned int clentab[128];
+	unsigned char lens[320];
+
+	unsigned char *obuf; //Inflated stream: history, then rows still to be processed
+	int obufsiz, rowpos; //rowpos: offset of the next row's filter byte in obuf
+	unsigned char *prev, *cur; //Unfiltered rows, with 16 zero bytes before each
+	int intlac, ixoff, iyoff, ixstpl, iystpl, ixsiz, iysiz, rowbpl, bpp, y, cx0, cx1;
+	int done; //1: every visible row is drawn, -1: bad filter type
+} kpngfastype;
+
+	//Builds a 2-level lookup table for a canonical Huffman code: 1<<tbits
+	//entries indexed by the next tbits of input, then subtables of
+	//1<<(15-tbits) entries for longer codes. symval[] is each symbol's entry
+	//less its length, 0 for symbols that must not appear.
+static int kpnghufbuild (unsigned int *tab, int tbits, const unsigned char *lens, int n, const unsigned int *symval)
+{
+	int i, j, k, l, r, code, subs, cnt[16], nxt[16];
+
+	for(i=0;i<16;i++) cnt[i] = 0;
+	for(i=0;i<n;i++) cnt[lens[i]]++;
+	cnt[0] = 0;
+	for(i=1,j=1;i<16;i++) { j = (j<<1)-cnt[i]; if (j < 0) return(-1); } //Over-subscribed
+	for(i=1,code=0;i<16;i++) { code = (code+cnt[i-1])<<1; nxt[i] = code; }
+
+	memset(tab,0,sizeof(tab[0])<<tbits);
+	subs = (1<<tbits);
+	for(i=0;i<n;i++)
+	{
+		l = lens[i]; if (!l) continue;
+		r = bitrev(nxt[l]++,l);
+		if (!symval[i]) continue;
+		if (l <= tbits)
+		{
+			for(j=r;j<(1<<tbits);j+=(1<<l)) tab[j] = symval[i]|l;
+			continue;
+		}
+		k = (r&((1<<tbits)-1));
+		if (!tab[k])
+		{
+			tab[k] = (subs<<16)|KPH_SUB|tbits;
+			memset(&tab[subs],0,sizeof(tab[0])<<(15-tbits));
+			subs += (1<<(15-tbits));
+		}
+		for(j=(r>>tbits);j<(1<<(15-tbits));j+=(1<<(l-tbits))) tab[(tab[k]>>16)+j] = symval[i]|l;
+	}
+	return(0);
+}
+
+static _inline unsigned long long kpngle64 (const unsigned char *p)
+{
+#ifdef BIGENDIAN
+	return(((unsigned long long)LSWAPIB(*(unsigned int *)&p[4])<<32)|LSWAPIB(*(unsigned int *)&p[0]));
+#else
+	unsigned long long v;
+	memcpy(&v,p,8);
+	return(v);
+#endif
+}
+
+	//Sets up the next Adam7 pass that has any pixels, as initpass() does.
+	//Returns 0 when there are none left.
+static int kpngfastpass (kpngfastype *d)
+{
+	int i, j;
+
+	if (d->intlac < 0) return(0);
+	while (1)
+	{
+		i = (d->intlac<<2);
+		d->ixoff = ((0x04020100>>i)&15);
+		d->iyoff = ((0x00402010>>i)&15);
+		if ((d->ixoff < xsiz) && (d->iyoff < ysiz)) break;
+		if (d->intlac < 2) { d->intlac = -1; return(0); }
+		d->intlac--;
+	}
+
+	d->ixstpl = j = ((0x33221100>>i)&15);
+	d->iystpl = ((0x33322110>>i)&15);
+	d->ixsiz = ((xsiz+(1<<j)-1-d->ixoff)>>j);
+	d->iysiz = ((ysiz+(1<<d->iystpl)-1-d->iyoff)>>d->iystpl);
+	d->rowbpl = ((0x04021301>>(coltype<<2))&15)*d->ixsiz;
+	switch (bitdepth)
+	{
+		case 1: d->rowbpl = ((d->rowbpl+7)>>3); break;
+		case 2: d->rowbpl = ((d->rowbpl+3)>>2); break;
+		case 4: d->rowbpl = ((d->rowbpl+1)>>1); break;
+	}
+	d->cx0 = max((-globxoffs-d->ixoff+(1<<j)-1)>>j,0);
+	d->cx1 = min((xres-globxoffs-d->ixoff+(1<<j)-1)>>j,d->ixsiz);
+	d->y = 0;
+	memset(d->prev,0,d->rowbpl+16);
+	d->intlac = ((d->intlac >= 2) ? d->intlac-1 : -1); //-1: this is the last pass
+	return(1);
+}
+
+static void kpngunfilter (int filt, const unsigned char *r, const unsigned char *p, unsigned char *c, int n, int bpp)
+{
+	int i, pa, pb, pc;
+
+	switch (filt)
+	{
+		case 0: memcpy(c,r,n); return;
+		case 1:
+#if KPNGSSE2
+			if (bpp >= 3)
+			{
+				__m128i a = _mm_setzero_si128();
+				for(i=0;i<n;i+=bpp)
+				{
+					a = _mm_add_epi8(a,_mm_cvtsi32_si128(*(int *)&r[i]));
+					*(int *)&c[i] = _mm_cvtsi128_si32(a);
+				}
+				return;
+			}
+#endif
+			for(i=0;i<n;i++) c[i] = (unsigned char)(r[i]+c[i-bpp]);
+			return;
+		case 2:
+#if KPNGSSE2
+			for(i=0;i<n;i+=16)
+				_mm_storeu_si128((__m128i *)&c[i],_mm_add_epi8(_mm_loadu_si128((const __m128i *)&r[i]),_mm_loadu_si128((const __m128i *)&p[i])));
+#else
+			for(i=0;i<n;i++) c[i] = (unsigned char)(r[i]+p[i]);
+#endif
+			return;
+		case 3:
+#if KPNGSSE2
+			if (bpp >= 3)
+			{
+				__m128i a = _mm_setzero_si128(), b, one = _mm_set1_epi8(1);
+				for(i=0;i<n;i+=bpp)
+				{
+					b = _mm_cvtsi32_si128(*(int *)&p[i]);
+						//avg_epu8 rounds up; the filter rounds down
+					a = _mm_sub_epi8(_mm_avg_epu8(a,b),_mm_and_si128(_mm_xor_si128(a,b),one));
+					a = _mm_add_epi8(a,_mm_cvtsi32_si128(*(int *)&r[i]));
+					*(int *)&c[i] = _mm_cvtsi128_si32(a);
+				}
+				return;
+			}
+#endif
+			for(i=0;i<n;i++) c[i] = (unsigned char)(r[i]+((c[i-bpp]+p[i])>>1));
+			return;
+		default:
+#if KPNGSSE2
+			if (bpp >= 3)
+			{
+				__m128i z = _mm_setzero_si128(), a = z, b, cc = z, x, da, db, dc, nota, usec;
+				for(i=0;i<n;i+=bpp)
+				{
+					b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(int *)&p[i]),z);
+					da = _mm_sub_epi16(b,cc); db = _mm_sub_epi16(a,cc); dc = _mm_add_epi16(da,db);
+					da = _mm_max_epi16(da,_mm_sub_epi16(z,da));
+					db = _mm_max_epi16(db,_mm_sub_epi16(z,db));
+					dc = _mm_max_epi16(dc,_mm_sub_epi16(z,dc));
+					nota = _mm_or_si128(_mm_cmpgt_epi16(da,db),_mm_cmpgt_epi16(da,dc));
+					usec = _mm_cmpgt_epi16(db,dc);
+					x = _mm_or_si128(_mm_and_si128(usec,cc),_mm_andnot_si128(usec,b));
+					x = _mm_or_si128(_mm_and_si128(nota,x),_mm_andnot_si128(nota,a));
+					x = _mm_add_epi8(_mm_packus_epi16(x,x),_mm_cvtsi32_si128(*(int *)&r[i]));
+					*(int *)&c[i] = _mm_cvtsi128_si32(x);
+					a = _mm_unpacklo_epi8(x,z); cc = b;
+				}
+				return;
+			}
+#endif
+			for(i=0;i<n;i++)
+			{
+				pa = p[i]-p[i-bpp]; pb = c[i-bpp]-p[i-bpp]; pc = labs(pa+pb); pa = labs(pa); pb = labs(pb);
+				if ((pa <= pb) && (pa <= pc)) pa = c[i-bpp];
+				else if (pb <= pc) pa = p[i];
+				else pa = p[i-bpp];
+				c[i] = (unsigned char)(r[i]+pa);
+			}
+			return;
+	}
+}
+
+	//Converts pixels cx0..cx1-1 of an unfiltered row to 32-bit, exactly as putbuf() does
+static void kpngdrawrow (const unsigned char *u, int cx0, int cx1, INT_PTR p, int stp)
+{
+	int x, v;
+
+	switch (coltype)
+	{
+		case 2:
+			for(x=cx0;x<cx1;x++,p+=stp)
+			{
+				v = LSWAPIB((u[x*3]<<16)|(u[x*3+1]<<8)|u[x*3+2]|0xff000000);
+				if (v == trnsrgb) v &= LSWAPIB(0xffffff);
+				*(int *)p = v;
+			}
+			break;
+		case 4:
+			for(x=cx0;x<cx1;x++,p+=stp)
+				*(int *)p = (palcol[u[x*2]]&LSWAPIB(0xffffff))|LSWAPIL((int)u[x*2+1]);
+			break;
+		case 6:
+			x = cx0;
+#if KPNGSSE2
+			if (stp == 4)
+			{
+				__m128i v4, ga = _mm_set1_epi32(0xff00ff00), bm = _mm_set1_epi32(0xff), rm = _mm_set1_epi32(0xff0000);
+				for(;x+4<=cx1;x+=4,p+=16)
+				{
+					v4 = _mm_loadu_si128((const __m128i *)&u[x*4]);
+					v4 = _mm_or_si128(_mm_and_si128(v4,ga),_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v4,16),bm),_mm_and_si128(_mm_slli_epi32(v4,16),rm)));
+					_mm_storeu_si128((__m128i *)p,v4);
+				}
+			}
+#endif
+			for(;x<cx1;x++,p+=stp)
+			{
+				*(unsigned char *)(p  ) = u[x*4+2];
+				*(unsigned char *)(p+1) = u[x*4+1];
+				*(unsigned char *)(p+2) = u[x*4  ];
+				*(unsigned char *)(p+3) = u[x*4+3];
+			}
+			break;
+		default:
+			switch (bitdepth)
+			{
+				case 1: for(x=cx0;x<cx1;x++,p+=stp) *(int *)p = palcol[(u[x>>3]>>(7-(x&7)))&1]; break;
+				case 2: for(x=cx0;x<cx1;x++,p+=stp) *(int *)p = palcol[(u[x>>2]>>(6-((x&3)<<1)))&3]; break;
+				case 4: for(x=cx0;x<cx1;x++,p+=stp) *(int *)p = palcol[(u[x>>1]>>(4-((x&1)<<2)))&15]; break;
+				case 8: for(x=cx0;x<cx1;x++,p+=stp) *(int *)p = palcol[u[x]]; break;
+			}
+			break;
+	}
+}
+
+	//Unfilters and draws every complete row inflated so far
+static void kpngfastrows (kpngfastype *d, int oleng)
+{
+	unsigned char *raw, *t;
+	int desty;
+
+	while ((!d->done) && (d->rowpos+d->rowbpl+1 <= oleng))
+	{
+		raw = &d->obuf[d->rowpos];
+		if (filter1st < 0) filter1st = raw[0]; else filterest |= (1<<raw[0]);
+		if (raw[0] > 5) { d->done = -1; return; } //putbuf() stalls on these too
+		kpngunfilter(raw[0],&raw[1],d->prev,d->cur,d->rowbpl,d->bpp);
+
+		desty = globyoffs+d->iyoff+(d->y<<d->iystpl);
+		if (((unsigned)desty < (unsigned)yres) && (d->cx0 < d->cx1))
+			kpngdrawrow(d->cur,d->cx0,d->cx1,
+				frameplace+(INT_PTR)desty*bytesperline+((globxoffs+d->ixoff+(d->cx0<<d->ixstpl))<<2),4<<d->ixstpl);
+
+		t = d->prev; d->prev = d->cur; d->cur = t;
+		d->rowpos += d->rowbpl+1;
+		d->y++;
+		if (d->y >= d->iysiz) { if (!kpngfastpass(d)) d->done = 1; }
+		else if ((d->intlac < 0) && (desty+(1<<d->iystpl) >= yres)) d->done = 1; //Last pass, and nothing more visible
+	}
+}
+
+	//Processes complete rows, then slides the window down. Returns the new
+	//end of the inflated data.
+static int kpngfastflush (kpngfastype *d, int oleng)
+{
+	int keep;
+
+	kpngfastrows(d,oleng);
+	keep = min(d->rowpos,oleng-KPNGHIST);
+	if (keep > 0)
+	{
+		memmove(d->obuf,&d->obuf[keep],oleng-keep);
+		d->rowpos -= keep; oleng -= keep;
+	}
+	return(oleng);
+}
+
+static int kpngrendfast (const unsigned char *kfilebuf, int kfilength, const unsigned char *idat, int leng)
+{
+	kpngfastype *d;
+	const unsigned char *ip, *iend, *cp, *fend;
+	unsigned char *ibuf = 0, *rows, *op, *olim, *ss;
+	unsigned long long bitbuf;
+	unsigned int e;
+	int i, j, k, n, bitcnt, bfinal, btype, hlit, hdist, hclen, ileng, dist, rawtotal, ret = -1;
+
+	fend = &kfilebuf[kfilength];
+
+		//Find the extent of the IDAT chunks; join them up if there are several
+	ileng = min(leng,(int)(fend-idat)); if (ileng < 0) return(-1);
+	cp = &idat[ileng+4]; n = 0;
+	while ((cp+8 <= fend) && (*(unsigned int *)&cp[4] == LSWAPIB(0x54414449)))
+	{
+		i = LSWAPIL(*(int *)&cp[0]); if (i < 0) break;
+		i = min(i,(int)(fend-cp-8)); n += i; cp = &cp[i+12];
+	}
+	if ((n) || (&idat[ileng+16] > fend))
+	{
+		ibuf = (unsigned char *)malloc(ileng+n+16); if (!ibuf) return(-1);
+		memcpy(ibuf,idat,ileng); j = ileng;
+		cp = &idat[ileng+4];
+		while ((j < ileng+n) && (*(unsigned int *)&cp[4] == LSWAPIB(0x54414449)))
+		{
+			i = min((int)LSWAPIL(*(int *)&cp[0]),ileng+n-j);
+			memcpy(&ibuf[j],&cp[8],i); j += i; cp = &cp[i+12];
+		}
+		memset(&ibuf[j],0,16);
+		ip = ibuf; iend = &ibuf[j];
+	}
+	else { ip = idat; iend = &idat[ileng]; }
+
+		//Size the window to the whole image if it is small
+	for(i=intlac,rawtotal=0;i>=(intlac?1:0);i--)
+	{
+		j = (i<<2);
+		if ((((0x04020100>>j)&15) >= xsiz) || (((0x00402010>>j)&15) >= ysiz)) continue;
+		n = ((0x04021301>>(coltype<<2))&15)*((xsiz+(1<<((0x33221100>>j)&15))-1-((0x04020100>>j)&15))>>((0x33221100>>j)&15));
+		n = ((n*bitdepth+7)>>3)+1;
+		k = ((ysiz+(1<<((0x33322110>>j)&15))-1-((0x00402010>>j)&15))>>((0x33322110>>j)&15));
+		if (k > (KPNGHIST+KPNGCHUNK-rawtotal)/n) { rawtotal = KPNGHIST+KPNGCHUNK; break; }
+		rawtotal += n*k;
+	}
+
+	rows = 0;
+	d = (kpngfastype *)malloc(sizeof(kpngfastype)); if (!d) { free(ibuf); return(-1); }
+	d->obufsiz = rawtotal+KPNGSLACK;
+	d->obuf = (unsigned char *)malloc(d->obufsiz);
+	rows = (unsigned char *)calloc(2,xsizbpl+64);
+	if ((!d->obuf) || (!rows)) goto kpngrendfast_end;
+	d->prev = &rows[16]; d->cur = &rows[xsizbpl+64+16];
+	d->bpp = ((0x04021301>>(coltype<<2))&15); if (bitdepth < 8) d->bpp = 1;
+	d->intlac = intlac; d->rowpos = 0; d->done = 0;
+	if (!kpngfastpass(d)) goto kpngrendfast_end;
+
+	op = d->obuf; olim = &d->obuf[d->obufsiz-KPNGSLACK];
+	if (ip+2 > iend) goto kpngrendfast_end;
+	zlibcompflags = ip[0]+(ip[1]<<8); ip += 2;
+	bitbuf = 0; bitcnt = 0;
+
+#define KPNGREFILL() { bitbuf |= kpngle64(ip)<<bitcnt; ip += ((63-bitcnt)>>3); bitcnt |= 56; }
+#define KPNGEAT(nb) { bitbuf >>= (nb); bitcnt -= (nb); }
+
+	do
+	{
+		numhufblocks++;
+		KPNGREFILL();
+		bfinal = (int)(bitbuf&1); btype = (int)((bitbuf>>1)&3); KPNGEAT(3);
+		if (btype == 0)
+		{
+				//Raw (uncompressed): give back the whole bytes in bitbuf
+			KPNGEAT(bitcnt&7);
+			ip -= (bitcnt>>3); bitbuf = 0; bitcnt = 0;
+			if (ip+4 > iend) goto kpngrendfast_end;
+			n = ip[0]+(ip[1]<<8); if ((ip[2]+(ip[3]<<8))^n^0xffff) goto kpngrendfast_end;
+			ip += 4;
+			if (n > iend-ip) goto kpngrendfast_end;
+			while (n > 0)
+			{
+				if (op >= olim)
+				{
+					op = &d->obuf[kpngfastflush(d,(int)(op-d->obuf))];
+					if (d->done) goto kpngrendfast_done;
+				}
+				i = min(n,(int)(olim-op));
+				memcpy(op,ip,i); op += i; ip += i; n -= i;
+			}
+			continue;
+		}
+		if (btype == 3) goto kpngrendfast_end;
+
+		if (btype == 1) //Fixed Huffman
+		{
+			for(i=0;i<144;i++) d->lens[i] = 8;
+			for(;i<256;i++) d->lens[i] = 9;
+			for(;i<280;i++) d->lens[i] = 7;
+			for(;i<288;i++) d->lens[i] = 8;
+			for(;i<320;i++) d->lens[i] = 5;
+			hlit = 288; hdist = 32;
+		}
+		else  //Dynamic Huffman
+		{
+			static const unsigned int clenval[19] = {
+				KPH_LIT|(0<<16),KPH_LIT|(1<<16),KPH_LIT|(2<<16),KPH_LIT|(3<<16),KPH_LIT|(4<<16),
+				KPH_LIT|(5<<16),KPH_LIT|(6<<16),KPH_LIT|(7<<16),KPH_LIT|(8<<16),KPH_LIT|(9<<16),
+				KPH_LIT|(10<<16),KPH_LIT|(11<<16),KPH_LIT|(12<<16),KPH_LIT|(13<<16),KPH_LIT|(14<<16),
+				KPH_LIT|(15<<16),KPH_LIT|(16<<16),KPH_LIT|(17<<16),KPH_LIT|(18<<16) };
+			unsigned char cl[19];
+
+			hlit = (int)(bitbuf&31)+257; hdist = (int)((bitbuf>>5)&31)+1; hclen = (int)((bitbuf>>10)&15)+4;
+			KPNGEAT(14);
+			if (hlit > 286) goto kpngrendfast_end;
+			for(i=0;i<19;i++) cl[i] = 0;
+			for(i=0;i<hclen;i++) { KPNGREFILL(); cl[ccind[i]] = (unsigned char)(bitbuf&7); KPNGEAT(3); }
+			if (kpnghufbuild(d->clentab,7,cl,19,clenval)) goto kpngrendfast_end;
+
+			j = 0; n = hlit+hdist;
+			while (j < n)
+			{
+				if (ip > iend+8) goto kpngrendfast_end;
+				KPNGREFILL();
+				e = d->clentab[bitbuf&127]; if (!(e&31)) goto kpngrendfast_end;
+				KPNGEAT(e&31); e >>= 16;
+				if (e < 16) { d->lens[j++] = (unsigned char)e; continue; }
+				if (e == 16)
+				{
+					if (!j) goto kpngrendfast_end;
+					i = (int)(bitbuf&3)+3; KPNGEAT(2); e = d->lens[j-1];
+				}
+				else if (e == 17) { i = (int)(bitbuf&7)+3; KPNGEAT(3); e = 0; }
+				else { i = (int)(bitbuf&127)+11; KPNGEAT(7); e = 0; }
+				if (j+i > n) goto kpngrendfast_end;
+				for(;i;i--) d->lens[j++] = (unsigned char)e;
+			}
+			memmove(&d->lens[288],&d->lens[hlit],hdist);
+			for(i=hlit;i<288;i++) d->lens[i] = 0;
+			for(i=288+hdist;i<320;i++) d->lens[i] = 0;
+		}
+		if (kpnghufbuild(d->lit,KPHLITBITS,d->lens,288,kphlitval)) goto kpngrendfast_end;
+		if (kpnghufbuild(d->dist,KPHDISTBITS,&d->lens[288],32,kphdistval)) goto kpngrendfast_end;
+
+		while (1)
+		{
+			if (op >= olim)
+			{
+				op = &d->obuf[kpngfastflush(d,(int)(op-d->obuf))];
+				if (d->done) goto kpngrendfast_done;
+			}
+			if (ip > iend+8) goto kpngrendfast_end;
+			KPNGREFILL();
+
+			e = d->lit[bitbuf&((1<<KPHLITBITS)-1)];
+			if (e&KPH_SUB) e = d->lit[(e>>16)+((bitbuf>>KPHLITBITS)&((1<<(15-KPHLITBITS))-1))];
+			if (!(e&31)) goto kpngrendfast_end;
+			KPNGEAT(e&31);
+			if (e&KPH_LIT)
+			{
+				*op++ = (unsigned char)(e>>16);
+					//Often another literal follows; 41+ bits are still buffered
+				e = d->lit[bitbuf&((1<<KPHLITBITS)-1)];
+				if ((e&(KPH_LIT|KPH_SUB)) != KPH_LIT) continue;
+				KPNGEAT(e&31);
+				*op++ = (unsigned char)(e>>16);
+				continue;
+			}
+			if (e&KPH_EOB) break;
+
+			n = (int)(e>>16)+(int)(bitbuf&((1<<((e>>8)&15))-1)); KPNGEAT((e>>8)&15);
+			e = d->dist[bitbuf&((1<<KPHDISTBITS)-1)];
+			if (e&KPH_SUB) e = d->dist[(e>>16)+((bitbuf>>KPHDISTBITS)&((1<<(15-KPHDISTBITS))-1))];
+			if (!(e&31)) goto kpngrendfast_end;
+			KPNGEAT(e&31);
+			dist = (int)(e>>16)+(int)(bitbuf&((1<<((e>>8)&15))-1)); KPNGEAT((e>>8)&15);
+			if (dist > op-d->obuf) goto kpngrendfast_end;
+
+			ss = op-dist;
+			if (dist >= 8)
+				{ for(i=0;i<n;i+=8) memcpy(&op[i],&ss[i],8); } //May write up to 7 bytes past the match
+			else if (dist == 1)
+				memset(op,ss[0],n);
+			else
+				{ for(i=0;i<n;i++) op[i] = ss[i]; }
+			op += n;
+		}
+	} while (!bfinal);
+
+	kpngfastrows(d,(int)(op-d->obuf));
+kpngrendfast_done:;
+	ret = 0;
+kpngrendfast_end:;
+#undef KPNGREFILL
+#undef KPNGEAT
+	if (rows) free(rows);
+	if (d->obuf) free(d->obuf);
+	free(d);
+	if (ibuf) free(ibuf);
+	return(ret);
+}
+
+int kpngsetfast (int fast)
+{
+	int o = kpngfast;
+	if (fast >= 0) kpngfast = (fast != 0);
+	return(o);
+}
+
 static void initpngtables()
 {
 	int i, j, k;
@@ -1005,6 +1704,14 @@ static void initpngtables()
 	}
 	hxbit[285+30-257][1] = 258; hxbit[285+30-257][0] = 0;
 
+		//Entries for kpnghufbuild(), less the code lengths
+	for(i=0;i<256;i++) kphlitval[i] = (i<<16)|KPH_LIT;
+	kphlitval[256] = KPH_EOB;
+	for(i=257;i<286;i++) kphlitval[i] = (hxbit[i+30-257][1]<<16)|(hxbit[i+30-257][0]<<8);
+	kphlitval[286] = kphlitval[287] = 0;
+	for(i=0;i<30;i++) kphdistval[i] = (hxbit[i][1]<<16)|(hxbit[i][0]<<8);
+	kphdistval[30] = kphdistval[31] = 0;
+
 	k = getcputype();
 	if (k&(1<<15))
 	{
@@ -1019,6 +1726,7 @@ static int kpngrend (const char *kfilebuf, int kfilength,
 {
 	int i, j, k, bfinal, btype, hlit, hdist, leng;
 	int slidew, slider;
+	const unsigned char *idat;
 	//int qhuf0v, qhuf1v;
 
 	if (!pnginited) { pnginited = 1; initpngtables(); }
@@ -1108,6 +1816,8 @@ static int kpngrend (const char *kfilebuf, int kfilength,
 		filptr = &filptr[leng+4]; //crc = LSWAPIL(*(int *)&filptr[-4]);
 	}
 
+	idat = filptr;
+
 		//Initialize this for the getbits() function
 	zipfilmode = 0;
 	filptr = &filptr[leng-4]; bitpos = -((leng-4)<<3); nfilptr = 0;
@@ -1151,6 +1861,12 @@ static int kpngrend (const char *kfilebuf, int kfilength,
 		//Note: xsizbpl gets re-written inside initpass()
 	if ((xsizbpl+1)*sizeof(olinbuf[0]) > sizeof(olinbuf)) return(-1);
 
+	if (kpngfast)
+	{
+		if (kpngrendfast((const unsigned char *)kfilebuf,kfilength,idat,leng)) return(-1);
+		goto kpngrend_goodret;
+	}
+
 	initpass();
 
 	slidew = 0; slider = 16384;
@@ -1265,18 +1981,13 @@ kpngrend_goodret:;
 	//   All non 32-bit color drawing was removed
 	//   "Motion" JPG code was removed
 	//   A lot of parameters were added to kpeg() for library usage
-static int kpeginited = 0;
-static int clipxdim, clipydim;
-
-static int hufmaxatbit[8][20], hufvalatbit[8][20], hufcnt[8];
-static unsigned char hufnumatbit[8][20], huftable[8][256];
-static int hufquickval[8][1024], hufquickbits[8][1024], hufquickcnt[8];
-static int quantab[4][64], dct[12][64], lastdc[4], unzig[64], zigit[64]; //dct:10=MAX (says spec);+2 for hacks
-static unsigned char gnumcomponents, dcflagor[64];
-static int gcompid[4], gcomphsamp[4], gcompvsamp[4], gcompquantab[4], gcomphsampshift[4], gcompvsampshift[4];
-static int lnumcomponents, lcompid[4], lcompdc[4], lcompac[4], lcomphsamp[4], lcompvsamp[4], lcompquantab[4];
-static int lcomphvsamp0, lcomphsampshift0, lcompvsampshift0;
-static int colclip[1024], colclipup8[1024], colclipup16[1024];
+static KPTHREAD int clipxdim, clipydim;
+
+static KPTHREAD int hufcnt[8], hufquickcnt[8], lastdc[4];
+static KPTHREAD unsigned char gnumcomponents;
+static KPTHREAD int gcompid[4], gcomphsamp[4], gcompvsamp[4], gcompquantab[4], gcomphsampshift[4], gcompvsampshift[4];
+static KPTHREAD int lnumcomponents, lcompid[4], lcompdc[4], lcompac[4], lcomphsamp[4], lcompvsamp[4], lcompquantab[4];
+static KPTHREAD int lcomphvsamp0, lcomphsampshift0, lcompvsampshift0;
 static unsigned char pow2char[8] = {1,2,4,8,16,32,64,128};
 
 #if defined(__WATCOMC__) && USE_ASM
@@ -1347,7 +2058,6 @@ static inline int mulshr32 (int a, int b)
 
 static int cosqr16[8] =    //cosqr16[i] = ((cos(PI*i/16)*sqrt(2))<<24);
   {23726566,23270667,21920489,19727919,16777216,13181774,9079764,4628823};
-static int crmul[4096], cbmul[4096];
 
 static void initkpeg ()
 {
@@ -1947,9 +2657,6 @@ kpegrend_break2:;
 //==============================  KPEGILIB ends ==============================
 //================================ GIF begins ================================
 
-static unsigned char suffix[4100], filbuffer[768], tempstack[4096];
-static int prefix[4100];
-
 static int kgifrend (const char *kfilebuf, int kfilelength,
 	INT_PTR daframeplace, int dabytesperline, int daxres, int dayres,
 	int daglobxoffs, int daglobyoffs)
@@ -2630,8 +3337,11 @@ int kprender (const char *buf, int leng, INT_PTR frameptr, int bpl,
 {
 	unsigned char *ubuf = (unsigned char *)buf;
 
+	if (!kpgetctx()) return(-1);
 	paleng = 0; bakcol = 0; numhufblocks = zlibcompflags = 0; filtype = -1;
 
+	kzsuspend(); //The decoders share their buffers with ZIP streams
+
 	if ((ubuf[0] == 0x89) && (ubuf[1] == 0x50)) //.PNG
 		return(kpngrend(buf,leng,frameptr,bpl,xdim,ydim,xoff,yoff));
 
@@ -2845,23 +3555,26 @@ int kzaddstack (const char *zipnam)
 	return(0);
 }
 
+	//A stream's state is thread-local (see KPTHREAD), so read and close a ZIP
+	//stream on the thread that opened it.
 int kzopen (const char *filnam)
 {
 	FILE *fil;
 	int zipseek;
 	char tempbuf[46+260], *zipnam;
 
-	//kzfs.fil = 0;
+	if (!kzfs) kzfs = &kzdefaultfs;
+	//kzfs->fil = 0;
 	if (filnam[0] != '|')
 	{
-		kzfs.fil = fopen(filnam,"rb");
-		if (kzfs.fil)
+		kzfs->fil = fopen(filnam,"rb");
+		if (kzfs->fil)
 		{
-			kzfs.comptyp = 0;
-			kzfs.seek0 = 0;
-			kzfs.leng = filelength(_fileno(kzfs.fil));
-			kzfs.pos = 0;
-			kzfs.i = 0;
+			kzfs->comptyp = 0;
+			kzfs->seek0 = 0;
+			kzfs->leng = filelength(_fileno(kzfs->fil));
+			kzfs->pos = 0;
+			kzfs->i = 0;
 			return(1);
 		}
 	}
@@ -2873,24 +3586,28 @@ int kzopen (const char *filnam)
 		if (*(int *)&tempbuf[0] != LSWAPIB(0x04034b50)) { fclose(fil); return(0); }
 		fseek(fil,SSWAPIB(*(short *)&tempbuf[26])+SSWAPIB(*(short *)&tempbuf[28]),SEEK_CUR);
 
-		kzfs.fil = fil;
-		kzfs.comptyp = SSWAPIB(*(short *)&tempbuf[8]);
-		kzfs.seek0 = ftell(fil);
-		kzfs.leng = LSWAPIB(*(int *)&tempbuf[22]);
-		kzfs.pos = 0;
-		switch(kzfs.comptyp) //Compression method
+		kzfs->fil = fil;
+		kzfs->snapvalid = 0;
+		kzfreecheckpoints();
+		kzfs->comptyp = SSWAPIB(*(short *)&tempbuf[8]);
+		kzfs->seek0 = ftell(fil);
+		kzfs->leng = LSWAPIB(*(int *)&tempbuf[22]);
+		kzfs->pos = 0;
+		switch(kzfs->comptyp) //Compression method
 		{
-			case 0: kzfs.i = 0; return(1);
+			case 0: kzfs->i = 0; return(1);
 			case 8:
+				if (!kpgetctx()) { fclose(kzfs->fil); kzfs->fil = 0; return(0); }
 				if (!pnginited) { pnginited = 1; initpngtables(); }
-				kzfs.comptell = 0;
-				kzfs.compleng = LSWAPIB(*(int *)&tempbuf[18]);
+				kzfs->comptell = 0;
+				kzfs->compleng = LSWAPIB(*(int *)&tempbuf[18]);
 
 					//WARNING: No file in ZIP can be > 2GB-32K bytes
+				kzsuspend(); kzdecoder = kzfs;
 				gslidew = 0x7fffffff; //Force reload at beginning
 
 				return(1);
-			default: fclose(kzfs.fil); kzfs.fil = 0; return(0);
+			default: fclose(kzfs->fil); kzfs->fil = 0; return(0);
 		}
 	}
 	return(0);
@@ -3040,51 +3757,123 @@ int kzfindfile (char *filnam)
 
 // --------------------------------------------------------------------------
 
-static char *gzbufptr;
+static KPTHREAD char *gzbufptr;
 static void putbuf4zip (const unsigned char *buf, int uncomp0, int uncomp1)
 {
 	int i0, i1;
 		//              uncomp0 ... uncomp1
-		//  &gzbufptr[kzfs.pos] ... &gzbufptr[kzfs.endpos];
-	i0 = max(uncomp0,kzfs.pos);
-	i1 = min(uncomp1,kzfs.endpos);
+		//  &gzbufptr[kzfs->pos] ... &gzbufptr[kzfs->endpos];
+	i0 = max(uncomp0,kzfs->pos);
+	i1 = min(uncomp1,kzfs->endpos);
 	if (i0 < i1) memcpy(&gzbufptr[i0],&buf[i0-uncomp0],i1-i0);
 }
 
+	//Sets how many Kbytes apart checkpoints are taken, 0 to take none, or
+	//<0 to leave it be. Rounded up to 16K, the granularity kzread() pauses at.
+int kzsetcheckpoints (int kbytes)
+{
+	int i = (kzchkinterval>>10);
+	if (kbytes >= 0) kzchkinterval = ((kbytes+15)&~15)<<10;
+	return(i);
+}
+
+	//Called just after gslider is advanced, where kzread() may pause
+static void kzsavecheckpoint (int jmpplc, int i, int bfinal)
+{
+	kzchk *c;
+	int j;
+
+	if ((!kzchkinterval) || ((gslider-16384)%kzchkinterval)) return;
+	if ((kzfs->numchk) && (kzfs->chk[kzfs->numchk-1].gslider >= gslider)) return;
+	if (kzfs->numchk >= kzfs->maxchk)
+	{
+		j = max(kzfs->maxchk<<1,8);
+		c = (kzchk *)realloc(kzfs->chk,j*sizeof(kzchk)); if (!c) return;
+		kzfs->chk = c; kzfs->maxchk = j;
+	}
+	c = &kzfs->chk[kzfs->numchk++];
+	c->gslidew = gslidew; c->gslider = gslider;
+	c->jmpplc = jmpplc; c->i = i; c->bfinal = bfinal;
+	j = (int)(filptr-olinbuf)+(bitpos>>3);
+	c->compofs = kzfs->combase+j; c->bitofs = (bitpos&7);
+	memcpy(&c->fl,&kpctx->fl,sizeof(kzflate));
+}
+
+	//Returns the last checkpoint whose window still covers pos, or 0
+static kzchk *kzfindcheckpoint (int pos)
+{
+	int lo = 0, hi = kzfs->numchk, mid;
+
+	while (lo < hi)
+	{
+		mid = ((lo+hi)>>1);
+		if (kzfs->chk[mid].gslidew-32768 <= pos) lo = mid+1; else hi = mid;
+	}
+	if (!lo) return(0);
+	return(&kzfs->chk[lo-1]);
+}
+
+static void kzloadcheckpoint (const kzchk *c)
+{
+	gslidew = c->gslidew; gslider = c->gslider;
+	kzfs->jmpplc = c->jmpplc; kzfs->i = c->i; kzfs->bfinal = c->bfinal;
+	memcpy(&kpctx->fl,&c->fl,sizeof(kzflate));
+
+		//Refill the bit FIFO from the checkpoint's compressed offset
+	fseek(kzfs->fil,kzfs->seek0+c->compofs,SEEK_SET);
+	kzfs->comptell = min((unsigned)(kzfs->compleng-c->compofs),sizeof(olinbuf));
+	fread(&olinbuf[0],kzfs->comptell,1,kzfs->fil);
+	kzfs->comptell += c->compofs;
+	kzfs->combase = c->compofs;
+	bitpos = -(((int)sizeof(olinbuf)-4)<<3)+c->bitofs;
+	filptr = &olinbuf[sizeof(olinbuf)-4];
+}
+
 	//returns number of bytes copied
 int kzread (void *buffer, int leng)
 {
 	int i, j, k, bfinal, btype, hlit, hdist;
+	kzchk *chk;
 
-	if ((!kzfs.fil) || (leng <= 0)) return(0);
+	if (!kzfs) kzfs = &kzdefaultfs;
+	if ((!kzfs->fil) || (leng <= 0)) return(0);
 
-	if (kzfs.comptyp == 0)
+	if (kzfs->comptyp == 0)
 	{
-		if (kzfs.pos != kzfs.i) //Seek only when position changes
-			fseek(kzfs.fil,kzfs.seek0+kzfs.pos,SEEK_SET);
-		i = min(kzfs.leng-kzfs.pos,leng);
-		fread(buffer,i,1,kzfs.fil);
-		kzfs.i += i; //kzfs.i is a local copy of ftell(kzfs.fil);
+		if (kzfs->pos != kzfs->i) //Seek only when position changes
+			fseek(kzfs->fil,kzfs->seek0+kzfs->pos,SEEK_SET);
+		i = min(kzfs->leng-kzfs->pos,leng);
+		fread(buffer,i,1,kzfs->fil);
+		kzfs->i += i; //kzfs->i is a local copy of ftell(kzfs->fil);
 	}
-	else if (kzfs.comptyp == 8)
+	else if (kzfs->comptyp == 8)
 	{
+		if (!kpgetctx()) return(0);
+		kzresume();
 		zipfilmode = 1;
 
 			//Initialize for putbuf4zip
-		gzbufptr = (char *)buffer; gzbufptr = &gzbufptr[-kzfs.pos];
-		kzfs.endpos = min(kzfs.pos+leng,kzfs.leng);
-		if (kzfs.endpos == kzfs.pos) return(0); //Guard against reading 0 length
+		gzbufptr = (char *)buffer; gzbufptr = &gzbufptr[-kzfs->pos];
+		kzfs->endpos = min(kzfs->pos+leng,kzfs->leng);
+		if (kzfs->endpos == kzfs->pos) return(0); //Guard against reading 0 length
+
+			//Jump to a checkpoint if it saves going back to the start, or
+			//saves unzipping what lies between here and it
+		chk = kzfindcheckpoint(kzfs->pos);
+		if ((chk) && ((kzfs->pos < gslidew-32768) || (chk->gslidew > gslidew)))
+			kzloadcheckpoint(chk);
 
-		if (kzfs.pos < gslidew-32768) // Must go back to start :(
+		if (kzfs->pos < gslidew-32768) // Must go back to start :(
 		{
-			if (kzfs.comptell) fseek(kzfs.fil,kzfs.seek0,SEEK_SET);
+			if (kzfs->comptell) fseek(kzfs->fil,kzfs->seek0,SEEK_SET);
 
 			gslidew = 0; gslider = 16384;
-			kzfs.jmpplc = 0;
+			kzfs->jmpplc = 0;
+			kzfs->combase = 0;
 
 				//Initialize for suckbits/peekbits/getbits
-			kzfs.comptell = min((unsigned)kzfs.compleng,sizeof(olinbuf));
-			fread(&olinbuf[0],kzfs.comptell,1,kzfs.fil);
+			kzfs->comptell = min((unsigned)kzfs->compleng,sizeof(olinbuf));
+			fread(&olinbuf[0],kzfs->comptell,1,kzfs->fil);
 				//Make it re-load when there are < 32 bits left in FIFO
 			bitpos = -(((int)sizeof(olinbuf)-4)<<3);
 				//Identity: filptr + (bitpos>>3) = &olinbuf[0]
@@ -3096,7 +3885,7 @@ int kzread (void *buffer, int leng)
 
 				//HACK: Don't unzip anything until you have to...
 				//   (keeps file pointer as low as possible)
-			if (kzfs.endpos <= gslidew) j = kzfs.endpos;
+			if (kzfs->endpos <= gslidew) j = kzfs->endpos;
 
 				//write uncompoffs on slidebuf from: i to j
 			if (!((i^j)&32768))
@@ -3109,10 +3898,10 @@ int kzread (void *buffer, int leng)
 
 				//HACK: Don't unzip anything until you have to...
 				//   (keeps file pointer as low as possible)
-			if (kzfs.endpos <= gslidew) goto retkzread;
+			if (kzfs->endpos <= gslidew) goto retkzread;
 		}
 
-		switch (kzfs.jmpplc)
+		switch (kzfs->jmpplc)
 		{
 			case 0: goto kzreadplc0;
 			case 1: goto kzreadplc1;
@@ -3128,17 +3917,17 @@ kzreadplc0:;
 				//Display Huffman block offsets&lengths of input file - for debugging only!
 			{
 			static int ouncomppos = 0, ocomppos = 0;
-			if (kzfs.comptell == sizeof(olinbuf)) i = 0;
-			else if (kzfs.comptell < kzfs.compleng) i = kzfs.comptell-(sizeof(olinbuf)-4);
-			else i = kzfs.comptell-(kzfs.comptell%(sizeof(olinbuf)-4));
+			if (kzfs->comptell == sizeof(olinbuf)) i = 0;
+			else if (kzfs->comptell < kzfs->compleng) i = kzfs->comptell-(sizeof(olinbuf)-4);
+			else i = kzfs->comptell-(kzfs->comptell%(sizeof(olinbuf)-4));
 			i += ((char *)&filptr[bitpos>>3])-((char *)(&olinbuf[0]));
 			i = (i<<3)+(bitpos&7)-3;
 			if (gslidew) printf(" ULng:0x%08x CLng:0x%08x.%x",gslidew-ouncomppos,(i-ocomppos)>>3,((i-ocomppos)&7)<<1);
 			printf("\ntype:%d, Uoff:0x%08x Coff:0x%08x.%x",btype,gslidew,i>>3,(i&7)<<1);
 			if (bfinal)
 			{
-				printf(" ULng:0x%08x CLng:0x%08x.%x",kzfs.leng-gslidew,((kzfs.compleng<<3)-i)>>3,(((kzfs.compleng<<3)-i)&7)<<1);
-				printf("\n        Uoff:0x%08x Coff:0x%08x.0",kzfs.leng,kzfs.compleng);
+				printf(" ULng:0x%08x CLng:0x%08x.%x",kzfs->leng-gslidew,((kzfs->compleng<<3)-i)>>3,(((kzfs->compleng<<3)-i)&7)<<1);
+				printf("\n        Uoff:0x%08x Coff:0x%08x.0",kzfs->leng,kzfs->compleng);
 				ouncomppos = ocomppos = 0;
 			}
 			else { ouncomppos = gslidew; ocomppos = i; }
@@ -3155,11 +3944,12 @@ kzreadplc0:;
 					if (gslidew >= gslider)
 					{
 						putbuf4zip(&slidebuf[(gslider-16384)&32767],gslider-16384,gslider); gslider += 16384;
-						if (gslider-16384 >= kzfs.endpos)
+						kzsavecheckpoint(1,i,bfinal);
+						if (gslider-16384 >= kzfs->endpos)
 						{
-							kzfs.jmpplc = 1; kzfs.i = i; kzfs.bfinal = bfinal;
+							kzfs->jmpplc = 1; kzfs->i = i; kzfs->bfinal = bfinal;
 							goto retkzread;
-kzreadplc1:;         i = kzfs.i; bfinal = kzfs.bfinal;
+kzreadplc1:;         i = kzfs->i; bfinal = kzfs->bfinal;
 						}
 					}
 					slidebuf[(gslidew++)&32767] = (char)getbits(8);
@@ -3210,10 +4000,11 @@ kzreadplc1:;         i = kzfs.i; bfinal = kzfs.bfinal;
 				if (gslidew >= gslider)
 				{
 					putbuf4zip(&slidebuf[(gslider-16384)&32767],gslider-16384,gslider); gslider += 16384;
-					if (gslider-16384 >= kzfs.endpos)
+					kzsavecheckpoint(2,0,bfinal);
+					if (gslider-16384 >= kzfs->endpos)
 					{
-						kzfs.jmpplc = 2; kzfs.bfinal = bfinal; goto retkzread;
-kzreadplc2:;      bfinal = kzfs.bfinal;
+						kzfs->jmpplc = 2; kzfs->bfinal = bfinal; goto retkzread;
+kzreadplc2:;      bfinal = kzfs->bfinal;
 					}
 				}
 
@@ -3242,41 +4033,45 @@ kzreadplc2:;      bfinal = kzfs.bfinal;
 			putbuf4zip(&slidebuf[gslider&32767],gslider,gslidew&~32767);
 			putbuf4zip(slidebuf,gslidew&~32767,gslidew);
 		}
-kzreadplc3:; kzfs.jmpplc = 3;
+kzreadplc3:; kzfs->jmpplc = 3;
 	}
 
 retkzread:;
-	i = kzfs.pos;
-	kzfs.pos += leng; if (kzfs.pos > kzfs.leng) kzfs.pos = kzfs.leng;
-	return(kzfs.pos-i);
+	i = kzfs->pos;
+	kzfs->pos += leng; if (kzfs->pos > kzfs->leng) kzfs->pos = kzfs->leng;
+	return(kzfs->pos-i);
 }
 
 int kzfilelength ()
 {
-	if (!kzfs.fil) return(0);
-	return(kzfs.leng);
+	if (!kzfs) kzfs = &kzdefaultfs;
+	if (!kzfs->fil) return(0);
+	return(kzfs->leng);
 }
 
 	//WARNING: kzseek(<-32768,SEEK_CUR); or:
 	//         kzseek(0,SEEK_END);       can make next kzread very slow!!!
+	//         (unless kzsetcheckpoints() is on and a checkpoint is near)
 int kzseek (int offset, int whence)
 {
-	if (!kzfs.fil) return(-1);
+	if (!kzfs) kzfs = &kzdefaultfs;
+	if (!kzfs->fil) return(-1);
 	switch (whence)
 	{
-		case SEEK_CUR: kzfs.pos += offset; break;
-		case SEEK_END: kzfs.pos = kzfs.leng+offset; break;
-		case SEEK_SET: default: kzfs.pos = offset;
+		case SEEK_CUR: kzfs->pos += offset; break;
+		case SEEK_END: kzfs->pos = kzfs->leng+offset; break;
+		case SEEK_SET: default: kzfs->pos = offset;
 	}
-	if (kzfs.pos < 0) kzfs.pos = 0;
-	if (kzfs.pos > kzfs.leng) kzfs.pos = kzfs.leng;
-	return(kzfs.pos);
+	if (kzfs->pos < 0) kzfs->pos = 0;
+	if (kzfs->pos > kzfs->leng) kzfs->pos = kzfs->leng;
+	return(kzfs->pos);
 }
 
 int kztell ()
 {
-	if (!kzfs.fil) return(-1);
-	return(kzfs.pos);
+	if (!kzfs) kzfs = &kzdefaultfs;
+	if (!kzfs->fil) return(-1);
+	return(kzfs->pos);
 }
 
 int kzgetc ()
@@ -3288,13 +4083,48 @@ int kzgetc ()
 
 int kzeof ()
 {
-	if (!kzfs.fil) return(-1);
-	return(kzfs.pos >= kzfs.leng);
+	if (!kzfs) kzfs = &kzdefaultfs;
+	if (!kzfs->fil) return(-1);
+	return(kzfs->pos >= kzfs->leng);
 }
 
 void kzclose ()
 {
-	if (kzfs.fil) { fclose(kzfs.fil); kzfs.fil = 0; }
+	if (!kzfs) kzfs = &kzdefaultfs;
+	if (kzdecoder == kzfs) kzdecoder = 0;
+	kzfs->snapvalid = 0;
+	kzfreecheckpoints();
+	if (kzfs->fil) { fclose(kzfs->fil); kzfs->fil = 0; }
+}
+
+void *kzstreamopen (const char *filnam)
+{
+	kzfilestate *fs, *ofs;
+
+	fs = (kzfilestate *)calloc(1,sizeof(kzfilestate)); if (!fs) return(0);
+	ofs = kzfs; kzfs = fs;
+	if (!kzopen(filnam)) { free(fs); fs = 0; }
+	kzfs = ofs;
+	return((void *)fs);
+}
+
+void *kzstreamselect (void *stream)
+{
+	kzfilestate *ofs = kzfs;
+	kzfs = stream ? (kzfilestate *)stream : &kzdefaultfs;
+	return((void *)ofs);
+}
+
+void kzstreamclose (void *stream)
+{
+	kzfilestate *fs = (kzfilestate *)stream, *ofs;
+
+	if (!fs) return;
+	ofs = kzfs; kzfs = fs;
+	kzclose();
+	kzfs = (ofs == fs) ? &kzdefaultfs : ofs;
+	if (fs->snap) free(fs->snap);
+	free(fs);
 }
 
 //====================== ZIP decompression code ends =========================
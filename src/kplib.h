@@ -3,6 +3,14 @@ extern void kpzload (const char *, intptr_t *, int *, int *, int *);
 	//Low-level PNG/JPG functions:
 extern void kpgetdim (void *, int, int *, int *);
 extern int kprender (void *, int, void *, int, int, int, int, int);
+	//1 (the default) decodes PNGs with the faster path, 0 with the original
+	//code. <0 just returns the setting.
+extern int kpngsetfast (int);
+	//1 if pictures and ZIP streams may be decoded on several threads at once
+extern int kpthreadsafe (void);
+	//Frees the decoder state the calling thread allocated when it first
+	//decoded something. Call before a thread that decoded ends.
+extern void kpthreadfree (void);
 
 	//ZIP functions:
 extern int kzaddstack (const char *);
@@ -15,6 +23,15 @@ extern int kztell (void);
 extern int kzgetc (void);
 extern int kzeof (void);
 extern void kzclose (void);
+	//Several ZIP streams can be open at once, each reading on from where it
+	//left off. kzstreamselect() makes one current for the functions above,
+	//0 being the stream kzopen() uses by default, and returns the previous.
+extern void *kzstreamopen (const char *);
+extern void *kzstreamselect (void *);
+extern void kzstreamclose (void *);
+	//Snapshots *flate state every so many Kbytes of a stream so seeks resume
+	//from the nearest one. 0 (the default) takes none; <0 just returns the setting.
+extern int kzsetcheckpoints (int);
 
 extern void kzfindfilestart (const char *); //pass wildcard string
 extern int kzfindfile (char *); //you alloc buf, returns 1:found,0:~found
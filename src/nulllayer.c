@@ -0,0 +1,539 @@
+// Null interface layer
+// for the Build Engine
+//
+// Renders into a framebuffer in memory with no window, input or OpenGL,
+// for headless tools like the benchmark.
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+#include "build.h"
+#include "baselayer.h"
+#include "cache1d.h"
+#include "pragmas.h"
+#include "a.h"
+#include "osd.h"
+
+int   _buildargc = 1;
+const char **_buildargv = NULL;
+
+char quitevent=0, appactive=1;
+
+static unsigned char *frame;
+int xres=-1, yres=-1, bpp=0, fullscreen=0, bytesperline, imageSize;
+intptr_t frameplace=0;
+char modechange=1;
+char offscreenrendering=0;
+char videomodereset = 0;
+
+// input
+int inputdevices=0;
+char keystatus[256];
+int keyfifo[KEYFIFOSIZ];
+unsigned char keyasciififo[KEYFIFOSIZ];
+int keyfifoplc, keyfifoend;
+int keyasciififoplc, keyasciififoend;
+int mousex=0,mousey=0,mouseb=0;
+int joyaxis[4], joyb=0;
+char joynumaxes=0, joynumbuttons=0;
+
+void (*keypresscallback)(int,int) = 0;
+void (*mousepresscallback)(int,int) = 0;
+void (*joypresscallback)(int,int) = 0;
+
+
+int wm_msgbox(const char *name, const char *fmt, ...)
+{
+	va_list va;
+
+	va_start(va,fmt);
+	Bvfprintf(stderr, fmt, va);
+	va_end(va);
+	Bfputc('\n', stderr);
+
+	return 0;
+}
+
+int wm_ynbox(const char *name, const char *fmt, ...)
+{
+	return 0;
+}
+
+int wm_filechooser(const char *initialdir, const char *initialfile, const char *type, int foropen, char **choice)
+{
+	return -1;
+}
+
+int wm_idle(void *ptr)
+{
+	return 0;
+}
+
+void wm_setapptitle(const char *name)
+{
+}
+
+void wm_setwindowtitle(const char *name)
+{
+}
+
+
+//
+//
+// ---------------------------------------
+//
+// System
+//
+// ---------------------------------------
+//
+//
+
+int main(int argc, char *argv[])
+{
+	_buildargc = argc;
+	_buildargv = (const char **)argv;
+
+	baselayer_init();
+
+	return app_main(_buildargc, (char const * const*)_buildargv);
+}
+
+static void shutdownvideo(void);
+
+//
+// initsystem() -- init systems
+//
+int initsystem(void)
+{
+	buildputs("Null system interface\n");
+	atexit(uninitsystem);
+	return 0;
+}
+
+//
+// uninitsystem() -- uninit systems
+//
+void uninitsystem(void)
+{
+	uninitinput();
+	uninitmouse();
+	uninittimer();
+	shutdownvideo();
+}
+
+//
+// initputs() -- prints a string to the intitialization window
+//
+void initputs(const char *str)
+{
+}
+
+//
+// debugprintf() -- prints a debug string to stderr
+//
+void debugprintf(const char *f, ...)
+{
+#ifdef DEBUGGINGAIDS
+	va_list va;
+
+	va_start(va,f);
+	Bvfprintf(stderr, f, va);
+	va_end(va);
+#endif
+}
+
+
+//
+//
+// ---------------------------------------
+//
+// All things Input
+//
+// ---------------------------------------
+//
+//
+
+int initinput(void)
+{
+	inputdevices = 0;
+	return 0;
+}
+
+void uninitinput(void)
+{
+	uninitmouse();
+}
+
+const char *getkeyname(int num)
+{
+	return NULL;
+}
+
+const char *getjoyname(int what, int num)
+{
+	return NULL;
+}
+
+unsigned char bgetchar(void)
+{
+	return 0;
+}
+
+int bkbhit(void)
+{
+	return 0;
+}
+
+void bflushchars(void)
+{
+	keyasciififoplc = keyasciififoend = 0;
+}
+
+void setkeypresscallback(void (*callback)(int, int)) { keypresscallback = callback; }
+void setmousepresscallback(void (*callback)(int, int)) { mousepresscallback = callback; }
+void setjoypresscallback(void (*callback)(int, int)) { joypresscallback = callback; }
+
+int initmouse(void)
+{
+	return 0;
+}
+
+void uninitmouse(void)
+{
+}
+
+void grabmouse(int a)
+{
+}
+
+void readmousexy(int *x, int *y)
+{
+	*x = *y = 0;
+}
+
+void readmousebstatus(int *b)
+{
+	*b = 0;
+}
+
+void releaseallbuttons(void)
+{
+	mouseb = 0;
+	joyb = 0;
+	memset(keystatus, 0, sizeof(keystatus));
+}
+
+
+//
+//
+// ---------------------------------------
+//
+// All things Timer
+//
+// ---------------------------------------
+//
+//
+
+static int timerinstalled=0;
+static unsigned int timerlastsample=0;
+static int timerticspersec=0;
+static void (*usertimercallback)(void) = NULL;
+
+	// microseconds since an arbitrary point
+static uint64_t getusecs(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+		(uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+//
+// inittimer() -- initialise timer
+//
+int inittimer(int tickspersecond)
+{
+	if (timerinstalled) return 0;	// already installed
+
+	timerticspersec = tickspersecond;
+	timerlastsample = (unsigned int)(getusecs() * timerticspersec / 1000000);
+	usertimercallback = NULL;
+	timerinstalled = 1;
+
+	return 0;
+}
+
+//
+// uninittimer() -- shut down timer
+//
+void uninittimer(void)
+{
+	timerinstalled = 0;
+}
+
+//
+// sampletimer() -- update totalclock
+//
+void sampletimer(void)
+{
+	int n;
+
+	if (!timerinstalled) return;
+
+	n = (int)((unsigned int)(getusecs() * timerticspersec / 1000000) - timerlastsample);
+	if (n>0) {
+		totalclock += n;
+		timerlastsample += n;
+	}
+
+	if (usertimercallback) for (; n>0; n--) usertimercallback();
+}
+
+//
+// getticks() -- returns a millisecond ticks count
+//
+unsigned int getticks(void)
+{
+	return (unsigned int)(getusecs() / 1000);
+}
+
+//
+// getusecticks() -- returns a microsecond ticks count
+//
+unsigned int getusecticks(void)
+{
+	return (unsigned int)getusecs();
+}
+
+//
+// gettimerfreq() -- returns the number of ticks per second the timer is configured to generate
+//
+int gettimerfreq(void)
+{
+	return timerticspersec;
+}
+
+//
+// installusertimercallback() -- set up a callback function to be called when the timer is fired
+//
+void (*installusertimercallback(void (*callback)(void)))(void)
+{
+	void (*oldtimercallback)(void);
+
+	oldtimercallback = usertimercallback;
+	usertimercallback = callback;
+
+	return oldtimercallback;
+}
+
+
+//
+//
+// ---------------------------------------
+//
+// All things Video
+//
+// ---------------------------------------
+//
+//
+
+static char modeschecked=0;
+
+//
+// getvalidmodes() -- figure out what video modes are available
+//
+void getvalidmodes(void)
+{
+	static int defaultres[][2] = {
+		{1920,1200},{1920,1080},{1600,1200},{1680,1050},{1600,900},{1400,1050},{1440,900},{1366,768},
+		{1280,1024},{1280,960},{1280,800},{1280,720},{1152,864},{1024,768},{800,600},{640,480},
+		{640,400},{512,384},{480,360},{400,300},{320,240},{320,200},{0,0}
+	};
+	int i;
+
+	if (modeschecked) return;
+
+	validmodecnt=0;
+	for (i=0; defaultres[i][0] && validmodecnt<MAXVALIDMODES; i++) {
+		if (defaultres[i][0] > MAXXDIM || defaultres[i][1] > MAXYDIM) continue;
+		validmode[validmodecnt].xdim=defaultres[i][0];
+		validmode[validmodecnt].ydim=defaultres[i][1];
+		validmode[validmodecnt].bpp=8;
+		validmode[validmodecnt].fs=0;
+		validmodecnt++;
+	}
+
+	modeschecked=1;
+}
+
+//
+// checkvideomode() -- makes sure the video mode passed is legal
+//   Any 8-bit size within the engine's limits is accepted.
+//
+int checkvideomode(int *x, int *y, int c, int fs, int forced)
+{
+	int i;
+
+	getvalidmodes();
+
+	if (c > 8) return -1;
+
+	if (*x < 320) *x = 320;
+	if (*y < 200) *y = 200;
+	if (*x > MAXXDIM) *x = MAXXDIM;
+	if (*y > MAXYDIM) *y = MAXYDIM;
+	*x &= 0xfffffff8l;
+
+	for (i=0; i<validmodecnt; i++) {
+		if (validmode[i].xdim == *x && validmode[i].ydim == *y) return i;
+	}
+
+	return 0x7fffffffl;
+}
+
+static void shutdownvideo(void)
+{
+	if (frame) {
+		free(frame);
+		frame = NULL;
+	}
+	frameplace = 0;
+}
+
+//
+// setvideomode() -- allocate an in-memory framebuffer
+//
+int setvideomode(int x, int y, int c, int fs)
+{
+	int i, j, pitch;
+
+	if ((fs == fullscreen) && (x == xres) && (y == yres) && (c == bpp) &&
+		!videomodereset) {
+		OSD_ResizeDisplay(xres,yres);
+		return 0;
+	}
+
+	if (checkvideomode(&x,&y,c,fs,0) < 0) return -1;
+
+	shutdownvideo();
+
+	// Round up to a multiple of 4.
+	pitch = (((x|1) + 4) & ~3);
+
+	frame = (unsigned char *) calloc(pitch, y);
+	if (!frame) {
+		buildputs("Unable to allocate framebuffer\n");
+		return -1;
+	}
+
+	frameplace = (intptr_t) frame;
+	bytesperline = pitch;
+	imageSize = bytesperline * y;
+	numpages = 1;
+
+	setvlinebpl(bytesperline);
+	for (i = j = 0; i <= y; i++) {
+		ylookup[i] = j;
+		j += bytesperline;
+	}
+
+	xres = x;
+	yres = y;
+	bpp = c;
+	fullscreen = fs;
+	modechange = 1;
+	videomodereset = 0;
+	OSD_ResizeDisplay(xres,yres);
+
+	return 0;
+}
+
+//
+// resetvideomode() -- resets the video system
+//
+void resetvideomode(void)
+{
+	videomodereset = 1;
+	modeschecked = 0;
+}
+
+//
+// begindrawing() -- locks the framebuffer for drawing
+//
+void begindrawing(void)
+{
+}
+
+//
+// enddrawing() -- unlocks the framebuffer
+//
+void enddrawing(void)
+{
+}
+
+//
+// showframe() -- update the display
+//
+void showframe(void)
+{
+}
+
+//
+// setpalette() -- set palette values
+//
+int setpalette(int UNUSED(start), int UNUSED(num), unsigned char * UNUSED(dapal))
+{
+	return 0;
+}
+
+//
+// setgamma
+//
+int setgamma(float gamma)
+{
+	return 0;
+}
+
+#if USE_OPENGL
+int loadgldriver(const char *soname)
+{
+	return -1;
+}
+
+int unloadgldriver(void)
+{
+	return 0;
+}
+
+void *getglprocaddress(const char *name, int UNUSED(ext))
+{
+	return NULL;
+}
+#endif
+
+
+//
+// handleevents() -- nothing to process but the timer
+//   returns !0 if there was an important event worth checking (like quitting)
+//
+int handleevents(void)
+{
+	sampletimer();
+	return quitevent;
+}
@@ -0,0 +1,311 @@
+// 8-bit to 32-bit palette expansion
+// for the Build Engine
+//
+// Software modes draw 8-bit frames that the layers turn into 32-bit pixels
+// for the display, a table lookup per pixel. AVX2 gathers eight lookups at
+// a time. ARM64 has no gather, but its four-register table instructions
+// cover 64 entries at once, so each channel's 256 entries are split across
+// four lookups. SSE2 has neither a gather nor a byte shuffle, and a plain
+// loop over the 32-bit table is as quick as anything it offers.
+
+#include "build.h"
+#include "bthread.h"
+#include "palexpand.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# if defined(_MSC_VER) || defined(__clang__) || \
+	(defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#  define PALEXPAND_AVX2
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#   include <intrin.h>
+#   define AVX2_TARGET
+#  else
+#   define AVX2_TARGET __attribute__((target("avx2")))
+#  endif
+# endif
+#endif
+
+	// The NEON kernel has yet to go through an ARM compiler, so builds have
+	// to ask for it by defining PALEXPAND_NEON.
+#if defined(PALEXPAND_NEON) && (!(defined(__aarch64__) || defined(_M_ARM64)) || !B_LITTLE_ENDIAN)
+# undef PALEXPAND_NEON
+#endif
+#ifdef PALEXPAND_NEON
+# include <arm_neon.h>
+#endif
+
+
+static void row_c(unsigned int *dest, const unsigned char *src, int count, const palexpandtable *tab)
+{
+	const unsigned int *pixel = tab->pixel;
+
+	for (; count >= 4; count -= 4, src += 4, dest += 4) {
+		dest[0] = pixel[src[0]];
+		dest[1] = pixel[src[1]];
+		dest[2] = pixel[src[2]];
+		dest[3] = pixel[src[3]];
+	}
+	for (; count > 0; count--) *dest++ = pixel[*src++];
+}
+
+
+#ifdef PALEXPAND_AVX2
+
+static AVX2_TARGET void row_avx2(unsigned int *dest, const unsigned char *src, int count, const palexpandtable *tab)
+{
+	const int *pixel = (const int *)tab->pixel;
+	__m256i a, b;
+
+	for (; count >= 16; count -= 16, src += 16, dest += 16) {
+		a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src));
+		b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + 8)));
+		_mm256_storeu_si256((__m256i *)dest, _mm256_i32gather_epi32(pixel, a, 4));
+		_mm256_storeu_si256((__m256i *)(dest + 8), _mm256_i32gather_epi32(pixel, b, 4));
+	}
+	if (count > 0) row_c(dest, src, count, tab);
+}
+
+static int haveavx2(void)
+{
+#ifdef _MSC_VER
+	int r[4];
+
+	__cpuid(r, 0);
+	if (r[0] < 7) return 0;
+	__cpuid(r, 1);
+	if ((r[2] & ((1<<27)|(1<<28))) != ((1<<27)|(1<<28))) return 0;	// OSXSAVE, AVX
+	if ((_xgetbv(0) & 6) != 6) return 0;	// OS saves the YMM registers
+	__cpuidex(r, 7, 0);
+	return (r[1] & (1<<5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif	// PALEXPAND_AVX2
+
+
+#ifdef PALEXPAND_NEON
+
+	//Loads a 64-byte quarter of a table. vld1q_u8_x4() would do, but older
+	//GCCs lack it.
+static inline uint8x16x4_t quarter_neon(const unsigned char *table)
+{
+	uint8x16x4_t t;
+
+	t.val[0] = vld1q_u8(table);
+	t.val[1] = vld1q_u8(table + 16);
+	t.val[2] = vld1q_u8(table + 32);
+	t.val[3] = vld1q_u8(table + 48);
+	return t;
+}
+
+	//Looks up 16 indices in a 256-entry byte table held as four 64-byte quarters.
+	//Indices outside a quarter leave the lane as it was.
+static inline uint8x16_t lookup_neon(const unsigned char *table, uint8x16_t idx)
+{
+	uint8x16_t r, q = vdupq_n_u8(64);
+
+	r = vqtbl4q_u8(quarter_neon(table), idx);
+	idx = vsubq_u8(idx, q); r = vqtbx4q_u8(r, quarter_neon(table + 64), idx);
+	idx = vsubq_u8(idx, q); r = vqtbx4q_u8(r, quarter_neon(table + 128), idx);
+	idx = vsubq_u8(idx, q); r = vqtbx4q_u8(r, quarter_neon(table + 192), idx);
+	return r;
+}
+
+static void row_neon(unsigned int *dest, const unsigned char *src, int count, const palexpandtable *tab)
+{
+	uint8x16x4_t px;
+	uint8x16_t idx;
+
+	px.val[3] = vdupq_n_u8(0);
+	for (; count >= 16; count -= 16, src += 16, dest += 16) {
+		idx = vld1q_u8(src);
+		px.val[0] = lookup_neon(tab->b, idx);
+		px.val[1] = lookup_neon(tab->g, idx);
+		px.val[2] = lookup_neon(tab->r, idx);
+		vst4q_u8((unsigned char *)dest, px);	// B,G,R,X in memory is XRGB8888
+	}
+	if (count > 0) row_c(dest, src, count, tab);
+}
+
+#endif	// PALEXPAND_NEON
+
+
+static const palexpandkernel kernel_c = { "C", row_c };
+#ifdef PALEXPAND_AVX2
+static const palexpandkernel kernel_avx2 = { "AVX2", row_avx2 };
+#endif
+#ifdef PALEXPAND_NEON
+static const palexpandkernel kernel_neon = { "NEON", row_neon };
+#endif
+
+const palexpandkernel * const *palexpand_getkernels(void)
+{
+	static const palexpandkernel *kernels[4];
+	static int numkernels = 0;
+
+	if (numkernels) return kernels;
+
+#ifdef PALEXPAND_AVX2
+	if (haveavx2()) kernels[numkernels++] = &kernel_avx2;
+#endif
+#ifdef PALEXPAND_NEON
+	kernels[numkernels++] = &kernel_neon;
+#endif
+	kernels[numkernels++] = &kernel_c;
+	kernels[numkernels] = NULL;
+
+	return kernels;
+}
+
+void palexpand_settable(palexpandtable *tab, const palette_t *pal)
+{
+	unsigned int r, g, b;
+	int i;
+
+	for (i=0; i<256; i++) {
+		r = pal[i].r; g = pal[i].g; b = pal[i].b;
+		tab->r[i] = r; tab->g[i] = g; tab->b[i] = b;
+		tab->pixel[i] = (r << 16) | (g << 8) | b;
+	}
+}
+
+void palexpand(void *dest, int destpitch, const unsigned char *src, int srcpitch,
+	int width, int height, const palexpandtable *tab)
+{
+	void (*row)(unsigned int *, const unsigned char *, int, const palexpandtable *);
+
+	row = palexpand_getkernels()[0]->row;
+	for (; height > 0; height--) {
+		row((unsigned int *)dest, src, width, tab);
+		dest = (void *)((intptr_t)dest + destpitch);
+		src += srcpitch;
+	}
+}
+
+
+//
+// The background expander
+//
+
+struct palexpander_typ {
+	bmutex_t mtx;
+	bcond_t wakecond, donecond;
+	bthread_t thread;
+	int quit, busy;
+
+	palexpandtable tab;
+	void *dest;
+	const unsigned char *src;
+	int destpitch, srcpitch, width, height;
+};
+
+static int expanderproc(void *arg)
+{
+	palexpander *pe = (palexpander *)arg;
+
+	bmutex_lock(pe->mtx);
+	while (1) {
+		while (!pe->quit && !pe->busy) {
+			bcond_wait(pe->wakecond, pe->mtx);
+		}
+		if (pe->quit) break;
+		bmutex_unlock(pe->mtx);
+
+		palexpand(pe->dest, pe->destpitch, pe->src, pe->srcpitch, pe->width, pe->height, &pe->tab);
+
+		bmutex_lock(pe->mtx);
+		pe->busy = 0;
+		bcond_signal(pe->donecond);
+	}
+	bmutex_unlock(pe->mtx);
+
+	return 0;
+}
+
+palexpander * palexpander_create(void)
+{
+	palexpander *pe;
+
+	pe = (palexpander *)Bcalloc(1, sizeof(palexpander));
+	if (!pe) return NULL;
+
+	pe->mtx = bmutex_create();
+	pe->wakecond = bcond_create();
+	pe->donecond = bcond_create();
+	if (pe->mtx && pe->wakecond && pe->donecond) {
+		pe->thread = bthread_create(expanderproc, pe);
+	}
+	if (!pe->thread) {
+		palexpander_destroy(pe);
+		return NULL;
+	}
+
+	return pe;
+}
+
+void palexpander_destroy(palexpander *pe)
+{
+	if (!pe) return;
+
+	if (pe->thread) {
+		bmutex_lock(pe->mtx);
+		pe->quit = 1;
+		bcond_signal(pe->wakecond);
+		bmutex_unlock(pe->mtx);
+		bthread_join(pe->thread);	// the thread finishes any expansion first
+	}
+
+	bcond_destroy(pe->donecond);
+	bcond_destroy(pe->wakecond);
+	bmutex_destroy(pe->mtx);
+	Bfree(pe);
+}
+
+void palexpander_start(palexpander *pe, void *dest, int destpitch, const unsigned char *src, int srcpitch,
+	int width, int height, const palexpandtable *tab)
+{
+	palexpander_wait(pe);
+
+	pe->tab = *tab;
+	pe->dest = dest;
+	pe->destpitch = destpitch;
+	pe->src = src;
+	pe->srcpitch = srcpitch;
+	pe->width = width;
+	pe->height = height;
+
+	bmutex_lock(pe->mtx);
+	pe->busy = 1;
+	bcond_signal(pe->wakecond);
+	bmutex_unlock(pe->mtx);
+}
+
+int palexpander_busy(palexpander *pe)
+{
+	int busy;
+
+	bmutex_lock(pe->mtx);
+	busy = pe->busy;
+	bmutex_unlock(pe->mtx);
+
+	return busy;
+}
+
+int palexpander_wait(palexpander *pe)
+{
+	int waited;
+
+	bmutex_lock(pe->mtx);
+	waited = pe->busy;
+	while (pe->busy) {
+		bcond_wait(pe->donecond, pe->mtx);
+	}
+	bmutex_unlock(pe->mtx);
+
+	return waited;
+}
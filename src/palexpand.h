@@ -0,0 +1,90 @@
+// 8-bit to 32-bit palette expansion
+// for the Build Engine
+//
+// Requires build.h for palette_t.
+
+#ifndef PALEXPAND_H
+#define PALEXPAND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A palette prepared for expansion. Each colour becomes a 32-bit pixel
+ * 0x00RRGGBB in the machine's byte order, which SDL and Windows both call
+ * XRGB8888. The channels are kept apart too for kernels that look them up
+ * a byte at a time.
+ */
+typedef struct {
+	unsigned int pixel[256];
+	unsigned char r[256], g[256], b[256];
+} palexpandtable;
+
+/**
+ * A kernel expanding one row of count pixels from src into dest.
+ */
+typedef struct {
+	const char *name;
+	void (*row)(unsigned int *dest, const unsigned char *src, int count, const palexpandtable *tab);
+} palexpandkernel;
+
+/**
+ * Returns the kernels usable on this processor, best first, as a
+ * NULL-terminated list which always ends with the scalar kernel.
+ */
+const palexpandkernel * const *palexpand_getkernels(void);
+
+/**
+ * Prepares a palette of 256 colours for expansion.
+ */
+void palexpand_settable(palexpandtable *tab, const palette_t *pal);
+
+/**
+ * Expands a width by height image of palette indices into 32-bit pixels
+ * with the best kernel for the processor.
+ * @param dest the first 32-bit pixel
+ * @param destpitch bytes from one row of dest to the next
+ * @param src the first palette index
+ * @param srcpitch bytes from one row of src to the next
+ */
+void palexpand(void *dest, int destpitch, const unsigned char *src, int srcpitch,
+	int width, int height, const palexpandtable *tab);
+
+typedef struct palexpander_typ palexpander;
+
+/**
+ * Starts a thread of its own for expanding frames while the next one is drawn.
+ * @return the expander, or NULL on failure
+ */
+palexpander * palexpander_create(void);
+
+/**
+ * Waits for any expansion under way, then stops the thread and releases it.
+ */
+void palexpander_destroy(palexpander *pe);
+
+/**
+ * Has the thread palexpand() an image, returning at once. The table is
+ * copied, but src and dest must be left alone until palexpander_wait().
+ * Any expansion already under way is waited for first.
+ */
+void palexpander_start(palexpander *pe, void *dest, int destpitch, const unsigned char *src, int srcpitch,
+	int width, int height, const palexpandtable *tab);
+
+/**
+ * Returns 1 while an expansion begun by palexpander_start() is under way.
+ */
+int palexpander_busy(palexpander *pe);
+
+/**
+ * Waits for the expansion begun by palexpander_start() to finish.
+ * @return 1 if there was one, 0 if the expander was idle
+ */
+int palexpander_wait(palexpander *pe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -79,6 +79,7 @@ Low priority:
 # include "hightile_priv.h"
 # include "polymosttex_priv.h"
 # include "polymosttexcache.h"
+# include "polymosttexstream.h"
 # include "mdsprite_priv.h"
 #endif
 extern char textfont[2048], smalltextfont[2048];
@@ -134,6 +135,9 @@ struct glfiltermodes glfiltermodes[numglfiltermodes] = {
 int glanisotropy = 0;            // 0 = maximum supported by card
 int glusetexcompr = 1;
 int gltexcomprquality = 0;	// 0 = fast, 1 = slow and pretty, 2 = very slow and pretty
+int gltexcomprthreads = 0;	// 0 = one per processor
+int gltexmipgamma = 0;		// 1 = average mipmaps as linear light
+int gltexstreaming = 0;		// 1 = load hightile textures missing from the cache in the background
 int gltexfiltermode = 5;   // GL_LINEAR_MIPMAP_LINEAR
 int glusetexcache = 1;
 int glmultisample = 0, glnvmultisamplehint = 0;
@@ -971,6 +975,10 @@ void polymost_nextpage(void)
 {
 #if USE_OPENGL
 	polymost_palfade();
+
+	if (rendmode == 3) {
+		ptstream_update(0);	// hightile textures finished since the last frame
+	}
 #endif
 
 #ifdef DEBUGGINGAIDS
@@ -1984,6 +1992,7 @@ static void domost (float x0, float y0, float x1, float y1, int polymethod)
 }
 
 static void polymost_scansector (int sectnum);
+static const unsigned char *pvsrow = NULL;
 
 static void polymost_drawalls (int bunch)
 {
@@ -1998,6 +2007,7 @@ static void polymost_drawalls (int bunch)
 #ifdef DEBUGGINGAIDS
 	polymostcallcounts.drawalls++;
 #endif
+	profilebegin(PROFILE_DRAWALLS);
 
 	sectnum = thesector[bunchfirst[bunch]]; sec = &sector[sectnum];
 
@@ -2876,6 +2886,8 @@ static void polymost_drawalls (int bunch)
 			if ((!(gotsector[nextsectnum>>3]&pow2char[nextsectnum&7])) && (testvisiblemost(x0,x1)))
 				polymost_scansector(nextsectnum);
 	}
+
+	profileend(PROFILE_DRAWALLS);
 }
 
 static int polymost_bunchfront (int b1, int b2)
@@ -2883,9 +2895,11 @@ static int polymost_bunchfront (int b1, int b2)
 	double x1b1, x1b2, x2b1, x2b2;
 	int b1f, b2f, i;
 
+	renderstats.bunchfronts++;
 	b1f = bunchfirst[b1]; x1b1 = dxb1[b1f]; x2b2 = dxb2[bunchlast[b2]]; if (x1b1 >= x2b2) return(-1);
 	b2f = bunchfirst[b2]; x1b2 = dxb1[b2f]; x2b1 = dxb2[bunchlast[b1]]; if (x1b2 >= x2b1) return(-1);
 
+	renderstats.bunchoverlaps++;
 	if (x1b1 >= x1b2)
 	{
 		for(i=b2f;dxb2[i]<=x1b1;i=p2[i]);
@@ -2904,6 +2918,8 @@ static void polymost_scansector (int sectnum)
 	int xs, ys, x1, y1, x2, y2;
 
 	if (sectnum < 0) return;
+	if (pvsrow && !(pvsrow[sectnum>>3]&pow2char[sectnum&7])) return;
+	profilebegin(PROFILE_SCANSECTOR);
 	if (automapping) show2dsector[sectnum>>3] |= pow2char[sectnum&7];
 
 	sectorborder[0] = sectnum, sectorbordercnt = 1;
@@ -2942,7 +2958,8 @@ static void polymost_scansector (int sectnum)
 			x2 = wal2->x-globalposx; y2 = wal2->y-globalposy;
 
 			nextsectnum = wal->nextsector; //Scan close sectors
-			if ((nextsectnum >= 0) && (!(wal->cstat&32)) && (!(gotsector[nextsectnum>>3]&pow2char[nextsectnum&7])))
+			if ((nextsectnum >= 0) && (!(wal->cstat&32)) && (!(gotsector[nextsectnum>>3]&pow2char[nextsectnum&7])) &&
+				((!pvsrow) || (pvsrow[nextsectnum>>3]&pow2char[nextsectnum&7])))
 			{
 				d = (double)x1*(double)y2 - (double)x2*(double)y1; xp1 = (double)(x2-x1); yp1 = (double)(y2-y1);
 				if (d*d <= (xp1*xp1 + yp1*yp1)*(SCISDIST*SCISDIST*260.0))
@@ -2986,6 +3003,8 @@ static void polymost_scansector (int sectnum)
 			bunchlast[z] = zz;
 		}
 	} while (sectorbordercnt > 0);
+
+	profileend(PROFILE_SCANSECTOR);
 }
 
 void polymost_drawrooms ()
@@ -3176,6 +3195,7 @@ void polymost_drawrooms ()
 		if (globalcursectnum < 0) globalcursectnum = i;
 	}
 
+	pvsrow = getpvsrow(globalcursectnum);
 	polymost_scansector(globalcursectnum);
 
 	if (inpreparemirror)
@@ -3183,6 +3203,7 @@ void polymost_drawrooms ()
 		grhalfxdown10x = -grhalfxdown10;
 		inpreparemirror = 0;
 		polymost_drawalls(0);
+		renderstats.bunches++;
 		numbunches--;
 		bunchfirst[0] = bunchfirst[numbunches];
 		bunchlast[0] = bunchlast[numbunches];
@@ -3210,6 +3231,7 @@ void polymost_drawrooms ()
 		}
 
 		polymost_drawalls(closest);
+		renderstats.bunches++;
 
 		if (automapping)
 		{
@@ -4794,6 +4816,21 @@ static int osdcmd_polymostvars(const osdfuncparm_t *parm)
 		}
 		return OSDCMD_OK;
 	}
+	else if (!Bstrcasecmp(parm->name, "gltexcomprthreads")) {
+		if (showval) { buildprintf("gltexcomprthreads is %d\n", gltexcomprthreads); }
+		else gltexcomprthreads = max(0, val);
+		return OSDCMD_OK;
+	}
+	else if (!Bstrcasecmp(parm->name, "gltexmipgamma")) {
+		if (showval) { buildprintf("gltexmipgamma is %d\n", gltexmipgamma); }
+		else gltexmipgamma = (val != 0);
+		return OSDCMD_OK;
+	}
+	else if (!Bstrcasecmp(parm->name, "gltexstreaming")) {
+		if (showval) { buildprintf("gltexstreaming is %d\n", gltexstreaming); }
+		else gltexstreaming = (val != 0);
+		return OSDCMD_OK;
+	}
 	else if (!Bstrcasecmp(parm->name, "glredbluemode")) {
 		if (showval) { buildprintf("glredbluemode is %d\n", glredbluemode); }
 		else glredbluemode = (val != 0);
@@ -4860,6 +4897,9 @@ void polymost_initosdfuncs(void)
 	OSD_RegisterFunction("usehightile","usehightile: enable/disable hightile texture rendering in >8-bit mode",osdcmd_polymostvars);
 	OSD_RegisterFunction("glusetexcompr","glusetexcompr: enable/disable OpenGL texture compression",osdcmd_polymostvars);
 	OSD_RegisterFunction("gltexcomprquality","gltexcomprquality: sets texture compression quality. 0 = fast (default), 1 = slow, 2 = very slow",osdcmd_polymostvars);
+	OSD_RegisterFunction("gltexcomprthreads","gltexcomprthreads: sets the number of threads compressing textures. 0 = one per processor (default)",osdcmd_polymostvars);
+	OSD_RegisterFunction("gltexmipgamma","gltexmipgamma: enable/disable gamma-correct hightile mipmaps. Cached textures keep what they were made with",osdcmd_polymostvars);
+	OSD_RegisterFunction("gltexstreaming","gltexstreaming: enable/disable loading hightile textures in the background, drawing the ART tiles until they arrive",osdcmd_polymostvars);
 	OSD_RegisterFunction("glredbluemode","glredbluemode: enable/disable experimental OpenGL red-blue glasses mode",osdcmd_polymostvars);
 	OSD_RegisterFunction("gltexturemode", "gltexturemode: changes the texture filtering settings", osdcmd_gltexturemode);
 	OSD_RegisterFunction("gltextureanisotropy", "gltextureanisotropy: changes the OpenGL texture anisotropy setting", osdcmd_gltextureanisotropy);
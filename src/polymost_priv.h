@@ -55,6 +55,9 @@ struct glfiltermodes {
 extern struct glfiltermodes glfiltermodes[numglfiltermodes];
 
 extern int gltexcomprquality;	// 0 = fast, 1 = slow and pretty, 2 = very slow and pretty
+extern int gltexcomprthreads;	// 0 = one per processor
+extern int gltexmipgamma;	// 1 = average mipmaps as linear light
+extern int gltexstreaming;	// 1 = load hightile textures missing from the cache in the background
 extern int gltexmaxsize;	// 0 means autodetection on first run
 extern int gltexmiplevel;	// discards this many mipmap levels
 
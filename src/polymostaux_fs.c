@@ -0,0 +1,47 @@
+// Generated by text2c.pl. Do not edit directly.
+
+const char default_polymostaux_fs_glsl[] =
+	"#glbuild(ES2) #version 100\n"
+	"#glbuild(2)   #version 110\n"
+	"#glbuild(3)   #version 140\n"
+	"\n"
+	"#ifdef GL_ES\n"
+	"precision lowp float;\n"
+	"precision lowp int;\n"
+	"#  define o_fragcolour gl_FragColor\n"
+	"#elif __VERSION__ < 140\n"
+	"#  define mediump\n"
+	"#  define o_fragcolour gl_FragColor\n"
+	"#else\n"
+	"#  define varying in\n"
+	"#  define texture2D texture\n"
+	"out vec4 o_fragcolour;\n"
+	"#endif\n"
+	"\n"
+	"uniform sampler2D u_texture;\n"
+	"uniform vec4 u_colour;\n"
+	"uniform vec4 u_bgcolour;\n"
+	"uniform int u_mode;\n"
+	"\n"
+	"varying mediump vec2 v_texcoord;\n"
+	"\n"
+	"void main(void)\n"
+	"{\n"
+	"    vec4 pixel;\n"
+	"\n"
+	"    if (u_mode == 0) {\n"
+	"        // Text.\n"
+	"        pixel = texture2D(u_texture, v_texcoord);\n"
+	"        o_fragcolour = mix(u_bgcolour, u_colour, pixel.a);\n"
+	"    } else if (u_mode == 1) {\n"
+	"        // Tile screen.\n"
+	"        pixel = texture2D(u_texture, v_texcoord);\n"
+	"        o_fragcolour = mix(u_bgcolour, pixel, pixel.a);\n"
+	"    } else if (u_mode == 2) {\n"
+	"        // Foreground colour.\n"
+	"        o_fragcolour = u_colour;\n"
+	"    }\n"
+	"}\n"
+;
+
+const int default_polymostaux_fs_glsl_size = 914;
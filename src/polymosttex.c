@@ -14,6 +14,8 @@
 #include "polymosttex_priv.h"
 #include "polymosttexcache.h"
 #include "polymosttexcompress.h"
+#include "polymosttexstream.h"
+#include "texfilter.h"
 
 /** a texture hash entry */
 struct PTHash_typ {
@@ -58,6 +60,21 @@ struct PTTexture_typ {
 };
 typedef struct PTTexture_typ PTTexture;
 
+/** a texture made ready for uploading, every level of it in memory */
+struct PTMPrepared_typ {
+	GLint intexfmt;
+	GLenum rawfmt;
+	int compress;		// PTCOMPRESS_*
+	int sizx, sizy;		// padded size
+	int tsizx, tsizy;	// true size
+	int hasalpha;
+	int numlevels;
+	ptcompressimage levels[32];	// the output of each if compressed, else the bgra
+	int glevel[32];		// GL mip level of each, or -1 for one kept only for the cache
+	int comprticks;		// how long compressing took
+	PTCacheTile * tdef;	// the cache entry to write, or null; owns the outputs
+};
+
 static int primecnt   = 0;	// expected number of textures to load during priming
 static int primedone  = 0;	// running total of how many textures have been primed
 static int primepos   = 0;	// the position in pthashhead where we are up to in priming
@@ -81,7 +98,11 @@ static const char *compressfourcc[] = {
 static void ptm_fixtransparency(PTTexture * tex, int clamped);
 static void ptm_applyeffects(PTTexture * tex, int effects);
 static void ptm_mipscale(PTTexture * tex);
-static void ptm_uploadtexture(PTMHead * ptm, unsigned short flags, PTTexture * tex, PTCacheTile * tdef);
+static void ptm_preparelevels(PTTexture * tex, unsigned short flags, PTCacheTile * tdef, int pooled, PTMHead * direct, PTMPrepared * prep);
+static void ptm_uploadlevels(PTMHead * ptm, PTMPrepared * prep);
+static void ptm_freelevels(PTMPrepared * prep);
+static void ptm_bindtexture(PTMHead * ptm);
+static void ptm_uploadtexture(PTMHead * ptm, unsigned short flags, PTTexture * tex);
 
 
 static inline int pt_gethashhead(const int picnum)
@@ -190,6 +211,138 @@ PTMHead * PTM_GetHead(const PTMIdent *id)
 }
 
 
+/**
+ * Decodes a texture file into BGRA pixels, applies effects, and repeats the
+ * picture into its padding if it will wrap
+ * @param picdata the file's contents
+ * @param picdatalen the length of picdata
+ * @param tex the texture to receive the pixels, in tex->pic allocated with malloc()
+ * @param flags PTH_* flags to tune the load process
+ * @param effects HICEFFECT_* effects to apply
+ * @param pow2 whether to pad the texture to power of two dimensions
+ * @return 0 on success, <0 on error as for PTM_LoadTextureFile
+ */
+static int ptm_decodetexture(char * picdata, int picdatalen, PTTexture * tex, int flags, int effects, int pow2)
+{
+	int y;
+
+	tex->tsizx = tex->tsizy = 0;
+	kpgetdim(picdata, picdatalen, (int *) &tex->tsizx, (int *) &tex->tsizy);
+	if (tex->tsizx == 0 || tex->tsizy == 0) {
+		return -4;
+	}
+
+	if (pow2) {
+		for (tex->sizx = 1; tex->sizx < tex->tsizx; tex->sizx += tex->sizx) ;
+		for (tex->sizy = 1; tex->sizy < tex->tsizy; tex->sizy += tex->sizy) ;
+	} else {
+		tex->sizx = tex->tsizx;
+		tex->sizy = tex->tsizy;
+	}
+
+	tex->pic = (coltype *) malloc(tex->sizx * tex->sizy * sizeof(coltype));
+	if (!tex->pic) {
+		return -2;
+	}
+	memset(tex->pic, 0, tex->sizx * tex->sizy * sizeof(coltype));
+
+	if (kprender(picdata, picdatalen, tex->pic, tex->sizx * sizeof(coltype), tex->sizx, tex->sizy, 0, 0)) {
+		free(tex->pic);
+		tex->pic = 0;
+		return -5;
+	}
+
+	ptm_applyeffects(tex, effects);	// updates tex->hasalpha
+
+	if (! (flags & PTH_CLAMPED) || (flags & PTH_SKYBOX)) { //Duplicate texture pixels (wrapping tricks for non power of 2 texture sizes)
+		if (tex->sizx > tex->tsizx) {	//Copy left to right
+			coltype * lptr = tex->pic;
+			for (y = 0; y < tex->tsizy; y++, lptr += tex->sizx) {
+				memcpy(&lptr[tex->tsizx], lptr, (tex->sizx - tex->tsizx) << 2);
+			}
+		}
+		if (tex->sizy > tex->tsizy) {	//Copy top to bottom
+			memcpy(&tex->pic[tex->sizx * tex->tsizy], tex->pic, (tex->sizy - tex->tsizy) * tex->sizx << 2);
+		}
+	}
+
+	tex->rawfmt = GL_BGRA;
+
+	return 0;
+}
+
+/**
+ * Chooses the compressed format for a texture from those the driver offers
+ * @param hasalpha whether the texture has transparency
+ * @param intexfmt receives the OpenGL format code
+ * @return a PTCOMPRESS_* constant, or PTCOMPRESS_NONE if none suits
+ */
+static int ptm_choosecompression(int hasalpha, GLint * intexfmt)
+{
+#if GL_EXT_texture_compression_dxt1 || GL_EXT_texture_compression_s3tc
+	if (!hasalpha && glinfo.texcomprdxt1) {
+		*intexfmt = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		return PTCOMPRESS_DXT1;
+	}
+#endif
+#if GL_OES_compressed_ETC1_RGB8_texture
+	if (!hasalpha && glinfo.texcompretc1) {
+		*intexfmt = GL_ETC1_RGB8_OES;
+		return PTCOMPRESS_ETC1;
+	}
+#endif
+#if GL_EXT_texture_compression_s3tc
+	if (hasalpha && glinfo.texcomprdxt5) {
+		*intexfmt = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		return PTCOMPRESS_DXT5;
+	}
+#endif
+	return PTCOMPRESS_NONE;
+}
+
+/**
+ * Scales a texture down through every mip level and compresses the levels
+ * together. The texture is left at 1x1.
+ * @param tex the texture, already with its transparency fixed
+ * @param flags PTH_* flags
+ * @param compress the PTCOMPRESS_* format
+ * @param skip how many levels are to be thrown away rather than uploaded
+ * @param keepall whether the thrown away levels should be compressed anyway
+ * @param pooled whether the compressor's threads may be used
+ * @param levels receives the levels, whose bgra and output are allocated with malloc()
+ * @param glevel receives the GL mip level of each, or -1 for one thrown away
+ * @return the number of levels
+ */
+static int ptm_compresslevels(PTTexture * tex, unsigned short flags, int compress, int skip, int keepall,
+	int pooled, ptcompressimage * levels, int * glevel)
+{
+	int i, numlevels = 0, last;
+
+	// Scale down to every level first so they compress all at once.
+	for (i = 0; ; i++) {
+		glevel[numlevels] = max(0, i - skip);
+		last = (tex->sizx <= 1 && tex->sizy <= 1);
+		if (keepall || i >= skip || last) {
+			levels[numlevels].width = tex->sizx;
+			levels[numlevels].height = tex->sizy;
+			levels[numlevels].bgra = malloc(tex->sizx * tex->sizy * 4);
+			memcpy(levels[numlevels].bgra, tex->pic, tex->sizx * tex->sizy * 4);
+			levels[numlevels].output = (unsigned char *) malloc(ptcompress_getstorage(tex->sizx, tex->sizy, compress));
+			if (i < skip && !last) glevel[numlevels] = -1;
+			numlevels++;
+		}
+		if (last) break;
+
+		ptm_mipscale(tex);
+		ptm_fixtransparency(tex, (flags & PTH_CLAMPED));
+	}
+
+	ptcompress_compressmany(levels, numlevels, compress, pooled);
+
+	return numlevels;
+}
+
+
 /**
  * Loads a texture file into OpenGL from the PolymostTex cache
  * @param filename the texture filename
@@ -284,22 +437,20 @@ incompatible:
 
 
 /**
- * Loads a texture file into OpenGL
+ * Loads a texture file into OpenGL from the PolymostTex cache if it is there
  * @param filename the texture filename
  * @param ptmh the PTMHead structure to receive the texture details
  * @param flags PTH_* flags to tune the load process
- * @param effects HICEFFECT_* effects to apply
- * @return 0 on success, <0 on error
+ * @param effects HICEFFECT_* effects
+ * @param writetocache receives whether the texture should be written to the
+ *   cache once it has been prepared from the file
+ * @return 0 if it was loaded from the cache
  */
-int PTM_LoadTextureFile(const char* filename, PTMHead* ptmh, int flags, int effects)
+static int ptm_loadfromcache(const char* filename, PTMHead* ptmh, int flags, int effects, int* writetocache)
 {
-	PTTexture tex;
-	int filh, picdatalen;
-	int x, y;
-	char * picdata = 0;
-	PTCacheTile * tdef = 0;
-	int writetocache = 0, iscached = 0;
+	int iscached = 0;
 
+	*writetocache = 0;
 	if (!(flags & PTH_NOCOMPRESS) && glusetexcache && glusetexcompr) {
 		iscached = PTCacheHasTile(filename, effects, (flags & PTH_CLAMPED));
 
@@ -310,14 +461,41 @@ int PTM_LoadTextureFile(const char* filename, PTMHead* ptmh, int flags, int effe
 		}*/
 
 		if (!iscached) {
-			writetocache = 1;
+			*writetocache = 1;
 		}
 	}
 
 	if (iscached) {
-		if (ptm_loadcachedtexturefile(filename, ptmh, flags, effects) == 0) {
-			return 0;
-		}
+		return ptm_loadcachedtexturefile(filename, ptmh, flags, effects);
+	}
+	return -1;
+}
+
+/**
+ * Loads a texture file into OpenGL, or has it loaded in the background
+ * @param filename the texture filename
+ * @param ptmh the PTMHead structure to receive the texture details
+ * @param flags PTH_* flags to tune the load process
+ * @param effects HICEFFECT_* effects to apply
+ * @param background whether a texture missing from the cache may be left to
+ *   the loading threads
+ * @return 0 on success, 1 if it is loading in the background, <0 on error
+ */
+static int ptm_loadtexturefile(const char* filename, PTMHead* ptmh, int flags, int effects, int background)
+{
+	PTMPrepared * prep = 0;
+	int filh, picdatalen, err;
+	char * picdata = 0;
+	int writetocache = 0;
+
+	if (ptm_loadfromcache(filename, ptmh, flags, effects, &writetocache) == 0) {
+		return 0;
+	}
+
+	detect_texture_size();	// before the loading threads need it
+
+	if (background && ptstream_queue(filename, ptmh, flags, effects, writetocache) == 0) {
+		return 1;
 	}
 
 	filh = kopen4load((char *) filename, 0);
@@ -334,60 +512,64 @@ int PTM_LoadTextureFile(const char* filename, PTMHead* ptmh, int flags, int effe
 
 	if (kread(filh, picdata, picdatalen) != picdatalen) {
 		kclose(filh);
+		free(picdata);
 		return -3;
 	}
 
 	kclose(filh);
 
-	kpgetdim(picdata, picdatalen, (int *) &tex.tsizx, (int *) &tex.tsizy);
-	if (tex.tsizx == 0 || tex.tsizy == 0) {
-		free(picdata);
-		return -4;
-	}
-
-	if (!glinfo.texnpot || writetocache) {
-		for (tex.sizx = 1; tex.sizx < tex.tsizx; tex.sizx += tex.sizx) ;
-		for (tex.sizy = 1; tex.sizy < tex.tsizy; tex.sizy += tex.sizy) ;
-	} else {
-		tex.sizx = tex.tsizx;
-		tex.sizy = tex.tsizy;
+	err = PTM_PrepareTextureFile(filename, picdata, picdatalen, flags, effects, writetocache, 1, &prep);
+	free(picdata);
+	picdata = 0;
+	if (err) {
+		return err;
 	}
 
-	tex.pic = (coltype *) malloc(tex.sizx * tex.sizy * sizeof(coltype));
-	if (!tex.pic) {
-		return -2;
-	}
-	memset(tex.pic, 0, tex.sizx * tex.sizy * sizeof(coltype));
+	PTM_UploadPrepared(ptmh, prep);
 
-	if (kprender(picdata, picdatalen, tex.pic, tex.sizx * sizeof(coltype), tex.sizx, tex.sizy, 0, 0)) {
-		free(picdata);
-		free(tex.pic);
-		return -5;
-	}
+	return 0;
+}
 
-	free(picdata);
-	picdata = 0;
+/**
+ * Loads a texture file into OpenGL
+ * @param filename the texture filename
+ * @param ptmh the PTMHead structure to receive the texture details
+ * @param flags PTH_* flags to tune the load process
+ * @param effects HICEFFECT_* effects to apply
+ * @return 0 on success, <0 on error
+ */
+int PTM_LoadTextureFile(const char* filename, PTMHead* ptmh, int flags, int effects)
+{
+	return ptm_loadtexturefile(filename, ptmh, flags, effects, 0);
+}
 
-	ptm_applyeffects(&tex, effects);	// updates tex.hasalpha
+/**
+ * Decodes a texture file and makes every level ready for PTM_UploadPrepared,
+ * without involving OpenGL
+ * @param filename the texture filename, for the cache entry
+ * @param picdata the file's contents
+ * @param picdatalen the length of picdata
+ * @param flags PTH_* flags to tune the load process
+ * @param effects HICEFFECT_* effects to apply
+ * @param forcache whether to make a cache entry for PTM_UploadPrepared to write
+ * @param pooled whether compression may use the compressor's threads
+ * @param prep receives the prepared texture
+ * @return 0 on success, <0 on error as for PTM_LoadTextureFile
+ */
+int PTM_PrepareTextureFile(const char* filename, char* picdata, int picdatalen, int flags, int effects,
+	int forcache, int pooled, PTMPrepared** prep)
+{
+	PTTexture tex;
+	PTCacheTile * tdef = 0;
+	int err;
 
-	ptmh->flags = 0;
-	if (tex.hasalpha) {
-		ptmh->flags |= PTH_HASALPHA;
-	}
+	*prep = 0;
 
-	if (! (flags & PTH_CLAMPED) || (flags & PTH_SKYBOX)) { //Duplicate texture pixels (wrapping tricks for non power of 2 texture sizes)
-		if (tex.sizx > tex.tsizx) {	//Copy left to right
-			coltype * lptr = tex.pic;
-			for (y = 0; y < tex.tsizy; y++, lptr += tex.sizx) {
-				memcpy(&lptr[tex.tsizx], lptr, (tex.sizx - tex.tsizx) << 2);
-			}
-		}
-		if (tex.sizy > tex.tsizy) {	//Copy top to bottom
-			memcpy(&tex.pic[tex.sizx * tex.tsizy], tex.pic, (tex.sizy - tex.tsizy) * tex.sizx << 2);
-		}
+	err = ptm_decodetexture(picdata, picdatalen, &tex, flags, effects, !glinfo.texnpot || forcache);
+	if (err) {
+		return err;
 	}
 
-	tex.rawfmt = GL_BGRA;
 	if (!glinfo.bgra) {
 		int j;
 		for (j = tex.sizx * tex.sizy - 1; j >= 0; j--) {
@@ -396,12 +578,13 @@ int PTM_LoadTextureFile(const char* filename, PTMHead* ptmh, int flags, int effe
 		tex.rawfmt = GL_RGBA;
 	}
 
-	ptmh->tsizx = tex.tsizx;
-	ptmh->tsizy = tex.tsizy;
-	ptmh->sizx  = tex.sizx;
-	ptmh->sizy  = tex.sizy;
+	*prep = (PTMPrepared *) malloc(sizeof(PTMPrepared));
+	if (!*prep) {
+		free(tex.pic);
+		return -2;
+	}
 
-	if (writetocache) {
+	if (forcache) {
 		int nmips = 0;
 		while (max(1, (tex.sizx >> nmips)) > 1 ||
 			   max(1, (tex.sizy >> nmips)) > 1) {
@@ -412,26 +595,104 @@ int PTM_LoadTextureFile(const char* filename, PTMHead* ptmh, int flags, int effe
 		tdef = PTCacheAllocNewTile(nmips);
 		tdef->filename = strdup(filename);
 		tdef->effects = effects;
-		tdef->flags = (flags | ptmh->flags) & (PTH_CLAMPED | PTH_HASALPHA);
+		tdef->flags = (flags | (tex.hasalpha ? PTH_HASALPHA : 0)) & (PTH_CLAMPED | PTH_HASALPHA);
 	}
 
-	ptm_uploadtexture(ptmh, flags, &tex, tdef);
+	ptm_preparelevels(&tex, flags, tdef, pooled, 0, *prep);
+
+	free(tex.pic);
+
+	return 0;
+}
+
+/**
+ * Uploads a prepared texture into OpenGL, writes its cache entry if it has
+ * one, and frees it
+ * @param ptmh the PTMHead structure to receive the texture details
+ * @param prep the prepared texture
+ */
+void PTM_UploadPrepared(PTMHead* ptmh, PTMPrepared* prep)
+{
+	ptmh->tsizx = prep->tsizx;
+	ptmh->tsizy = prep->tsizy;
+	ptmh->sizx  = prep->sizx;
+	ptmh->sizy  = prep->sizy;
+
+	ptm_uploadlevels(ptmh, prep);
 
-	if (writetocache) {
+	if (prep->tdef) {
 		if (polymosttexverbosity >= 2) {
 			buildprintf("PolymostTex: writing %s (effects %d, flags %d) to cache\n",
-					   tdef->filename, tdef->effects, tdef->flags);
+					   prep->tdef->filename, prep->tdef->effects, prep->tdef->flags);
 		}
-		PTCacheWriteTile(tdef);
-		PTCacheFreeTile(tdef);
-		tdef = 0;
+		PTCacheWriteTile(prep->tdef);
 	}
 
+	PTM_FreePrepared(prep);
+}
 
-	if (tex.pic) {
+/**
+ * Frees a prepared texture without uploading it
+ * @param prep the prepared texture
+ */
+void PTM_FreePrepared(PTMPrepared* prep)
+{
+	ptm_freelevels(prep);
+	free(prep);
+}
+
+/**
+ * Prepares a texture file's cache entry just as PTM_LoadTextureFile does
+ * before storing it, without involving OpenGL
+ * @param filename the texture filename
+ * @param picdata the file's contents
+ * @param picdatalen the length of picdata
+ * @param flags PTH_* flags to tune the load process
+ * @param effects HICEFFECT_* effects to apply
+ * @param tdef receives the cache entry, for PTCacheWriteTile and PTCacheFreeTile
+ * @return 0 on success, <0 on error
+ */
+int PTM_BakeTextureFile(const char* filename, char* picdata, int picdatalen, int flags, int effects, PTCacheTile** tdef)
+{
+	PTTexture tex;
+	GLint intexfmt;
+	ptcompressimage levels[32];
+	int glevel[32], numlevels, compress, err, i;
+
+	*tdef = 0;
+
+	err = ptm_decodetexture(picdata, picdatalen, &tex, flags, effects, 1);
+	if (err) {
+		return err;
+	}
+
+	compress = ptm_choosecompression(tex.hasalpha, &intexfmt);
+	if (!compress) {
 		free(tex.pic);
-		tex.pic = 0;
+		return -6;
+	}
+
+	ptm_fixtransparency(&tex, (flags & PTH_CLAMPED));
+
+	*tdef = PTCacheAllocNewTile(32);
+	(*tdef)->filename = strdup(filename);
+	(*tdef)->effects = effects;
+	(*tdef)->flags = (flags & PTH_CLAMPED) | (tex.hasalpha ? PTH_HASALPHA : 0);
+	(*tdef)->format = intexfmt;
+	(*tdef)->tsizx = tex.tsizx;
+	(*tdef)->tsizy = tex.tsizy;
+
+	numlevels = ptm_compresslevels(&tex, flags, compress, 0, 1, 0, levels, glevel);
+	for (i = 0; i < numlevels; i++) {
+		(*tdef)->mipmap[i].sizx = levels[i].width;
+		(*tdef)->mipmap[i].sizy = levels[i].height;
+		(*tdef)->mipmap[i].length = ptcompress_getstorage(levels[i].width, levels[i].height, compress);
+		(*tdef)->mipmap[i].data = levels[i].output;
+		free(levels[i].bgra);
 	}
+	(*tdef)->nummipmaps = numlevels;
+
+	free(tex.pic);
 
 	return 0;
 }
@@ -456,6 +717,8 @@ const char * PTM_GetLoadTextureFileErrorString(int err)
 			return "unrecognised format";
 		case -5:
 			return "decode error";
+		case -6:
+			return "no compressed format suits it";
 		default:
 			return "unknown error";
 	}
@@ -557,34 +820,59 @@ static void pt_unload(PTHash * pth)
 {
 	int i;
 	for (i = PTHPIC_SIZE - 1; i>=0; i--) {
+		if (pth->head.pic[i]) {
+			ptstream_cancel(pth->head.pic[i]);
+		}
 		if (pth->head.pic[i] && pth->head.pic[i]->glpic) {
 			glfunc.glDeleteTextures(1, &pth->head.pic[i]->glpic);
 			pth->head.pic[i]->glpic = 0;
 		}
 	}
+	pth->head.flags &= ~PTH_LOADING;
 }
 
 static int pt_load_art(PTHead * pth);
-static int pt_load_hightile(PTHead * pth);
+static int pt_load_hightile(PTHead * pth, int background);
 static void pt_load_applyparameters(PTHead * pth);
 
 /**
  * Loads a texture into memory from disk
  * @param pth pointer to the pthash of the texture to load
- * @return !0 on success
+ * @param background whether a hightile replacement may be loaded in the background
+ * @return the pthash to draw with, which is the ART version standing in for
+ *   pth while its replacement loads in the background, or null on failure
  */
-static int pt_load(PTHash * pth)
+static PTHash * pt_load(PTHash * pth, int background)
 {
+	PTHash * art;
+
 	if (pth->head.pic[PTHPIC_BASE] &&
 		pth->head.pic[PTHPIC_BASE]->glpic != 0 &&
 		(pth->head.pic[PTHPIC_BASE]->flags & PTH_DIRTY) == 0) {
-		return 1;	// loaded
+		return pth;	// loaded
 	}
 
 	if ((pth->head.flags & PTH_HIGHTILE)) {
 		// try and load from a replacement
-		if (pt_load_hightile(&pth->head)) {
-			return 1;
+		switch (pt_load_hightile(&pth->head, background)) {
+			case 1:
+				return pth;
+			case -1:
+				// it's on its way, so until then draw the ART version
+				// without deferring to it for good
+				if (pth->head.flags & PTH_SKYBOX) {
+					return 0;
+				}
+				art = pt_findhash(
+						pth->head.picnum, pth->head.palnum,
+						(pth->head.flags & ~PTH_HIGHTILE),
+						1);
+				if (!art) {
+					return 0;
+				}
+				return pt_load(art, 0);
+			default:
+				break;
 		}
 
 		// if that failed, get the hash for the ART version and
@@ -596,11 +884,11 @@ static int pt_load(PTHash * pth)
 		if (!pth->deferto) {
 			return 0;
 		}
-		return pt_load(pth->deferto);
+		return pt_load(pth->deferto, background);
 	}
 
 	if (pt_load_art(&pth->head)) {
-		return 1;
+		return pth;
 	}
 
 	// we're SOL
@@ -723,7 +1011,7 @@ static int pt_load_art(PTHead * pth)
 	pth->pic[PTHPIC_BASE]->tsizy = tex.tsizy;
 	pth->pic[PTHPIC_BASE]->sizx  = tex.sizx;
 	pth->pic[PTHPIC_BASE]->sizy  = tex.sizy;
-	ptm_uploadtexture(pth->pic[PTHPIC_BASE], pth->flags, &tex, 0);
+	ptm_uploadtexture(pth->pic[PTHPIC_BASE], pth->flags, &tex);
 
 	if (hasfullbright) {
         id.layer = PTHPIC_GLOW;
@@ -733,7 +1021,7 @@ static int pt_load_art(PTHead * pth)
 		pth->pic[PTHPIC_GLOW]->sizx  = tex.sizx;
 		pth->pic[PTHPIC_GLOW]->sizy  = tex.sizy;
 		fbtex.hasalpha = 1;
-		ptm_uploadtexture(pth->pic[PTHPIC_GLOW], pth->flags, &fbtex, 0);
+		ptm_uploadtexture(pth->pic[PTHPIC_GLOW], pth->flags, &fbtex);
 	} else {
 		// it might be that after reloading an invalidated texture, the
 		// glow map might not be needed anymore, so release it
@@ -754,13 +1042,16 @@ static int pt_load_art(PTHead * pth)
 /**
  * Load a Hightile texture into an OpenGL texture
  * @param pth the header to populate
- * @return !0 on success. Success is defined as all faces of a skybox being loaded,
- *   or at least the base texture of a regular replacement.
+ * @param background whether textures missing from the cache may be left to
+ *   the loading threads. If not, any of pth's textures already with them are
+ *   waited for.
+ * @return 1 on success, 0 on failure, or -1 while loading in the background.
+ *   Success is defined as all faces of a skybox being loaded, or at least the
+ *   base texture of a regular replacement.
  */
-static int pt_load_hightile(PTHead * pth)
+static int pt_load_hightile(PTHead * pth, int background)
 {
 	const char *filename = 0;
-	int hasalpha = 0;
 	int effects = 0;
 	int err = 0;
 	int texture = 0, loaded[PTHPIC_SIZE] = { 0,0,0,0,0,0, };
@@ -774,46 +1065,82 @@ static int pt_load_hightile(PTHead * pth)
 		return 0;
 	}
 
-	effects = (pth->palnum != pth->repldef->palnum) ? hictinting[pth->palnum].f : 0;
+	if (!(pth->flags & PTH_LOADING)) {
+		effects = (pth->palnum != pth->repldef->palnum) ? hictinting[pth->palnum].f : 0;
 
-	pth->flags &= ~(PTH_NOCOMPRESS | PTH_HASALPHA);
-	if (pth->repldef->flags & HIC_NOCOMPRESS) {
-		pth->flags |= PTH_NOCOMPRESS;
-	}
+		pth->flags &= ~(PTH_NOCOMPRESS | PTH_HASALPHA);
+		if (pth->repldef->flags & HIC_NOCOMPRESS) {
+			pth->flags |= PTH_NOCOMPRESS;
+		}
 
-	for (texture = 0; texture < PTHPIC_SIZE; texture++) {
-		if (pth->flags & PTH_SKYBOX) {
-			if (texture >= 6) {
-				texture = PTHPIC_SIZE;
-				continue;
-			}
-			filename = pth->repldef->skybox->face[texture];
-		} else {
-			switch (texture) {
-				case PTHPIC_BASE:
-					filename = pth->repldef->filename;
-					break;
-				default:
-					// future developments may use the other indices
+		for (texture = 0; texture < PTHPIC_SIZE; texture++) {
+			if (pth->flags & PTH_SKYBOX) {
+				if (texture >= 6) {
 					texture = PTHPIC_SIZE;
 					continue;
+				}
+				filename = pth->repldef->skybox->face[texture];
+			} else {
+				switch (texture) {
+					case PTHPIC_BASE:
+						filename = pth->repldef->filename;
+						break;
+					default:
+						// future developments may use the other indices
+						texture = PTHPIC_SIZE;
+						continue;
+				}
 			}
-		}
 
-		if (!filename) {
-			continue;
-		}
+			if (!filename) {
+				continue;
+			}
 
-        PTM_InitIdent(&id, pth);
-        id.layer = texture;
-        pth->pic[texture] = PTM_GetHead(&id);
+	        PTM_InitIdent(&id, pth);
+	        id.layer = texture;
+	        pth->pic[texture] = PTM_GetHead(&id);
+
+			err = ptm_loadtexturefile(filename, pth->pic[texture], pth->flags, effects, background);
+			if (err > 0) {
+				pth->flags |= PTH_LOADING;
+			} else if (err < 0) {
+				if (polymosttexverbosity >= 1) {
+					const char * errstr = PTM_GetLoadTextureFileErrorString(err);
+					buildprintf("PolymostTex: %s (pic %d pal %d) %s\n",
+							   filename, pth->picnum, pth->palnum, errstr);
+				}
+				if (pth->pic[texture]->glpic) {
+					// a reload failed, so don't go on with the old version
+					glfunc.glDeleteTextures(1, &pth->pic[texture]->glpic);
+					pth->pic[texture]->glpic = 0;
+				}
+			}
+		}
+	}
 
-		if ((err = PTM_LoadTextureFile(filename, pth->pic[texture], pth->flags, effects))) {
-			if (polymosttexverbosity >= 1) {
-				const char * errstr = PTM_GetLoadTextureFileErrorString(err);
-				buildprintf("PolymostTex: %s (pic %d pal %d) %s\n",
-						   filename, pth->picnum, pth->palnum, errstr);
+	if (pth->flags & PTH_LOADING) {
+		for (texture = 0; texture < PTHPIC_SIZE; texture++) {
+			if (!pth->pic[texture] || !(pth->pic[texture]->flags & PTH_LOADING)) {
+				continue;
+			}
+			if (background) {
+				return -1;
 			}
+			ptstream_finish(pth->pic[texture]);
+		}
+		pth->flags &= ~PTH_LOADING;
+	}
+
+	// Textures that failed are left without a glpic.
+	for (texture = 0; texture < PTHPIC_SIZE; texture++) {
+		if (pth->flags & PTH_SKYBOX) {
+			if (texture >= 6) break;
+			filename = pth->repldef->skybox->face[texture];
+		} else {
+			if (texture != PTHPIC_BASE) break;
+			filename = pth->repldef->filename;
+		}
+		if (!filename || !pth->pic[texture] || !pth->pic[texture]->glpic) {
 			continue;
 		}
 
@@ -890,79 +1217,8 @@ static void pt_load_applyparameters(PTHead * pth)
  */
 static void ptm_fixtransparency(PTTexture * tex, int clamped)
 {
-	coltype *wpptr;
-	int j, x, y, r, g, b;
-	int dox, doy, naxsiz2;
-	int daxsiz = tex->tsizx, daysiz = tex->tsizy;
-	int daxsiz2 = tex->sizx, daysiz2 = tex->sizy;
-
-	dox = daxsiz2-1;
-	doy = daysiz2-1;
-	if (clamped) {
-		dox = min(dox,daxsiz);
-		doy = min(doy,daysiz);
-	} else {
-		// Make repeating textures duplicate top/left parts
-		daxsiz = daxsiz2;
-		daysiz = daysiz2;
-	}
-
-	daxsiz--; daysiz--; naxsiz2 = -daxsiz2; // Hacks for optimization inside loop
-
-	// Set transparent pixels to average color of neighboring opaque pixels
-	// Doing this makes bilinear filtering look much better for masked textures (I.E. sprites)
-	for (y = doy; y >= 0; y--) {
-		wpptr = &tex->pic[y*daxsiz2+dox];
-		for (x = dox; x >= 0; x--, wpptr--) {
-			if (wpptr->a) {
-				continue;
-			}
-			r = g = b = j = 0;
-			if ((x>     0) && (wpptr[     -1].a)) {
-				r += (int)wpptr[     -1].r;
-				g += (int)wpptr[     -1].g;
-				b += (int)wpptr[     -1].b;
-				j++;
-			}
-			if ((x<daxsiz) && (wpptr[     +1].a)) {
-				r += (int)wpptr[     +1].r;
-				g += (int)wpptr[     +1].g;
-				b += (int)wpptr[     +1].b;
-				j++;
-			}
-			if ((y>     0) && (wpptr[naxsiz2].a)) {
-				r += (int)wpptr[naxsiz2].r;
-				g += (int)wpptr[naxsiz2].g;
-				b += (int)wpptr[naxsiz2].b;
-				j++;
-			}
-			if ((y<daysiz) && (wpptr[daxsiz2].a)) {
-				r += (int)wpptr[daxsiz2].r;
-				g += (int)wpptr[daxsiz2].g;
-				b += (int)wpptr[daxsiz2].b;
-				j++;
-			}
-			switch (j) {
-				case 1: wpptr->r =   r            ;
-					wpptr->g =   g            ;
-					wpptr->b =   b            ;
-					break;
-				case 2: wpptr->r = ((r   +  1)>>1);
-					wpptr->g = ((g   +  1)>>1);
-					wpptr->b = ((b   +  1)>>1);
-					break;
-				case 3: wpptr->r = ((r*85+128)>>8);
-					wpptr->g = ((g*85+128)>>8);
-					wpptr->b = ((b*85+128)>>8);
-					break;
-				case 4: wpptr->r = ((r   +  2)>>2);
-					wpptr->g = ((g   +  2)>>2);
-					wpptr->b = ((b   +  2)>>2);
-					break;
-				default: break;
-			}
-		}
-	}
+	texfilter_fixtransparency((unsigned char *) tex->pic, tex->sizx, tex->sizy,
+		tex->tsizx, tex->tsizy, clamped);
 }
 
 /**
@@ -1027,140 +1283,58 @@ static void ptm_applyeffects(PTTexture * tex, int effects)
  */
 static void ptm_mipscale(PTTexture * tex)
 {
-	GLsizei newx, newy;
-	GLsizei x, y;
-	coltype *wpptr, *rpptr;
-	int r, g, b, a, k;
-
-	newx = max(1, (tex->sizx >> 1));
-	newy = max(1, (tex->sizy >> 1));
-
-	for (y = 0; y < newy; y++) {
-		wpptr = &tex->pic[y * newx];
-		rpptr = &tex->pic[(y << 1) * tex->sizx];
-
-		for (x = 0; x < newx; x++, wpptr++, rpptr += 2) {
-			r = g = b = a = k = 0;
-			if (rpptr[0].a) {
-				r += (int)rpptr[0].r;
-				g += (int)rpptr[0].g;
-				b += (int)rpptr[0].b;
-				a += (int)rpptr[0].a;
-				k++;
-			}
-			if ((x+x+1 < tex->sizx) && (rpptr[1].a)) {
-				r += (int)rpptr[1].r;
-				g += (int)rpptr[1].g;
-				b += (int)rpptr[1].b;
-				a += (int)rpptr[1].a;
-				k++;
-			}
-			if (y+y+1 < tex->sizy) {
-				if (rpptr[tex->sizx].a) {
-					r += (int)rpptr[tex->sizx  ].r;
-					g += (int)rpptr[tex->sizx  ].g;
-					b += (int)rpptr[tex->sizx  ].b;
-					a += (int)rpptr[tex->sizx  ].a;
-					k++;
-				}
-				if ((x+x+1 < tex->sizx) && (rpptr[tex->sizx+1].a)) {
-					r += (int)rpptr[tex->sizx+1].r;
-					g += (int)rpptr[tex->sizx+1].g;
-					b += (int)rpptr[tex->sizx+1].b;
-					a += (int)rpptr[tex->sizx+1].a;
-					k++;
-				}
-			}
-			switch(k) {
-				case 0:
-				case 1: wpptr->r = r;
-					wpptr->g = g;
-					wpptr->b = b;
-					wpptr->a = a;
-					break;
-				case 2: wpptr->r = ((r+1)>>1);
-					wpptr->g = ((g+1)>>1);
-					wpptr->b = ((b+1)>>1);
-					wpptr->a = ((a+1)>>1);
-					break;
-				case 3: wpptr->r = ((r*85+128)>>8);
-					wpptr->g = ((g*85+128)>>8);
-					wpptr->b = ((b*85+128)>>8);
-					wpptr->a = ((a*85+128)>>8);
-					break;
-				case 4: wpptr->r = ((r+2)>>2);
-					wpptr->g = ((g+2)>>2);
-					wpptr->b = ((b+2)>>2);
-					wpptr->a = ((a+2)>>2);
-					break;
-				default: break;
-			}
-			//if (wpptr->a) wpptr->a = 255;
-		}
-	}
+	texfilter_mipscale((unsigned char *) tex->pic, tex->sizx, tex->sizy, gltexmipgamma);
 
-	tex->sizx = newx;
-	tex->sizy = newy;
+	tex->sizx = max(1, (tex->sizx >> 1));
+	tex->sizy = max(1, (tex->sizy >> 1));
 }
 
 
 /**
- * Sends texture data to GL
- * @param ptm the texture management header
+ * Makes every level of a texture ready to send to GL
+ * @param tex the texture, which is left scaled down
  * @param flags extra flags to modify how the texture is uploaded
- * @param tex the texture to upload
- * @param tdef the polymosttexcache definition to receive compressed mipmaps, or null
+ * @param tdef the polymosttexcache definition to receive compressed mipmaps, or null.
+ *   It is freed if the texture isn't compressed after all.
+ * @param pooled whether compression may use the compressor's threads
+ * @param direct the texture management header to send an uncompressed texture's
+ *   levels to as they are made, leaving prep without any, or null to keep GL
+ *   out of it, as another thread must
+ * @param prep receives the levels
  */
-static void ptm_uploadtexture(PTMHead * ptm, unsigned short flags, PTTexture * tex, PTCacheTile * tdef)
+static void ptm_preparelevels(PTTexture * tex, unsigned short flags, PTCacheTile * tdef, int pooled, PTMHead * direct, PTMPrepared * prep)
 {
-	int i;
-	GLint mipmap;
-	GLint intexfmt;
-	int compress = PTCOMPRESS_NONE;
-	unsigned char * comprdata = 0;
-	int tdefmip = 0, comprsize = 0;
+	int i, mipmap;
 	int starttime;
 
-	detect_texture_size();
+	memset(prep, 0, sizeof(PTMPrepared));
+	prep->sizx = tex->sizx;
+	prep->sizy = tex->sizy;
+	prep->tsizx = tex->tsizx;
+	prep->tsizy = tex->tsizy;
+	prep->hasalpha = tex->hasalpha;
+	prep->rawfmt = tex->rawfmt;
 
 #if USE_OPENGL == USE_GLES2
 	// GLES permits BGRA as an internal format.
-    intexfmt = tex->rawfmt;
+    prep->intexfmt = tex->rawfmt;
 #else
-    intexfmt = GL_RGBA;
+    prep->intexfmt = GL_RGBA;
 #endif
 	if (!(flags & PTH_NOCOMPRESS) && glusetexcompr) {
-#if GL_EXT_texture_compression_dxt1 || GL_EXT_texture_compression_s3tc
-		if (!compress && !tex->hasalpha && glinfo.texcomprdxt1) {
-			intexfmt = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
-			compress = PTCOMPRESS_DXT1;
-		}
-#endif
-#if GL_OES_compressed_ETC1_RGB8_texture
-		if (!compress && !tex->hasalpha && glinfo.texcompretc1) {
-			intexfmt = GL_ETC1_RGB8_OES;
-			compress = PTCOMPRESS_ETC1;
-		}
-#endif
-#if GL_EXT_texture_compression_s3tc
-		if (!compress && tex->hasalpha && glinfo.texcomprdxt5) {
-			intexfmt = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
-			compress = PTCOMPRESS_DXT5;
-		}
-#endif
+		prep->compress = ptm_choosecompression(tex->hasalpha, &prep->intexfmt);
 	}
 
-	if (compress && tdef) {
-		tdef->format = intexfmt;
+	if (prep->compress && tdef) {
+		tdef->format = prep->intexfmt;
 		tdef->tsizx  = tex->tsizx;
 		tdef->tsizy  = tex->tsizy;
+		prep->tdef = tdef;
+	} else if (tdef) {
+		PTCacheFreeTile(tdef);
+		tdef = 0;
 	}
 
-	if (ptm->glpic == 0) {
-		glfunc.glGenTextures(1, &ptm->glpic);
-	}
-	glfunc.glBindTexture(GL_TEXTURE_2D, ptm->glpic);
-
 	ptm_fixtransparency(tex, (flags & PTH_CLAMPED));
 
 	mipmap = 0;
@@ -1176,117 +1350,146 @@ static void ptm_uploadtexture(PTMHead * ptm, unsigned short flags, PTTexture * t
 		mipmap++;
 	}
 
-	for ( ;
-	     mipmap > 0 && (tex->sizx > 1 || tex->sizy > 1);
-	     mipmap--) {
-		if (compress && tdef) {
-			comprsize = ptcompress_getstorage(tex->sizx, tex->sizy, compress);
-			comprdata = (unsigned char *) malloc(comprsize);
-
-			starttime = getticks();
-			ptcompress_compress(tex->pic, tex->sizx, tex->sizy, comprdata, compress);
-			if (polymosttexverbosity >= 2) {
-				buildprintf("PolymostTex: ptcompress_compress (%dx%d, %s) took %f sec\n",
-					   tex->sizx, tex->sizy, compressfourcc[compress],
-					   (float)(getticks() - starttime) / 1000.f);
-			}
+	if (prep->compress) {
+		// Levels thrown away are still compressed for the cache.
+		starttime = getticks();
+		prep->numlevels = ptm_compresslevels(tex, flags, prep->compress, mipmap, tdef != 0, pooled,
+			prep->levels, prep->glevel);
+		prep->comprticks = getticks() - starttime;
 
-			tdef->mipmap[tdefmip].sizx = tex->sizx;
-			tdef->mipmap[tdefmip].sizy = tex->sizy;
-			tdef->mipmap[tdefmip].length = comprsize;
-			tdef->mipmap[tdefmip].data = comprdata;
-			tdefmip++;
+		for (i = 0; i < prep->numlevels; i++) {
+			free(prep->levels[i].bgra);
+			prep->levels[i].bgra = 0;
 
-			comprdata = 0;
+			if (tdef) {
+				tdef->mipmap[i].sizx = prep->levels[i].width;
+				tdef->mipmap[i].sizy = prep->levels[i].height;
+				tdef->mipmap[i].length = ptcompress_getstorage(prep->levels[i].width, prep->levels[i].height, prep->compress);
+				tdef->mipmap[i].data = prep->levels[i].output;
+			}
 		}
-
-		ptm_mipscale(tex);
-		ptm_fixtransparency(tex, (flags & PTH_CLAMPED));
-	}
-
-	if (compress) {
-		comprsize = ptcompress_getstorage(tex->sizx, tex->sizy, compress);
-		comprdata = (unsigned char *) malloc(comprsize);
-
-		starttime = getticks();
-		ptcompress_compress(tex->pic, tex->sizx, tex->sizy, comprdata, compress);
-		if (polymosttexverbosity >= 2) {
-			buildprintf("PolymostTex: ptcompress_compress (%dx%d, %s) took %f sec\n",
-				   tex->sizx, tex->sizy, compressfourcc[compress],
-				   (float)(getticks() - starttime) / 1000.f);
+	} else {
+		for ( ;
+		     mipmap > 0 && (tex->sizx > 1 || tex->sizy > 1);
+		     mipmap--) {
+			ptm_mipscale(tex);
+			ptm_fixtransparency(tex, (flags & PTH_CLAMPED));
 		}
 
-		if (tdef) {
-			tdef->mipmap[tdefmip].sizx = tex->sizx;
-			tdef->mipmap[tdefmip].sizy = tex->sizy;
-			tdef->mipmap[tdefmip].length = comprsize;
-			tdef->mipmap[tdefmip].data = comprdata;
-			tdefmip++;
+		if (direct) {
+			ptm_bindtexture(direct);
 		}
+		for (i = 0; ; i++) {
+			if (direct) {
+				glfunc.glTexImage2D(GL_TEXTURE_2D, i, prep->intexfmt, tex->sizx, tex->sizy, 0,
+					prep->rawfmt, GL_UNSIGNED_BYTE, (const GLvoid *) tex->pic);
+			} else {
+				prep->levels[i].width = tex->sizx;
+				prep->levels[i].height = tex->sizy;
+				prep->levels[i].bgra = malloc(tex->sizx * tex->sizy * 4);
+				memcpy(prep->levels[i].bgra, tex->pic, tex->sizx * tex->sizy * 4);
+				prep->glevel[i] = i;
+			}
+			if (tex->sizx <= 1 && tex->sizy <= 1) break;
 
-		glfunc.glCompressedTexImage2D(GL_TEXTURE_2D, 0,
-			intexfmt, tex->sizx, tex->sizy, 0,
-			comprsize, (const GLvoid *) comprdata);
-
-		if (tdef) {
-			// we need to retain each mipmap for the tdef struct, so
-			// force each mipmap to be allocated afresh in the loop below
-			comprdata = 0;
+			ptm_mipscale(tex);
+			ptm_fixtransparency(tex, (flags & PTH_CLAMPED));
 		}
-	} else {
-		glfunc.glTexImage2D(GL_TEXTURE_2D, 0,
-			intexfmt, tex->sizx, tex->sizy, 0, tex->rawfmt,
-			GL_UNSIGNED_BYTE, (const GLvoid *) tex->pic);
+		prep->numlevels = direct ? 0 : i + 1;
 	}
+}
 
-	for (mipmap = 1; tex->sizx > 1 || tex->sizy > 1; mipmap++) {
-		ptm_mipscale(tex);
-		ptm_fixtransparency(tex, (flags & PTH_CLAMPED));
+/**
+ * Creates a texture's GL object if it has none, and binds it
+ * @param ptm the texture management header
+ */
+static void ptm_bindtexture(PTMHead * ptm)
+{
+	if (ptm->glpic == 0) {
+		glfunc.glGenTextures(1, &ptm->glpic);
+	}
+	glfunc.glBindTexture(GL_TEXTURE_2D, ptm->glpic);
+}
 
-		if (compress) {
-			comprsize = ptcompress_getstorage(tex->sizx, tex->sizy, compress);
-			if (tdef) {
-				comprdata = (unsigned char *) malloc(comprsize);
-			}
+/**
+ * Sends prepared levels to GL
+ * @param ptm the texture management header
+ * @param prep the levels
+ */
+static void ptm_uploadlevels(PTMHead * ptm, PTMPrepared * prep)
+{
+	int i;
 
-			starttime = getticks();
-			ptcompress_compress(tex->pic, tex->sizx, tex->sizy, comprdata, compress);
-			if (polymosttexverbosity >= 2) {
-				buildprintf("PolymostTex: ptcompress_compress (%dx%d, %s) took %f sec\n",
-					   tex->sizx, tex->sizy, compressfourcc[compress],
-					   (float)(getticks() - starttime) / 1000.f);
-			}
+	tracebegin("texture upload");
 
-			if (tdef) {
-				tdef->mipmap[tdefmip].sizx = tex->sizx;
-				tdef->mipmap[tdefmip].sizy = tex->sizy;
-				tdef->mipmap[tdefmip].length = comprsize;
-				tdef->mipmap[tdefmip].data = comprdata;
-				tdefmip++;
-			}
+	if (prep->compress && polymosttexverbosity >= 2) {
+		buildprintf("PolymostTex: ptcompress_compressmany (%dx%d, %d levels, %s) took %f sec\n",
+			   prep->levels[0].width, prep->levels[0].height, prep->numlevels, compressfourcc[prep->compress],
+			   (float)prep->comprticks / 1000.f);
+	}
 
-			glfunc.glCompressedTexImage2D(GL_TEXTURE_2D, mipmap,
-						intexfmt, tex->sizx, tex->sizy, 0,
-						comprsize, (const GLvoid *) comprdata);
+	ptm_bindtexture(ptm);
 
-			if (tdef) {
-				// we need to retain each mipmap for the tdef struct, so
-				// force each mipmap to be allocated afresh in this loop
-				comprdata = 0;
-			}
+	for (i = 0; i < prep->numlevels; i++) {
+		if (prep->glevel[i] < 0) {
+			continue;
+		}
+		if (prep->compress) {
+			glfunc.glCompressedTexImage2D(GL_TEXTURE_2D, prep->glevel[i],
+				prep->intexfmt, prep->levels[i].width, prep->levels[i].height, 0,
+				ptcompress_getstorage(prep->levels[i].width, prep->levels[i].height, prep->compress),
+				(const GLvoid *) prep->levels[i].output);
 		} else {
-			glfunc.glTexImage2D(GL_TEXTURE_2D, mipmap,
-				intexfmt, tex->sizx, tex->sizy, 0, tex->rawfmt,
-				GL_UNSIGNED_BYTE, (const GLvoid *) tex->pic);
+			glfunc.glTexImage2D(GL_TEXTURE_2D, prep->glevel[i],
+				prep->intexfmt, prep->levels[i].width, prep->levels[i].height, 0, prep->rawfmt,
+				GL_UNSIGNED_BYTE, (const GLvoid *) prep->levels[i].bgra);
 		}
 	}
 
 	ptm->flags = 0;
-	ptm->flags |= (tex->hasalpha ? PTH_HASALPHA : 0);
+	ptm->flags |= (prep->hasalpha ? PTH_HASALPHA : 0);
+
+	traceend("texture upload");
+}
 
-	if (comprdata) {
-		free(comprdata);
+/**
+ * Frees prepared levels, and the cache entry that owns them if there is one
+ * @param prep the levels
+ */
+static void ptm_freelevels(PTMPrepared * prep)
+{
+	int i;
+
+	for (i = 0; i < prep->numlevels; i++) {
+		free(prep->levels[i].bgra);
+		if (!prep->tdef) {
+			free(prep->levels[i].output);
+		}
+	}
+	if (prep->tdef) {
+		PTCacheFreeTile(prep->tdef);
 	}
+	prep->numlevels = 0;
+	prep->tdef = 0;
+}
+
+/**
+ * Sends texture data to GL
+ * @param ptm the texture management header
+ * @param flags extra flags to modify how the texture is uploaded
+ * @param tex the texture to upload
+ */
+static void ptm_uploadtexture(PTMHead * ptm, unsigned short flags, PTTexture * tex)
+{
+	PTMPrepared prep;
+
+	detect_texture_size();
+
+	tracebegin("texture upload");
+	ptm_preparelevels(tex, flags, 0, 1, ptm, &prep);
+	traceend("texture upload");
+	ptm_uploadlevels(ptm, &prep);
+	ptm_freelevels(&prep);
 }
 
 
@@ -1329,6 +1532,8 @@ void PTMarkPrime(int picnum, int palnum, unsigned short flags)
 
 /**
  * Runs a cycle of the priming process. Call until nonzero is returned.
+ * With gltexstreaming, hightile textures are handed to the loading threads
+ * and the cycles after the last go on uploading them until all are done.
  * @param done receives the number of textures primed so far
  * @param total receives the total number of textures to be primed
  * @return 0 when priming is complete
@@ -1336,10 +1541,13 @@ void PTMarkPrime(int picnum, int palnum, unsigned short flags)
 int PTDoPrime(int* done, int* total)
 {
 	PTHash * pth;
+	int loading;
 
 	if (primepos >= PTHASHHEADSIZ) {
-		// done
-		return 0;
+		loading = ptstream_update(1);
+		*done = max(0, primedone - loading);
+		*total = primecnt;
+		return (loading > 0);
 	}
 
 	if (primepos == 0) {
@@ -1361,16 +1569,17 @@ int PTDoPrime(int* done, int* total)
 	while (pth) {
 		if (pth->primecnt > 0) {
 			primedone++;
-			pt_load(pth);
+			pt_load(pth, gltexstreaming);
 		}
 		pth = pth->next;
 	}
 
-	*done = primedone;
+	loading = ptstream_update(0);
+	*done = max(0, primedone - loading);
 	*total = primecnt;
 	primepos++;
 
-	return (primepos < PTHASHHEADSIZ);
+	return (primepos < PTHASHHEADSIZ || loading > 0);
 }
 
 /**
@@ -1419,6 +1628,9 @@ void PTClear()
 		}
 		ptmhashhead[i] = 0;
 	}
+
+	ptstream_uninit();
+	ptcompress_uninit();
 }
 
 
@@ -1440,7 +1652,9 @@ PTHead * PT_GetHead(int picnum, int palnum, unsigned short flags, int peek)
 		return 0;
 	}
 
-	if (!pt_load(pth)) {
+	// skyboxes have nothing to stand in for them
+	pth = pt_load(pth, gltexstreaming && !(flags & PTH_SKYBOX));
+	if (pth == 0) {
 		return 0;
 	}
 
@@ -15,6 +15,7 @@ enum {
 	PTH_HASALPHA = 8,		// NOTE: only seen in PTMHead.flags, not in PTHead.flags
 	PTH_NOCOMPRESS = 16,	// prevents texture compression from being used
 	PTH_NOMIPLEVEL = 32,	// prevents gltexmiplevel from being applied
+	PTH_LOADING = 64,		// being prepared in the background, see polymosttexstream.h
 	PTH_DIRTY = 128,		// NOTE: only seen in PTMHead.flags, not in PTHead.flags
 };
 
@@ -81,6 +82,11 @@ enum {
 struct PTIter_typ;	// an opaque iterator type for walking the internal hash
 typedef struct PTIter_typ * PTIter;
 
+struct PTCacheTile_typ;	// see polymosttexcache.h
+
+struct PTMPrepared_typ;	// an opaque texture made ready for uploading
+typedef struct PTMPrepared_typ PTMPrepared;
+
 extern int polymosttexverbosity;	// 0 = none, 1 = errors (default), 2 = all
 
 /**
@@ -186,6 +192,58 @@ PTMHead * PTM_GetHead(const PTMIdent *id);
  */
 int PTM_LoadTextureFile(const char* filename, PTMHead* ptmh, int flags, int effects);
 
+/**
+ * Prepares a texture file's cache entry just as PTM_LoadTextureFile does
+ * before storing it, without involving OpenGL, so it may be called from any
+ * thread. The formats it compresses to are those glinfo says are available.
+ * @param filename the texture filename
+ * @param picdata the file's contents
+ * @param picdatalen the length of picdata
+ * @param flags PTH_* flags to tune the load process
+ * @param effects HICEFFECT_* effects to apply
+ * @param tdef receives the cache entry, for PTCacheWriteTile and PTCacheFreeTile
+ * @return 0 on success, <0 on error
+ *
+ * Shared method for texcachebuild to call.
+ */
+int PTM_BakeTextureFile(const char* filename, char* picdata, int picdatalen, int flags, int effects,
+	struct PTCacheTile_typ** tdef);
+
+/**
+ * Decodes a texture file and makes every level ready for PTM_UploadPrepared,
+ * without involving OpenGL, so it may be called from any thread
+ * @param filename the texture filename, for the cache entry
+ * @param picdata the file's contents
+ * @param picdatalen the length of picdata
+ * @param flags PTH_* flags to tune the load process
+ * @param effects HICEFFECT_* effects to apply
+ * @param forcache whether to make a cache entry for PTM_UploadPrepared to write
+ * @param pooled whether compression may use the compressor's threads, which
+ *   only the thread uploading textures may ask for
+ * @param prep receives the prepared texture
+ * @return 0 on success, <0 on error as for PTM_LoadTextureFile
+ *
+ * Shared method for polymosttexstream.c to call.
+ */
+int PTM_PrepareTextureFile(const char* filename, char* picdata, int picdatalen, int flags, int effects,
+	int forcache, int pooled, PTMPrepared** prep);
+
+/**
+ * Uploads a prepared texture into OpenGL, writes its cache entry if it has
+ * one, and frees it
+ * @param ptmh the PTMHead structure to receive the texture details
+ * @param prep the prepared texture
+ *
+ * Shared method for polymosttexstream.c to call.
+ */
+void PTM_UploadPrepared(PTMHead* ptmh, PTMPrepared* prep);
+
+/**
+ * Frees a prepared texture without uploading it
+ * @param prep the prepared texture
+ */
+void PTM_FreePrepared(PTMPrepared* prep);
+
 /**
  * Returns a string describing the error returned by PTM_LoadTextureFile
  * @param err the error code
@@ -14,18 +14,33 @@
  INDEX (texture.cacheindex):
    signature  "PolymostTexIndx"
    version    CACHEVER
-   ENTRIES...
-     filename  char[BMAX_PATH]
-     effects   int32
-     flags     int32		PTH_CLAMPED
-     offset    int32		Offset from the start of the STORAGE file
-     mtime     int32		When kplib can return mtimes from ZIPs, this will be used to spot stale entries
+   numslots   uint32		Size of the table, a power of two, or 0 for none
+   numentries uint32		Slots in use, never more than half of them
+   journal    uint32		Offset of the JOURNAL from the start of the file
+   reserved   uint32
+   SLOTS[numslots]...		Placed by hash, probing linearly to the next slot when taken
+     hash     uint32		ptcache_hash() of the filename, effects and flags
+     name     uint32		Offset of the filename from the start of the file, or 0 if empty
+     effects  int32
+     flags    int32		PTH_CLAMPED
+     offset   uint32		Offset of the entry from the start of the STORAGE file
+     mtime    int32		When the file was last modified, or 0 if unknown. The game records 0,
+				and texcachebuild the file's time to spot stale entries
+   FILENAMES...			NUL-terminated
+   JOURNAL...			Entries added since the table was built, each superseding any before
+     namelen  int32
+     filename char[namelen]
+     effects  int32
+     flags    int32
+     offset   uint32
+     mtime    int32
 
  STORAGE (texture.cache):
    signature  "PolymostTexStor"
    version    CACHEVER
    ENTRIES...
-     tsizx     int32		Unpadded dimensions
+     MIPMAP DATA...		Each level on a 4096 byte boundary, or a 16 byte one if it is shorter
+     tsizx     int32		Unpadded dimensions, on a 16 byte boundary
      tsizy     int32
      flags     int32		PTH_CLAMPED | PTH_HASALPHA
      format    int32		OpenGL compressed format code
@@ -34,96 +49,374 @@
        sizx    int32		Padded dimensions
        sizy    int32
        length  int32
-       data    char[length]
+       data    uint32		Offset of the level's data from the start of the file
 
  All multibyte values are little-endian.
+
+ Both files are mapped into memory when the index is loaded. Finding an entry
+ reads only the slots probed, and entries in the mapped storage are handed out
+ without copying their data. Only the journal is read at load time, and it is
+ folded into a new table when the index is unloaded.
  */
 
+typedef struct {
+	int8_t signature[16];
+	uint32_t numslots;
+	uint32_t numentries;
+	uint32_t journal;
+	uint32_t reserved;
+} PTCacheIndexHeader;
+
+typedef struct {
+	uint32_t hash;
+	uint32_t name;
+	int32_t effects;
+	int32_t flags;
+	uint32_t offset;
+	int32_t mtime;
+} PTCacheIndexSlot;
+
+#define PTCACHEALIGN 4096	// mipmaps at least this long start on a multiple of it
+#define PTCACHEMAXMIPS 32
+
+	// The journal, in memory
 struct PTCacheIndex_typ {
 	char * filename;
+	unsigned int hash;
 	int effects;
 	int flags;
-	off_t offset;
+	unsigned int offset;
+	int mtime;
 	struct PTCacheIndex_typ * next;
 };
 typedef struct PTCacheIndex_typ PTCacheIndex;
 #define PTCACHEHASHSIZ 512
 static PTCacheIndex * cachehead[PTCACHEHASHSIZ];	// will be initialized 0 by .bss segment
+static int cachejournal = 0;	// entries in the journal on disk
+
+static unsigned char * indexmap = 0, * storagemap = 0;
+static bsize_t indexmaplen = 0, storagemaplen = 0;
+static int indexmapped = 0;	// indexmap is a mapping, rather than read into memory
 
 static const char * CACHEINDEXFILE = "texture.cacheindex";
 static const char * CACHESTORAGEFILE = "texture.cache";
-static const int CACHEVER = 0;
+static const int CACHEVER = 1;
 
 static int cachedisabled = 0, cachereplace = 0;
 
-static unsigned int gethashhead(const char * filename)
+static unsigned int ptcache_hash(const char * filename, int effects, int flags)
 {
-	// implements the djb2 hash, constrained to the hash table size
+	// implements the djb2 hash, carried on over the effects and flags
 	// http://www.cse.yorku.ca/~oz/hash.html
-	unsigned long hash = 5381;
+	unsigned int hash = 5381;
 	int c;
 
-    while ((c = (unsigned char)*filename++)) {
+	while ((c = (unsigned char)*filename++)) {
 		hash = ((hash << 5) + hash) ^ c; /* hash * 33 ^ c */
 	}
+	hash = ((hash << 5) + hash) ^ (unsigned int) effects;
+	hash = ((hash << 5) + hash) ^ (unsigned int) (flags & PTH_CLAMPED);
 
-    return hash & (PTCACHEHASHSIZ-1);
+	return hash;
 }
 
 /**
  * Adds an item to the cachehead hash.
  * @param filename
+ * @param hash
  * @param effects
  * @param flags
  * @param offset
+ * @param mtime
  */
-static void ptcache_addhash(const char * filename, int effects, int flags, off_t offset)
+static void ptcache_addhash(const char * filename, unsigned int hash, int effects, int flags, unsigned int offset, int mtime)
 {
-	unsigned int hash = gethashhead(filename);
-
 	// to reduce memory fragmentation we tack the filename onto the end of the block
 	PTCacheIndex * pci = (PTCacheIndex *) malloc(sizeof(PTCacheIndex) + strlen(filename) + 1);
 
 	pci->filename = (char *) pci + sizeof(PTCacheIndex);
 	strcpy(pci->filename, filename);
+	pci->hash    = hash;
 	pci->effects = effects;
 	pci->flags   = flags & (PTH_CLAMPED);
 	pci->offset  = offset;
-	pci->next = cachehead[hash];
+	pci->mtime   = mtime;
+	pci->next = cachehead[hash & (PTCACHEHASHSIZ-1)];
 
-	cachehead[hash] = pci;
+	cachehead[hash & (PTCACHEHASHSIZ-1)] = pci;
 }
 
 /**
  * Locates an item in the cachehead hash.
  * @param filename
+ * @param hash
  * @param effects
  * @param flags
  * @return the PTCacheIndex item, or null
  */
-static PTCacheIndex * ptcache_findhash(const char * filename, int effects, int flags)
+static PTCacheIndex * ptcache_findhash(const char * filename, unsigned int hash, int effects, int flags)
 {
 	PTCacheIndex * pci;
 
-	pci = cachehead[ gethashhead(filename) ];
-	if (!pci) {
-		return 0;
-	}
-
 	flags &= PTH_CLAMPED;
 
-	while (pci) {
-		if (effects == pci->effects &&
+	for (pci = cachehead[hash & (PTCACHEHASHSIZ-1)]; pci; pci = pci->next) {
+		if (hash == pci->hash &&
+		    effects == pci->effects &&
 		    flags == pci->flags &&
 		    strcmp(pci->filename, filename) == 0) {
 			return pci;
 		}
-		pci = pci->next;
 	}
 
 	return 0;
 }
 
+/**
+ * Adds an item to the journal in memory, superseding any already there.
+ */
+static void ptcache_journal(const char * filename, int effects, int flags, unsigned int offset, int mtime)
+{
+	unsigned int hash = ptcache_hash(filename, effects, flags);
+	PTCacheIndex * pci;
+
+	pci = ptcache_findhash(filename, hash, effects, flags);
+	if (pci) {
+		pci->offset = offset;
+		pci->mtime = mtime;
+	} else {
+		ptcache_addhash(filename, hash, effects, flags, offset, mtime);
+	}
+	cachejournal++;
+}
+
+/**
+ * Returns the filename of a slot in the mapped index's table.
+ * @param slot
+ * @return the filename, or null if the slot is empty or mangled
+ */
+static const char * ptcache_slotname(const PTCacheIndexSlot * slot)
+{
+	const PTCacheIndexHeader * head = (const PTCacheIndexHeader *) indexmap;
+	unsigned int name = B_LITTLE32(slot->name);
+
+	if (name < sizeof(PTCacheIndexHeader) + B_LITTLE32(head->numslots) * sizeof(PTCacheIndexSlot) ||
+	    name >= B_LITTLE32(head->journal)) {
+		return 0;
+	}
+	return (const char *) indexmap + name;
+}
+
+/**
+ * Locates an item in the mapped index's table.
+ * @param filename
+ * @param hash
+ * @param effects
+ * @param flags
+ * @return the slot, or null
+ */
+static const PTCacheIndexSlot * ptcache_findslot(const char * filename, unsigned int hash, int effects, int flags)
+{
+	const PTCacheIndexSlot * slots, * slot;
+	const char * name;
+	unsigned int numslots, i, n;
+
+	if (!indexmap) {
+		return 0;
+	}
+
+	numslots = B_LITTLE32(((const PTCacheIndexHeader *) indexmap)->numslots);
+	slots = (const PTCacheIndexSlot *) (indexmap + sizeof(PTCacheIndexHeader));
+	flags &= PTH_CLAMPED;
+
+	for (n = 0, i = hash; n < numslots; n++, i++) {
+		slot = &slots[i & (numslots-1)];
+		if (!slot->name) {
+			break;
+		}
+		if (B_LITTLE32(slot->hash) == hash &&
+		    (int) B_LITTLE32(slot->effects) == effects &&
+		    (int) B_LITTLE32(slot->flags) == flags &&
+		    (name = ptcache_slotname(slot)) &&
+		    strcmp(name, filename) == 0) {
+			return slot;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Finds where a tile is stored, looking first in the journal.
+ * @return !0 if it exists
+ */
+static int ptcache_find(const char * filename, int effects, int flags, unsigned int * offset, int * mtime)
+{
+	unsigned int hash = ptcache_hash(filename, effects, flags);
+	const PTCacheIndexSlot * slot;
+	PTCacheIndex * pci;
+
+	flags &= PTH_CLAMPED;
+
+	pci = ptcache_findhash(filename, hash, effects, flags);
+	if (pci) {
+		*offset = pci->offset;
+		*mtime = pci->mtime;
+		return 1;
+	}
+
+	slot = ptcache_findslot(filename, hash, effects, flags);
+	if (slot) {
+		*offset = B_LITTLE32(slot->offset);
+		*mtime = B_LITTLE32(slot->mtime);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Places an item in a table being built, copying its filename after the slots.
+ */
+static void ptcache_putslot(unsigned char * buf, unsigned int numslots, unsigned int * namepos,
+	const char * filename, unsigned int hash, int effects, int flags, unsigned int offset, int mtime)
+{
+	PTCacheIndexSlot * slots = (PTCacheIndexSlot *) (buf + sizeof(PTCacheIndexHeader));
+	unsigned int i;
+
+	for (i = hash & (numslots-1); slots[i].name; i = (i+1) & (numslots-1)) ;
+
+	slots[i].hash    = B_LITTLE32(hash);
+	slots[i].name    = B_LITTLE32(*namepos);
+	slots[i].effects = B_LITTLE32(effects);
+	slots[i].flags   = B_LITTLE32(flags);
+	slots[i].offset  = B_LITTLE32(offset);
+	slots[i].mtime   = B_LITTLE32(mtime);
+
+	strcpy((char *) buf + *namepos, filename);
+	*namepos += strlen(filename) + 1;
+}
+
+/**
+ * Folds the journal into a new table and rewrites the index file with it.
+ */
+static void ptcache_compact(void)
+{
+	const PTCacheIndexSlot * oldslots = 0;
+	PTCacheIndexHeader * head;
+	PTCacheIndex * pci;
+	unsigned int oldnumslots = 0, numslots, numentries = 0, namebytes = 0;
+	unsigned int namepos, size, i, hash;
+	const char * name;
+	unsigned char * buf;
+	FILE * fh;
+
+	if (indexmap) {
+		oldnumslots = B_LITTLE32(((const PTCacheIndexHeader *) indexmap)->numslots);
+		oldslots = (const PTCacheIndexSlot *) (indexmap + sizeof(PTCacheIndexHeader));
+	}
+
+	// count what survives from the old table, then the journal
+	for (i = 0; i < oldnumslots; i++) {
+		name = ptcache_slotname(&oldslots[i]);
+		if (!name) continue;
+		if (ptcache_findhash(name, B_LITTLE32(oldslots[i].hash), B_LITTLE32(oldslots[i].effects),
+				B_LITTLE32(oldslots[i].flags))) continue;
+		numentries++;
+		namebytes += strlen(name) + 1;
+	}
+	for (i = 0; i < PTCACHEHASHSIZ; i++) {
+		for (pci = cachehead[i]; pci; pci = pci->next) {
+			numentries++;
+			namebytes += strlen(pci->filename) + 1;
+		}
+	}
+
+	for (numslots = 16; numslots < numentries * 2; numslots <<= 1) ;
+	namepos = sizeof(PTCacheIndexHeader) + numslots * sizeof(PTCacheIndexSlot);
+	size = namepos + namebytes;
+
+	buf = (unsigned char *) calloc(1, size);
+	if (!buf) {
+		return;	// the journal stays as it is
+	}
+
+	head = (PTCacheIndexHeader *) buf;
+	memcpy(head->signature, "PolymostTexIndx", 15);
+	head->signature[15] = CACHEVER;
+	head->numslots = B_LITTLE32(numslots);
+	head->numentries = B_LITTLE32(numentries);
+	head->journal = B_LITTLE32(size);
+
+	for (i = 0; i < oldnumslots; i++) {
+		name = ptcache_slotname(&oldslots[i]);
+		if (!name) continue;
+		hash = B_LITTLE32(oldslots[i].hash);
+		if (ptcache_findhash(name, hash, B_LITTLE32(oldslots[i].effects), B_LITTLE32(oldslots[i].flags))) continue;
+		ptcache_putslot(buf, numslots, &namepos, name, hash, B_LITTLE32(oldslots[i].effects),
+			B_LITTLE32(oldslots[i].flags), B_LITTLE32(oldslots[i].offset), B_LITTLE32(oldslots[i].mtime));
+	}
+	for (i = 0; i < PTCACHEHASHSIZ; i++) {
+		for (pci = cachehead[i]; pci; pci = pci->next) {
+			ptcache_putslot(buf, numslots, &namepos, pci->filename, pci->hash, pci->effects,
+				pci->flags, pci->offset, pci->mtime);
+		}
+	}
+
+	// the old table can't be mapped while its file is rewritten
+	if (indexmapped) {
+		Bunmapfile(indexmap, indexmaplen);
+	} else {
+		free(indexmap);
+	}
+	indexmap = 0;
+	indexmaplen = 0;
+
+	// should this fail part way, the index is found corrupt and replaced next time
+	fh = fopen(CACHEINDEXFILE, "wb");
+	if (!fh || fwrite(buf, size, 1, fh) != 1) {
+		buildprintf("PolymostTexCache: error writing %s\n", CACHEINDEXFILE);
+	} else {
+		cachejournal = 0;
+	}
+	if (fh) fclose(fh);
+	free(buf);
+}
+
+/**
+ * Releases the journal in memory and the mappings.
+ */
+static void ptcache_release(void)
+{
+	PTCacheIndex * pci, * next;
+	int i;
+
+	for (i = 0; i < PTCACHEHASHSIZ; i++) {
+		pci = cachehead[i];
+		while (pci) {
+			next = pci->next;
+			// we needn't free pci->filename since it was alloced with pci
+			free(pci);
+			pci = next;
+		}
+		cachehead[i] = 0;
+	}
+	cachejournal = 0;
+
+	if (indexmapped) {
+		Bunmapfile(indexmap, indexmaplen);
+	} else {
+		free(indexmap);
+	}
+	indexmap = 0;
+	indexmaplen = 0;
+	indexmapped = 0;
+
+	Bunmapfile(storagemap, storagemaplen);
+	storagemap = 0;
+	storagemaplen = 0;
+}
+
 /**
  * Loads the cache index file into memory
  */
@@ -134,18 +427,15 @@ void PTCacheLoadIndex(void)
 	const int8_t indexsig[16] = { 'P','o','l','y','m','o','s','t','T','e','x','I','n','d','x',CACHEVER };
 	const int8_t storagesig[16] = { 'P','o','l','y','m','o','s','t','T','e','x','S','t','o','r',CACHEVER };
 
-	int8_t filename[BMAX_PATH+1];
-	int32_t effects;
-	int32_t flags;
-	int32_t offset;
-	int32_t mtime;
-	PTCacheIndex * pci;
+	char filename[BMAX_PATH];
+	const PTCacheIndexHeader * head;
+	int32_t namelen, fields[4];
+	unsigned int numslots, journal;
+	bsize_t pos;
+	int fil;
 
-	int total = 0, dups = 0;
 	int haveindex = 0, havestore = 0;
 
-	memset(filename, 0, sizeof(filename));
-
 	// first, check the cache storage file's signature.
 	// we open for reading and writing to test permission
 	fh = fopen(CACHESTORAGEFILE, "r+b");
@@ -172,9 +462,11 @@ void PTCacheLoadIndex(void)
 	if (fh) {
 		haveindex = 1;
 
+		// a cache from an older version is rebuilt as textures are next loaded
 		if (fread(sig, 16, 1, fh) != 1 || memcmp(sig, indexsig, 16)) {
 			cachereplace = 1;
 		}
+		fclose(fh);
 	} else {
 		if (errno == ENOENT) {
 			// file doesn't exist, which is fine
@@ -194,47 +486,84 @@ void PTCacheLoadIndex(void)
 
 	if (cachereplace) {
 		buildprintf("PolymostTexCache: texture cache will be replaced\n");
-		if (fh) {
-			fclose(fh);
-		}
 		return;
 	}
 
-	// now that the index is sitting at the first entry, load everything
-	while (!feof(fh)) {
-		if (fread(filename, BMAX_PATH, 1, fh) != 1 && feof(fh)) {
-			break;
+	// map the index, or failing that read it in
+	fil = Bopen(CACHEINDEXFILE, BO_BINARY|BO_RDONLY, BS_IREAD);
+	if (fil < 0) {
+		buildprintf("PolymostTexCache: error opening %s, texture cache disabled\n", CACHEINDEXFILE);
+		cachedisabled = 1;
+		return;
+	}
+	indexmaplen = (bsize_t) Bfilelength(fil);
+	if (indexmaplen >= sizeof(PTCacheIndexHeader)) {
+		indexmap = (unsigned char *) Bmapfile(fil, indexmaplen);
+		indexmapped = (indexmap != 0);
+		if (!indexmap) {
+			indexmap = (unsigned char *) malloc(indexmaplen);
+			if (indexmap && Bread(fil, indexmap, indexmaplen) != (int) indexmaplen) {
+				free(indexmap);
+				indexmap = 0;
+			}
 		}
-		if (fread(&effects, 4,         1, fh) != 1 ||
-		    fread(&flags,   4,         1, fh) != 1 ||
-		    fread(&offset,  4,         1, fh) != 1 ||
-		    fread(&mtime,   4,         1, fh) != 1) {
-			// truncated entry, so throw the whole cache away
-			buildprintf("PolymostTexCache: corrupt texture cache index detected, cache will be replaced\n");
-			cachereplace = 1;
-			PTCacheUnloadIndex();
-			break;
+	}
+	Bclose(fil);
+
+	if (!indexmap) {
+		goto corrupt;
+	}
+
+	head = (const PTCacheIndexHeader *) indexmap;
+	numslots = B_LITTLE32(head->numslots);
+	journal = B_LITTLE32(head->journal);
+	if ((numslots & (numslots-1)) ||
+	    numslots > (indexmaplen - sizeof(PTCacheIndexHeader)) / sizeof(PTCacheIndexSlot) ||
+	    journal < sizeof(PTCacheIndexHeader) + numslots * sizeof(PTCacheIndexSlot) ||
+	    journal > indexmaplen ||
+	    (journal > sizeof(PTCacheIndexHeader) + numslots * sizeof(PTCacheIndexSlot) && indexmap[journal-1] != 0)) {
+		goto corrupt;
+	}
+
+	// the journal is all that needs reading now
+	for (pos = journal; pos < indexmaplen; pos += 4 + namelen + sizeof(fields)) {
+		if (indexmaplen - pos < 4) {
+			goto corrupt;
+		}
+		memcpy(&namelen, indexmap + pos, 4);
+		namelen = B_LITTLE32(namelen);
+		if (namelen < 1 || namelen >= BMAX_PATH || indexmaplen - pos - 4 < namelen + sizeof(fields)) {
+			goto corrupt;
 		}
+		memcpy(filename, indexmap + pos + 4, namelen);
+		filename[namelen] = 0;
+		memcpy(fields, indexmap + pos + 4 + namelen, sizeof(fields));
 
-		effects = B_LITTLE32(effects);
-		flags   = B_LITTLE32(flags);
-		offset  = B_LITTLE32(offset);
-		mtime   = B_LITTLE32(mtime);
+		ptcache_journal(filename, B_LITTLE32(fields[0]), B_LITTLE32(fields[1]),
+			B_LITTLE32(fields[2]), B_LITTLE32(fields[3]));
+	}
 
-		pci = ptcache_findhash((char *) filename, (int) effects, (int) flags);
-		if (pci) {
-			// superseding an old hash entry
-			pci->offset = (off_t) offset;
-			dups++;
-		} else {
-			ptcache_addhash((char *) filename, (int) effects, (int) flags, (off_t) offset);
+	// map the storage so tiles can be handed out from it. Without a mapping,
+	// tiles are read from the file instead
+	fil = Bopen(CACHESTORAGEFILE, BO_BINARY|BO_RDONLY, BS_IREAD);
+	if (fil >= 0) {
+		storagemaplen = (bsize_t) Bfilelength(fil);
+		storagemap = (unsigned char *) Bmapfile(fil, storagemaplen);
+		if (!storagemap) {
+			storagemaplen = 0;
 		}
-		total++;
+		Bclose(fil);
 	}
 
-	fclose(fh);
+	buildprintf("PolymostTexCache: cache index loaded (%d entries, %d more journalled)\n",
+		(int) B_LITTLE32(head->numentries), cachejournal);
+	return;
 
-	buildprintf("PolymostTexCache: cache index loaded (%d entries, %d old entries skipped)\n", total, dups);
+corrupt:
+	// truncated or mangled, so throw the whole cache away
+	buildprintf("PolymostTexCache: corrupt texture cache index detected, cache will be replaced\n");
+	cachereplace = 1;
+	ptcache_release();
 }
 
 /**
@@ -242,19 +571,10 @@ void PTCacheLoadIndex(void)
  */
 void PTCacheUnloadIndex(void)
 {
-	PTCacheIndex * pci, * next;
-	int i;
-
-	for (i = 0; i < PTCACHEHASHSIZ; i++) {
-		pci = cachehead[i];
-		while (pci) {
-			next = pci->next;
-			// we needn't free pci->filename since it was alloced with pci
-			free(pci);
-			pci = next;
-		}
-		cachehead[i] = 0;
+	if (cachejournal && !cachereplace && !cachedisabled) {
+		ptcache_compact();
 	}
+	ptcache_release();
 
 	buildprintf("PolymostTexCache: cache index unloaded\n");
 }
@@ -264,92 +584,103 @@ void PTCacheUnloadIndex(void)
  * @param offset the starting offset
  * @return a PTCacheTile entry fully completed
  */
-static PTCacheTile * ptcache_load(off_t offset)
+static PTCacheTile * ptcache_load(unsigned int offset)
 {
-	int32_t tsizx, tsizy;
-	int32_t sizx, sizy;
-	int32_t flags;
-	int32_t format;
+	int32_t desc[5 + PTCACHEMAXMIPS * 4];
 	int32_t nmipmaps, i;
-	int32_t length;
+	uint32_t data, length;
+	int mapped;
 
 	PTCacheTile * tdef = 0;
-	FILE * fh;
+	FILE * fh = 0;
 
 	if (cachereplace) {
 		// cache is in a broken state, so don't try loading
 		return 0;
 	}
 
-	fh = fopen(CACHESTORAGEFILE, "rb");
-	if (!fh) {
-		cachedisabled = 1;
-		buildprintf("PolymostTexCache: error opening %s, texture cache disabled\n", CACHESTORAGEFILE);
-		return 0;
+	// entries written since the storage was mapped are read from the file
+	mapped = (storagemap && offset < storagemaplen);
+	if (mapped) {
+		if (storagemaplen - offset < 5 * 4) {
+			goto fail;
+		}
+		memcpy(desc, storagemap + offset, 5 * 4);
+	} else {
+		fh = fopen(CACHESTORAGEFILE, "rb");
+		if (!fh) {
+			cachedisabled = 1;
+			buildprintf("PolymostTexCache: error opening %s, texture cache disabled\n", CACHESTORAGEFILE);
+			return 0;
+		}
+		if (fseek(fh, offset, SEEK_SET) || fread(desc, 5 * 4, 1, fh) != 1) {
+			// truncated entry, so throw the whole cache away
+			goto fail;
+		}
 	}
 
-	fseek(fh, offset, SEEK_SET);
-
-	if (fread(&tsizx, 4, 1, fh) != 1 ||
-	    fread(&tsizy, 4, 1, fh) != 1 ||
-	    fread(&flags, 4, 1, fh) != 1 ||
-	    fread(&format, 4, 1, fh) != 1 ||
-	    fread(&nmipmaps, 4, 1, fh) != 1) {
-		// truncated entry, so throw the whole cache away
+	nmipmaps = B_LITTLE32(desc[4]);
+	if (nmipmaps < 1 || nmipmaps > PTCACHEMAXMIPS) {
+		goto fail;
+	}
+	if (mapped) {
+		if (storagemaplen - offset < (bsize_t) (5 + nmipmaps * 4) * 4) {
+			goto fail;
+		}
+		memcpy(&desc[5], storagemap + offset + 5 * 4, nmipmaps * 4 * 4);
+	} else if (fread(&desc[5], nmipmaps * 4 * 4, 1, fh) != 1) {
 		goto fail;
 	}
-
-	tsizx = B_LITTLE32(tsizx);
-	tsizy = B_LITTLE32(tsizy);
-	flags = B_LITTLE32(flags);
-	format = B_LITTLE32(format);
-	nmipmaps = B_LITTLE32(nmipmaps);
 
 	tdef = PTCacheAllocNewTile(nmipmaps);
-	tdef->tsizx = tsizx;
-	tdef->tsizy = tsizy;
-	tdef->flags = flags;
-	tdef->format = format;
+	tdef->tsizx = B_LITTLE32(desc[0]);
+	tdef->tsizy = B_LITTLE32(desc[1]);
+	tdef->flags = B_LITTLE32(desc[2]);
+	tdef->format = B_LITTLE32(desc[3]);
+	tdef->mapped = mapped;
 
 	for (i = 0; i < nmipmaps; i++) {
-		if (fread(&sizx, 4, 1, fh) != 1 ||
-		    fread(&sizy, 4, 1, fh) != 1 ||
-		    fread(&length, 4, 1, fh) != 1) {
-			// truncated entry, so throw the whole cache away
+		tdef->mipmap[i].sizx = B_LITTLE32(desc[5 + i * 4 + 0]);
+		tdef->mipmap[i].sizy = B_LITTLE32(desc[5 + i * 4 + 1]);
+		length = B_LITTLE32(desc[5 + i * 4 + 2]);
+		data = B_LITTLE32(desc[5 + i * 4 + 3]);
+
+		// the data comes before the entry
+		if (data > offset || length > offset - data) {
 			goto fail;
 		}
+		tdef->mipmap[i].length = (int) length;
 
-		sizx = B_LITTLE32(sizx);
-		sizy = B_LITTLE32(sizy);
-		length = B_LITTLE32(length);
-
-		tdef->mipmap[i].sizx = sizx;
-		tdef->mipmap[i].sizy = sizy;
-		tdef->mipmap[i].length = length;
-		tdef->mipmap[i].data = (unsigned char *) malloc(length);
-
-		if (fread(tdef->mipmap[i].data, length, 1, fh) != 1) {
-			// truncated data
-			goto fail;
+		if (mapped) {
+			tdef->mipmap[i].data = storagemap + data;
+		} else {
+			tdef->mipmap[i].data = (unsigned char *) malloc(length);
+			if (!tdef->mipmap[i].data ||
+			    fseek(fh, data, SEEK_SET) ||
+			    fread(tdef->mipmap[i].data, length, 1, fh) != 1) {
+				// truncated data
+				goto fail;
+			}
 		}
 	}
 
-	fclose(fh);
+	if (fh) fclose(fh);
 
 	return tdef;
 fail:
 	cachereplace = 1;
 	buildprintf("PolymostTexCache: corrupt texture cache detected, cache will be replaced\n");
-	PTCacheUnloadIndex();
-	fclose(fh);
+	if (fh) fclose(fh);
 	if (tdef) {
 		PTCacheFreeTile(tdef);
 	}
+	PTCacheUnloadIndex();
 	return 0;
 }
 
 /**
- * Loads a tile from the cache.
+ * Loads a tile from the cache. The mipmap data may point into the cache
+ * file's mapping, so free the tile before unloading the index.
  * @param filename the filename
  * @param effects the effects bits
  * @param flags the flags bits
@@ -357,22 +688,23 @@ fail:
  */
 PTCacheTile * PTCacheLoadTile(const char * filename, int effects, int flags)
 {
-	PTCacheIndex * pci;
 	PTCacheTile * tdef;
+	unsigned int offset;
+	int mtime;
 
 	if (cachedisabled) {
 		return 0;
 	}
 
-	pci = ptcache_findhash(filename, effects, flags);
-	if (!pci) {
+	if (!ptcache_find(filename, effects, flags, &offset, &mtime)) {
 		return 0;
 	}
 
-	tdef = ptcache_load(pci->offset);
+	tdef = ptcache_load(offset);
 	if (tdef) {
 		tdef->filename = strdup(filename);
 		tdef->effects  = effects;
+		tdef->mtime    = mtime;
 	}
 	return tdef;
 }
@@ -386,11 +718,33 @@ PTCacheTile * PTCacheLoadTile(const char * filename, int effects, int flags)
  */
 int PTCacheHasTile(const char * filename, int effects, int flags)
 {
+	unsigned int offset;
+	int mtime;
+
 	if (cachedisabled) {
 		return 0;
 	}
 
-	return (ptcache_findhash(filename, effects, flags) != 0);
+	return ptcache_find(filename, effects, flags, &offset, &mtime);
+}
+
+/**
+ * Returns when the file a cached tile was made from was last modified.
+ * @param filename the filename
+ * @param effects the effects bits
+ * @param flags the flags bits
+ * @return the time, 0 if none was recorded, or -1 if the tile isn't cached
+ */
+int PTCacheGetTileMtime(const char * filename, int effects, int flags)
+{
+	unsigned int offset;
+	int mtime;
+
+	if (cachedisabled) {
+		return -1;
+	}
+
+	return ptcache_find(filename, effects, flags, &offset, &mtime) ? mtime : -1;
 }
 
 /**
@@ -404,7 +758,7 @@ void PTCacheFreeTile(PTCacheTile * tdef)
 	if (tdef->filename) {
 		free(tdef->filename);
 	}
-	for (i = 0; i < tdef->nummipmaps; i++) {
+	for (i = 0; i < tdef->nummipmaps && !tdef->mapped; i++) {
 		if (tdef->mipmap[i].data) {
 			free(tdef->mipmap[i].data);
 		}
@@ -438,20 +792,27 @@ PTCacheTile * PTCacheAllocNewTile(int nummipmaps)
  */
 int PTCacheWriteTile(PTCacheTile * tdef)
 {
-	long i;
-	PTCacheIndex * pci;
+	static const int8_t zeros[PTCACHEALIGN] = { 0 };
+	int32_t desc[5 + PTCACHEMAXMIPS * 4];
+	unsigned char record[4 + BMAX_PATH + 4 * 4];
+	int32_t field;
+	long i, offset, pad, align;
+	int namelen;
 
 	FILE * fh;
-	off_t offset;
 	char createmode[] = "ab";
 
 	if (cachedisabled) {
 		return 0;
 	}
+	if (tdef->nummipmaps < 1 || tdef->nummipmaps > PTCACHEMAXMIPS) {
+		return 0;
+	}
 
 	if (cachereplace) {
 		createmode[0] = 'w';
 		cachereplace = 0;
+		ptcache_release();
 	}
 
 	// 1. write the tile data to the storage file
@@ -479,49 +840,45 @@ int PTCacheWriteTile(PTCacheTile * tdef)
 		offset = 16;
 	}
 
-	{
-		int32_t tsizx, tsizy;
-		int32_t format, flags, nmipmaps;
-
-		tsizx = B_LITTLE32(tdef->tsizx);
-		tsizy = B_LITTLE32(tdef->tsizy);
-		flags = tdef->flags & (PTH_CLAMPED | PTH_HASALPHA);
-		flags = B_LITTLE32(flags);
-		format = B_LITTLE32(tdef->format);
-		nmipmaps = B_LITTLE32(tdef->nummipmaps);
-
-		if (fwrite(&tsizx, 4, 1, fh) != 1 ||
-		    fwrite(&tsizy, 4, 1, fh) != 1 ||
-		    fwrite(&flags, 4, 1, fh) != 1 ||
-		    fwrite(&format, 4, 1, fh) != 1 ||
-		    fwrite(&nmipmaps, 4, 1, fh) != 1) {
-			goto fail;
-		}
-	}
-
+	// the mipmaps, each aligned, then the entry describing them
 	for (i = 0; i < tdef->nummipmaps; i++) {
-		int32_t sizx, sizy;
-		int32_t length;
-
-		sizx = B_LITTLE32(tdef->mipmap[i].sizx);
-		sizy = B_LITTLE32(tdef->mipmap[i].sizy);
-		length = B_LITTLE32(tdef->mipmap[i].length);
-
-		if (fwrite(&sizx, 4, 1, fh) != 1 ||
-		    fwrite(&sizy, 4, 1, fh) != 1 ||
-		    fwrite(&length, 4, 1, fh) != 1) {
+		align = (tdef->mipmap[i].length >= PTCACHEALIGN) ? PTCACHEALIGN : 16;
+		pad = (align - offset % align) % align;
+		if (pad && fwrite(zeros, pad, 1, fh) != 1) {
 			goto fail;
 		}
+		offset += pad;
+
+		desc[5 + i * 4 + 0] = B_LITTLE32(tdef->mipmap[i].sizx);
+		desc[5 + i * 4 + 1] = B_LITTLE32(tdef->mipmap[i].sizy);
+		desc[5 + i * 4 + 2] = B_LITTLE32(tdef->mipmap[i].length);
+		desc[5 + i * 4 + 3] = B_LITTLE32((int32_t) offset);
 
 		if (fwrite(tdef->mipmap[i].data, tdef->mipmap[i].length, 1, fh) != 1) {
 			// truncated data
 			goto fail;
 		}
+		offset += tdef->mipmap[i].length;
+	}
+
+	pad = (16 - offset % 16) % 16;
+	if (pad && fwrite(zeros, pad, 1, fh) != 1) {
+		goto fail;
+	}
+	offset += pad;
+
+	desc[0] = B_LITTLE32(tdef->tsizx);
+	desc[1] = B_LITTLE32(tdef->tsizy);
+	desc[2] = B_LITTLE32(tdef->flags & (PTH_CLAMPED | PTH_HASALPHA));
+	desc[3] = B_LITTLE32(tdef->format);
+	desc[4] = B_LITTLE32(tdef->nummipmaps);
+	if (fwrite(desc, (5 + tdef->nummipmaps * 4) * 4, 1, fh) != 1) {
+		goto fail;
 	}
 
 	fclose(fh);
 
-	// 2. append to the index
+	// 2. append to the index's journal
 	fh = fopen(CACHEINDEXFILE, createmode);
 	if (!fh) {
 		cachedisabled = 1;
@@ -531,44 +888,43 @@ int PTCacheWriteTile(PTCacheTile * tdef)
 
 	fseek(fh, 0, SEEK_END);
 	if (ftell(fh) == 0) {
-		// new file
-		const int8_t indexsig[16] = { 'P','o','l','y','m','o','s','t','T','e','x','I','n','d','x',CACHEVER };
-		if (fwrite(indexsig, 16, 1, fh) != 1) {
+		// new file, with an empty table
+		PTCacheIndexHeader head;
+
+		memset(&head, 0, sizeof(head));
+		memcpy(head.signature, "PolymostTexIndx", 15);
+		head.signature[15] = CACHEVER;
+		head.journal = B_LITTLE32((uint32_t) sizeof(head));
+		if (fwrite(&head, sizeof(head), 1, fh) != 1) {
 			goto fail;
 		}
 	}
 
-	{
-		int8_t filename[BMAX_PATH];
-		int32_t effects, offsett, flags, mtime;
-
-		strncpy((char *) filename, tdef->filename, sizeof(filename)-1);
-		filename[sizeof(filename)-1] = 0;
-		effects = B_LITTLE32(tdef->effects);
-		flags   = tdef->flags & (PTH_CLAMPED);	// we don't want the informational flags in the index
-		flags   = B_LITTLE32(flags);
-		offsett = B_LITTLE32(offset);
-		mtime = 0;
-
-		if (fwrite(filename, sizeof(filename), 1, fh) != 1 ||
-		    fwrite(&effects, 4, 1, fh) != 1 ||
-		    fwrite(&flags, 4, 1, fh) != 1 ||
-		    fwrite(&offsett, 4, 1, fh) != 1 ||
-		    fwrite(&mtime, 4, 1, fh) != 1) {
-			goto fail;
-		}
+	namelen = min((int) strlen(tdef->filename), BMAX_PATH-1);
+	field = B_LITTLE32(namelen);
+	memcpy(&record[0], &field, 4);
+	memcpy(&record[4], tdef->filename, namelen);
+	field = B_LITTLE32(tdef->effects);
+	memcpy(&record[4 + namelen + 0], &field, 4);
+	field = tdef->flags & (PTH_CLAMPED);	// we don't want the informational flags in the index
+	field = B_LITTLE32(field);
+	memcpy(&record[4 + namelen + 4], &field, 4);
+	field = B_LITTLE32((int32_t) offset);
+	memcpy(&record[4 + namelen + 8], &field, 4);
+	field = B_LITTLE32(tdef->mtime);
+	memcpy(&record[4 + namelen + 12], &field, 4);
+
+	// one write, so the record is either there whole or not at all
+	if (fwrite(record, 4 + namelen + 4 * 4, 1, fh) != 1) {
+		goto fail;
 	}
 
 	fclose(fh);
 
-	// stow the data into the index in memory
-	pci = ptcache_findhash(tdef->filename, tdef->effects, tdef->flags);
-	if (pci) {
-		// superseding an old hash entry
-		pci->offset = offset;
-	} else {
-		ptcache_addhash(tdef->filename, tdef->effects, tdef->flags, offset);
-	}
+	// stow the data into the journal in memory
+	memcpy(record, tdef->filename, namelen);
+	record[namelen] = 0;
+	ptcache_journal((const char *) record, tdef->effects, tdef->flags, (unsigned int) offset, tdef->mtime);
 
 	return 1;
 fail:
@@ -583,9 +939,10 @@ fail:
  */
 void PTCacheForceRebuild(void)
 {
+	// set first, so the index isn't compacted only to be thrown away
+	cachereplace = 1;
 	PTCacheUnloadIndex();
 	cachedisabled = 0;
-	cachereplace = 1;
 }
 
 #endif //USE_OPENGL
@@ -25,7 +25,9 @@ struct PTCacheTile_typ {
 	int flags;
 	int format;	// OpenGL format code
 	int tsizx, tsizy;
+	int mtime;	// when the file was last modified, or 0 if unknown
 	int nummipmaps;
+	int mapped;	// the mipmap data points into the cache's mapping and isn't to be freed
 	PTCacheTileMip mipmap[1];
 };
 typedef struct PTCacheTile_typ PTCacheTile;
@@ -41,7 +43,8 @@ void PTCacheLoadIndex(void);
 void PTCacheUnloadIndex(void);
 
 /**
- * Loads a tile from the cache.
+ * Loads a tile from the cache. The mipmap data may point into the cache
+ * file's mapping, so free the tile before unloading the index.
  * @param filename the filename
  * @param effects the effects bits
  * @param flags the flags bits
@@ -58,6 +61,15 @@ PTCacheTile * PTCacheLoadTile(const char * filename, int effects, int flags);
  */
 int PTCacheHasTile(const char * filename, int effects, int flags);
 
+/**
+ * Returns when the file a cached tile was made from was last modified.
+ * @param filename the filename
+ * @param effects the effects bits
+ * @param flags the flags bits
+ * @return the time, 0 if none was recorded, or -1 if the tile isn't cached
+ */
+int PTCacheGetTileMtime(const char * filename, int effects, int flags);
+
 /**
  * Disposes of the resources allocated for a PTCacheTile
  * @param tdef a PTCacheTile entry
@@ -1,5 +1,10 @@
 /**
  * libsquish/rg_etc1 bridging interface
+ *
+ * Each 4x4 block compresses without regard to its neighbours, so images are
+ * cut into bands of block rows and the bands of every image in a batch are
+ * shared out across a pool of threads. The blocks come out exactly as they
+ * would one after another.
  */
 
 #include "build.h"
@@ -13,9 +18,24 @@
 
 extern "C" {
 #include "glbuild.h"
-extern int gltexcomprquality;
+#include "workpool.h"
+extern int gltexcomprquality, gltexcomprthreads;
 }
 
+#define BLOCKROWSPERJOB 4	// rows of 4x4 blocks in each band
+#define MINPOOLBLOCKS 256	// batches with fewer blocks than this aren't worth the threads
+
+static workpool *comprpool = NULL;
+static int comprpoolthreads = 0;	// the gltexcomprthreads it was made for
+
+typedef struct {
+	ptcompressimage *images;
+	int numimages;
+	int *firstjob;		// each image's first band, and the total after the last
+	int format, squishflags;
+	rg_etc1::etc1_pack_params etc1params;
+} comprbatch;
+
 static int getsquishflags(int format)
 {
 	int flags;
@@ -39,24 +59,12 @@ static int getsquishflags(int format)
 	return flags;
 }
 
-static void compressetc1(uint8_t *bgra, int width, int height, uint8_t *out)
+static void compressetc1(const uint8_t *bgra, int width, int height, uint8_t *out,
+	rg_etc1::etc1_pack_params &params)
 {
-	rg_etc1::etc1_pack_params params;
 	uint8_t block[4][4][4];
 	int x, y, s, t, xyoff, stride;
 
-	static int initonce = 0;
-	if (!initonce) {
-		rg_etc1::pack_etc1_block_init();
-		initonce = 1;
-	}
-
-	switch (gltexcomprquality) {
-		case 2: params.m_quality = rg_etc1::cHighQuality; break;
-		case 1: params.m_quality = rg_etc1::cMediumQuality; break;
-		default: params.m_quality = rg_etc1::cLowQuality; break;
-	}
-
 	stride = width * 4;
 	for (y = 0; y < height; y += 4) {
 		for (x = 0; x < width; x += 4) {
@@ -87,6 +95,34 @@ static void compressetc1(uint8_t *bgra, int width, int height, uint8_t *out)
 	}
 }
 
+static void compressband(void *ctx, int job)
+{
+	comprbatch *batch = (comprbatch *)ctx;
+	const ptcompressimage *img;
+	const uint8_t *src;
+	uint8_t *out;
+	int i, y, height, blockbytes;
+
+	for (i = 0; batch->firstjob[i+1] <= job; i++) ;
+	img = &batch->images[i];
+
+	y = (job - batch->firstjob[i]) * BLOCKROWSPERJOB * 4;
+	height = min(BLOCKROWSPERJOB * 4, img->height - y);
+	blockbytes = (batch->format == PTCOMPRESS_DXT5) ? 16 : 8;
+	src = (const uint8_t *)img->bgra + y * img->width * 4;
+	out = img->output + (y / 4) * ((img->width + 3) / 4) * blockbytes;
+
+	switch (batch->format) {
+		case PTCOMPRESS_DXT1:
+		case PTCOMPRESS_DXT5:
+			squish::CompressImage(src, img->width, height, out, batch->squishflags);
+			break;
+		case PTCOMPRESS_ETC1:
+			compressetc1(src, img->width, height, out, batch->etc1params);
+			break;
+	}
+}
+
 extern "C" int ptcompress_getstorage(int width, int height, int format)
 {
 	switch (format) {
@@ -99,18 +135,68 @@ extern "C" int ptcompress_getstorage(int width, int height, int format)
 	return 0;
 }
 
-extern "C" int ptcompress_compress(void * bgra, int width, int height, unsigned char * output, int format)
+extern "C" int ptcompress_compressmany(ptcompressimage *images, int numimages, int format, int pooled)
 {
+	comprbatch batch;
+	workpool *pool = NULL;
+	int i, blockrows, numblocks = 0;
+
 	switch (format) {
 		case PTCOMPRESS_DXT1:
 		case PTCOMPRESS_DXT5:
-			squish::CompressImage( (squish::u8 const *) bgra, width, height, output, getsquishflags(format));
-			return 0;
+			batch.squishflags = getsquishflags(format);
+			break;
 		case PTCOMPRESS_ETC1:
-			compressetc1((uint8_t *)bgra, width, height, output);
-			return 0;
+			{
+				// texcachebuild calls from several threads, and C++
+				// guarantees this runs only once
+				static const bool initonce = (rg_etc1::pack_etc1_block_init(), true);
+				(void)initonce;
+			}
+			switch (gltexcomprquality) {
+				case 2: batch.etc1params.m_quality = rg_etc1::cHighQuality; break;
+				case 1: batch.etc1params.m_quality = rg_etc1::cMediumQuality; break;
+				default: batch.etc1params.m_quality = rg_etc1::cLowQuality; break;
+			}
+			break;
+		default:
+			return -1;
+	}
+
+	batch.firstjob = (int *)malloc((numimages + 1) * sizeof(int));
+	if (!batch.firstjob) return -1;
+	batch.images = images;
+	batch.numimages = numimages;
+	batch.format = format;
+
+	batch.firstjob[0] = 0;
+	for (i = 0; i < numimages; i++) {
+		blockrows = (images[i].height + 3) / 4;
+		numblocks += blockrows * ((images[i].width + 3) / 4);
+		batch.firstjob[i+1] = batch.firstjob[i] + (blockrows + BLOCKROWSPERJOB - 1) / BLOCKROWSPERJOB;
+	}
+
+	if (pooled && numblocks >= MINPOOLBLOCKS && gltexcomprthreads != 1) {
+		if (comprpool && comprpoolthreads != gltexcomprthreads) {
+			workpool_destroy(comprpool);
+			comprpool = NULL;
+		}
+		if (!comprpool) {
+			comprpool = workpool_create(gltexcomprthreads);
+			comprpoolthreads = gltexcomprthreads;
+		}
+		pool = comprpool;
 	}
-	return -1;
+	workpool_run(pool, compressband, &batch, batch.firstjob[numimages]);
+
+	free(batch.firstjob);
+	return 0;
+}
+
+extern "C" void ptcompress_uninit(void)
+{
+	workpool_destroy(comprpool);
+	comprpool = NULL;
 }
 
 #endif	//USE_OPENGL
@@ -18,8 +18,28 @@ enum {
 	PTCOMPRESS_DXT5 = 2,
 	PTCOMPRESS_ETC1 = 3,
 };
+
+typedef struct {
+	void * bgra;
+	int width, height;
+	unsigned char * output;		// ptcompress_getstorage() bytes
+} ptcompressimage;
+
 int ptcompress_getstorage(int width, int height, int format);
-int ptcompress_compress(void * bgra, int width, int height, unsigned char * output, int format);
+
+/**
+ * Compresses several images at once, such as the mip levels of a texture.
+ * The output is the same as compressing each whole image in turn.
+ * @param pooled !0 to share the work across a pool of threads, which only
+ *   the thread uploading textures may ask for. Otherwise the images are
+ *   compressed on the calling thread, whichever it is.
+ */
+int ptcompress_compressmany(ptcompressimage * images, int numimages, int format, int pooled);
+
+/**
+ * Stops the compression threads, if any were started.
+ */
+void ptcompress_uninit(void);
 
 #ifdef __cplusplus
 }
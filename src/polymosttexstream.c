@@ -0,0 +1,447 @@
+// Background hightile loading
+// for the Build Engine
+//
+// Hightile textures missing from the texture cache take the loading threads
+// reading, decoding, mipmapping and compressing them, so drawing goes on
+// with the ART tiles in the meantime. Only the main thread touches OpenGL,
+// the texture cache and the file system: it maps each file before handing
+// it over, so the thread's first touch of the pages is what reads them, and
+// uploads what the threads have finished once a frame.
+
+#include "build.h"
+
+#if USE_POLYMOST && USE_OPENGL
+
+#include "baselayer.h"
+#include "glbuild.h"
+#include "cache1d.h"
+#include "bthread.h"
+#include "kplib.h"
+#include "engine_priv.h"
+#include "polymost_priv.h"
+#include "hightile_priv.h"
+#include "polymosttex_priv.h"
+#include "polymosttexstream.h"
+
+#define MAXLOADTHREADS 4
+#define MAXINFLIGHT 8		// files handed to the threads and not yet uploaded, which bounds the memory held
+#define UPLOADUSECS 4000	// how long ptstream_update() may spend uploading, after the first
+
+enum {
+	PTS_QUEUED = 0,		// waiting for a thread
+	PTS_PREPARING,		// a thread is preparing it
+	PTS_READY,			// waiting to be uploaded
+};
+
+typedef struct ptstreamjob_typ {
+	struct ptstreamjob_typ *next;
+	PTMHead *ptmh;		// null once cancelled
+	char *filename;
+	int flags, effects, forcache;
+
+	char *picdata;		// the file's contents
+	int picdatalen;
+	int picdatamapped;	// whether picdata is mapped rather than read
+
+	int state;			// PTS_*
+	int err;
+	PTMPrepared *prep;
+} ptstreamjob;
+
+static bthread_t workers[MAXLOADTHREADS];
+static int numworkers = 0;
+static bmutex_t streammutex = NULL;
+static bcond_t streamcond = NULL;
+static volatile int streamquit = 0;
+
+	// Files yet to be mapped, seen only by the main thread
+static ptstreamjob *waiting = NULL, *waitingtail = NULL;
+static int numwaiting = 0;
+
+	// Files handed to the threads, guarded by streammutex
+static ptstreamjob *inflight = NULL, *inflighttail = NULL;
+static int numinflight = 0;
+
+
+static int loadworker(void *UNUSED(arg))
+{
+	ptstreamjob *job;
+	PTMPrepared *prep;
+	int err;
+
+	bmutex_lock(streammutex);
+	while (!streamquit) {
+		for (job = inflight; job && job->state != PTS_QUEUED; job = job->next) ;
+		if (!job) {
+			bcond_wait(streamcond, streammutex);
+			continue;
+		}
+
+		job->state = PTS_PREPARING;
+		bmutex_unlock(streammutex);
+
+		err = PTM_PrepareTextureFile(job->filename, job->picdata, job->picdatalen,
+			job->flags, job->effects, job->forcache, 0, &prep);
+
+		bmutex_lock(streammutex);
+		job->err = err;
+		job->prep = prep;
+		job->state = PTS_READY;
+		bcond_broadcast(streamcond);
+	}
+	bmutex_unlock(streammutex);
+
+	kpthreadfree();
+	return 0;
+}
+
+static int startworkers(void)
+{
+	int i, numthreads;
+
+	if (numworkers) return 0;
+
+	streammutex = bmutex_create();
+	streamcond = bcond_create();
+	if (!streammutex || !streamcond) goto fail;
+
+	// Leave a processor for the main thread where there are several.
+	numthreads = min(MAXLOADTHREADS, max(1, bthread_numcpus() - 1));
+
+	streamquit = 0;
+	for (i = 0; i < numthreads; i++) {
+		workers[numworkers] = bthread_create(loadworker, NULL);
+		if (!workers[numworkers]) break;
+		numworkers++;
+	}
+	if (!numworkers) goto fail;
+	return 0;
+
+fail:
+	if (streamcond) bcond_destroy(streamcond);
+	if (streammutex) bmutex_destroy(streammutex);
+	streamcond = NULL;
+	streammutex = NULL;
+	return -1;
+}
+
+static void stopworkers(void)
+{
+	int i;
+
+	if (!numworkers) return;
+
+	bmutex_lock(streammutex);
+	streamquit = 1;
+	bcond_broadcast(streamcond);
+	bmutex_unlock(streammutex);
+
+	for (i = 0; i < numworkers; i++) {
+		bthread_join(workers[i]);
+	}
+	bcond_destroy(streamcond);
+	bmutex_destroy(streammutex);
+	numworkers = 0;
+	streamcond = NULL;
+	streammutex = NULL;
+}
+
+	// Maps or reads a job's file, returning 0 or an error as for PTM_LoadTextureFile
+static int openjob(ptstreamjob *job)
+{
+	int filh;
+
+	job->picdata = (char *)kmapfile(job->filename, 0, &job->picdatalen);
+	if (job->picdata) {
+		job->picdatamapped = 1;
+		return 0;
+	}
+
+	// In a ZIP archive, most likely.
+	filh = kopen4load(job->filename, 0);
+	if (filh < 0) {
+		return -1;
+	}
+	job->picdatalen = kfilelength(filh);
+	job->picdata = (char *)malloc(max(1, job->picdatalen));
+	if (!job->picdata) {
+		kclose(filh);
+		return -2;
+	}
+	if (kread(filh, job->picdata, job->picdatalen) != job->picdatalen) {
+		kclose(filh);
+		return -3;
+	}
+	kclose(filh);
+
+	return 0;
+}
+
+static void freejob(ptstreamjob *job)
+{
+	if (job->prep) {
+		PTM_FreePrepared(job->prep);
+	}
+	if (job->picdatamapped) {
+		kunmapfile((unsigned char *)job->picdata, job->picdatalen);
+	} else {
+		free(job->picdata);
+	}
+	free(job->filename);
+	free(job);
+}
+
+	// Uploads a job's texture, or marks it failed, and frees the job
+static void finishjob(ptstreamjob *job)
+{
+	PTMHead *ptmh = job->ptmh;
+	int dirty;
+
+	if (!ptmh) {
+		freejob(job);
+		return;
+	}
+
+	if (job->err) {
+		if (polymosttexverbosity >= 1) {
+			buildprintf("PolymostTex: %s %s\n", job->filename, PTM_GetLoadTextureFileErrorString(job->err));
+		}
+		if (ptmh->glpic) {
+			// a reload failed, so don't go on with the old version
+			glfunc.glDeleteTextures(1, &ptmh->glpic);
+			ptmh->glpic = 0;
+		}
+		ptmh->flags &= ~PTH_LOADING;
+	} else {
+		// if it was invalidated while it loaded, it must load again
+		dirty = ptmh->flags & PTH_DIRTY;
+		PTM_UploadPrepared(ptmh, job->prep);	// sets the flags afresh
+		ptmh->flags |= dirty;
+		job->prep = NULL;
+	}
+
+	freejob(job);
+}
+
+	// Prepares a job on the main thread, as for a texture wanted straight away
+static void runjob(ptstreamjob *job)
+{
+	job->err = openjob(job);
+	if (!job->err) {
+		job->err = PTM_PrepareTextureFile(job->filename, job->picdata, job->picdatalen,
+			job->flags, job->effects, job->forcache, 1, &job->prep);
+	}
+	finishjob(job);
+}
+
+	// Maps the waiting files for the threads while there is room
+static void feedworkers(void)
+{
+	ptstreamjob *job;
+	int err;
+
+	while (waiting && numinflight < MAXINFLIGHT) {
+		job = waiting;
+		waiting = job->next;
+		if (!waiting) waitingtail = NULL;
+		numwaiting--;
+		job->next = NULL;
+
+		err = openjob(job);
+
+		bmutex_lock(streammutex);
+		job->err = err;
+		job->state = err ? PTS_READY : PTS_QUEUED;
+		if (inflighttail) inflighttail->next = job;
+		else inflight = job;
+		inflighttail = job;
+		numinflight++;
+		bcond_broadcast(streamcond);
+		bmutex_unlock(streammutex);
+	}
+}
+
+	// Takes a job out of the in-flight list, with streammutex held
+static void unlinkinflight(ptstreamjob *job)
+{
+	ptstreamjob *prev;
+
+	if (inflight == job) {
+		inflight = job->next;
+		if (!inflight) inflighttail = NULL;
+	} else {
+		for (prev = inflight; prev->next != job; prev = prev->next) ;
+		prev->next = job->next;
+		if (inflighttail == job) inflighttail = prev;
+	}
+	job->next = NULL;
+	numinflight--;
+}
+
+	// Takes a job out of the waiting list, returning it if it was there
+static ptstreamjob *unlinkwaiting(PTMHead *ptmh)
+{
+	ptstreamjob *job, *prev = NULL;
+
+	for (job = waiting; job && job->ptmh != ptmh; prev = job, job = job->next) ;
+	if (!job) return NULL;
+
+	if (prev) prev->next = job->next;
+	else waiting = job->next;
+	if (waitingtail == job) waitingtail = prev;
+	job->next = NULL;
+	numwaiting--;
+
+	return job;
+}
+
+int ptstream_queue(const char *filename, PTMHead *ptmh, int flags, int effects, int forcache)
+{
+	ptstreamjob *job;
+
+	// Builds whose decoders share state can't decode on another thread.
+	if (!kpthreadsafe()) return -1;
+	if (startworkers()) return -1;
+
+	job = (ptstreamjob *)calloc(1, sizeof(ptstreamjob));
+	if (!job) return -1;
+	job->filename = strdup(filename);
+	if (!job->filename) {
+		free(job);
+		return -1;
+	}
+	job->ptmh = ptmh;
+	job->flags = flags;
+	job->effects = effects;
+	job->forcache = forcache;
+
+	if (waitingtail) waitingtail->next = job;
+	else waiting = job;
+	waitingtail = job;
+	numwaiting++;
+
+	ptmh->flags = (ptmh->flags & ~PTH_DIRTY) | PTH_LOADING;
+
+	feedworkers();
+
+	return 0;
+}
+
+int ptstream_update(int wait)
+{
+	ptstreamjob *job;
+	unsigned int starttime;
+
+	if (!numworkers) return 0;
+
+	starttime = getusecticks();
+	feedworkers();
+
+	while (1) {
+		bmutex_lock(streammutex);
+		for (job = inflight; job && job->state != PTS_READY; job = job->next) ;
+		if (!job && wait && inflight) {
+			bcond_wait(streamcond, streammutex);
+			bmutex_unlock(streammutex);
+			continue;
+		}
+		if (job) {
+			unlinkinflight(job);
+		}
+		bmutex_unlock(streammutex);
+		if (!job) break;
+
+		finishjob(job);
+		feedworkers();
+		wait = 0;
+
+		if (getusecticks() - starttime >= UPLOADUSECS) break;
+	}
+
+	return numwaiting + numinflight;
+}
+
+void ptstream_finish(PTMHead *ptmh)
+{
+	ptstreamjob *job;
+
+	if (!(ptmh->flags & PTH_LOADING)) return;
+
+	job = unlinkwaiting(ptmh);
+	if (job) {
+		runjob(job);
+		return;
+	}
+
+	bmutex_lock(streammutex);
+	while (1) {
+		for (job = inflight; job && job->ptmh != ptmh; job = job->next) ;
+		if (!job || job->state != PTS_PREPARING) break;
+		bcond_wait(streamcond, streammutex);
+	}
+	if (job) {
+		unlinkinflight(job);
+	}
+	bmutex_unlock(streammutex);
+
+	if (!job) {
+		ptmh->flags &= ~PTH_LOADING;
+	} else if (job->state == PTS_QUEUED) {
+		runjob(job);
+	} else {
+		finishjob(job);
+	}
+}
+
+void ptstream_cancel(PTMHead *ptmh)
+{
+	ptstreamjob *job;
+
+	if (!(ptmh->flags & PTH_LOADING)) return;
+	ptmh->flags &= ~PTH_LOADING;
+
+	job = unlinkwaiting(ptmh);
+	if (job) {
+		freejob(job);
+		return;
+	}
+
+	bmutex_lock(streammutex);
+	for (job = inflight; job && job->ptmh != ptmh; job = job->next) ;
+	if (job && job->state == PTS_PREPARING) {
+		job->ptmh = NULL;	// discarded once ready
+		job = NULL;
+	} else if (job) {
+		unlinkinflight(job);
+	}
+	bmutex_unlock(streammutex);
+
+	if (job) {
+		freejob(job);
+	}
+}
+
+void ptstream_uninit(void)
+{
+	ptstreamjob *job;
+
+	stopworkers();
+
+	while (waiting || inflight) {
+		if (waiting) {
+			job = waiting;
+			waiting = job->next;
+		} else {
+			job = inflight;
+			inflight = job->next;
+		}
+		if (job->ptmh) {
+			job->ptmh->flags &= ~PTH_LOADING;
+		}
+		freejob(job);
+	}
+	waitingtail = inflighttail = NULL;
+	numwaiting = numinflight = 0;
+}
+
+#endif //USE_POLYMOST && USE_OPENGL
@@ -0,0 +1,60 @@
+#if (USE_POLYMOST == 0)
+#error Polymost not enabled.
+#endif
+#if (USE_OPENGL == 0)
+#error OpenGL not enabled.
+#endif
+
+#ifndef POLYMOSTTEXSTREAM_H
+#define POLYMOSTTEXSTREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Queues a texture file to be read, decoded and prepared by the loading
+ * threads. The PTMHead is marked PTH_LOADING until ptstream_update() uploads
+ * the texture, or marks it failed by leaving it without a glpic.
+ * @param filename the texture filename
+ * @param ptmh the PTMHead structure to receive the texture
+ * @param flags PTH_* flags to tune the load process
+ * @param effects HICEFFECT_* effects to apply
+ * @param forcache whether to write the texture to the cache once uploaded
+ * @return 0 if queued, or <0 if the texture must be loaded straight away
+ *   because the threads couldn't be started or the decoders aren't thread-safe
+ */
+int ptstream_queue(const char *filename, PTMHead *ptmh, int flags, int effects, int forcache);
+
+/**
+ * Uploads the textures the loading threads have finished with, for a few
+ * milliseconds at most, and hands the threads more files to read. Call once
+ * a frame.
+ * @param wait !0 to wait for a texture to finish if none has yet
+ * @return the number of textures still to be uploaded
+ */
+int ptstream_update(int wait);
+
+/**
+ * Finishes loading a texture straight away, waiting for the thread
+ * preparing it if need be.
+ * @param ptmh the PTMHead structure marked PTH_LOADING
+ */
+void ptstream_finish(PTMHead *ptmh);
+
+/**
+ * Forgets a texture that is loading, if it is.
+ * @param ptmh the PTMHead structure
+ */
+void ptstream_cancel(PTMHead *ptmh);
+
+/**
+ * Forgets every texture still loading and stops the loading threads.
+ */
+void ptstream_uninit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,374 @@
+// Renderer profiling
+// for the Build Engine
+//
+// The engine brackets each of its stages with profilebegin() and
+// profileend(), which do nothing but test the profiling flag when it is
+// clear. While it is set, the time between them goes to the stage, less
+// any stages begun inside, and profileframe() closes off each frame so
+// getprofile(), the overlay and the CSV file see whole frames.
+//
+// A trace records the stages as events too, along with whatever else calls
+// tracebegin() and traceend(), on any thread. Each thread appends to a
+// buffer of its own, so recording takes no locks, and the buffers are
+// written out as a Chrome trace once the frames asked for have passed.
+
+#include "build.h"
+#include "cache1d.h"
+#include "a_priv.h"
+#include "bthread.h"
+#include "engine_priv.h"
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+#ifdef _MSC_VER
+# define THREADLOCAL __declspec(thread)
+#else
+# define THREADLOCAL __thread
+#endif
+
+extern int getclosestcol(int r, int g, int b);	// engine.c
+
+int profiling = 0;
+int profileoverlay = 0;
+
+const char *profiletimernames[PROFILE_NUMTIMERS] = {
+	"drawrooms", "scansector", "drawalls", "ceilscan", "florscan", "flushspans",
+	"drawmasks", "drawsprite", "rotatesprite", "loadtile", "nextpage"
+};
+const char *profilekernelnames[PROFILE_NUMKERNELS] = {
+	"vline", "mvline", "tvline", "hline", "mhline", "thline",
+	"slopevlin", "spritevline", "drawslab"
+};
+
+#define MAXPROFILEDEPTH 16
+
+static profiletype current, last;
+static struct {
+	int timer;
+	int64_t start, inner;	// when it began, and the time its inner stages took
+} stack[MAXPROFILEDEPTH];
+static int depth = 0;
+
+static int64_t frameend = 0;
+static unsigned int lastmisses = 0;
+static BFILE *csvfil = NULL;
+static unsigned int csvframe = 0;
+
+#define MAXTRACETHREADS 64
+#define MAXTRACEEVENTS 65536	// per thread
+
+typedef struct {
+	const char *name;
+	int64_t time;
+	int value;
+	char phase;		// 'B'egin, 'E'nd or 'i'nstant
+} traceeventtype;
+typedef struct {
+	traceeventtype *events;
+	volatile int numevents;
+	int dropped;
+} tracebuftype;
+
+static volatile int tracing = 0;
+static tracebuftype tracebufs[MAXTRACETHREADS];
+static volatile int numtracebufs = 0;
+static int tracebufgen = 1;		// advanced when the buffers are freed
+static THREADLOCAL tracebuftype *threadtracebuf = NULL;
+static THREADLOCAL int threadtracebufgen = 0;
+static char *tracefilename = NULL;
+static int traceframes = 0, traceprofiling = 0;
+static int64_t tracestart = 0;
+
+int64_t profileclock(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (now.QuadPart / freq.QuadPart) * 1000000000 +
+		(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void traceevent(char phase, const char *name, int value)
+{
+	tracebuftype *buf;
+	traceeventtype *ev;
+	int i;
+
+	if (threadtracebufgen != tracebufgen) {	// the thread's first event
+		threadtracebufgen = tracebufgen;
+		threadtracebuf = NULL;
+		i = bthread_atomicadd(&numtracebufs, 1) - 1;
+		if (i < MAXTRACETHREADS) {
+			tracebufs[i].events = (traceeventtype *)Bmalloc(MAXTRACEEVENTS * sizeof(traceeventtype));
+			if (tracebufs[i].events) threadtracebuf = &tracebufs[i];
+		}
+	}
+	buf = threadtracebuf;
+	if (!buf) return;
+	if (buf->numevents >= MAXTRACEEVENTS) {
+		buf->dropped++;
+		return;
+	}
+
+	ev = &buf->events[buf->numevents];
+	ev->name = name;
+	ev->time = profileclock();
+	ev->value = value;
+	ev->phase = phase;
+	bthread_atomicadd(&buf->numevents, 1);	// publishes the event to writetrace()
+}
+
+void tracebegin(const char *name)
+{
+	if (tracing) traceevent('B', name, 0);
+}
+
+void traceend(const char *name)
+{
+	if (tracing) traceevent('E', name, 0);
+}
+
+void traceinstant(const char *name, int value)
+{
+	if (tracing) traceevent('i', name, value);
+}
+
+void profilepush(int timer)
+{
+	if (tracing) traceevent('B', profiletimernames[timer], 0);
+	if (depth < MAXPROFILEDEPTH) {
+		stack[depth].timer = timer;
+		stack[depth].inner = 0;
+		stack[depth].start = profileclock();
+	}
+	depth++;
+}
+
+void profilepop(int timer)
+{
+	int64_t t;
+
+	if (tracing) traceevent('E', profiletimernames[timer], 0);
+	if (depth <= 0) return;	// profiling began partway through the stage
+	depth--;
+	if (depth >= MAXPROFILEDEPTH || stack[depth].timer != timer) return;
+
+	t = profileclock() - stack[depth].start;
+	current.nsecs[timer] += t - stack[depth].inner;
+	current.calls[timer]++;
+	if (depth > 0 && depth <= MAXPROFILEDEPTH) stack[depth-1].inner += t;
+}
+
+void profiletile(int bytes)
+{
+	current.tilesloaded++;
+	current.tilebytes += bytes;
+}
+
+static void writecsv(const profiletype *p)
+{
+	int i;
+
+	if (csvframe == 0) {
+		Bfprintf(csvfil, "frame,frame_ms");
+		for (i=0; i<PROFILE_NUMTIMERS; i++) Bfprintf(csvfil, ",%s_ms,%s_calls", profiletimernames[i], profiletimernames[i]);
+		for (i=0; i<PROFILE_NUMKERNELS; i++) Bfprintf(csvfil, ",%s_pixels", profilekernelnames[i]);
+		Bfprintf(csvfil, ",tiles_loaded,tile_bytes,cache_misses\n");
+	}
+	Bfprintf(csvfil, "%u,%.3f", csvframe++, (double)p->framensecs / 1000000.0);
+	for (i=0; i<PROFILE_NUMTIMERS; i++) Bfprintf(csvfil, ",%.3f,%u", (double)p->nsecs[i] / 1000000.0, p->calls[i]);
+	for (i=0; i<PROFILE_NUMKERNELS; i++) Bfprintf(csvfil, ",%u", p->pixels[i]);
+	Bfprintf(csvfil, ",%u,%u,%u\n", p->tilesloaded, p->tilebytes, p->cachemisses);
+}
+
+static void writetrace(void)
+{
+	BFILE *fil;
+	tracebuftype *buf;
+	traceeventtype *ev;
+	int i, j, n, total = 0, dropped = 0;
+
+	tracing = 0;
+	if (!tracefilename) return;
+
+	fil = Bfopen(tracefilename, "w");
+	if (!fil) {
+		buildprintf("Could not create trace file %s\n", tracefilename);
+	} else {
+		Bfprintf(fil, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		n = min(numtracebufs, MAXTRACETHREADS);
+		for (i=0; i<n; i++) {
+			buf = &tracebufs[i];
+			if (i == 0) Bfprintf(fil, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}");
+			else Bfprintf(fil, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", i, i);
+
+			for (j=0, ev=buf->events; j<buf->numevents; j++, ev++) {
+				Bfprintf(fil, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+					ev->name, ev->phase, (double)(ev->time - tracestart) / 1000.0, i);
+				if (ev->phase == 'i') Bfprintf(fil, ",\"s\":\"t\",\"args\":{\"value\":%d}}", ev->value);
+				else Bfprintf(fil, "}");
+			}
+			total += buf->numevents;
+			dropped += buf->dropped;
+		}
+		Bfprintf(fil, "\n]}\n");
+		Bfclose(fil);
+
+		buildprintf("Wrote %d trace events to %s\n", total, tracefilename);
+		if (dropped) buildprintf("  %d more were dropped for want of space\n", dropped);
+	}
+
+	Bfree(tracefilename);
+	tracefilename = NULL;
+	profiling = traceprofiling;
+}
+
+//
+// tracetofile
+//
+int tracetofile(const char *filename, int frames)
+{
+	int i;
+
+	if (tracing) {
+		traceend("frame");
+		writetrace();
+	}
+	if (!filename) return 0;
+
+	tracefilename = Bstrdup(filename);
+	if (!tracefilename) return -1;
+
+		// Any worker threads are idle between frames, so their buffers can be emptied
+	for (i=min(numtracebufs, MAXTRACETHREADS)-1; i>=0; i--) {
+		tracebufs[i].numevents = 0;
+		tracebufs[i].dropped = 0;
+	}
+	traceframes = frames;
+	traceprofiling = profiling;
+	profiling = 1;
+	tracestart = profileclock();
+	tracing = 1;
+	tracebegin("frame");
+	return 0;
+}
+
+//
+// profileframe
+//
+void profileframe(void)
+{
+	cachestatstype cs;
+	int64_t now;
+
+	if (tracing) {
+		traceend("frame");
+		if (traceframes > 0 && --traceframes == 0) writetrace();
+		else tracebegin("frame");
+	}
+
+	spanpixelcounts = profiling ? current.pixels : NULL;
+	if (!profiling) {
+		frameend = 0;
+		return;
+	}
+
+	now = profileclock();
+	getcachestats(&cs);
+	if (frameend) {
+		current.framensecs = now - frameend;
+		current.cachemisses = cs.misses - lastmisses;
+		last = current;
+		if (csvfil) writecsv(&last);
+	}
+	frameend = now;
+	lastmisses = cs.misses;
+
+	memset(&current, 0, sizeof(current));
+}
+
+//
+// getprofile
+//
+void getprofile(profiletype *p)
+{
+	*p = last;
+}
+
+//
+// profilecsv
+//
+int profilecsv(const char *filename)
+{
+	if (csvfil) {
+		Bfclose(csvfil);
+		csvfil = NULL;
+	}
+	if (!filename) return 0;
+
+	csvfil = Bfopen(filename, "w");
+	if (!csvfil) return -1;
+	csvframe = 0;
+	profiling = 1;
+	return 0;
+}
+
+//
+// uninitprofile (internal)
+//
+void uninitprofile(void)
+{
+	int i;
+
+	tracetofile(NULL, 0);
+	profilecsv(NULL);
+	for (i=min(numtracebufs, MAXTRACETHREADS)-1; i>=0; i--) {
+		Bfree(tracebufs[i].events);
+		tracebufs[i].events = NULL;
+	}
+	numtracebufs = 0;
+	tracebufgen++;
+}
+
+//
+// drawprofile (internal)
+//
+void drawprofile(void)
+{
+	char buf[64];
+	int i, y = 4, col, backcol;
+
+	if (!profileoverlay || !profiling) return;
+
+	col = getclosestcol(63,63,63);
+	backcol = getclosestcol(0,0,0);
+
+	Bsprintf(buf, "frame %7.2f ms", (double)last.framensecs / 1000000.0);
+	printext256(4,y,col,backcol,buf,1); y += 8;
+	for (i=0; i<PROFILE_NUMTIMERS; i++) {
+		if (!last.calls[i]) continue;
+		Bsprintf(buf, "%-12s %6.2f ms %6u", profiletimernames[i], (double)last.nsecs[i] / 1000000.0, last.calls[i]);
+		printext256(4,y,col,backcol,buf,1); y += 8;
+	}
+	for (i=0; i<PROFILE_NUMKERNELS; i++) {
+		if (!last.pixels[i]) continue;
+		Bsprintf(buf, "%-12s %9u px", profilekernelnames[i], last.pixels[i]);
+		printext256(4,y,col,backcol,buf,1); y += 8;
+	}
+	Bsprintf(buf, "tiles %u (%u KB), misses %u", last.tilesloaded, last.tilebytes >> 10, last.cachemisses);
+	printext256(4,y,col,backcol,buf,1);
+}
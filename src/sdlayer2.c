@@ -42,6 +42,7 @@
 #include "a.h"
 #include "osd.h"
 #include "glbuild.h"
+#include "palexpand.h"
 
 #if defined(__APPLE__)
 # include "osxbits.h"
@@ -74,7 +75,15 @@ static SDL_Texture *sdl_texture;	// For non-GL 8-bit mode output.
 #else
 static SDL_Surface *sdl_surface;	// For non-GL 8-bit mode output.
 #endif
-static unsigned char *frame;
+static unsigned char *frame, *backframe;
+static palexpandtable paltab;
+static palexpander *expander = NULL;	// with threadedblit, expands each frame while the next is drawn
+static char expanding = 0;		// a frame is being expanded into the locked display
+static char wholeframe = 1;		// the display needs all of the next frame, not just what was drawn
+#ifndef SDLAYER_USE_RENDERER
+static SDL_Surface *lockedsurface, *lastsurface;
+static SDL_Rect updaterect;		// the part of the window surface expanded into
+#endif
 int xres=-1, yres=-1, bpp=0, fullscreen=0, bytesperline, imageSize;
 intptr_t frameplace=0;
 char modechange=1;
@@ -901,12 +910,26 @@ int checkvideomode(int *x, int *y, int c, int fs, int forced)
 }
 
 
+static void unlockdisplay(void);
+
 static void shutdownvideo(void)
 {
+	if (expander) {
+		palexpander_destroy(expander);
+		expander = NULL;
+	}
+	if (expanding) {
+		unlockdisplay();
+		expanding = 0;
+	}
 	if (frame) {
 		free(frame);
 		frame = NULL;
 	}
+	if (backframe) {
+		free(backframe);
+		backframe = NULL;
+	}
 #if USE_OPENGL
 	if (!nogl) {
 		glbuild_delete_8bit_shader(&gl8bit);
@@ -1092,6 +1115,20 @@ int setvideomode(int x, int y, int c, int fs)
 		bytesperline = pitch;
 		imageSize = bytesperline * y;
 		numpages = 1;
+		wholeframe = 1;
+
+#if USE_OPENGL
+		if (nogl) {
+#endif
+			if (threadedblit) {
+				// Draw into one buffer while the other is expanded.
+				backframe = (unsigned char *) malloc(pitch * y);
+				if (backframe) expander = palexpander_create();
+				if (!expander) buildputs("Unable to start the frame expansion thread\n");
+			}
+#if USE_OPENGL
+		}
+#endif
 
 		setvlinebpl(bytesperline);
 		for (i = j = 0; i <= y; i++) {
@@ -1184,36 +1221,118 @@ void enddrawing(void)
 
 
 //
-// showframe() -- update the display
+// lockdisplay() -- locks the 32-bit pixels threadedblit expands frames
+//   into, returning NULL if there are none to lock
 //
-void showframe(void)
+static unsigned int *lockdisplay(int *pitch)
 {
-	int i,j;
+#ifdef SDLAYER_USE_RENDERER
+	void *pixels;
 
-#if USE_OPENGL
-	if (!nogl) {
-		if (bpp == 8) {
-			glbuild_update_8bit_frame(&gl8bit, frame, xres, yres, bytesperline);
-			glbuild_draw_8bit_frame(&gl8bit);
-		}
+	if (SDL_LockTexture(sdl_texture, NULL, &pixels, pitch)) {
+		debugprintf("Could not lock texture: %s\n", SDL_GetError());
+		return NULL;
+	}
+	wholeframe = 1;	// a streaming texture's pixels are undefined once locked
+	return (unsigned int *)pixels;
+#else
+	// Expand straight into the window if it takes XRGB8888 pixels, saving
+	// SDL a blit from the 8-bit surface.
+	lockedsurface = SDL_GetWindowSurface(sdl_window);
+	if (!lockedsurface) {
+		debugprintf("Could not get window surface: %s\n", SDL_GetError());
+		return NULL;
+	}
+	if ((lockedsurface->format->format != SDL_PIXELFORMAT_RGB888 &&
+			lockedsurface->format->format != SDL_PIXELFORMAT_ARGB8888) ||
+			lockedsurface->w < xres || lockedsurface->h < yres) {
+		lockedsurface = NULL;
+		return NULL;
+	}
+	if (SDL_MUSTLOCK(lockedsurface) && SDL_LockSurface(lockedsurface)) {
+		debugprintf("Could not lock window surface: %s\n", SDL_GetError());
+		lockedsurface = NULL;
+		return NULL;
+	}
+	if (lockedsurface != lastsurface) {
+		lastsurface = lockedsurface;
+		wholeframe = 1;
+	}
+	*pitch = lockedsurface->pitch;
+	return (unsigned int *)lockedsurface->pixels;
+#endif
+}
 
-		SDL_GL_SwapWindow(sdl_window);
-		return;
+static void unlockdisplay(void)
+{
+#ifdef SDLAYER_USE_RENDERER
+	SDL_UnlockTexture(sdl_texture);
+#else
+	if (SDL_MUSTLOCK(lockedsurface)) SDL_UnlockSurface(lockedsurface);
+#endif
+}
+
+static void presentdisplay(void)
+{
+	unlockdisplay();
+#ifdef SDLAYER_USE_RENDERER
+	if (SDL_RenderCopy(sdl_renderer, sdl_texture, NULL, NULL)) {
+		debugprintf("Could not copy render texture: %s\n", SDL_GetError());
 	}
+	SDL_RenderPresent(sdl_renderer);
+#else
+	SDL_UpdateWindowSurfaceRects(sdl_window, &updaterect, 1);
 #endif
+}
+
+//
+// setblitrect() -- sets rect to box, or to the whole frame if box is NULL
+//
+static void setblitrect(SDL_Rect *rect, const dirtyrecttype *box)
+{
+	if (box) {
+		rect->x = box->x1; rect->y = box->y1;
+		rect->w = box->x2 - box->x1; rect->h = box->y2 - box->y1;
+	} else {
+		rect->x = 0; rect->y = 0;
+		rect->w = xres; rect->h = yres;
+	}
+}
 
+//
+// boundrects() -- sets box to the bounds of a frame's dirty rectangles
+//
+static void boundrects(const dirtyrecttype *rects, int numrects, dirtyrecttype *box)
+{
+	int i;
+
+	*box = rects[0];
+	for (i = 1; i < numrects; i++) {
+		box->x1 = min(box->x1, rects[i].x1); box->y1 = min(box->y1, rects[i].y1);
+		box->x2 = max(box->x2, rects[i].x2); box->y2 = max(box->y2, rects[i].y2);
+	}
+}
+
+#ifdef SDLAYER_USE_RENDERER
+//
+// blittexture() -- expands the frame, or just the part of it in box, into the
+//   texture a pixel at a time
+//
+static void blittexture(const dirtyrecttype *box)
+{
+	SDL_Rect rect;
 	unsigned char *pixels, *in;
 	int pitch, y, x;
 
-#ifdef SDLAYER_USE_RENDERER
-	if (SDL_LockTexture(sdl_texture, NULL, (void**)&pixels, &pitch)) {
+	setblitrect(&rect, box);
+	if (SDL_LockTexture(sdl_texture, box ? &rect : NULL, (void**)&pixels, &pitch)) {
 		debugprintf("Could not lock texture: %s\n", SDL_GetError());
 		return;
 	}
 
-	in = frame;
-	for (y = yres - 1; y >= 0; y--) {
-		for (x = xres - 1; x >= 0; x--) {
+	in = frame + rect.y * bytesperline + rect.x;
+	for (y = rect.h - 1; y >= 0; y--) {
+		for (x = rect.w - 1; x >= 0; x--) {
 #if B_LITTLE_ENDIAN
 			// RGBA -> BGRA, ignoring A
 			/*
@@ -1239,20 +1358,31 @@ void showframe(void)
 		debugprintf("Could not copy render texture: %s\n", SDL_GetError());
 	}
 	SDL_RenderPresent(sdl_renderer);
+}
 
-#else //SDLAYER_USE_RENDERER
+#else
+//
+// blitsurface() -- has SDL convert the frame, or just the part of it in box,
+//   to whatever the window takes
+//
+static void blitsurface(const dirtyrecttype *box)
+{
 	SDL_Surface *winsurface;
+	SDL_Rect rect, dstrect;
+	unsigned char *pixels, *in;
+	int pitch, y;
 
 	if (SDL_LockSurface(sdl_surface)) {
 		debugprintf("Could not lock surface: %s\n", SDL_GetError());
 		return;
 	}
-	pixels = (unsigned char *)sdl_surface->pixels;
 	pitch = sdl_surface->pitch;
+	setblitrect(&rect, box);
+	pixels = (unsigned char *)sdl_surface->pixels + rect.y * pitch + rect.x;
 
-	in = frame;
-	for (y = yres - 1; y >= 0; y--) {
-		memcpy(pixels, in, xres);
+	in = frame + rect.y * bytesperline + rect.x;
+	for (y = rect.h - 1; y >= 0; y--) {
+		memcpy(pixels, in, rect.w);
 		pixels += pitch;
 		in += bytesperline;
 	}
@@ -1264,9 +1394,148 @@ void showframe(void)
 		debugprintf("Could not get window surface: %s\n", SDL_GetError());
 		return;
 	}
-	SDL_BlitSurface(sdl_surface, NULL, winsurface, NULL);
-	SDL_UpdateWindowSurface(sdl_window);
-#endif //SDLAYER_USE_RENDERER
+	if (box) {
+		dstrect = rect;
+		SDL_BlitSurface(sdl_surface, &rect, winsurface, &dstrect);
+		SDL_UpdateWindowSurfaceRects(sdl_window, &rect, 1);
+	} else {
+		SDL_BlitSurface(sdl_surface, NULL, winsurface, NULL);
+		SDL_UpdateWindowSurface(sdl_window);
+	}
+}
+#endif	// SDLAYER_USE_RENDERER
+
+
+//
+// showframe() -- update the display
+//
+void showframe(void)
+{
+	dirtyrecttype rects[MAXDIRTYRECTS], box;
+	unsigned int *pixels;
+	unsigned char *drawn;
+	int pitch, numrects, i, y;
+
+#if USE_OPENGL
+	if (!nogl) {
+		if (bpp == 8) {
+			numrects = getdirtyrects(rects);
+			if (dirtyblit) {
+				// The texture keeps the last frame, so only what changed goes up.
+				for (i = 0; i < numrects; i++) {
+					glbuild_update_8bit_rows(&gl8bit, frame, bytesperline, rects[i].y1, rects[i].y2);
+				}
+			} else {
+				glbuild_update_8bit_frame(&gl8bit, frame, xres, yres, bytesperline);
+			}
+			glbuild_draw_8bit_frame(&gl8bit);
+		}
+
+		SDL_GL_SwapWindow(sdl_window);
+		return;
+	}
+#endif
+
+	numrects = getdirtyrects(rects);
+
+	if (!expander) {
+		// Without threadedblit, SDL is handed the whole frame as it always was,
+		// unless dirtyblit asks for just the part of it that was drawn.
+		if (!dirtyblit || wholeframe) {
+			wholeframe = 0;
+#ifdef SDLAYER_USE_RENDERER
+			blittexture(NULL);
+#else
+			blitsurface(NULL);
+#endif
+			return;
+		}
+		if (numrects) {
+			boundrects(rects, numrects, &box);
+#ifdef SDLAYER_USE_RENDERER
+			blittexture(&box);
+#else
+			blitsurface(&box);
+#endif
+		}
+#ifdef SDLAYER_USE_RENDERER
+		else {
+			// Nothing changed, but the frame is still presented to keep its pace.
+			if (SDL_RenderCopy(sdl_renderer, sdl_texture, NULL, NULL)) {
+				debugprintf("Could not copy render texture: %s\n", SDL_GetError());
+			}
+			SDL_RenderPresent(sdl_renderer);
+		}
+#endif
+		return;
+	}
+
+	if (expanding) {
+		// The last frame was expanded while this one was drawn.
+		palexpander_wait(expander);
+		expanding = 0;
+		presentdisplay();
+	}
+
+	pixels = lockdisplay(&pitch);
+	if (!pixels) {
+		wholeframe = 1;
+#ifndef SDLAYER_USE_RENDERER
+		blitsurface(NULL);
+#endif
+		return;
+	}
+
+	// The display keeps the last frame, so with dirtyblit only what changed
+	// is expanded.
+	if (wholeframe || !dirtyblit) {
+		rects[0].x1 = 0; rects[0].y1 = 0;
+		rects[0].x2 = xres; rects[0].y2 = yres;
+		numrects = 1;
+		wholeframe = 0;
+	}
+	if (!numrects) {
+		unlockdisplay();
+		return;
+	}
+	boundrects(rects, numrects, &box);
+#ifndef SDLAYER_USE_RENDERER
+	updaterect.x = box.x1; updaterect.y = box.y1;
+	updaterect.w = box.x2 - box.x1; updaterect.h = box.y2 - box.y1;
+#endif
+
+	if (frameplace == (intptr_t) frame) {
+		// Present it once expanded, and draw the next into the other buffer.
+		// Callers drawing over the last frame before showing it again (the
+		// editors do) expect a single page, so that buffer is brought up to
+		// date with what was drawn into this one.
+		palexpander_start(expander, (unsigned char *)pixels + box.y1 * pitch + box.x1 * 4, pitch,
+			frame + box.y1 * bytesperline + box.x1, bytesperline,
+			box.x2 - box.x1, box.y2 - box.y1, &paltab);
+		expanding = 1;
+
+		drawn = frame;
+		frame = backframe;
+		backframe = drawn;
+		for (i = 0; i < numrects; i++) {
+			for (y = rects[i].y1; y < rects[i].y2; y++) {
+				memcpy(frame + y * bytesperline + rects[i].x1, backframe + y * bytesperline + rects[i].x1,
+					rects[i].x2 - rects[i].x1);
+			}
+		}
+		frameplace = (intptr_t) frame;
+		return;
+	}
+
+	// With a tile as the view, the frame stays put and is expanded here,
+	// leaving the other buffer behind.
+	wholeframe = 1;
+	for (i = 0; i < numrects; i++) {
+		palexpand((unsigned char *)pixels + rects[i].y1 * pitch + rects[i].x1 * 4, pitch,
+			frame + rects[i].y1 * bytesperline + rects[i].x1, bytesperline,
+			rects[i].x2 - rects[i].x1, rects[i].y2 - rects[i].y1, &paltab);
+	}
+	presentdisplay();
 }
 
 
@@ -1275,6 +1544,8 @@ void showframe(void)
 //
 int setpalette(int UNUSED(start), int UNUSED(num), unsigned char * UNUSED(dapal))
 {
+	palexpand_settable(&paltab, curpalettefaded);
+	wholeframe = 1;
 #if USE_OPENGL
 	if (!nogl) {
 		glbuild_update_8bit_palette(&gl8bit, curpalettefaded);
@@ -1463,6 +1734,20 @@ int handleevents(void)
 						SDL_SetRelativeMouseMode(appactive ? SDL_TRUE : SDL_FALSE);
 					}
 					rv=-1;
+				} else if (ev.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+					// SDL replaces the window surface once it's next asked for,
+					// so the expander must be done writing to this one. The frame
+					// it held goes unshown and the next is expanded whole.
+					if (expanding) {
+						palexpander_wait(expander);
+						expanding = 0;
+						unlockdisplay();
+					}
+					wholeframe = 1;
+				} else if (ev.window.event == SDL_WINDOWEVENT_EXPOSED) {
+					// Whatever of the window was shown may be lost, and dirtyblit
+					// would otherwise send only what gets drawn next.
+					wholeframe = 1;
 				}
 				break;
 
@@ -1537,6 +1822,12 @@ int handleevents(void)
 		}
 	}
 
+	if (expanding && !palexpander_busy(expander)) {
+		// Present the last frame now it's ready rather than at the next showframe().
+		expanding = 0;
+		presentdisplay();
+	}
+
 	sampletimer();
 	startwin_idle(NULL);
 	wm_idle(NULL);
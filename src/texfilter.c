@@ -0,0 +1,404 @@
+// Texture mipmap filtering
+// for the Build Engine
+//
+// Polymost halves a hightile texture level by level down to 1x1, bleeding
+// colour into the transparent pixels of each level, whenever the texture
+// isn't found in the texture cache. SSE2 does four pixels at a time. It sums
+// the channels of the opaque pixels in 16-bit lanes, then divides each sum
+// by its count with the multiply and shift that gives the scalar kernels'
+// rounding exactly. The gamma-correct filter looks every channel up in a
+// table both ways, which SSE2 can't do any quicker, so it is scalar only.
+
+#include "compat.h"
+#include "bthread.h"
+#include "texfilter.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__)) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define TEXFILTER_SSE2
+# include <emmintrin.h>
+#endif
+
+typedef struct { unsigned char r, g, b, a; } texel;	// r and b may be either way around
+
+static unsigned short tolinear[256];		// sRGB-encoded to linear light, 0-65535
+static unsigned char fromlinear[65536];		// and back to the nearest encoding
+static volatile int gammaclaimed = 0, gammabuilt = 0;
+
+
+	// Divides the sum of k channel values, rounding as the filters always have.
+static inline int divround(int v, int k)
+{
+	switch (k) {
+		case 2: return (v+1)>>1;
+		case 3: return (v*85+128)>>8;
+		case 4: return (v+2)>>2;
+		default: return v;
+	}
+}
+
+	// Averages the opaque pixels of each 2x2 block for outputs x0 to x1-1 of row y.
+static void mipscalerow_c(texel *pic, int sizx, int sizy, int y, int x0, int x1)
+{
+	texel *wpptr, *rpptr;
+	int x, r, g, b, a, k;
+
+	wpptr = &pic[y * max(1, sizx >> 1) + x0];
+	rpptr = &pic[(y << 1) * sizx + (x0 << 1)];
+
+	for (x = x0; x < x1; x++, wpptr++, rpptr += 2) {
+		r = g = b = a = k = 0;
+		if (rpptr[0].a) {
+			r += (int)rpptr[0].r;
+			g += (int)rpptr[0].g;
+			b += (int)rpptr[0].b;
+			a += (int)rpptr[0].a;
+			k++;
+		}
+		if ((x+x+1 < sizx) && (rpptr[1].a)) {
+			r += (int)rpptr[1].r;
+			g += (int)rpptr[1].g;
+			b += (int)rpptr[1].b;
+			a += (int)rpptr[1].a;
+			k++;
+		}
+		if (y+y+1 < sizy) {
+			if (rpptr[sizx].a) {
+				r += (int)rpptr[sizx  ].r;
+				g += (int)rpptr[sizx  ].g;
+				b += (int)rpptr[sizx  ].b;
+				a += (int)rpptr[sizx  ].a;
+				k++;
+			}
+			if ((x+x+1 < sizx) && (rpptr[sizx+1].a)) {
+				r += (int)rpptr[sizx+1].r;
+				g += (int)rpptr[sizx+1].g;
+				b += (int)rpptr[sizx+1].b;
+				a += (int)rpptr[sizx+1].a;
+				k++;
+			}
+		}
+		wpptr->r = divround(r, k);
+		wpptr->g = divround(g, k);
+		wpptr->b = divround(b, k);
+		wpptr->a = divround(a, k);
+	}
+}
+
+static void mipscale_c(unsigned char *pic, int sizx, int sizy)
+{
+	int y, newx = max(1, sizx >> 1), newy = max(1, sizy >> 1);
+
+	for (y = 0; y < newy; y++) {
+		mipscalerow_c((texel *)pic, sizx, sizy, y, 0, newx);
+	}
+}
+
+	// As mipscale_c(), but with the colours averaged as linear light.
+static void mipscale_gamma_c(unsigned char *pic, int sizx, int sizy)
+{
+	texel *wpptr, *rpptr, *p[4];
+	int x, y, i, n, r, g, b, a, k;
+	int newx = max(1, sizx >> 1), newy = max(1, sizy >> 1);
+
+	for (y = 0; y < newy; y++) {
+		wpptr = &((texel *)pic)[y * newx];
+		rpptr = &((texel *)pic)[(y << 1) * sizx];
+
+		for (x = 0; x < newx; x++, wpptr++, rpptr += 2) {
+			n = 0;
+			p[n++] = &rpptr[0];
+			if (x+x+1 < sizx) p[n++] = &rpptr[1];
+			if (y+y+1 < sizy) {
+				p[n++] = &rpptr[sizx];
+				if (x+x+1 < sizx) p[n++] = &rpptr[sizx+1];
+			}
+
+			r = g = b = a = k = 0;
+			for (i = 0; i < n; i++) {
+				if (!p[i]->a) continue;
+				r += tolinear[p[i]->r];
+				g += tolinear[p[i]->g];
+				b += tolinear[p[i]->b];
+				a += p[i]->a;
+				k++;
+			}
+			if (k) {
+				wpptr->r = fromlinear[(r + (k>>1)) / k];
+				wpptr->g = fromlinear[(g + (k>>1)) / k];
+				wpptr->b = fromlinear[(b + (k>>1)) / k];
+			} else {
+				wpptr->r = wpptr->g = wpptr->b = 0;
+			}
+			wpptr->a = divround(a, k);
+		}
+	}
+}
+
+	// Fixes pixels x0 to x1-1 of row y from their neighbours within columns
+	// 0 to lastx and rows 0 to lasty.
+static void fixrow_c(texel *pic, int sizx, int y, int x0, int x1, int lastx, int lasty)
+{
+	texel *wpptr;
+	int x, r, g, b, j;
+
+	wpptr = &pic[y * sizx + x0];
+	for (x = x0; x < x1; x++, wpptr++) {
+		if (wpptr->a) {
+			continue;
+		}
+		r = g = b = j = 0;
+		if ((x>    0) && (wpptr[   -1].a)) {
+			r += (int)wpptr[   -1].r;
+			g += (int)wpptr[   -1].g;
+			b += (int)wpptr[   -1].b;
+			j++;
+		}
+		if ((x<lastx) && (wpptr[   +1].a)) {
+			r += (int)wpptr[   +1].r;
+			g += (int)wpptr[   +1].g;
+			b += (int)wpptr[   +1].b;
+			j++;
+		}
+		if ((y>    0) && (wpptr[-sizx].a)) {
+			r += (int)wpptr[-sizx].r;
+			g += (int)wpptr[-sizx].g;
+			b += (int)wpptr[-sizx].b;
+			j++;
+		}
+		if ((y<lasty) && (wpptr[ sizx].a)) {
+			r += (int)wpptr[ sizx].r;
+			g += (int)wpptr[ sizx].g;
+			b += (int)wpptr[ sizx].b;
+			j++;
+		}
+		if (j) {
+			wpptr->r = divround(r, j);
+			wpptr->g = divround(g, j);
+			wpptr->b = divround(b, j);
+		}
+	}
+}
+
+	// The last column and row to fix, and the last whose pixels count as
+	// neighbours. A clamped texture's padding doesn't count, but the column
+	// and row next to it are fixed so filtering up to the edge looks right.
+	// A repeating texture's padding duplicates its top and left parts.
+static void fixbounds(int sizx, int sizy, int tsizx, int tsizy, int clamped,
+	int *dox, int *doy, int *lastx, int *lasty)
+{
+	*dox = sizx-1;
+	*doy = sizy-1;
+	if (clamped) {
+		*dox = min(*dox, tsizx);
+		*doy = min(*doy, tsizy);
+		*lastx = tsizx-1;
+		*lasty = tsizy-1;
+	} else {
+		*lastx = sizx-1;
+		*lasty = sizy-1;
+	}
+}
+
+static void fixtransparency_c(unsigned char *pic, int sizx, int sizy, int tsizx, int tsizy, int clamped)
+{
+	int y, dox, doy, lastx, lasty;
+
+	fixbounds(sizx, sizy, tsizx, tsizy, clamped, &dox, &doy, &lastx, &lasty);
+	for (y = 0; y <= doy; y++) {
+		fixrow_c((texel *)pic, sizx, y, 0, dox+1, lastx, lasty);
+	}
+}
+
+
+#ifdef TEXFILTER_SSE2
+
+	// Divides the 16-bit channel sums of four pixels, lo for the first two
+	// and hi for the last two, by each pixel's count as divround() does:
+	// (v*mul+add)>>8 with mul 256, 128, 85 or 64. No product passes 65535.
+static inline __m128i divround_sse2(__m128i sumlo, __m128i sumhi, __m128i cnt)
+{
+	__m128i mul, add;
+
+	mul =                  _mm_and_si128(_mm_cmpeq_epi32(cnt, _mm_set1_epi32(1)), _mm_set1_epi16(256));
+	mul = _mm_or_si128(mul, _mm_and_si128(_mm_cmpeq_epi32(cnt, _mm_set1_epi32(2)), _mm_set1_epi16(128)));
+	mul = _mm_or_si128(mul, _mm_and_si128(_mm_cmpeq_epi32(cnt, _mm_set1_epi32(3)), _mm_set1_epi16(85)));
+	mul = _mm_or_si128(mul, _mm_and_si128(_mm_cmpeq_epi32(cnt, _mm_set1_epi32(4)), _mm_set1_epi16(64)));
+	add = _mm_and_si128(_mm_cmpgt_epi32(cnt, _mm_set1_epi32(1)), _mm_set1_epi16(128));
+
+	sumlo = _mm_add_epi16(_mm_mullo_epi16(sumlo, _mm_unpacklo_epi32(mul, mul)), _mm_unpacklo_epi32(add, add));
+	sumhi = _mm_add_epi16(_mm_mullo_epi16(sumhi, _mm_unpackhi_epi32(mul, mul)), _mm_unpackhi_epi32(add, add));
+	return _mm_packus_epi16(_mm_srli_epi16(sumlo, 8), _mm_srli_epi16(sumhi, 8));
+}
+
+	// Adds the four pixels of px that are opaque to the channel sums, and
+	// takes those that are transparent off the counts.
+static inline void accum_sse2(__m128i px, __m128i *sumlo, __m128i *sumhi, __m128i *cnt)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i transparent;
+
+	transparent = _mm_cmpeq_epi32(_mm_and_si128(px, _mm_set1_epi32((int)0xff000000)), zero);
+	px = _mm_andnot_si128(transparent, px);
+
+	*sumlo = _mm_add_epi16(*sumlo, _mm_unpacklo_epi8(px, zero));
+	*sumhi = _mm_add_epi16(*sumhi, _mm_unpackhi_epi8(px, zero));
+	*cnt = _mm_add_epi32(*cnt, transparent);
+}
+
+static void mipscale_sse2(unsigned char *pic, int sizx, int sizy)
+{
+	texel *wpptr, *rpptr;
+	__m128i a0, a1, b0, b1, sumlo, sumhi, cnt;
+	int x, y, newx = max(1, sizx >> 1), newy = max(1, sizy >> 1);
+
+	if (sizy < 2) {
+		mipscale_c(pic, sizx, sizy);
+		return;
+	}
+
+	for (y = 0; y < newy; y++) {
+		wpptr = &((texel *)pic)[y * newx];
+		rpptr = &((texel *)pic)[(y << 1) * sizx];
+
+		// Each pass reads eight pixels of both rows before writing four,
+		// which never reaches past what it read.
+		for (x = 0; x+x+8 <= sizx; x += 4) {
+			a0 = _mm_loadu_si128((const __m128i *)&rpptr[x+x]);
+			a1 = _mm_loadu_si128((const __m128i *)&rpptr[x+x+4]);
+			b0 = _mm_loadu_si128((const __m128i *)&rpptr[sizx+x+x]);
+			b1 = _mm_loadu_si128((const __m128i *)&rpptr[sizx+x+x+4]);
+
+			sumlo = sumhi = _mm_setzero_si128();
+			cnt = _mm_set1_epi32(4);
+			accum_sse2(_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a0), _mm_castsi128_ps(a1), _MM_SHUFFLE(2,0,2,0))),
+				&sumlo, &sumhi, &cnt);
+			accum_sse2(_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a0), _mm_castsi128_ps(a1), _MM_SHUFFLE(3,1,3,1))),
+				&sumlo, &sumhi, &cnt);
+			accum_sse2(_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(b0), _mm_castsi128_ps(b1), _MM_SHUFFLE(2,0,2,0))),
+				&sumlo, &sumhi, &cnt);
+			accum_sse2(_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(b0), _mm_castsi128_ps(b1), _MM_SHUFFLE(3,1,3,1))),
+				&sumlo, &sumhi, &cnt);
+
+			_mm_storeu_si128((__m128i *)&wpptr[x], divround_sse2(sumlo, sumhi, cnt));
+		}
+		if (x < newx) {
+			mipscalerow_c((texel *)pic, sizx, sizy, y, x, newx);
+		}
+	}
+}
+
+static void fixtransparency_sse2(unsigned char *pic, int sizx, int sizy, int tsizx, int tsizy, int clamped)
+{
+	texel *wpptr;
+	__m128i px, transparent, sumlo, sumhi, cnt, avg;
+	const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+	int x, y, dox, doy, lastx, lasty, vecend;
+
+	fixbounds(sizx, sizy, tsizx, tsizy, clamped, &dox, &doy, &lastx, &lasty);
+
+	// Pixels with neighbours on both sides go four at a time.
+	vecend = min(dox+1, lastx);
+
+	for (y = 0; y <= doy; y++) {
+		wpptr = &((texel *)pic)[y * sizx];
+		fixrow_c((texel *)pic, sizx, y, 0, min(1, dox+1), lastx, lasty);
+
+		for (x = 1; x+4 <= vecend; x += 4) {
+			px = _mm_loadu_si128((const __m128i *)&wpptr[x]);
+			transparent = _mm_cmpeq_epi32(_mm_and_si128(px, alpha), _mm_setzero_si128());
+			if (!_mm_movemask_epi8(transparent)) {
+				continue;
+			}
+
+			// Opaque pixels never change, so it doesn't matter whether
+			// the neighbours have been fixed yet.
+			sumlo = sumhi = _mm_setzero_si128();
+			cnt = _mm_set1_epi32(2 + (y > 0) + (y < lasty));
+			accum_sse2(_mm_loadu_si128((const __m128i *)&wpptr[x-1]), &sumlo, &sumhi, &cnt);
+			accum_sse2(_mm_loadu_si128((const __m128i *)&wpptr[x+1]), &sumlo, &sumhi, &cnt);
+			if (y > 0) {
+				accum_sse2(_mm_loadu_si128((const __m128i *)&wpptr[x-sizx]), &sumlo, &sumhi, &cnt);
+			}
+			if (y < lasty) {
+				accum_sse2(_mm_loadu_si128((const __m128i *)&wpptr[x+sizx]), &sumlo, &sumhi, &cnt);
+			}
+
+			// only transparent pixels with an opaque neighbour change
+			avg = divround_sse2(sumlo, sumhi, cnt);
+			transparent = _mm_andnot_si128(_mm_cmpeq_epi32(cnt, _mm_setzero_si128()), transparent);
+			px = _mm_or_si128(_mm_andnot_si128(transparent, px),
+				_mm_and_si128(transparent, _mm_andnot_si128(alpha, avg)));
+			_mm_storeu_si128((__m128i *)&wpptr[x], px);
+		}
+
+		fixrow_c((texel *)pic, sizx, y, max(x, min(1, dox+1)), dox+1, lastx, lasty);
+	}
+}
+
+#endif	// TEXFILTER_SSE2
+
+
+static const texfilterkernel kernel_c = { "C", mipscale_c, fixtransparency_c };
+#ifdef TEXFILTER_SSE2
+static const texfilterkernel kernel_sse2 = { "SSE2", mipscale_sse2, fixtransparency_sse2 };
+#endif
+
+	// Builds the tables on first use. The first thread here builds them and
+	// any others arriving meanwhile wait for it.
+static void buildgammatables(void)
+{
+	double v;
+	int i, j;
+
+	if (bthread_atomicadd(&gammabuilt, 0)) return;
+	if (bthread_atomicadd(&gammaclaimed, 1) != 1) {
+		while (!bthread_atomicadd(&gammabuilt, 0)) ;
+		return;
+	}
+
+	for (i = 0; i < 256; i++) {
+		v = i / 255.0;
+		v = (v <= 0.04045) ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+		tolinear[i] = (unsigned short)(v * 65535.0 + 0.5);
+	}
+
+	// Each linear value goes to the encoding nearest it, so a colour
+	// averaged with itself comes back unchanged.
+	for (i = 0, j = 0; i < 65536; i++) {
+		while (j < 255 && i * 2 > tolinear[j] + tolinear[j+1]) j++;
+		fromlinear[i] = j;
+	}
+
+	bthread_atomicadd(&gammabuilt, 1);
+}
+
+static const texfilterkernel * const kernels[] = {
+#ifdef TEXFILTER_SSE2
+	&kernel_sse2,
+#endif
+	&kernel_c,
+	NULL
+};
+
+const texfilterkernel * const *texfilter_getkernels(void)
+{
+	return kernels;
+}
+
+void texfilter_mipscale(unsigned char *pic, int sizx, int sizy, int gamma)
+{
+	if (gamma) {
+		buildgammatables();
+		mipscale_gamma_c(pic, sizx, sizy);
+	} else {
+		kernels[0]->mipscale(pic, sizx, sizy);
+	}
+}
+
+void texfilter_fixtransparency(unsigned char *pic, int sizx, int sizy, int tsizx, int tsizy, int clamped)
+{
+	kernels[0]->fixtransparency(pic, sizx, sizy, tsizx, tsizy, clamped);
+}
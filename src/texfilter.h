@@ -0,0 +1,58 @@
+// Texture mipmap filtering
+// for the Build Engine
+//
+// Textures are 32-bit pixels with alpha in the fourth byte, the other
+// three in either order. Transparent means an alpha of zero.
+
+#ifndef TEXFILTER_H
+#define TEXFILTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A set of filtering kernels, each producing exactly what the scalar ones do.
+ */
+typedef struct {
+	const char *name;
+
+	/**
+	 * Halves a sizx by sizy texture in place, each pixel the average of the
+	 * 2x2 block it came from, leaving out transparent pixels.
+	 */
+	void (*mipscale)(unsigned char *pic, int sizx, int sizy);
+
+	/**
+	 * Gives transparent pixels the average colour of their opaque neighbours
+	 * so they don't darken the edges of bilinearly filtered cut-outs. A
+	 * clamped texture is done as far as one pixel past its unpadded size of
+	 * tsizx by tsizy; a repeating one is done throughout.
+	 */
+	void (*fixtransparency)(unsigned char *pic, int sizx, int sizy, int tsizx, int tsizy, int clamped);
+} texfilterkernel;
+
+/**
+ * Returns the kernels usable on this processor, best first, as a
+ * NULL-terminated list which always ends with the scalar kernels.
+ */
+const texfilterkernel * const *texfilter_getkernels(void);
+
+/**
+ * Halves a texture in place with the best kernel for the processor.
+ * @param gamma !0 to average the colours as linear light rather than as
+ *   their sRGB-encoded values, which keeps mipmaps of high-contrast detail
+ *   from darkening, but only has a scalar version
+ */
+void texfilter_mipscale(unsigned char *pic, int sizx, int sizy, int gamma);
+
+/**
+ * Fixes a texture's transparent pixels with the best kernel for the processor.
+ */
+void texfilter_fixtransparency(unsigned char *pic, int sizx, int sizy, int tsizx, int tsizy, int clamped);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
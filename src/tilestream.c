@@ -0,0 +1,347 @@
+// Background tile loading
+// for the Build Engine
+//
+// A worker thread reads tile pixels from the ART files into staging buffers
+// of its own. Only the main thread touches the cache: staged tiles are copied
+// in by loadtile() when they are wanted, and by tilestream_update() once a
+// frame, so cache1d's locks and handles work exactly as they always have.
+
+#include "build.h"
+#include "cache1d.h"
+#include "bthread.h"
+#include "engine_priv.h"
+
+int tilestreaming = 0;
+
+#define MAXSTAGEDBYTES (16<<20)	// the worker waits once this much is waiting to be installed
+
+enum {
+	TS_NONE = 0,
+	TS_QUEUED,		// waiting for the worker
+	TS_READING,		// the worker is reading it
+	TS_READY,		// staged, waiting to be installed
+};
+
+static bthread_t worker = NULL;
+static bmutex_t streammutex = NULL;
+static bcond_t streamcond = NULL;
+static volatile int streamquit = 0;
+
+	// Guarded by streammutex once the worker has started
+static unsigned char tilestate[MAXTILES];
+static unsigned char *staging[MAXTILES];
+static int stagingsize[MAXTILES];
+static short queue[MAXTILES], ready[MAXTILES];
+static int queuehead = 0, queuelen = 0, readyhead = 0;
+static volatile int readylen = 0;
+static int stagedbytes = 0;
+
+	// Where each ART file's bytes are, for the worker's own descriptors,
+	// set up by tilestream_setartfile()
+static char *artpath[MAXTILEFILES];
+static int artbase[MAXTILEFILES], artfd[MAXTILEFILES];
+static char artstreamable[MAXTILEFILES];
+
+	// Tiles the renderer is drawing with the placeholder while they load
+static unsigned char placeheld[(MAXTILES+7)>>3];
+static unsigned char *placeholder = NULL;
+static int placeholdersize = 0, numplaceheld = 0;
+
+static short drained[MAXTILES];
+
+
+static unsigned char *readtile(int tilenume)
+{
+	int fnum, siz;
+	unsigned char *buf;
+
+	fnum = tilefilenum[tilenume];
+	siz = tilesizx[tilenume]*tilesizy[tilenume];
+
+	if (artfd[fnum] < 0) {
+		artfd[fnum] = Bopen(artpath[fnum], BO_BINARY|BO_RDONLY, BS_IREAD);
+		if (artfd[fnum] < 0) return NULL;
+	}
+
+	buf = (unsigned char *)Bmalloc(siz);
+	if (!buf) return NULL;
+
+	if (Blseek(artfd[fnum], artbase[fnum]+tilefileoffs[tilenume], BSEEK_SET) < 0 ||
+			Bread(artfd[fnum], buf, siz) != siz) {
+		Bfree(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+static int streamworker(void *UNUSED(arg))
+{
+	int tilenume;
+	unsigned char *buf;
+
+	bmutex_lock(streammutex);
+	while (!streamquit) {
+		if (!queuelen || stagedbytes >= MAXSTAGEDBYTES) {
+			bcond_wait(streamcond, streammutex);
+			continue;
+		}
+
+		tilenume = queue[queuehead];
+		queuehead = (queuehead+1) % MAXTILES;
+		queuelen--;
+		if (tilestate[tilenume] != TS_QUEUED) continue;	// claimed by loadtile() meanwhile
+
+		tilestate[tilenume] = TS_READING;
+		bmutex_unlock(streammutex);
+
+		buf = readtile(tilenume);
+
+		bmutex_lock(streammutex);
+		if (buf) {
+			staging[tilenume] = buf;
+			stagingsize[tilenume] = tilesizx[tilenume]*tilesizy[tilenume];
+			stagedbytes += stagingsize[tilenume];
+			tilestate[tilenume] = TS_READY;
+			ready[(readyhead+readylen) % MAXTILES] = tilenume;
+			readylen++;
+		} else {
+			tilestate[tilenume] = TS_NONE;
+		}
+		bcond_broadcast(streamcond);
+	}
+	bmutex_unlock(streammutex);
+
+	return 0;
+}
+
+static int startworker(void)
+{
+	if (worker) return 0;
+
+	streammutex = bmutex_create();
+	streamcond = bcond_create();
+	if (!streammutex || !streamcond) goto fail;
+
+	streamquit = 0;
+	worker = bthread_create(streamworker, NULL);
+	if (!worker) goto fail;
+	return 0;
+
+fail:
+	if (streamcond) bcond_destroy(streamcond);
+	if (streammutex) bmutex_destroy(streammutex);
+	streamcond = NULL;
+	streammutex = NULL;
+	return -1;
+}
+
+static void stopworker(void)
+{
+	if (!worker) return;
+
+	bmutex_lock(streammutex);
+	streamquit = 1;
+	bcond_broadcast(streamcond);
+	bmutex_unlock(streammutex);
+
+	bthread_join(worker);
+	bcond_destroy(streamcond);
+	bmutex_destroy(streammutex);
+	worker = NULL;
+	streamcond = NULL;
+	streammutex = NULL;
+}
+
+	// Queues a tile for the worker if it can be streamed, returning 1 if it
+	// is now queued or already on its way
+static int queuetile(int tilenume)
+{
+	int siz;
+
+	if (tilestate[tilenume] != TS_NONE) return 1;
+
+	siz = tilesizx[tilenume]*tilesizy[tilenume];
+	if (siz <= 0 || !artstreamable[tilefilenum[tilenume]]) return 0;
+	if (startworker()) return 0;
+
+	bmutex_lock(streammutex);
+	if (queuelen == MAXTILES) {
+		bmutex_unlock(streammutex);
+		return 0;
+	}
+	tilestate[tilenume] = TS_QUEUED;
+	queue[(queuehead+queuelen) % MAXTILES] = tilenume;
+	queuelen++;
+	bcond_broadcast(streamcond);
+	bmutex_unlock(streammutex);
+
+	return 1;
+}
+
+static void unplacehold(int tilenume)
+{
+	if (!(placeheld[tilenume>>3] & pow2char[tilenume&7])) return;
+
+	placeheld[tilenume>>3] &= ~pow2char[tilenume&7];
+	waloff[tilenume] = 0;
+	numplaceheld--;
+}
+
+	// Takes a tile back from the worker, waiting if it is being read.
+	// Returns its staged pixels if there are any, which the caller must free.
+	// Only tilestream_claim() and queuetile() take tiles out of TS_NONE, and
+	// both run on the main thread, so it may be tested without the lock.
+static unsigned char *claimtile(int tilenume, int *siz)
+{
+	unsigned char *buf = NULL;
+
+	if (tilestate[tilenume] == TS_NONE) return NULL;
+
+	bmutex_lock(streammutex);
+	while (tilestate[tilenume] == TS_READING)
+		bcond_wait(streamcond, streammutex);
+
+	if (tilestate[tilenume] == TS_READY) {
+		buf = staging[tilenume];
+		*siz = stagingsize[tilenume];
+		staging[tilenume] = NULL;
+		stagedbytes -= *siz;
+		bcond_broadcast(streamcond);
+	}
+	tilestate[tilenume] = TS_NONE;
+	bmutex_unlock(streammutex);
+
+	return buf;
+}
+
+unsigned char *tilestream_claim(short tilenume)
+{
+	unsigned char *buf;
+	int siz;
+
+	unplacehold(tilenume);
+	buf = claimtile(tilenume, &siz);
+	if (buf && siz != tilesizx[tilenume]*tilesizy[tilenume]) {
+		Bfree(buf);	// the tile was resized after it was read
+		buf = NULL;
+	}
+	return buf;
+}
+
+void tilestream_cancel(short tilenume)
+{
+	Bfree(tilestream_claim(tilenume));
+}
+
+int tilestream_placehold(short tilenume)
+{
+	int i;
+
+	if (placeheld[tilenume>>3] & pow2char[tilenume&7]) return 1;
+	if (tilestate[tilenume] == TS_READY) return 0;	// loadtile() can install it straight away
+
+		//Spans already drawn may point into the placeholder, so it is sized
+		//once for the biggest tile and never moves
+	if (!placeholder) {
+		for (i=0; i<MAXTILES; i++)
+			placeholdersize = max(placeholdersize, tilesizx[i]*tilesizy[i]);
+		placeholder = (unsigned char *)Bcalloc(1, max(placeholdersize, 1));
+		if (!placeholder) { placeholdersize = 0; return 0; }
+	}
+	if (tilesizx[tilenume]*tilesizy[tilenume] > placeholdersize) return 0;
+	if (!queuetile(tilenume)) return 0;
+
+	placeheld[tilenume>>3] |= pow2char[tilenume&7];
+	waloff[tilenume] = (intptr_t)placeholder;
+	numplaceheld++;
+	return 1;
+}
+
+void tilestream_update(void)
+{
+	int i, n, tilenume;
+
+	if (!worker || !readylen) return;
+
+	bmutex_lock(streammutex);
+	for (n = 0; readylen > 0; readylen--) {
+		tilenume = ready[readyhead];
+		readyhead = (readyhead+1) % MAXTILES;
+		if (tilestate[tilenume] == TS_READY) drained[n++] = tilenume;
+	}
+	bmutex_unlock(streammutex);
+
+	for (i = 0; i < n; i++) {
+		tilenume = drained[i];
+		if (waloff[tilenume] == 0 || (placeheld[tilenume>>3] & pow2char[tilenume&7]))
+			loadtile(tilenume);
+		else
+			tilestream_cancel(tilenume);	// loaded some other way meanwhile
+	}
+}
+
+void tilestream_resolveplaceholders(void)
+{
+	int i;
+
+	for (i=0; numplaceheld > 0 && i<MAXTILES; i++)
+		if (placeheld[i>>3] & pow2char[i&7]) loadtile((short)i);
+}
+
+void prefetchtiles(const short *tiles, int numtiles)
+{
+	int i;
+
+	for (i=0; i<numtiles; i++) {
+		if ((unsigned)tiles[i] >= (unsigned)MAXTILES) continue;
+		if (waloff[tiles[i]] && !(placeheld[tiles[i]>>3] & pow2char[tiles[i]&7])) continue;
+		queuetile(tiles[i]);
+	}
+}
+
+int tryloadtile(short tilenume)
+{
+	if ((unsigned)tilenume >= (unsigned)MAXTILES) return 0;
+	if (tilesizx[tilenume]*tilesizy[tilenume] <= 0) return 0;
+	if (waloff[tilenume] && !(placeheld[tilenume>>3] & pow2char[tilenume&7])) return 1;
+
+	if (tilestate[tilenume] == TS_READY || !queuetile(tilenume)) {
+		loadtile(tilenume);
+		return waloff[tilenume] != 0;
+	}
+	return 0;
+}
+
+void tilestream_setartfile(int filenum, const char *filename)
+{
+	artfd[filenum] = -1;
+	artstreamable[filenum] = (kfilelocation(filename, 0, &artpath[filenum], &artbase[filenum]) == 0);
+}
+
+void tilestream_reset(void)
+{
+	int i;
+
+	stopworker();
+
+	for (i=0; i<MAXTILES; i++) {
+		unplacehold(i);
+		if (staging[i]) Bfree(staging[i]);
+		staging[i] = NULL;
+		tilestate[i] = TS_NONE;
+	}
+	queuehead = queuelen = readyhead = readylen = 0;
+	stagedbytes = 0;
+
+	for (i=0; i<MAXTILEFILES; i++) {
+		if (artpath[i] && artfd[i] >= 0) Bclose(artfd[i]);
+		artfd[i] = -1;
+		if (artpath[i]) free(artpath[i]);
+		artpath[i] = NULL;
+		artstreamable[i] = 0;
+	}
+
+	Bfree(placeholder);
+	placeholder = NULL;
+	placeholdersize = 0;
+}
@@ -0,0 +1,3 @@
+const char *build_version = "d72b04b";
+const char *build_date = __DATE__;
+const char *build_time = __TIME__;
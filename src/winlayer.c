@@ -1426,7 +1426,17 @@ void showframe(void)
 #if USE_OPENGL
 	if (!nogl) {
 		if (bpp == 8) {
-			glbuild_update_8bit_frame(&gl8bit, frame, xres, yres, bytesperline);
+			dirtyrecttype rects[MAXDIRTYRECTS];
+
+			j = getdirtyrects(rects);
+			if (dirtyblit) {
+				// The texture keeps the last frame, so only what changed goes up.
+				for (i = 0; i < j; i++) {
+					glbuild_update_8bit_rows(&gl8bit, frame, bytesperline, rects[i].y1, rects[i].y2);
+				}
+			} else {
+				glbuild_update_8bit_frame(&gl8bit, frame, xres, yres, bytesperline);
+			}
 			glbuild_draw_8bit_frame(&gl8bit);
 		}
 
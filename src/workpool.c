@@ -0,0 +1,169 @@
+// Worker thread pool
+// for the Build Engine
+
+#include "compat.h"
+#include "bthread.h"
+#include "workpool.h"
+
+#define MAXWORKPOOLTHREADS 64
+
+struct workpool_typ {
+	bmutex_t mtx;
+	bcond_t wakecond, donecond;
+
+	int numworkers;
+	bthread_t workers[MAXWORKPOOLTHREADS];
+
+	int quit, busy;
+	unsigned int generation;	// incremented for each workpool_run() batch
+
+	void (*func)(void *, int);
+	void *ctx;
+	int numjobs;
+	volatile int nextjob;
+	int jobsdone;
+	int activeworkers;	// workers yet to report back from the current batch
+};
+
+// Claims and executes jobs from the current batch until none remain.
+// Returns the number of jobs this thread completed.
+static int runjobs(workpool *pool)
+{
+	int job, done = 0;
+
+	while ((job = bthread_atomicadd(&pool->nextjob, 1) - 1) < pool->numjobs) {
+		pool->func(pool->ctx, job);
+		done++;
+	}
+	return done;
+}
+
+static int workerproc(void *arg)
+{
+	workpool *pool = (workpool *)arg;
+	unsigned int seengeneration;
+	int done;
+
+	bmutex_lock(pool->mtx);
+	seengeneration = pool->generation;
+	while (1) {
+		while (!pool->quit && pool->generation == seengeneration) {
+			bcond_wait(pool->wakecond, pool->mtx);
+		}
+		if (pool->quit) break;
+		seengeneration = pool->generation;
+		pool->activeworkers++;
+		bmutex_unlock(pool->mtx);
+
+		done = runjobs(pool);
+
+		bmutex_lock(pool->mtx);
+		pool->jobsdone += done;
+		pool->activeworkers--;
+		if (pool->jobsdone == pool->numjobs && pool->activeworkers == 0) {
+			bcond_signal(pool->donecond);
+		}
+	}
+	bmutex_unlock(pool->mtx);
+
+	return 0;
+}
+
+workpool * workpool_create(int numthreads)
+{
+	workpool *pool;
+
+	if (numthreads < 1) numthreads = bthread_numcpus();
+	numthreads = min(numthreads, MAXWORKPOOLTHREADS+1);
+
+	pool = (workpool *)Bcalloc(1, sizeof(workpool));
+	if (!pool) return NULL;
+
+	pool->mtx = bmutex_create();
+	pool->wakecond = bcond_create();
+	pool->donecond = bcond_create();
+	if (!pool->mtx || !pool->wakecond || !pool->donecond) {
+		workpool_destroy(pool);
+		return NULL;
+	}
+
+	for (pool->numworkers = 0; pool->numworkers < numthreads-1; pool->numworkers++) {
+		pool->workers[pool->numworkers] = bthread_create(workerproc, pool);
+		if (!pool->workers[pool->numworkers]) break;
+	}
+
+	return pool;
+}
+
+void workpool_destroy(workpool *pool)
+{
+	int i;
+
+	if (!pool) return;
+
+	if (pool->mtx) {
+		bmutex_lock(pool->mtx);
+		pool->quit = 1;
+		bcond_broadcast(pool->wakecond);
+		bmutex_unlock(pool->mtx);
+	}
+	for (i = 0; i < pool->numworkers; i++) {
+		bthread_join(pool->workers[i]);
+	}
+
+	bcond_destroy(pool->donecond);
+	bcond_destroy(pool->wakecond);
+	bmutex_destroy(pool->mtx);
+	Bfree(pool);
+}
+
+int workpool_numthreads(workpool *pool)
+{
+	if (!pool) return 1;
+	return pool->numworkers + 1;
+}
+
+void workpool_run(workpool *pool, void (*func)(void *ctx, int job), void *ctx, int numjobs)
+{
+	int i, done;
+
+	if (numjobs <= 0) return;
+
+	if (pool) {
+		bmutex_lock(pool->mtx);
+		if (pool->busy || pool->numworkers == 0 || numjobs == 1) {
+			bmutex_unlock(pool->mtx);
+			pool = NULL;
+		}
+	}
+	if (!pool) {
+		for (i = 0; i < numjobs; i++) func(ctx, i);
+		return;
+	}
+
+	// a worker that woke late for the previous batch may still be looking
+	// for jobs, so let it finish before the batch state is replaced
+	while (pool->activeworkers > 0) {
+		bcond_wait(pool->donecond, pool->mtx);
+	}
+
+	pool->busy = 1;
+	pool->func = func;
+	pool->ctx = ctx;
+	pool->numjobs = numjobs;
+	pool->nextjob = 0;
+	pool->jobsdone = 0;
+	pool->generation++;
+	bcond_broadcast(pool->wakecond);
+	bmutex_unlock(pool->mtx);
+
+	done = runjobs(pool);
+
+	bmutex_lock(pool->mtx);
+	pool->jobsdone += done;
+	while (pool->jobsdone < pool->numjobs || pool->activeworkers > 0) {
+		bcond_wait(pool->donecond, pool->mtx);
+	}
+	pool->busy = 0;
+	bmutex_unlock(pool->mtx);
+}
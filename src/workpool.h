@@ -0,0 +1,45 @@
+// Worker thread pool
+// for the Build Engine
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct workpool_typ workpool;
+
+/**
+ * Creates a pool of worker threads.
+ * @param numthreads the total number of threads that will execute jobs,
+ *   including the thread calling workpool_run(), so numthreads-1 workers are
+ *   started. Values less than 1 choose one per processor.
+ * @return the pool, or NULL on failure
+ */
+workpool * workpool_create(int numthreads);
+
+/**
+ * Stops the worker threads and releases the pool.
+ */
+void workpool_destroy(workpool *pool);
+
+/**
+ * Returns the number of threads executing jobs for the pool, including the caller.
+ */
+int workpool_numthreads(workpool *pool);
+
+/**
+ * Calls func(ctx, job) for each job in 0..numjobs-1, spread across the pool's
+ * threads and the calling thread, and returns once all have completed.
+ * Jobs are claimed in ascending order but may complete in any order.
+ * If pool is NULL, or the pool is already busy (e.g. when called from a job),
+ * the jobs run serially on the calling thread.
+ */
+void workpool_run(workpool *pool, void (*func)(void *ctx, int job), void *ctx, int numjobs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
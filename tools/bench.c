@@ -0,0 +1,365 @@
+// Headless renderer benchmark
+// Renders a map along a scripted camera path into memory and reports the
+// frame rate, frame time percentiles and a CRC of every frame. Saved CRCs
+// can be checked on later runs so rendering changes are caught.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "cache1d.h"
+#include "pragmas.h"
+#include "crc32.h"
+
+extern int renderthreads;	// from engine.c
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+typedef struct {
+	int x, y, z;
+	short ang, horiz, sectnum;
+} camtype;
+
+static const char *mapname = NULL, *artname = "tiles000.art", *grpname = NULL;
+static const char *pathname = NULL, *savename = NULL, *checkname = NULL, *profilename = NULL;
+static const char *tracename = NULL;
+static int xdim_ = 1024, ydim_ = 768, benchframes = 300, warmframes = 0, cachemb = 64, quiet = 0;
+
+static camtype *path = NULL;
+static int pathlen = 0;
+
+static void usage(void)
+{
+	puts("bench [options] mapfile\n"
+		"  -r WxH        render resolution (default 1024x768)\n"
+		"  -n frames     number of frames to time (default 300)\n"
+		"  -w frames     untimed frames to draw first (default 0)\n"
+		"  -t threads    renderer threads, 0 for one per processor (default 1)\n"
+		"  -m megabytes  tile cache size (default 64)\n"
+		"  -b            load tiles in the background, drawing placeholders until they arrive\n"
+		"  -f            map the group and ART files into memory instead of reading them\n"
+		"  -a artfile    first ART file of the tile set (default tiles000.art)\n"
+		"  -g grpfile    group file to load data from\n"
+		"  -p pathfile   camera path, one \"x y z ang horiz sectnum\" per line,\n"
+		"                instead of walking the map from the start position\n"
+		"  -s crcfile    save the frame CRCs\n"
+		"  -c crcfile    compare the frame CRCs with a saved set, failing on any difference\n"
+		"  -P csvfile    profile the renderer's stages, writing each frame's profile as CSV\n"
+		"  -T tracefile  record the timed frames as a Chrome trace\n"
+		"  -q            print only the summary"
+	);
+}
+
+static int loadpath(const char *fn)
+{
+	FILE *fp;
+	char line[256];
+	camtype c;
+	int ang, horiz, sectnum, alloced = 0;
+
+	fp = fopen(fn, "r");
+	if (!fp) {
+		buildprintf("Could not open path file %s\n", fn);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%d %d %d %d %d %d", &c.x, &c.y, &c.z, &ang, &horiz, &sectnum) != 6) continue;
+		c.ang = (short)(ang & 2047);
+		c.horiz = (short)horiz;
+		c.sectnum = (short)sectnum;
+
+		if (pathlen == alloced) {
+			alloced = alloced ? alloced * 2 : 256;
+			path = (camtype *)Brealloc(path, alloced * sizeof(camtype));
+			if (!path) { fclose(fp); return -1; }
+		}
+		path[pathlen++] = c;
+	}
+	fclose(fp);
+
+	if (!pathlen) {
+		buildprintf("Path file %s has no positions\n", fn);
+		return -1;
+	}
+	return 0;
+}
+
+	// Walks forward from the start position like a player would, turning
+	// away whenever a wall blocks the way, while looking gently up and down.
+	// Everything is integer maths on the map so the path is the same on
+	// every run and machine.
+static void walkcamera(camtype *c, int frame)
+{
+	int xvect, yvect, ox, oy, z, ceilz, ceilhit, florz, florhit;
+
+	ox = c->x; oy = c->y; z = c->z;
+	xvect = sintable[(c->ang+512)&2047] << 5;
+	yvect = sintable[c->ang] << 5;
+	clipmove(&c->x, &c->y, &z, &c->sectnum, xvect, yvect, 164, 4<<8, 4<<8, CLIPMASK0);
+
+	if (klabs(c->x-ox) + klabs(c->y-oy) < 64) {
+		c->ang = (c->ang + 384 + ((frame*97)&255)) & 2047;	// blocked, so turn away
+	} else {
+		c->ang = (c->ang + 3) & 2047;	// drift slowly
+	}
+
+	if (c->sectnum >= 0) {
+		getzrange(c->x, c->y, c->z, c->sectnum, &ceilz, &ceilhit, &florz, &florhit, 128, CLIPMASK0);
+		z = florz - (32<<8);
+		if (z < ceilz + (4<<8)) z = (ceilz + florz) >> 1;
+		c->z += (z - c->z) >> 2;
+	}
+
+	c->horiz = (short)(100 + (sintable[(frame<<4)&2047] >> 9));
+}
+
+	// The same tsprite setup as the game does between drawrooms and
+	// drawmasks, less the interpolation of moving sprites.
+static void analyzesprites(int dax, int day)
+{
+	int i, k;
+	spritetype *tspr;
+
+	for (i=0,tspr=&tsprite[0]; i<spritesortcnt; i++,tspr++) {
+			//Don't allow close explosion sprites to be transluscent
+		k = tspr->statnum;
+		if ((k == 3) || (k == 4) || (k == 5) || (k == 7))
+			if (klabs(dax-tspr->x) < 256)
+				if (klabs(day-tspr->y) < 256)
+					tspr->cstat &= ~2;
+
+		tspr->shade += 6;
+		if (sector[tspr->sectnum].ceilingstat&1)
+			tspr->shade += sector[tspr->sectnum].ceilingshade;
+		else
+			tspr->shade += sector[tspr->sectnum].floorshade;
+	}
+}
+
+static unsigned int drawframe(const camtype *c)
+{
+	clearview(0);
+	drawrooms(c->x, c->y, c->z, c->ang, c->horiz, c->sectnum);
+	analyzesprites(c->x, c->y);
+	drawmasks();
+
+	return crc32once((unsigned char *)frameplace, bytesperline * ydim);
+}
+
+static int cmpuint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(const unsigned int *sorted, int n, int pct)
+{
+	return sorted[min(n-1, (n * pct) / 100)] / 1000.0;
+}
+
+static int comparecrcs(const char *fn, const unsigned int *crcs, int n)
+{
+	FILE *fp;
+	unsigned int crc;
+	int i, frame, fails = 0;
+
+	fp = fopen(fn, "r");
+	if (!fp) {
+		buildprintf("Could not open CRC file %s\n", fn);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (fscanf(fp, "%d %x", &frame, &crc) != 2) {
+			buildprintf("CRC file %s ends at frame %d\n", fn, i);
+			fails++;
+			break;
+		}
+		if (crc != crcs[i]) {
+			if (fails < 10) buildprintf("Frame %d differs: %08x, expected %08x\n", i, crcs[i], crc);
+			fails++;
+		}
+	}
+	fclose(fp);
+	return fails;
+}
+
+static int savecrcs(const char *fn, const unsigned int *crcs, int n)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(fn, "w");
+	if (!fp) {
+		buildprintf("Could not create CRC file %s\n", fn);
+		return -1;
+	}
+	for (i = 0; i < n; i++) fprintf(fp, "%d %08x\n", i, crcs[i]);
+	fclose(fp);
+	return 0;
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	camtype cam;
+	cachestatstype cache;
+	renderstatstype stats;
+	profiletype prof, proftotal;
+	double bunches = 0.0, bunchfronts = 0.0, bunchoverlaps = 0.0;
+	unsigned int *crcs, *usecs, *sorted, t, loadusecs, total = 0;
+	int i, k, fails = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') { mapname = argv[i]; continue; }
+		if (!argv[i][1] || argv[i][2]) { usage(); return 1; }
+		if (argv[i][1] == 'q') { quiet = 1; continue; }
+		if (argv[i][1] == 'b') { tilestreaming = 1; continue; }
+		if (argv[i][1] == 'f') { usefilemapping = 1; continue; }
+		if (i+1 >= argc) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 'r':
+				if (sscanf(argv[++i], "%dx%d", &xdim_, &ydim_) != 2) { usage(); return 1; }
+				break;
+			case 'n': benchframes = atoi(argv[++i]); break;
+			case 'w': warmframes = atoi(argv[++i]); break;
+			case 't': renderthreads = atoi(argv[++i]); break;
+			case 'm': cachemb = atoi(argv[++i]); break;
+			case 'a': artname = argv[++i]; break;
+			case 'g': grpname = argv[++i]; break;
+			case 'p': pathname = argv[++i]; break;
+			case 's': savename = argv[++i]; break;
+			case 'c': checkname = argv[++i]; break;
+			case 'P': profilename = argv[++i]; break;
+			case 'T': tracename = argv[++i]; break;
+			default: usage(); return 1;
+		}
+	}
+	if (!mapname || benchframes < 1 || warmframes < 0 || renderthreads < 0 || cachemb < 1) { usage(); return 1; }
+
+	loadusecs = getusecticks();
+	if (grpname && initgroupfile(grpname) < 0) {
+		buildprintf("Could not open group file %s\n", grpname);
+		return 1;
+	}
+	if (initengine()) {
+		buildprintf("initengine() failed: %s\n", engineerrstr);
+		return 1;
+	}
+	if (loadpics((char *)artname, cachemb*1048576) < 0) {
+		buildprintf("Could not load tiles from %s\n", artname);
+		return 1;
+	}
+	memset(&cam, 0, sizeof(cam));
+	if (loadboard((char *)mapname, 0, &cam.x, &cam.y, &cam.z, &cam.ang, &cam.sectnum) < 0) {
+		buildprintf("Could not load map %s\n", mapname);
+		return 1;
+	}
+	loadusecs = getusecticks() - loadusecs;
+	if (pathname && loadpath(pathname)) return 1;
+	if (setgamemode(0, xdim_, ydim_, 8) < 0) {
+		buildprintf("Could not set a %dx%d video mode\n", xdim_, ydim_);
+		return 1;
+	}
+
+	crcs = (unsigned int *)Bmalloc(benchframes * sizeof(unsigned int));
+	usecs = (unsigned int *)Bmalloc(benchframes * sizeof(unsigned int));
+	sorted = (unsigned int *)Bmalloc(benchframes * sizeof(unsigned int));
+	if (!crcs || !usecs || !sorted) return 1;
+
+	if (!quiet) buildprintf("%dx%d, %d renderer threads\nframe     ms  crc\n", xdim, ydim, renderthreads);
+
+	memset(&proftotal, 0, sizeof(proftotal));
+	if (profilename) {
+		profiling = 1;
+		profileframe();
+	}
+
+	for (i = -warmframes; i < benchframes; i++) {
+		if (pathname) {
+			cam = path[(i + warmframes) % pathlen];
+		} else {
+			walkcamera(&cam, i + warmframes);
+		}
+
+		if (i == 0 && profilename && profilecsv(profilename)) {
+			buildprintf("Could not create profile file %s\n", profilename);
+			return 1;
+		}
+		if (i == 0 && tracename && tracetofile(tracename, benchframes)) {
+			buildprintf("Could not begin a trace\n");
+			return 1;
+		}
+
+		t = getusecticks();
+		if (i < 0) {
+			drawframe(&cam);
+			if (profilename) profileframe();
+			continue;
+		}
+		crcs[i] = drawframe(&cam);
+		usecs[i] = getusecticks() - t;
+		total += usecs[i];
+
+		if (profilename) {
+			profileframe();
+			getprofile(&prof);
+			for (k = 0; k < PROFILE_NUMTIMERS; k++) proftotal.nsecs[k] += prof.nsecs[k];
+			for (k = 0; k < PROFILE_NUMKERNELS; k++) proftotal.pixels[k] += prof.pixels[k];
+		} else if (tracename) {
+			profileframe();
+		}
+
+		getrenderstats(&stats);
+		bunches += stats.bunches;
+		bunchfronts += stats.bunchfronts;
+		bunchoverlaps += stats.bunchoverlaps;
+
+		if (!quiet) buildprintf("%5d %6.2f  %08x\n", i, usecs[i] / 1000.0, crcs[i]);
+	}
+
+	memcpy(sorted, usecs, benchframes * sizeof(unsigned int));
+	qsort(sorted, benchframes, sizeof(unsigned int), cmpuint);
+
+	buildprintf("%s: %d frames at %dx%d in %.3f s, %.1f fps\n", mapname, benchframes, xdim, ydim,
+		total / 1000000.0, total ? benchframes * 1000000.0 / total : 0.0);
+	buildprintf("frame ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+		percentile(sorted, benchframes, 50), percentile(sorted, benchframes, 90),
+		percentile(sorted, benchframes, 99), sorted[benchframes-1] / 1000.0);
+
+	buildprintf("per frame: %.1f bunches drawn, %.1f bunchfront() calls, %.1f of them overlapping\n",
+		bunches / (double)benchframes, bunchfronts / (double)benchframes, bunchoverlaps / (double)benchframes);
+	if (profilename) {
+		buildprintf("ms per frame:");
+		for (k = 0; k < PROFILE_NUMTIMERS; k++)
+			if (proftotal.nsecs[k]) buildprintf(" %s %.3f", profiletimernames[k], proftotal.nsecs[k] / 1000000.0 / benchframes);
+		buildprintf("\npixels per frame:");
+		for (k = 0; k < PROFILE_NUMKERNELS; k++)
+			if (proftotal.pixels[k]) buildprintf(" %s %u", profilekernelnames[k], proftotal.pixels[k] / benchframes);
+		buildprintf("\n");
+		profilecsv(NULL);
+	}
+	getcachestats(&cache);
+	buildprintf("tile cache: %u misses, %u evictions\n", cache.misses, cache.evictions);
+	buildprintf("loading took %.2f ms\n", loadusecs / 1000.0);
+
+	if (savename && savecrcs(savename, crcs, benchframes)) fails = 1;
+	if (checkname) {
+		i = comparecrcs(checkname, crcs, benchframes);
+		if (i) {
+			if (i > 0) buildprintf("%d frames differ from %s\n", i, checkname);
+			fails = 1;
+		} else {
+			buildprintf("All frames match %s\n", checkname);
+		}
+	}
+
+	Bfree(sorted);
+	Bfree(usecs);
+	Bfree(crcs);
+	Bfree(path);
+	uninitengine();
+	if (grpname) uninitgroupfile();
+
+	return fails;
+}
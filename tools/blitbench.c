@@ -0,0 +1,127 @@
+// Palette expansion benchmark
+// Times each kernel this processor supports turning an 8-bit frame into
+// 32-bit pixels as the layers do in showframe(), checking each against the
+// scalar kernel and the scalar kernel's table against the pixel-at-a-time
+// loop the SDL layer uses without threadedblit, then times the background expander's hand-off, with the
+// copy the SDL layer makes to draw the next frame over, to show how much of
+// the work leaves the calling thread.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "palexpand.h"
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+static int width = MAXXDIM, height = MAXYDIM, frames = 100;
+
+static void usage(void)
+{
+	puts("blitbench [options]\n"
+		"  -r WxH      frame size (default 2880x1800, MAXXDIM by MAXYDIM)\n"
+		"  -n frames   frames to expand with each kernel (default 100)"
+	);
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	const palexpandkernel * const *kernels;
+	palexpandtable tab;
+	palexpander *pe;
+	palette_t pal[256];
+	unsigned char *src, *next;
+	unsigned int *dest, *ref;
+	unsigned int t, best, ref_us = 0, start, waited;
+	int i, j, k, y, pitch, fails = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || i+1 >= argc) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 'r':
+				if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) { usage(); return 1; }
+				break;
+			case 'n': frames = atoi(argv[++i]); break;
+			default: usage(); return 1;
+		}
+	}
+	if (width < 1 || height < 1 || frames < 1) { usage(); return 1; }
+
+	pitch = (((width|1) + 4) & ~3);	// as the layers round it
+	src = (unsigned char *)Bmalloc(pitch * height);
+	next = (unsigned char *)Bmalloc(pitch * height);
+	dest = (unsigned int *)Bmalloc(width * height * sizeof(unsigned int));
+	ref = (unsigned int *)Bmalloc(width * height * sizeof(unsigned int));
+	if (!src || !next || !dest || !ref) return 1;
+
+	srand(1);
+	for (i = 0; i < 256; i++) {
+		pal[i].r = rand() & 255; pal[i].g = rand() & 255; pal[i].b = rand() & 255; pal[i].f = 0;
+	}
+	for (i = 0; i < pitch * height; i++) src[i] = rand() & 255;
+	palexpand_settable(&tab, pal);
+#if B_LITTLE_ENDIAN
+	for (i = 0; i < 256; i++) {
+		if (tab.pixel[i] != (B_SWAP32(*(unsigned int *)&pal[i]) >> 8)) break;
+	}
+	if (i < 256) {
+		buildprintf("  the table differs from the pixel-at-a-time loop at entry %d\n", i);
+		fails++;
+	}
+#endif
+
+	buildprintf("%dx%d, %d frames\n", width, height, frames);
+
+	kernels = palexpand_getkernels();
+	for (k = 0; kernels[k]; k++) ;
+	for (k--; k >= 0; k--) {	// the scalar kernel first, as the reference
+		best = ~0u;
+		for (j = 0; j < frames; j++) {
+			t = getusecticks();
+			for (y = 0; y < height; y++) kernels[k]->row(&dest[y*width], &src[y*pitch], width, &tab);
+			t = getusecticks() - t;
+			if (t < best) best = t;
+		}
+		if (!kernels[k+1]) {
+			memcpy(ref, dest, width * height * sizeof(unsigned int));
+			ref_us = best;
+		} else if (memcmp(ref, dest, width * height * sizeof(unsigned int))) {
+			buildprintf("  %-5s differs from the scalar kernel\n", kernels[k]->name);
+			fails++;
+			continue;
+		}
+		buildprintf("  %-5s %7.3f ms per frame, %6.2f Mpixels/s, %.2fx\n", kernels[k]->name,
+			best / 1000.0, (double)width * height / best, best ? (double)ref_us / best : 0.0);
+	}
+
+	pe = palexpander_create();
+	if (!pe) {
+		buildprintf("Could not start the background expander\n");
+		return 1;
+	}
+	start = waited = 0;
+	for (j = 0; j < frames; j++) {
+		t = getusecticks();
+		palexpander_start(pe, dest, width * sizeof(unsigned int), src, pitch, width, height, &tab);
+		memcpy(next, src, pitch * height);
+		start += getusecticks() - t;
+		t = getusecticks();
+		palexpander_wait(pe);
+		waited += getusecticks() - t;
+	}
+	palexpander_destroy(pe);
+	if (memcmp(ref, dest, width * height * sizeof(unsigned int))) {
+		buildprintf("  the background expander differs from the scalar kernel\n");
+		fails++;
+	}
+	buildprintf("  background: %.3f ms per frame to hand off, %.3f ms waiting when nothing overlaps it\n",
+		start / 1000.0 / frames, waited / 1000.0 / frames);
+
+	Bfree(ref);
+	Bfree(dest);
+	Bfree(next);
+	Bfree(src);
+
+	return fails != 0;
+}
@@ -1,90 +1,185 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <dirent.h>
-#include <sys/stat.h>
+// Texture cache inspector
+// Lists the entries of the texture cache in a directory, from the index's
+// table and then its journal, checking each against the storage file.
+// by Jonathon Fowler (jf@jonof.id.au)
+
 #include "compat.h"
 
 #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT   0x83F0
 #define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT  0x83F1
 #define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT  0x83F2
 #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT  0x83F3
+#define GL_ETC1_RGB8_OES                  0x8D64
 
-typedef struct {
-	char magic[8];	// 'Polymost'
-	long xdim, ydim;	// of image, unpadded
-	long flags;		// 1 = !2^x, 2 = has alpha, 4 = lzw compressed
-} texcacheheader;
-typedef struct {
-	long size;
-	long format;
-	long xdim, ydim;	// of mipmap (possibly padded)
-	long border, depth;
-} texcachepicture;
+#define CACHEVER 1
+#define HEADERSIZE 32
+#define SLOTSIZE 24
+#define MAXMIPS 32
 
-int main(int argc, char **argv)
+static unsigned char *storage = NULL;
+static int storagelen = 0;
+static int mipbytes = 0, problems = 0;
+
+	// Reads a little-endian value wherever it lies.
+static unsigned int get32(const unsigned char *p)
 {
-	DIR *dir;
-	struct dirent *dirent;
-	struct stat st;
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned char *readfile(const char *dir, const char *name, int *len)
+{
+	char path[BMAX_PATH];
+	unsigned char *buf;
 	FILE *fp;
-	texcacheheader head;
-	texcachepicture mip;
-	
-	dir = opendir(".");
-	while ((dirent = readdir(dir))) {
-		if (stat(dirent->d_name, &st)) {
-			printf("%s: failed to stat\n", dirent->d_name);
-			continue;
-		}
-		if (!(st.st_mode&S_IFREG)) {
-			printf("%s: not a regular file\n", dirent->d_name);
-			continue;
-		}
-		
-		fp = fopen(dirent->d_name,"rb");
-		if (!fp) {
-			printf("%s: failed to open\n", dirent->d_name);
-			continue;
-		}
-		
-		if (fread(&head, sizeof(head), 1, fp) != 1) {
-			fclose(fp);
-			printf("%s: failed to read header\n", dirent->d_name);
-			continue;
+
+	Bsnprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "rb");
+	if (!fp) {
+		printf("%s: failed to open\n", path);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	*len = (int)ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = (unsigned char *)malloc(*len + 1);
+	if (!buf || (*len > 0 && fread(buf, *len, 1, fp) != 1)) {
+		printf("%s: failed to read\n", path);
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	return buf;
+}
+
+static void showentry(const char *filename, int effects, int flags, unsigned int offset, int mtime, const char *from)
+{
+	const char *format;
+	unsigned int nmipmaps, data, length, bytes = 0, i;
+	const unsigned char *desc;
+
+	printf("%s (effects %d, flags %d, %s): ", filename, effects, flags, from);
+
+	if (offset >= (unsigned int)storagelen || storagelen - offset < 20) {
+		printf("entry at %u is past the end of the storage\n", offset);
+		problems++;
+		return;
+	}
+	desc = storage + offset;
+	nmipmaps = get32(desc + 16);
+	if (nmipmaps < 1 || nmipmaps > MAXMIPS || storagelen - offset < 20 + nmipmaps * 16) {
+		printf("entry at %u has a bad mipmap count %u\n", offset, nmipmaps);
+		problems++;
+		return;
+	}
+	for (i = 0; i < nmipmaps; i++) {
+		length = get32(desc + 20 + i * 16 + 8);
+		data = get32(desc + 20 + i * 16 + 12);
+		if (data > offset || length > offset - data) {
+			printf("mipmap %u of the entry at %u lies outside the storage\n", i, offset);
+			problems++;
+			return;
 		}
-		head.xdim = B_LITTLE32(head.xdim);
-		head.ydim = B_LITTLE32(head.ydim);
-		head.flags = B_LITTLE32(head.flags);
-		if (fread(&mip, sizeof(mip), 1, fp) != 1) {
-			fclose(fp);
-			printf("%s: failed to read mipmap header\n", dirent->d_name);
-			continue;
+		if (data % (length >= 4096 ? 4096 : 16)) {
+			printf("mipmap %u of the entry at %u is misaligned\n", i, offset);
+			problems++;
+			return;
 		}
-		mip.format = B_LITTLE32(mip.format);
-		fclose(fp);
-		if (memcmp(head.magic, "Polymost", 8)) {
-			printf("%s: bad signature\n", dirent->d_name);
+		bytes += length;
+	}
+	mipbytes += bytes;
+
+	switch (get32(desc + 12)) {
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: format = "RGB DXT1"; break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: format = "RGBA DXT1"; break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: format = "RGBA DXT3"; break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: format = "RGBA DXT5"; break;
+		case GL_ETC1_RGB8_OES: format = "ETC1"; break;
+		default: format = "Unknown"; break;
+	}
+	printf("%dx%d%s %s, %u mipmaps, %u bytes, mtime %d\n", (int)get32(desc), (int)get32(desc + 4),
+		(get32(desc + 8) & 8) ? " alpha" : "", format, nmipmaps, bytes, mtime);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = ".";
+	unsigned char *index;
+	const unsigned char *slot, *p;
+	char filename[BMAX_PATH];
+	unsigned int numslots, numentries, journal, pos, namelen, name, i;
+	int indexlen, used = 0, journalled = 0;
+
+	if (argc > 2) {
+		puts("cacheinfo [directory]");
+		return 1;
+	}
+	if (argc == 2) dir = argv[1];
+
+	index = readfile(dir, "texture.cacheindex", &indexlen);
+	storage = readfile(dir, "texture.cache", &storagelen);
+	if (!index || !storage) return 1;
+
+	if (indexlen < HEADERSIZE || memcmp(index, "PolymostTexIndx", 15)) {
+		printf("texture.cacheindex: bad signature\n");
+		return 1;
+	}
+	if (storagelen < 16 || memcmp(storage, "PolymostTexStor", 15)) {
+		printf("texture.cache: bad signature\n");
+		return 1;
+	}
+	if (index[15] != CACHEVER || storage[15] != CACHEVER) {
+		printf("version %d index and version %d storage, where %d is understood\n", index[15], storage[15], CACHEVER);
+		return 1;
+	}
+
+	numslots = get32(index + 16);
+	numentries = get32(index + 20);
+	journal = get32(index + 24);
+	if ((numslots & (numslots - 1)) || numslots > (unsigned int)(indexlen - HEADERSIZE) / SLOTSIZE ||
+			journal < HEADERSIZE + numslots * SLOTSIZE || journal > (unsigned int)indexlen) {
+		printf("texture.cacheindex: bad header\n");
+		return 1;
+	}
+	index[indexlen] = 0;	// readfile() left room, so no filename runs off the end
+
+	for (i = 0; i < numslots; i++) {
+		slot = index + HEADERSIZE + i * SLOTSIZE;
+		name = get32(slot + 4);
+		if (!name) continue;
+		used++;
+		if (name < HEADERSIZE + numslots * SLOTSIZE || name >= journal) {
+			printf("slot %u: bad filename offset %u\n", i, name);
+			problems++;
 			continue;
 		}
-		else {
-			char *format;
-			char flags[4] = "", flagsc = 0;
-			switch (mip.format) {
-				case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: format = "RGB DXT1"; break;
-				case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: format = "RGBA DXT1"; break;
-				case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: format = "RGBA DXT3"; break;
-				case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: format = "RGBA DXT5"; break;
-				default: format = "Unknown"; break;
-			}
-			if (head.flags&1) flags[flagsc++] = '2';
-			if (head.flags&2) flags[flagsc++] = 'A';
-			if (head.flags&4) flags[flagsc++] = 'L';
-			flags[flagsc++] = 0;
-			
-			printf("%s: flags=%s format=%s\n", dirent->d_name, flags, format);
+		showentry((const char *)index + name, (int)get32(slot + 8), (int)get32(slot + 12),
+			get32(slot + 16), (int)get32(slot + 20), "table");
+	}
+	if ((unsigned int)used != numentries) {
+		printf("the table has %d slots in use but claims %u\n", used, numentries);
+		problems++;
+	}
+
+	for (pos = journal; pos < (unsigned int)indexlen; pos += 4 + namelen + 16) {
+		p = index + pos;
+		namelen = (indexlen - pos >= 4) ? get32(p) : 0;
+		if (namelen < 1 || namelen >= BMAX_PATH || indexlen - pos - 4 < namelen + 16) {
+			printf("journal entry at %u is truncated\n", pos);
+			problems++;
+			break;
 		}
+		memcpy(filename, p + 4, namelen);
+		filename[namelen] = 0;
+		p += 4 + namelen;
+		showentry(filename, (int)get32(p), (int)get32(p + 4), get32(p + 8), (int)get32(p + 12), "journal");
+		journalled++;
 	}
-	closedir(dir);
-	
-	return 0;
-}
\ No newline at end of file
+
+	printf("%u slots, %d in use, %d journal entries; %d bytes of storage, %d of them mipmaps; %d problems\n",
+		numslots, used, journalled, storagelen, mipbytes, problems);
+
+	free(storage);
+	free(index);
+
+	return problems != 0;
+}
@@ -0,0 +1,208 @@
+// Collision query benchmark
+// Fills each map given with actors and walks them about for a number of
+// ticks with clipmove(), getzrange() and pushmove() as a game would,
+// reporting how long the queries took and a CRC of every result. Saved
+// CRCs can be checked on later runs, so a change to the collision code
+// can be shown to give exactly the answers it gave before.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "cache1d.h"
+#include "crc32.h"
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+static const char *artname = "tiles000.art", *savename = NULL, *checkname = NULL;
+static int numactors = 500, numticks = 100, passes = 3;
+
+static unsigned int seed;
+static int rnd(int n)
+{
+	seed = seed * 1103515245u + 12345u;
+	return (int)((seed >> 8) % (unsigned)n);
+}
+
+static void usage(void)
+{
+	puts("clipbench [options] mapfile...\n"
+		"  -n actors    actors to add to each map (default 500)\n"
+		"  -t ticks     ticks to move them for (default 100)\n"
+		"  -p passes    times to run each map, keeping the best (default 3)\n"
+		"  -a artfile   first ART file of the tile set (default tiles000.art)\n"
+		"  -u 0|1       have the engine cache which sprites and walls each query can reach (default 0)\n"
+		"  -s crcfile   save the CRC of each map's results\n"
+		"  -c crcfile   compare the CRCs with a saved set, failing on any difference"
+	);
+}
+
+	// Drops actors at random spots inside random sectors, some of them
+	// wall or floor aligned, and all of them blocking
+static void addactors(void)
+{
+	int i, j, s, x, y, tries;
+	spritetype *spr;
+
+	for (i=0;i<numactors && numsectors>0;i++) {
+		for (tries=0;tries<64;tries++) {
+			s = rnd(numsectors);
+			j = sector[s].wallptr + rnd(max(1, (int)sector[s].wallnum));
+			x = wall[j].x + rnd(1025) - 512;
+			y = wall[j].y + rnd(1025) - 512;
+			if (inside(x, y, (short)s) == 1) break;
+		}
+		if (tries == 64) continue;
+
+		j = insertsprite((short)s, 0);
+		if (j < 0) break;
+		spr = &sprite[j];
+		spr->x = x; spr->y = y;
+		spr->z = getflorzofslope((short)s, x, y);
+		spr->cstat = 1|256;
+		if (rnd(8) == 0) spr->cstat |= 16;
+		else if (rnd(8) == 0) spr->cstat |= 32;
+		spr->picnum = rnd(MAXTILES);
+		spr->xrepeat = spr->yrepeat = 32 + rnd(33);
+		spr->xoffset = spr->yoffset = 0;
+		spr->clipdist = 32;
+		spr->ang = rnd(2048);
+	}
+}
+
+	// Moves every actor once, as the game's movesprite() does, and folds
+	// everything the queries returned into the CRC
+static void moveactors(unsigned int *crc)
+{
+	int i, r[8], ceilz, ceilhit, florz, florhit;
+	short cstat, sect;
+	spritetype *spr;
+
+	updateclipcache(-1);
+	for (i=0;i<MAXSPRITES;i++) {
+		spr = &sprite[i];
+		if (spr->statnum != 0 || spr->sectnum < 0) continue;
+
+		sect = spr->sectnum;
+		cstat = spr->cstat; spr->cstat &= ~1;
+		getzrange(spr->x, spr->y, spr->z-1, sect, &ceilz, &ceilhit, &florz, &florhit, 128, CLIPMASK0);
+		r[0] = clipmove(&spr->x, &spr->y, &spr->z, &sect,
+			(sintable[(spr->ang+512)&2047]>>2) << 11, (sintable[spr->ang]>>2) << 11,
+			128, 4<<8, 4<<8, CLIPMASK0);
+		r[1] = pushmove(&spr->x, &spr->y, &spr->z, &sect, 128, 4<<8, 4<<8, CLIPMASK0);
+		spr->cstat = cstat;
+
+		if (sect < 0) {
+			deletesprite((short)i);
+		} else {
+			if (r[0]) spr->ang = (spr->ang + 256 + rnd(1024)) & 2047;
+			spr->z = florz;
+			changespritesect((short)i, sect);
+			updateclipcache((short)i);
+		}
+		r[2] = sect;
+		r[3] = spr->x; r[4] = spr->y;
+		r[5] = ceilz; r[6] = florz;
+		r[7] = (ceilhit << 16) ^ florhit;
+		crc32block(crc, (unsigned char *)r, sizeof(r));
+	}
+}
+
+static int benchmap(const char *mapname, FILE *savefp, FILE *checkfp)
+{
+	int i, j, x, y, z, numsprites = 0;
+	short ang, cursect;
+	unsigned int t, best = ~0u, crc = 0, lastcrc = 0, savedcrc;
+
+	for (j=0;j<passes;j++) {
+		if (loadboard((char *)mapname, 0, &x, &y, &z, &ang, &cursect) < 0) {
+			buildprintf("Could not load map %s\n", mapname);
+			return 1;
+		}
+		seed = 1;
+		addactors();
+		for (i=0,numsprites=0;i<MAXSPRITES;i++) numsprites += (sprite[i].statnum < MAXSTATUS);
+
+		crc32init(&crc);
+		t = getusecticks();
+		for (i=0;i<numticks;i++) moveactors(&crc);
+		t = getusecticks() - t;
+		crc32finish(&crc);
+		if (t < best) best = t;
+
+		if (j > 0 && crc != lastcrc) {
+			buildprintf("%s: results differ between passes\n", mapname);
+			return 1;
+		}
+		lastcrc = crc;
+	}
+
+	buildprintf("%s: %d sectors, %d sprites, %d ticks in %.2f ms, %.2f ms per tick, crc %08x\n",
+		mapname, numsectors, numsprites, numticks, best / 1000.0, best / 1000.0 / numticks, crc);
+
+	if (savefp) fprintf(savefp, "%08x %s\n", crc, mapname);
+	if (checkfp) {
+		if (fscanf(checkfp, "%x %*s", &savedcrc) != 1) {
+			buildprintf("%s: no saved CRC\n", mapname);
+			return 1;
+		}
+		if (savedcrc != crc) {
+			buildprintf("%s: results differ, expected %08x\n", mapname, savedcrc);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	FILE *savefp = NULL, *checkfp = NULL;
+	int i, fails = 0, nummaps = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') { nummaps++; continue; }
+		if (!argv[i][1] || argv[i][2] || i+1 >= argc) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 'n': numactors = atoi(argv[++i]); break;
+			case 't': numticks = atoi(argv[++i]); break;
+			case 'p': passes = atoi(argv[++i]); break;
+			case 'a': artname = argv[++i]; break;
+			case 's': savename = argv[++i]; break;
+			case 'c': checkname = argv[++i]; break;
+			case 'u': useclipcache = atoi(argv[++i]); break;
+			default: usage(); return 1;
+		}
+	}
+	if (!nummaps || numactors < 0 || numticks < 1 || passes < 1) { usage(); return 1; }
+
+	initcrc32table();
+	if (initengine()) {
+		buildprintf("initengine() failed: %s\n", engineerrstr);
+		return 1;
+	}
+	if (loadpics((char *)artname, 8*1048576) < 0) {
+		buildprintf("Could not load tiles from %s\n", artname);
+		return 1;
+	}
+	if (savename && !(savefp = fopen(savename, "w"))) {
+		buildprintf("Could not create CRC file %s\n", savename);
+		return 1;
+	}
+	if (checkname && !(checkfp = fopen(checkname, "r"))) {
+		buildprintf("Could not open CRC file %s\n", checkname);
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-') { i++; continue; }
+		fails |= benchmap(argv[i], savefp, checkfp);
+	}
+	if (checkfp && !fails) buildprintf("All results match %s\n", checkname);
+
+	if (savefp) fclose(savefp);
+	if (checkfp) fclose(checkfp);
+	uninitengine();
+
+	return fails;
+}
@@ -0,0 +1,100 @@
+// Group file lookup benchmark
+// Writes a group file with many small members, then times opening every
+// one of them by name through kopen4load() and checks each opened the
+// right member.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "cache1d.h"
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+static void membername(char *name, int i)
+{
+		// Mixed case and a few extensions so the names spread like real ones
+	static const char *exts[] = { "ART", "map", "Png", "VOC", "dat" };
+	Bsprintf(name, "%c%07d.%s", 'A' + i % 26, i, exts[i % 5]);
+}
+
+static int writegroup(const char *fn, int numfiles)
+{
+	FILE *fp;
+	char name[16], entry[16];
+	int i, len;
+
+	fp = fopen(fn, "wb");
+	if (!fp) return -1;
+
+	fwrite("KenSilverman", 12, 1, fp);
+	len = B_LITTLE32(numfiles);
+	fwrite(&len, 4, 1, fp);
+	for (i = 0; i < numfiles; i++) {
+		membername(name, i);
+		memset(entry, 0, sizeof(entry));
+		memcpy(entry, name, min(12, (int)strlen(name)));
+		len = B_LITTLE32(4);
+		memcpy(&entry[12], &len, 4);
+		fwrite(entry, 16, 1, fp);
+	}
+	for (i = 0; i < numfiles; i++) {
+		len = B_LITTLE32(i);
+		fwrite(&len, 4, 1, fp);
+	}
+	fclose(fp);
+	return 0;
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	const char *grpname = "grpbench.grp";
+	char name[16];
+	int numfiles = 20000, passes = 5, i, j, fil, val, fails = 0;
+	unsigned int t, best = ~0u;
+
+	if (argc > 1) numfiles = atoi(argv[1]);
+	if (argc > 2) passes = atoi(argv[2]);
+	if (numfiles < 1 || passes < 1) {
+		puts("grpbench [members [passes]]");
+		return 1;
+	}
+
+	if (writegroup(grpname, numfiles) || initgroupfile(grpname) < 0) {
+		buildprintf("Could not create %s\n", grpname);
+		return 1;
+	}
+
+	for (j = 0; j < passes; j++) {
+		t = getusecticks();
+		for (i = 0; i < numfiles; i++) {
+			membername(name, i);
+			if (i & 1) Bstrlwr(name);
+			fil = kopen4load(name, 2);
+			if (fil < 0) { fails++; continue; }
+			if (j == 0) {
+				val = -1;
+				kread(fil, &val, 4);
+				if (B_LITTLE32(val) != i) fails++;
+			}
+			kclose(fil);
+		}
+		t = getusecticks() - t;
+		if (t < best) best = t;
+	}
+
+	if (kopen4load("NOTTHERE.DAT", 2) >= 0) fails++;
+
+	buildprintf("%d members: best of %d passes opened them all in %.2f ms, %.2f us each\n",
+		numfiles, passes, best / 1000.0, (double)best / numfiles);
+
+	uninitgroupfile();
+	remove(grpname);
+
+	if (fails) {
+		buildprintf("%d members did not open correctly\n", fails);
+		return 1;
+	}
+	return 0;
+}
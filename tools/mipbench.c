@@ -0,0 +1,170 @@
+// Mipmap filtering benchmark
+// Times each kernel this processor supports building a texture's mipmaps
+// as polymost does for hightile textures missing from the texture cache,
+// fixing the transparent pixels of each level after halving the last, and
+// checks every level against the scalar kernels. The gamma-correct filter
+// is timed too, for comparison.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "texfilter.h"
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+static int passes = 5;
+
+static void usage(void)
+{
+	puts("mipbench [options]\n"
+		"  -r WxH      only this texture size (default 256x256 up to 2048x2048, and 1000x600)\n"
+		"  -n passes   times to build each set of mipmaps, keeping the best (default 5)"
+	);
+}
+
+	// Gradients and noise with cut-outs of every alpha, and past tsizx by
+	// tsizy the transparent black padding the texture loader leaves.
+static void makeimage(unsigned char *pic, int sizx, int sizy, int tsizx, int tsizy)
+{
+	int x, y;
+
+	srand(1);
+	for (y = 0; y < sizy; y++) {
+		for (x = 0; x < sizx; x++, pic += 4) {
+			if (x >= tsizx || y >= tsizy) {
+				pic[0] = pic[1] = pic[2] = pic[3] = 0;
+				continue;
+			}
+			pic[0] = (x * 255 / tsizx) & 255;
+			pic[1] = (((x >> 4) ^ (y >> 4)) & 1) ? 220 : 30;
+			pic[2] = (y * 255 / tsizy + (rand() & 31)) & 255;
+			switch (((x >> 3) + (y >> 3) * 3) % 7) {
+				case 0: case 1: pic[3] = 0; break;
+				case 2: pic[3] = rand() & 255; break;
+				default: pic[3] = 255; break;
+			}
+		}
+	}
+}
+
+	// Builds the mipmaps of src down to 1x1 in work as ptm_uploadtexture()
+	// does, copying each level to chain if given, which is only worth timing
+	// if not. Returns the time taken.
+static unsigned int buildmips(const texfilterkernel *k, int gamma, unsigned char *work, unsigned char *chain,
+	const unsigned char *src, int sizx, int sizy, int tsizx, int tsizy, int clamped)
+{
+	unsigned int t;
+
+	memcpy(work, src, sizx * sizy * 4);
+
+	t = getusecticks();
+	k->fixtransparency(work, sizx, sizy, tsizx, tsizy, clamped);
+	while (1) {
+		if (chain) {
+			memcpy(chain, work, sizx * sizy * 4);
+			chain += sizx * sizy * 4;
+		}
+		if (sizx == 1 && sizy == 1) break;
+
+		if (gamma) texfilter_mipscale(work, sizx, sizy, 1);
+		else k->mipscale(work, sizx, sizy);
+		sizx = max(1, sizx >> 1);
+		sizy = max(1, sizy >> 1);
+		k->fixtransparency(work, sizx, sizy, tsizx, tsizy, clamped);
+	}
+	return getusecticks() - t;
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	static const int defsizes[][2] = {
+		{ 256, 256 }, { 512, 512 }, { 1024, 1024 }, { 2048, 2048 }, { 1000, 600 },
+	};
+	const texfilterkernel * const *kernels;
+	const int (*sizes)[2] = defsizes;
+	int onlysize[1][2], numsizes = (int)(sizeof(defsizes)/sizeof(defsizes[0]));
+	unsigned char *src, *work, *ref, *chain;
+	unsigned int t, best, ref_us = 0;
+	int i, j, k, s, clamped, gamma, sizx, sizy, tsizx, tsizy, chainpixels, fails = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || i+1 >= argc) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 'r':
+				if (sscanf(argv[++i], "%dx%d", &onlysize[0][0], &onlysize[0][1]) != 2) { usage(); return 1; }
+				if (onlysize[0][0] < 1 || onlysize[0][1] < 1) { usage(); return 1; }
+				sizes = onlysize;
+				numsizes = 1;
+				break;
+			case 'n': passes = atoi(argv[++i]); break;
+			default: usage(); return 1;
+		}
+	}
+	if (passes < 1) { usage(); return 1; }
+
+	kernels = texfilter_getkernels();
+
+	for (s = 0; s < numsizes; s++) {
+		sizx = sizes[s][0];
+		sizy = sizes[s][1];
+
+		for (i = sizx, j = sizy, chainpixels = 0; ; i = max(1, i >> 1), j = max(1, j >> 1)) {
+			chainpixels += i * j;
+			if (i == 1 && j == 1) break;
+		}
+		src = (unsigned char *)Bmalloc(sizx * sizy * 4);
+		work = (unsigned char *)Bmalloc(sizx * sizy * 4);
+		ref = (unsigned char *)Bmalloc(chainpixels * 4);
+		chain = (unsigned char *)Bmalloc(chainpixels * 4);
+		if (!src || !work || !ref || !chain) {
+			buildprintf("Out of memory\n");
+			return 1;
+		}
+
+		for (clamped = 0; clamped < 2; clamped++) {
+			// A clamped texture is padded out from a smaller size.
+			tsizx = clamped ? max(1, sizx - sizx / 8) : sizx;
+			tsizy = clamped ? max(1, sizy - sizy / 8) : sizy;
+			makeimage(src, sizx, sizy, tsizx, tsizy);
+
+			buildprintf("%dx%d %s, %d pixels with their mipmaps\n", sizx, sizy,
+				clamped ? "clamped" : "repeating", chainpixels);
+
+			for (k = 0; kernels[k]; k++) ;
+			for (k--; k >= 0; k--) {	// the scalar kernels first, as the reference
+				for (gamma = 0; gamma < 2; gamma++) {
+					if (gamma && kernels[k+1]) continue;	// the gamma filter is scalar only
+
+					buildmips(kernels[k], gamma, work, chain, src, sizx, sizy, tsizx, tsizy, clamped);
+					if (!kernels[k+1] && !gamma) {
+						memcpy(ref, chain, chainpixels * 4);
+					} else if (!gamma && memcmp(ref, chain, chainpixels * 4)) {
+						buildprintf("  %-5s differs from the scalar kernels\n", kernels[k]->name);
+						fails++;
+						continue;
+					}
+
+					best = ~0u;
+					for (j = 0; j < passes; j++) {
+						t = buildmips(kernels[k], gamma, work, NULL, src, sizx, sizy, tsizx, tsizy, clamped);
+						if (t < best) best = t;
+					}
+					if (!kernels[k+1] && !gamma) ref_us = best;
+
+					buildprintf("  %-5s %s %8.3f ms, %7.2f Mpixels/s, %.2fx\n", kernels[k]->name,
+						gamma ? "gamma " : "linear", best / 1000.0, best ? (double)chainpixels / best : 0.0,
+						best ? (double)ref_us / best : 0.0);
+				}
+			}
+		}
+
+		Bfree(chain);
+		Bfree(ref);
+		Bfree(work);
+		Bfree(src);
+	}
+
+	return fails != 0;
+}
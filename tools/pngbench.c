@@ -0,0 +1,246 @@
+// PNG decoding benchmark
+// Decodes every PNG in a directory with kplib, first one at a time with the
+// scalar decoder and then spread across a thread pool with the fast one,
+// checking the two agree to the byte and reporting how long each took.
+// CRCs of the images can be saved and checked on later runs, so a change to
+// the decoder can be compared with the one before it.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "cache1d.h"
+#include "crc32.h"
+#include "kplib.h"
+#include "workpool.h"
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+typedef struct {
+	char *name;
+	char *buf;
+	int leng, xsiz, ysiz;
+	unsigned char *pic, *refpic;
+	int result, refresult;
+	unsigned int crc;
+} pngtype;
+
+static pngtype *pngs = NULL;
+static int numpngs = 0;
+
+static void usage(void)
+{
+	puts("pngbench [options] directory\n"
+		"  -t threads  decoding threads for the fast decoder, 0 for one per processor (default 0)\n"
+		"  -n passes   times to decode everything, keeping the best (default 3)\n"
+		"  -s crcfile  save the CRC of every image\n"
+		"  -c crcfile  compare the image CRCs with a saved set, failing on any difference"
+	);
+}
+
+static int loadpngs(const char *dir)
+{
+	BDIR *d;
+	struct Bdirent *de;
+	char path[BMAX_PATH];
+	FILE *fp;
+	pngtype *p;
+	int alloced = 0;
+
+	d = Bopendir(dir);
+	if (!d) return -1;
+
+	while ((de = Breaddir(d))) {
+		if ((de->mode & BS_IFDIR) || !Bwildmatch(de->name, "*.png")) continue;
+
+		if (numpngs == alloced) {
+			alloced = alloced ? alloced * 2 : 256;
+			pngs = (pngtype *)Brealloc(pngs, alloced * sizeof(pngtype));
+			if (!pngs) { Bclosedir(d); return -1; }
+		}
+		p = &pngs[numpngs];
+		memset(p, 0, sizeof(pngtype));
+
+		Bsnprintf(path, sizeof(path), "%s/%s", dir, de->name);
+		fp = fopen(path, "rb");
+		if (!fp) continue;
+		fseek(fp, 0, SEEK_END);
+		p->leng = (int)ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		p->buf = (char *)Bmalloc(max(p->leng, 1));
+		if (p->leng < 16 || !p->buf || fread(p->buf, p->leng, 1, fp) != 1) {
+			fclose(fp);
+			Bfree(p->buf);
+			continue;
+		}
+		fclose(fp);
+
+		kpgetdim(p->buf, p->leng, &p->xsiz, &p->ysiz);
+		if (p->xsiz <= 0 || p->ysiz <= 0) {
+			Bfree(p->buf);
+			continue;
+		}
+		p->pic = (unsigned char *)Bmalloc(p->xsiz * p->ysiz * 4);
+		p->refpic = (unsigned char *)Bmalloc(p->xsiz * p->ysiz * 4);
+		p->name = Bstrdup(de->name);
+		if (!p->pic || !p->refpic || !p->name) { Bclosedir(d); return -1; }
+		numpngs++;
+	}
+	Bclosedir(d);
+
+	return numpngs ? 0 : -1;
+}
+
+static void decodepng(void *ctx, int job)
+{
+	pngtype *p = &pngs[job];
+	unsigned char *pic = ctx ? p->refpic : p->pic;
+
+	memset(pic, 0, p->xsiz * p->ysiz * 4);
+	if (ctx) p->refresult = kprender(p->buf, p->leng, pic, p->xsiz * 4, p->xsiz, p->ysiz, 0, 0);
+	else p->result = kprender(p->buf, p->leng, pic, p->xsiz * 4, p->xsiz, p->ysiz, 0, 0);
+}
+
+static int comparecrcs(const char *fn)
+{
+	FILE *fp;
+	char name[BMAX_PATH];
+	unsigned int crc;
+	int i, fails = 0;
+
+	fp = fopen(fn, "r");
+	if (!fp) {
+		buildprintf("Could not open CRC file %s\n", fn);
+		return -1;
+	}
+	for (i = 0; i < numpngs; i++) {
+		if (fscanf(fp, "%x %259s", &crc, name) != 2) {
+			buildprintf("CRC file %s ends at %s\n", fn, pngs[i].name);
+			fails++;
+			break;
+		}
+		if (Bstrcasecmp(name, pngs[i].name)) {
+			buildprintf("CRC file %s has %s where %s was expected\n", fn, name, pngs[i].name);
+			fails++;
+			break;
+		}
+		if (crc != pngs[i].crc) {
+			if (fails < 10) buildprintf("%s differs: %08x, expected %08x\n", pngs[i].name, pngs[i].crc, crc);
+			fails++;
+		}
+	}
+	fclose(fp);
+	return fails;
+}
+
+static int savecrcs(const char *fn)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(fn, "w");
+	if (!fp) {
+		buildprintf("Could not create CRC file %s\n", fn);
+		return -1;
+	}
+	for (i = 0; i < numpngs; i++) fprintf(fp, "%08x %s\n", pngs[i].crc, pngs[i].name);
+	fclose(fp);
+	return 0;
+}
+
+static int cmpname(const void *a, const void *b)
+{
+	return Bstrcasecmp(((const pngtype *)a)->name, ((const pngtype *)b)->name);
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	const char *dir = NULL, *savename = NULL, *checkname = NULL;
+	int i, j, threads = 0, passes = 3, fails = 0, diffs = 0;
+	unsigned int t, best, refbest, pixels = 0;
+	workpool *pool;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') { dir = argv[i]; continue; }
+		if (!argv[i][1] || argv[i][2] || i+1 >= argc) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 't': threads = atoi(argv[++i]); break;
+			case 'n': passes = atoi(argv[++i]); break;
+			case 's': savename = argv[++i]; break;
+			case 'c': checkname = argv[++i]; break;
+			default: usage(); return 1;
+		}
+	}
+	if (!dir || threads < 0 || passes < 1) { usage(); return 1; }
+
+	initcrc32table();
+
+	if (loadpngs(dir)) {
+		buildprintf("No PNGs could be read from %s\n", dir);
+		return 1;
+	}
+	qsort(pngs, numpngs, sizeof(pngtype), cmpname);
+	for (i = 0; i < numpngs; i++) pixels += pngs[i].xsiz * pngs[i].ysiz;
+
+		// Builds whose decoders share state can only use one thread
+	pool = workpool_create(kpthreadsafe() ? threads : 1);
+
+	for (j = 0, refbest = ~0u; j < passes; j++) {
+		kpngsetfast(0);
+		t = getusecticks();
+		for (i = 0; i < numpngs; i++) decodepng(pngs, i);
+		t = getusecticks() - t;
+		if (t < refbest) refbest = t;
+	}
+	for (j = 0, best = ~0u; j < passes; j++) {
+		kpngsetfast(1);
+		t = getusecticks();
+		workpool_run(pool, decodepng, NULL, numpngs);
+		t = getusecticks() - t;
+		if (t < best) best = t;
+	}
+
+	for (i = 0; i < numpngs; i++) {
+		pngtype *p = &pngs[i];
+
+		if (p->result != p->refresult || memcmp(p->pic, p->refpic, p->xsiz * p->ysiz * 4)) {
+			if (diffs < 10) buildprintf("%s decodes differently\n", p->name);
+			diffs++;
+		}
+		p->crc = p->refresult < 0 ? 0 : crc32once(p->refpic, p->xsiz * p->ysiz * 4);
+		if (p->refresult < 0) buildprintf("%s could not be decoded\n", p->name);
+	}
+
+	buildprintf("%d PNGs, %.1f megapixels\n", numpngs, pixels / 1000000.0);
+	buildprintf("scalar, 1 thread: %.2f ms, %.1f Mpixels/s\n", refbest / 1000.0,
+		refbest ? pixels / (double)refbest : 0.0);
+	buildprintf("fast, %d threads: %.2f ms, %.1f Mpixels/s\n", workpool_numthreads(pool), best / 1000.0,
+		best ? pixels / (double)best : 0.0);
+	if (diffs) {
+		buildprintf("%d PNGs decode differently with the fast decoder\n", diffs);
+		fails = 1;
+	}
+
+	if (savename && savecrcs(savename)) fails = 1;
+	if (checkname) {
+		i = comparecrcs(checkname);
+		if (i) {
+			if (i > 0) buildprintf("%d PNGs differ from %s\n", i, checkname);
+			fails = 1;
+		} else {
+			buildprintf("All PNGs match %s\n", checkname);
+		}
+	}
+
+	workpool_destroy(pool);
+	for (i = 0; i < numpngs; i++) {
+		Bfree(pngs[i].name);
+		Bfree(pngs[i].buf);
+		Bfree(pngs[i].pic);
+		Bfree(pngs[i].refpic);
+	}
+	Bfree(pngs);
+
+	return fails;
+}
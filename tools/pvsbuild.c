@@ -0,0 +1,416 @@
+// Potentially visible set builder
+// Works out for every sector of each map given which sectors could possibly
+// be seen from somewhere inside it, by following chains of portals for as
+// long as some straight line still passes through every portal of the
+// chain, and writes the sets to a .pvs file beside the map for the engine
+// to load with it. With -v it then draws views from random spots in the
+// map, checking every sector the renderer scans is in the camera sector's
+// set and the frames come out the same with the sets as without, and times
+// both.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "cache1d.h"
+#include "crc32.h"
+
+#include <math.h>
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+#ifndef PI
+#define PI 3.14159265358979323846
+#endif
+#define TWOPI (2.0*PI)
+#define MAXGROWTHS 16
+
+typedef struct {
+	double ax, ay, bx, by;	// the portal's ends, widened by the margin
+} portaltype;
+
+static const char *artname = "tiles000.art";
+static int numviews = 0, maxnodes = 250000, xdim_ = 640, ydim_ = 480;
+static double margin = 16.0, slack = 0.01, nearby = 20.0;
+
+static unsigned char *rows = NULL;
+static portaltype portals[MAXWALLS];
+static unsigned char restarted[(MAXSECTORS+7)>>3];
+static short restartqueue[MAXSECTORS];
+static int numrestarts, nodes, giveup, source;
+
+	// The directions lines leaving through each wall may take, as far as
+	// the chain being followed has narrowed them
+static double dirlo[MAXWALLS], dirhi[MAXWALLS];
+static int dirstamp[MAXWALLS], curstamp = 0;
+static unsigned char dirgrowths[MAXWALLS], dirqueued[MAXWALLS];
+static short dirstack[MAXWALLS];
+static int dirstackcnt;
+
+static unsigned int seed;
+static int rnd(int n)
+{
+	seed = seed * 1103515245u + 12345u;
+	return (int)((seed >> 8) % (unsigned)n);
+}
+
+static void usage(void)
+{
+	puts("pvsbuild [options] mapfile...\n"
+		"  -m units     distance to widen each portal by at both ends (default 16)\n"
+		"  -e radians   angle to widen each line's range of directions by (default 0.01)\n"
+		"  -n walls     portals to pass through from a sector before giving up and\n"
+		"               letting it see everything (default 250000)\n"
+		"  -v views     afterwards draw this many views from random spots, checking\n"
+		"               the sets hold and timing the renderer with and without them\n"
+		"  -r WxH       resolution of those views (default 640x480)\n"
+		"  -a artfile   first ART file of the tile set (default tiles000.art)"
+	);
+}
+
+	// Narrows the range of directions [lo,hi] a line's normal may take so
+	// that the normal also points within a right angle of (dx,dy), returning
+	// 0 if no direction is left. Ranges of two pieces are left as they were,
+	// which only ever errs towards seeing more.
+static int narrow(double *lo, double *hi, double dx, double dy)
+{
+	double phi, blo, bhi;
+	int p1, p2;
+
+	if (dx == 0.0 && dy == 0.0) return 1;
+	phi = atan2(dy, dx);
+	blo = phi - PI/2 - slack;
+	bhi = phi + PI/2 + slack;
+	if (*hi - *lo >= TWOPI) { *lo = blo; *hi = bhi; return 1; }
+
+	while (blo < *lo) { blo += TWOPI; bhi += TWOPI; }
+	while (blo >= *lo + TWOPI) { blo -= TWOPI; bhi -= TWOPI; }
+	p1 = (blo <= *hi);
+	p2 = (bhi - TWOPI >= *lo);
+	if (p1 && p2) return 1;
+	if (p1) { *lo = blo; *hi = min(bhi, *hi); return 1; }
+	if (p2) { *hi = min(bhi - TWOPI, *hi); return 1; }
+	return 0;
+}
+
+	// Widens [lo,hi] to the smallest range also taking in [blo,bhi],
+	// returning 1 if it grew
+static int widen(double *lo, double *hi, double blo, double bhi)
+{
+	if (*hi - *lo >= TWOPI) return 0;
+	if (bhi - blo >= TWOPI) { *lo = 0.0; *hi = TWOPI; return 1; }
+
+	while (blo < *lo) { blo += TWOPI; bhi += TWOPI; }
+	while (blo >= *lo + TWOPI) { blo -= TWOPI; bhi -= TWOPI; }
+	if (bhi <= *hi) return 0;
+	if (bhi - TWOPI >= *hi) { *lo = blo; *hi = bhi; return 1; }
+	if (blo <= *hi || bhi - *lo <= *hi - (blo - TWOPI)) *hi = bhi;
+	else *lo = blo - TWOPI;
+	if (*hi - *lo >= TWOPI) { *lo = 0.0; *hi = TWOPI; }
+	return 1;
+}
+
+	// Whether the wall's line passes near the source sector, close enough
+	// that the renderers' scan of the sectors beside the camera could take
+	// it whatever lies between
+static int nearsource(int w)
+{
+	const portaltype *p = &portals[w];
+	double nx, ny, len, d, dmin = 1e30, dmax = -1e30;
+	int i;
+
+	nx = p->ay - p->by; ny = p->bx - p->ax;
+	len = sqrt(nx*nx + ny*ny);
+	if (len == 0.0) return 1;
+	nx /= len; ny /= len;
+
+	for (i = sector[source].wallptr; i < sector[source].wallptr + sector[source].wallnum; i++) {
+		d = nx*(wall[i].x-p->ax) + ny*(wall[i].y-p->ay);
+		dmin = min(dmin, d);
+		dmax = max(dmax, d);
+	}
+	return (dmin <= nearby && dmax >= -nearby);
+}
+
+static void makeportals(void)
+{
+	double dx, dy, len;
+	portaltype *p;
+	int w;
+
+	for (w = 0; w < numwalls; w++) {
+		p = &portals[w];
+		p->ax = wall[w].x; p->ay = wall[w].y;
+		p->bx = wall[wall[w].point2].x; p->by = wall[wall[w].point2].y;
+		dx = p->bx - p->ax; dy = p->by - p->ay;
+		len = sqrt(dx*dx + dy*dy);
+		if (len > 0.0) { dx *= margin/len; dy *= margin/len; }
+		p->ax -= dx; p->ay -= dy;
+		p->bx += dx; p->by += dy;
+	}
+}
+
+static void restart(int sect)
+{
+	if (restarted[sect>>3] & (1<<(sect&7))) return;
+	restarted[sect>>3] |= (1<<(sect&7));
+	restartqueue[numrestarts++] = (short)sect;
+}
+
+	// Takes in more directions for lines leaving through wall w, queueing
+	// it to be followed again if that let any new ones through
+static void adddirs(int w, double lo, double hi)
+{
+	if (dirstamp[w] != curstamp) {
+		dirstamp[w] = curstamp;
+		dirlo[w] = lo; dirhi[w] = hi;
+		dirgrowths[w] = 0;
+	} else {
+		if (!widen(&dirlo[w], &dirhi[w], lo, hi)) return;
+		if (++dirgrowths[w] > MAXGROWTHS) { dirlo[w] = 0.0; dirhi[w] = TWOPI; }
+	}
+	if (!dirqueued[w]) {
+		dirqueued[w] = 1;
+		dirstack[dirstackcnt++] = (short)w;
+	}
+}
+
+	// Marks every sector a line leaving the first sector through wall first
+	// could reach. Each wall passed through keeps the range of directions
+	// such lines can have, narrowed by that wall, the one before it and the
+	// first, so following a wall again is only needed when its range grows.
+	// A wall whose line runs past the source sector instead starts again
+	// from the sector beyond with nothing narrowed.
+static void follow(unsigned char *row, int first)
+{
+	const portaltype *p1 = &portals[first], *q, *r;
+	double lo, hi;
+	int w, endw, sect, next;
+
+	curstamp++;
+	dirstackcnt = 0;
+	lo = 0.0; hi = TWOPI;
+	narrow(&lo, &hi, p1->bx - p1->ax, p1->by - p1->ay);
+	adddirs(first, lo, hi);
+
+	while (dirstackcnt > 0 && !giveup) {
+		w = dirstack[--dirstackcnt];
+		dirqueued[w] = 0;
+		sect = wall[w].nextsector;
+		row[sect>>3] |= (1<<(sect&7));
+		if (++nodes > maxnodes) { giveup = 1; break; }
+
+		q = &portals[w];
+		endw = sector[sect].wallptr + sector[sect].wallnum;
+		for (next = sector[sect].wallptr; next < endw; next++) {
+			if (wall[next].nextsector < 0 || next == wall[w].nextwall) continue;
+			if (restarted[wall[next].nextsector>>3] & (1<<(wall[next].nextsector&7))) continue;
+			if (nearsource(next)) { restart(wall[next].nextsector); continue; }
+
+			r = &portals[next];
+			lo = dirlo[w]; hi = dirhi[w];
+			if (!narrow(&lo, &hi, r->bx - r->ax, r->by - r->ay)) continue;
+			if (!narrow(&lo, &hi, r->bx - q->ax, r->by - q->ay)) continue;
+			if (!narrow(&lo, &hi, q->bx - r->ax, q->by - r->ay)) continue;
+			if (w != first) {
+				if (!narrow(&lo, &hi, r->bx - p1->ax, r->by - p1->ay)) continue;
+				if (!narrow(&lo, &hi, p1->bx - r->ax, p1->by - r->ay)) continue;
+			}
+			adddirs(next, lo, hi);
+		}
+	}
+	while (dirstackcnt > 0) dirqueued[dirstack[--dirstackcnt]] = 0;
+}
+
+static void buildrow(int s, unsigned char *row, int rowbytes)
+{
+	int w, i, sect;
+
+	memset(row, 0, rowbytes);
+	memset(restarted, 0, (numsectors+7)>>3);
+	numrestarts = nodes = giveup = 0;
+	source = s;
+
+	restart(s);
+	for (i = 0; i < numrestarts && !giveup; i++) {
+		sect = restartqueue[i];
+		row[sect>>3] |= (1<<(sect&7));
+		for (w = sector[sect].wallptr; w < sector[sect].wallptr + sector[sect].wallnum && !giveup; w++) {
+			if (wall[w].nextsector < 0) continue;
+			if (restarted[wall[w].nextsector>>3] & (1<<(wall[w].nextsector&7))) continue;
+			if (sect != s && nearsource(w)) { restart(wall[w].nextsector); continue; }
+			follow(row, w);
+		}
+	}
+
+	if (giveup) {
+		memset(row, 0, rowbytes);
+		for (i = 0; i < numsectors; i++) row[i>>3] |= (1<<(i&7));
+	}
+}
+
+	// A random spot inside a random sector, between its floor and ceiling
+static int randompoint(int *x, int *y, int *z, short *sectnum)
+{
+	int s, w, tries, cz, fz;
+
+	for (tries=0;tries<64;tries++) {
+		s = rnd(numsectors);
+		w = sector[s].wallptr + rnd(max(1, (int)sector[s].wallnum));
+		*x = wall[w].x + rnd(1025) - 512;
+		*y = wall[w].y + rnd(1025) - 512;
+		if (inside(*x, *y, (short)s) != 1) continue;
+		getzsofslope((short)s, *x, *y, &cz, &fz);
+		if (fz - cz < 2) continue;
+		*z = cz + 1 + rnd(fz - cz - 1);
+		*sectnum = (short)s;
+		return 0;
+	}
+	return -1;
+}
+
+	// Draws views from random spots with and without the sets, returning
+	// the number of sectors scanned that were missing from a set plus the
+	// number of frames that differed
+static int checkviews(int rowbytes)
+{
+	int i, j, x, y, z, horiz, missing = 0, diffs = 0, scanned = 0;
+	short ang, sectnum;
+	unsigned int t, crc, offtime = 0, ontime = 0;
+	const unsigned char *row;
+
+		// Load every tile first, so no view is timed reading them
+	for (i = 0; i < MAXTILES; i++) loadtile((short)i);
+
+	seed = 1;
+	for (i = 0; i < numviews; i++) {
+		if (randompoint(&x, &y, &z, &sectnum)) continue;
+		ang = (short)rnd(2048);
+		horiz = rnd(201);
+		row = &rows[sectnum*rowbytes];
+
+		usepvs = 0;
+		clearview(0);
+		t = getusecticks();
+		drawrooms(x, y, z, ang, horiz, sectnum);
+		drawmasks();
+		offtime += getusecticks() - t;
+		crc = crc32once((unsigned char *)frameplace, bytesperline * ydim);
+		for (j = 0; j < numsectors; j++) {
+			if (!(gotsector[j>>3] & (1<<(j&7)))) continue;
+			scanned++;
+			if (row[j>>3] & (1<<(j&7))) continue;
+			if (missing < 10) buildprintf("  sector %d was scanned from %d (%d,%d) ang %d but is not in its set\n",
+				j, sectnum, x, y, ang);
+			missing++;
+		}
+
+		usepvs = 1;
+		clearview(0);
+		t = getusecticks();
+		drawrooms(x, y, z, ang, horiz, sectnum);
+		drawmasks();
+		ontime += getusecticks() - t;
+		if (crc != crc32once((unsigned char *)frameplace, bytesperline * ydim)) diffs++;
+	}
+
+	buildprintf("  %d views at %dx%d, %.1f sectors scanned per view\n", numviews, xdim, ydim,
+		numviews ? (double)scanned / numviews : 0.0);
+	buildprintf("  without sets %.3f ms per view, with sets %.3f ms\n",
+		offtime / 1000.0 / max(1, numviews), ontime / 1000.0 / max(1, numviews));
+	if (missing) buildprintf("  %d scanned sectors were missing from the sets\n", missing);
+	if (diffs) buildprintf("  %d views drew differently with the sets\n", diffs);
+	return missing + diffs;
+}
+
+static int buildmap(const char *mapname)
+{
+	int i, j, x, y, z, rowbytes, giveups = 0, fails = 0;
+	short ang, cursect;
+	unsigned int t;
+	double seen = 0.0;
+
+	if (loadboard((char *)mapname, 0, &x, &y, &z, &ang, &cursect) < 0) {
+		buildprintf("Could not load map %s\n", mapname);
+		return 1;
+	}
+	rowbytes = (numsectors+7)>>3;
+	rows = (unsigned char *)Bmalloc(max(1, numsectors*rowbytes));
+	if (!rows) return 1;
+	makeportals();
+
+	t = getusecticks();
+	for (i = 0; i < numsectors; i++) {
+		buildrow(i, &rows[i*rowbytes], rowbytes);
+		giveups += giveup;
+		for (j = 0; j < numsectors; j++) seen += ((rows[i*rowbytes+(j>>3)] & (1<<(j&7))) != 0);
+	}
+	t = getusecticks() - t;
+
+	buildprintf("%s: %d sectors in %.2f s, each seeing %.1f%% of the map on average",
+		mapname, numsectors, t / 1000000.0, numsectors ? 100.0 * seen / numsectors / numsectors : 0.0);
+	if (giveups) buildprintf(", %d seeing everything after too many chains", giveups);
+	buildprintf("\n");
+
+	if (savepvs(mapname, rows)) {
+		buildprintf("Could not write the sets for %s\n", mapname);
+		Bfree(rows); rows = NULL;
+		return 1;
+	}
+
+	if (numviews > 0) {
+			// Load it again so the engine picks the file up
+		loadboard((char *)mapname, 0, &x, &y, &z, &ang, &cursect);
+		fails = checkviews(rowbytes);
+	}
+	Bfree(rows); rows = NULL;
+	return fails != 0;
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	int i, fails = 0, nummaps = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') { nummaps++; continue; }
+		if (!argv[i][1] || argv[i][2] || i+1 >= argc) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 'm': margin = atof(argv[++i]); break;
+			case 'e': slack = atof(argv[++i]); break;
+			case 'n': maxnodes = atoi(argv[++i]); break;
+			case 'v': numviews = atoi(argv[++i]); break;
+			case 'r':
+				if (sscanf(argv[++i], "%dx%d", &xdim_, &ydim_) != 2) { usage(); return 1; }
+				break;
+			case 'a': artname = argv[++i]; break;
+			default: usage(); return 1;
+		}
+	}
+	if (!nummaps || margin < 0.0 || slack < 0.0 || maxnodes < 1 || numviews < 0) { usage(); return 1; }
+
+	initcrc32table();
+	if (initengine()) {
+		buildprintf("initengine() failed: %s\n", engineerrstr);
+		return 1;
+	}
+	if (numviews > 0) {
+		if (loadpics((char *)artname, 8*1048576) < 0) {
+			buildprintf("Could not load tiles from %s\n", artname);
+			return 1;
+		}
+		if (setgamemode(0, xdim_, ydim_, 8) < 0) {
+			buildprintf("Could not set a %dx%d video mode\n", xdim_, ydim_);
+			return 1;
+		}
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-') { i++; continue; }
+		fails |= buildmap(argv[i]);
+	}
+
+	uninitengine();
+
+	return fails;
+}
@@ -0,0 +1,182 @@
+// Ray query benchmark
+// Casts random rays through each map given, once a ray at a time with
+// hitscan() and cansee() and once as batches with hitscanbatch() and
+// canseebatch(), checking every answer agrees and reporting the time each
+// took.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "cache1d.h"
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+static const char *artname = "tiles000.art";
+static int numrays = 100000, passes = 3;
+
+static hitscanraytype *hits, *refhits;
+static canseeraytype *sees, *refsees;
+
+static unsigned int seed;
+static int rnd(int n)
+{
+	seed = seed * 1103515245u + 12345u;
+	return (int)((seed >> 8) % (unsigned)n);
+}
+
+static void usage(void)
+{
+	puts("raybench [options] mapfile...\n"
+		"  -n rays      rays to cast on each map (default 100000)\n"
+		"  -t threads   threads for the batches, 0 for one per processor (default 0)\n"
+		"  -p passes    times to cast them all, keeping the best (default 3)\n"
+		"  -a artfile   first ART file of the tile set (default tiles000.art)"
+	);
+}
+
+	// A random spot inside a random sector, between its floor and ceiling
+static int randompoint(int *x, int *y, int *z, short *sectnum)
+{
+	int s, w, tries, cz, fz;
+
+	for (tries=0;tries<64;tries++) {
+		s = rnd(numsectors);
+		w = sector[s].wallptr + rnd(max(1, (int)sector[s].wallnum));
+		*x = wall[w].x + rnd(1025) - 512;
+		*y = wall[w].y + rnd(1025) - 512;
+		if (inside(*x, *y, (short)s) != 1) continue;
+		getzsofslope((short)s, *x, *y, &cz, &fz);
+		if (fz - cz < 2) continue;
+		*z = cz + 1 + rnd(fz - cz - 1);
+		*sectnum = (short)s;
+		return 0;
+	}
+	return -1;
+}
+
+static void makerays(void)
+{
+	int i, ang;
+	hitscanraytype *h;
+	canseeraytype *c;
+
+	for (i=0;i<numrays;i++) {
+		h = &hits[i];
+		memset(h, 0, sizeof(hitscanraytype));
+		if (randompoint(&h->x, &h->y, &h->z, &h->sectnum)) h->sectnum = -1;
+		ang = rnd(2048);
+		h->vx = sintable[(ang+512)&2047];
+		h->vy = sintable[ang];
+		h->vz = (rnd(2001) - 1000) << 6;
+		h->cliptype = CLIPMASK1;
+
+		c = &sees[i];
+		memset(c, 0, sizeof(canseeraytype));
+		if (randompoint(&c->x1, &c->y1, &c->z1, &c->sect1)) c->sect1 = -1;
+		if (randompoint(&c->x2, &c->y2, &c->z2, &c->sect2)) c->sect2 = -1;
+	}
+	memcpy(refhits, hits, numrays * sizeof(hitscanraytype));
+	memcpy(refsees, sees, numrays * sizeof(canseeraytype));
+}
+
+static int benchmap(const char *mapname)
+{
+	int i, j, x, y, z, fails = 0;
+	short ang, cursect;
+	unsigned int t, hitbest = ~0u, hitbatchbest = ~0u, seebest = ~0u, seebatchbest = ~0u;
+	hitscanraytype *h;
+
+	if (loadboard((char *)mapname, 0, &x, &y, &z, &ang, &cursect) < 0) {
+		buildprintf("Could not load map %s\n", mapname);
+		return 1;
+	}
+	seed = 1;
+	makerays();
+
+	for (j=0;j<passes;j++) {
+		t = getusecticks();
+		for (i=0;i<numrays;i++) {
+			h = &refhits[i];
+			hitscan(h->x, h->y, h->z, h->sectnum, h->vx, h->vy, h->vz,
+				&h->hitsect, &h->hitwall, &h->hitsprite, &h->hitx, &h->hity, &h->hitz, h->cliptype);
+		}
+		t = getusecticks() - t; if (t < hitbest) hitbest = t;
+
+		t = getusecticks();
+		hitscanbatch(hits, numrays);
+		t = getusecticks() - t; if (t < hitbatchbest) hitbatchbest = t;
+
+		t = getusecticks();
+		for (i=0;i<numrays;i++)
+			refsees[i].result = cansee(refsees[i].x1, refsees[i].y1, refsees[i].z1, refsees[i].sect1,
+				refsees[i].x2, refsees[i].y2, refsees[i].z2, refsees[i].sect2);
+		t = getusecticks() - t; if (t < seebest) seebest = t;
+
+		t = getusecticks();
+		canseebatch(sees, numrays);
+		t = getusecticks() - t; if (t < seebatchbest) seebatchbest = t;
+	}
+
+	for (i=0;i<numrays;i++) {
+		if (memcmp(&hits[i], &refhits[i], sizeof(hitscanraytype))) fails++;
+		if (sees[i].result != refsees[i].result) fails++;
+	}
+
+	buildprintf("%s: %d sectors, %d rays\n", mapname, numsectors, numrays);
+	buildprintf("  hitscan: %.3f us per ray, batched %.3f us\n",
+		(double)hitbest / numrays, (double)hitbatchbest / numrays);
+	buildprintf("  cansee:  %.3f us per ray, batched %.3f us\n",
+		(double)seebest / numrays, (double)seebatchbest / numrays);
+	if (fails) buildprintf("  %d batched answers differ\n", fails);
+
+	return fails != 0;
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	int i, fails = 0, nummaps = 0;
+
+	renderthreads = 0;
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') { nummaps++; continue; }
+		if (!argv[i][1] || argv[i][2] || i+1 >= argc) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 'n': numrays = atoi(argv[++i]); break;
+			case 't': renderthreads = atoi(argv[++i]); break;
+			case 'p': passes = atoi(argv[++i]); break;
+			case 'a': artname = argv[++i]; break;
+			default: usage(); return 1;
+		}
+	}
+	if (!nummaps || numrays < 1 || renderthreads < 0 || passes < 1) { usage(); return 1; }
+
+	hits = (hitscanraytype *)Bmalloc(numrays * sizeof(hitscanraytype));
+	refhits = (hitscanraytype *)Bmalloc(numrays * sizeof(hitscanraytype));
+	sees = (canseeraytype *)Bmalloc(numrays * sizeof(canseeraytype));
+	refsees = (canseeraytype *)Bmalloc(numrays * sizeof(canseeraytype));
+	if (!hits || !refhits || !sees || !refsees) return 1;
+
+	if (initengine()) {
+		buildprintf("initengine() failed: %s\n", engineerrstr);
+		return 1;
+	}
+	if (loadpics((char *)artname, 8*1048576) < 0) {
+		buildprintf("Could not load tiles from %s\n", artname);
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-') { i++; continue; }
+		fails |= benchmap(argv[i]);
+	}
+
+	uninitengine();
+	Bfree(refsees);
+	Bfree(sees);
+	Bfree(refhits);
+	Bfree(hits);
+
+	return fails;
+}
@@ -0,0 +1,184 @@
+// Sector lookup benchmark
+// Times finding the sector containing random points on each map given,
+// once by scanning every sector as updatesector() used to and once through
+// updatesector() and updatesectorz() with no starting sector, checks both
+// give the same answers, then checks again after moving some walls.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "cache1d.h"
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+typedef struct {
+	int x, y, z;
+	short sect, sectz;
+} pointtype;
+
+static pointtype *points = NULL;
+static int numpoints = 100000, passes = 3;
+
+static unsigned int seed = 1;
+static int rnd(int n)
+{
+	seed = seed * 1103515245u + 12345u;
+	return (int)((seed >> 8) % (unsigned)n);
+}
+
+static short scansector(int x, int y)
+{
+	int i;
+
+	for (i=numsectors-1;i>=0;i--)
+		if (inside(x,y,(short)i) == 1) return (short)i;
+	return -1;
+}
+
+static short scansectorz(int x, int y, int z)
+{
+	int i, cz, fz;
+
+	for (i=numsectors-1;i>=0;i--) {
+		getzsofslope((short)i, x, y, &cz, &fz);
+		if ((z >= cz) && (z <= fz))
+			if (inside(x,y,(short)i) == 1) return (short)i;
+	}
+	return -1;
+}
+
+	// Points anywhere in the map's bounds, at heights between some sector's
+	// ceiling and floor so updatesectorz() has something to find
+static void makepoints(void)
+{
+	int i, s, x0, y0, x1, y1;
+
+	x0 = y0 = 0x7fffffff; x1 = y1 = 0x80000000;
+	for (i=0;i<numwalls;i++) {
+		x0 = min(x0, wall[i].x); y0 = min(y0, wall[i].y);
+		x1 = max(x1, wall[i].x); y1 = max(y1, wall[i].y);
+	}
+	for (i=0;i<numpoints;i++) {
+		points[i].x = x0 + rnd(max(1, x1-x0+1));
+		points[i].y = y0 + rnd(max(1, y1-y0+1));
+		s = rnd(numsectors);
+		points[i].z = sector[s].ceilingz + rnd(max(1, sector[s].floorz-sector[s].ceilingz+1));
+	}
+}
+
+static int checkpoints(const char *what)
+{
+	int i, fails = 0;
+	short s;
+
+	for (i=0;i<numpoints;i++) {
+		s = -1;
+		updatesector(points[i].x, points[i].y, &s);
+		if (s != scansector(points[i].x, points[i].y)) fails++;
+		s = -1;
+		updatesectorz(points[i].x, points[i].y, points[i].z, &s);
+		if (s != scansectorz(points[i].x, points[i].y, points[i].z)) fails++;
+	}
+	if (fails) buildprintf("  %d lookups differ from a full scan %s\n", fails, what);
+	return fails;
+}
+
+static int benchmap(const char *mapname)
+{
+	int i, j, x, y, z, found, fails = 0;
+	short ang, cursect, s;
+	unsigned int t, scanbest = ~0u, gridbest = ~0u, scanzbest = ~0u, gridzbest = ~0u;
+
+	if (loadboard((char *)mapname, 0, &x, &y, &z, &ang, &cursect) < 0) {
+		buildprintf("Could not load map %s\n", mapname);
+		return 1;
+	}
+	makepoints();
+
+	for (j=0;j<passes;j++) {
+		t = getusecticks();
+		for (i=0;i<numpoints;i++) points[i].sect = scansector(points[i].x, points[i].y);
+		t = getusecticks() - t; if (t < scanbest) scanbest = t;
+
+		t = getusecticks();
+		for (i=0;i<numpoints;i++) points[i].sectz = scansectorz(points[i].x, points[i].y, points[i].z);
+		t = getusecticks() - t; if (t < scanzbest) scanzbest = t;
+
+		t = getusecticks();
+		for (i=0;i<numpoints;i++) {
+			s = -1;
+			updatesector(points[i].x, points[i].y, &s);
+			if (s != points[i].sect) fails++;
+		}
+		t = getusecticks() - t; if (t < gridbest) gridbest = t;
+
+		t = getusecticks();
+		for (i=0;i<numpoints;i++) {
+			s = -1;
+			updatesectorz(points[i].x, points[i].y, points[i].z, &s);
+			if (s != points[i].sectz) fails++;
+		}
+		t = getusecticks() - t; if (t < gridzbest) gridzbest = t;
+	}
+	for (i=0,found=0;i<numpoints;i++) found += (points[i].sect >= 0);
+
+	buildprintf("%s: %d sectors, %d walls, %d of %d points in a sector\n",
+		mapname, numsectors, numwalls, found, numpoints);
+	buildprintf("  updatesector:  scan %.3f us, grid %.3f us per lookup\n",
+		(double)scanbest / numpoints, (double)gridbest / numpoints);
+	buildprintf("  updatesectorz: scan %.3f us, grid %.3f us per lookup\n",
+		(double)scanzbest / numpoints, (double)gridzbest / numpoints);
+	if (fails) buildprintf("  %d lookups differ from a full scan\n", fails);
+
+		// Drag a few points about, as the game's moving sectors do
+	for (i=0;i<16 && numwalls>0;i++) {
+		j = rnd(numwalls);
+		dragpoint((short)j, wall[j].x + rnd(2049) - 1024, wall[j].y + rnd(2049) - 1024);
+	}
+	fails += checkpoints("after dragging walls");
+
+		// And move many sectors' walls directly, past what the grid tracks
+	for (i=0;i<numsectors;i+=2) {
+		for (j=sector[i].wallptr;j<sector[i].wallptr+sector[i].wallnum;j++) wall[j].x += 512;
+		invalidatesectorgrid((short)i);
+	}
+	fails += checkpoints("after moving sectors");
+
+	return fails != 0;
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	int i, fails = 0, nummaps = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') { nummaps++; continue; }
+		if (argv[i][1] == 'n' && !argv[i][2] && i+1 < argc) { numpoints = atoi(argv[++i]); continue; }
+		if (argv[i][1] == 'p' && !argv[i][2] && i+1 < argc) { passes = atoi(argv[++i]); continue; }
+		nummaps = 0;
+		break;
+	}
+	if (!nummaps || numpoints < 1 || passes < 1) {
+		puts("sectbench [-n points] [-p passes] mapfile...");
+		return 1;
+	}
+
+	points = (pointtype *)Bmalloc(numpoints * sizeof(pointtype));
+	if (!points) return 1;
+	if (initengine()) {
+		buildprintf("initengine() failed: %s\n", engineerrstr);
+		return 1;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-') { i++; continue; }
+		fails |= benchmap(argv[i]);
+	}
+
+	uninitengine();
+	Bfree(points);
+
+	return fails;
+}
@@ -0,0 +1,269 @@
+// Span kernel equivalence test
+// Checks every SIMD span kernel set this processor supports against the
+// scalar kernels over randomised parameters, then times each set.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "compat.h"
+#include "a.h"
+#include "a_priv.h"
+
+#ifdef ENGINE_USING_A_C
+
+	// Engine state the line functions in a-c.c refer to
+int asm1, asm2, asm4, fpuasm, globalx3, globaly3;
+intptr_t asm3;
+int reciptable[2048];
+
+int krecip(int num)
+{
+	float f = (float)num; int i = *(int *)&f;
+	return((reciptable[(i>>12)&2047]>>(((i-0x3f800000)>>23)&31))^(i>>31));
+}
+
+void buildprintf(const char *fmt, ...) { }
+
+#define DESTW 640
+#define DESTH 512
+#define MAXTEX (1<<20)
+
+static unsigned char tex[MAXTEX], pals[256*32], trans[65536];
+static unsigned char dest1[DESTW*DESTH], dest2[DESTW*DESTH];
+static intptr_t slopal[DESTH+1];
+
+static unsigned int rnd(void)
+{
+	static unsigned int seed = 0x1234567;
+	seed = seed*1664525+1013904223;
+	return seed;
+}
+static int rndrange(int lo, int hi) { return lo + (int)(rnd()%(unsigned int)(hi-lo+1)); }
+
+enum { KVLINE, KMVLINE, KTVLINE, KHLINE, KSLOPEVLIN, KSPRITEVLINE, NUMKERNELS };
+static const char *kernelnames[NUMKERNELS] = {
+	"vline", "mvline", "tvline", "hline", "slopevlin", "spritevline"
+};
+
+typedef struct {
+	int kernel;
+	int logx, logy, reverse;
+	int cnt, inc1, inc2, u, v;
+	int x3, y3, bz, bzinc;
+	int palofs, destofs, pinc;
+} spanparams;
+
+	// Returns a coordinate step of a quarter to one texel for a texture
+	// coordinate whose integer part starts at bit 'shift'
+static int texelstep(int shift)
+{
+	unsigned int quarter = 1u<<(shift-2);
+	return (int)(quarter + rnd()%(3*quarter)) * ((rnd()&1) ? 1 : -1);
+}
+
+	// Chooses parameters that keep every access within the buffers, as the
+	// engine's do; texture coordinates wrap so may be anything. Realistic
+	// parameters draw long spans that step through textures like the
+	// renderer does, rather than hopping about at random.
+static void randomparams(spanparams *sp, int kernel, int realistic)
+{
+	int xsiz, ysiz, pixels, col, row;
+
+	memset(sp, 0, sizeof(spanparams));
+	sp->kernel = kernel;
+	sp->logx = rndrange(1,10);
+	sp->logy = rndrange(1,10);
+	sp->reverse = rnd()&1;
+	sp->cnt = rndrange(0,DESTH-2);
+	sp->inc1 = (int)rnd() >> rndrange(0,12);
+	sp->inc2 = (int)rnd() >> rndrange(0,12);
+	sp->u = (int)rnd();
+	sp->v = (int)rnd();
+	sp->palofs = rndrange(0,31)<<8;
+	col = rndrange(0,DESTW-1);
+	row = rndrange(0,DESTH-1);
+
+	if (realistic) { row = 0; col = DESTW-1; }
+	switch (kernel) {
+		case KVLINE:
+		case KMVLINE:
+		case KTVLINE:
+			sp->logy = 32-sp->logy;
+			if (realistic) sp->inc1 = texelstep(sp->logy);
+			sp->cnt = rndrange(0,DESTH-1-row);
+			sp->destofs = row*DESTW+col;
+			break;
+		case KHLINE:	// draws leftwards
+			if (realistic) { sp->inc1 = texelstep(32-sp->logx); sp->inc2 = texelstep(32-sp->logy); }
+			sp->cnt = rndrange(0,col);
+			sp->destofs = row*DESTW+col;
+			break;
+		case KSLOPEVLIN:	// draws up or down, cnt pixels
+			sp->x3 = (int)rnd() >> rndrange(0,16);
+			sp->y3 = (int)rnd() >> rndrange(0,16);
+			sp->bz = (int)rnd();
+			sp->bzinc = (int)rnd() >> rndrange(4,20);
+			if (realistic) row = (rnd()&1) ? DESTH-1 : 0;
+			if (row > 0 && (row == DESTH-1 || (rnd()&1))) {
+				sp->pinc = -DESTW;
+				sp->cnt = rndrange(0,row+1);
+			} else {
+				sp->pinc = DESTW;
+				sp->cnt = rndrange(0,DESTH-row);
+			}
+			sp->destofs = row*DESTW+col;
+			break;
+		case KSPRITEVLINE:	// draws cnt-1 pixels, coordinates in 16.16
+			xsiz = 1<<sp->logx; ysiz = 1<<sp->logy;
+			sp->logy = ysiz;
+			pixels = rndrange(0,DESTH-1-row);
+			sp->cnt = pixels+1;
+			sp->u = rndrange(0,(xsiz<<16)-1);
+			sp->v = rndrange(0,(ysiz<<16)-1);
+			sp->inc1 = pixels ? rndrange(-sp->u/pixels, ((xsiz<<16)-1-sp->u)/pixels) : 0;
+			sp->inc2 = pixels ? rndrange(-sp->v/pixels, ((ysiz<<16)-1-sp->v)/pixels) : 0;
+			sp->destofs = row*DESTW+col;
+			break;
+	}
+}
+
+static void runspan(const spankerneltype *k, const spanparams *sp, unsigned char *dest)
+{
+	int i;
+
+	switch (sp->kernel) {
+		case KVLINE:
+			k->vline(tex,&pals[sp->palofs],sp->logy,DESTW,sp->inc1,sp->cnt,sp->v,&dest[sp->destofs]);
+			break;
+		case KMVLINE:
+			k->mvline(tex,&pals[sp->palofs],sp->logy,DESTW,sp->inc1,sp->cnt,sp->v,&dest[sp->destofs]);
+			break;
+		case KTVLINE:
+			k->tvline(tex,&pals[sp->palofs],trans,sp->reverse,sp->logy,DESTW,sp->inc1,sp->cnt,sp->v,&dest[sp->destofs]);
+			break;
+		case KHLINE:
+			k->hline(tex,&pals[sp->palofs],sp->logx,sp->logy,sp->inc1,sp->inc2,sp->cnt,sp->v,sp->u,&dest[sp->destofs]);
+			break;
+		case KSLOPEVLIN:
+			for(i=0;i<sp->cnt;i++) slopal[DESTH-i] = (intptr_t)&pals[((sp->palofs>>8)+i)%32<<8];
+			k->slopevlin(tex,&slopal[DESTH],sp->logx,sp->logy,sp->pinc,sp->x3,sp->y3,
+				sp->bz,sp->bzinc,sp->cnt,sp->u,sp->v,&dest[sp->destofs]);
+			break;
+		case KSPRITEVLINE:
+			k->spritevline(tex,&pals[sp->palofs],sp->logy,DESTW,sp->inc1,sp->inc2,sp->cnt,sp->u,sp->v,&dest[sp->destofs]);
+			break;
+	}
+}
+
+static int isscalar(const spankerneltype *k, int kernel)
+{
+	const spankerneltype *c = &spankernels_c;
+
+	switch (kernel) {
+		case KVLINE: return k->vline == c->vline;
+		case KMVLINE: return k->mvline == c->mvline;
+		case KTVLINE: return k->tvline == c->tvline;
+		case KHLINE: return k->hline == c->hline;
+		case KSLOPEVLIN: return k->slopevlin == c->slopevlin;
+		case KSPRITEVLINE: return k->spritevline == c->spritevline;
+	}
+	return 0;
+}
+
+static int checkset(const spankerneltype *k, int trials)
+{
+	spanparams sp;
+	int kernel, t, fails = 0, kfails;
+
+	for (kernel = 0; kernel < NUMKERNELS; kernel++) {
+		if (isscalar(k, kernel)) {
+			printf("  %-4s %-12s scalar\n", k->name, kernelnames[kernel]);
+			continue;
+		}
+		kfails = 0;
+		for (t = 0; t < trials; t++) {
+			randomparams(&sp, kernel, 0);
+			runspan(&spankernels_c, &sp, dest1);
+			runspan(k, &sp, dest2);
+			if (memcmp(dest1, dest2, sizeof(dest1))) {
+				if (!kfails) {
+					printf("  %s %s: mismatch with logx=%d logy=%d cnt=%d inc=%d,%d u=%d v=%d\n",
+						k->name, kernelnames[kernel], sp.logx, sp.logy, sp.cnt,
+						sp.inc1, sp.inc2, sp.u, sp.v);
+				}
+				memcpy(dest2, dest1, sizeof(dest1));
+				kfails++;
+			}
+		}
+		printf("  %-4s %-12s %s (%d of %d trials differ)\n", k->name, kernelnames[kernel],
+			kfails ? "FAIL" : "ok", kfails, trials);
+		fails += kfails;
+	}
+	return fails;
+}
+
+static void timeset(const spankerneltype *k, int spans)
+{
+	spanparams *sp;
+	int kernel, i;
+	double pixels, secs;
+	clock_t c;
+
+	sp = (spanparams *)malloc(spans * sizeof(spanparams));
+	if (!sp) return;
+
+	printf("  %-4s", k->name);
+	for (kernel = 0; kernel < NUMKERNELS; kernel++) {
+		for (i = 0, pixels = 0; i < spans; i++) {
+			randomparams(&sp[i], kernel, 1);
+			pixels += sp[i].cnt;
+		}
+		c = clock();
+		for (i = 0; i < spans; i++) runspan(k, &sp[i], dest2);
+		secs = (double)(clock() - c) / CLOCKS_PER_SEC;
+		printf(" %8.1f", secs > 0 ? pixels / secs / 1e6 : 0.0);
+	}
+	printf("\n");
+	free(sp);
+}
+
+int main(int argc, char **argv)
+{
+	const spankerneltype * const *sets;
+	int i, trials = 20000, fails = 0;
+
+	if (argc > 1) trials = atoi(argv[1]);
+
+	for (i = 0; i < 2048; i++) reciptable[i] = (int)(((int64_t)2048<<30)/(i+2048));
+	for (i = 0; i < MAXTEX; i++) tex[i] = (rnd()%10 == 0) ? 255 : (unsigned char)rnd();
+	for (i = 0; i < (int)sizeof(pals); i++) pals[i] = (unsigned char)rnd();
+	for (i = 0; i < (int)sizeof(trans); i++) trans[i] = (unsigned char)rnd();
+	for (i = 0; i < (int)sizeof(dest1); i++) dest1[i] = dest2[i] = (unsigned char)rnd();
+
+	sets = getspankernelsets();
+
+	printf("Comparing against the scalar kernels over %d spans per kernel:\n", trials);
+	for (i = 0; sets[i] != &spankernels_c; i++) fails += checkset(sets[i], trials);
+
+	printf("\nMpixels/sec:  ");
+	for (i = 0; i < NUMKERNELS; i++) printf(" %8s", kernelnames[i]);
+	printf("\n");
+	for (i = 0; sets[i]; i++) timeset(sets[i], trials);
+
+	if (fails) {
+		printf("\n%d spans differ from the scalar kernels.\n", fails);
+		return 1;
+	}
+	return 0;
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+	printf("The span kernels are only used when the engine is built without USE_ASM.\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,355 @@
+// Texture cache builder
+// Reads a definitions file and prepares every hightile replacement, skybox
+// face and model skin it names for the texture cache, exactly as the game
+// would the first time it drew each, so the game finds them all already
+// compressed. Textures are prepared several at once across a pool of
+// threads. Entries already cached are kept unless the file they were made
+// from has been modified since.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "cache1d.h"
+#include "workpool.h"
+#include "kplib.h"
+#include "glbuild.h"
+#include "hightile_priv.h"
+#include "polymosttex_priv.h"
+#include "polymosttexcache.h"
+#include "mdsprite_priv.h"
+
+extern int gltexcomprquality, gltexcomprthreads;	// from polymost.c
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+#define MAXARCHIVES 16
+
+typedef struct {
+	const char *filename;
+	int effects, flags;
+	int mtime;		// of the file, 0 if unknown
+	char *picdata;
+	int picdatalen;
+	PTCacheTile *tdef;
+	int err;
+} itemtype;
+
+static itemtype *items = NULL;
+static int numitems = 0, itemsalloced = 0;
+static int archivetime = 0;		// the newest of the archives, for files inside ZIPs
+
+static void usage(void)
+{
+	puts("texcachebuild [options] defsfile\n"
+		"  -g archive  add a group or ZIP file to search, may be repeated\n"
+		"  -p path     add a directory to search, may be repeated\n"
+		"  -f format   dxt for DXT1 and DXT5, or etc1 for ETC1 (default dxt)\n"
+		"  -q quality  gltexcomprquality, 0 to 2 (default 0)\n"
+		"  -j threads  threads to prepare textures on, 0 for one per processor (default 0)\n"
+		"  -r          rebuild the cache from nothing rather than only what has changed\n"
+		"  -v          list each texture as it is prepared\n"
+		"The cache is written to texture.cache and texture.cacheindex in the\n"
+		"current directory, where the game looks for it."
+	);
+}
+
+static void additem(const char *filename, int effects, int flags)
+{
+	itemtype *it;
+
+	if (!filename || !filename[0]) return;
+
+	if (numitems == itemsalloced) {
+		itemsalloced = itemsalloced ? itemsalloced * 2 : 256;
+		items = (itemtype *)Brealloc(items, itemsalloced * sizeof(itemtype));
+		if (!items) {
+			buildprintf("Out of memory\n");
+			exit(1);
+		}
+	}
+	it = &items[numitems++];
+	memset(it, 0, sizeof(itemtype));
+	it->filename = filename;
+	it->effects = effects;
+	it->flags = flags;
+}
+
+static int compareitems(const void *a, const void *b)
+{
+	const itemtype *ia = (const itemtype *)a, *ib = (const itemtype *)b;
+	int c;
+
+	c = strcmp(ia->filename, ib->filename);
+	if (c) return c;
+	if (ia->effects != ib->effects) return ia->effects - ib->effects;
+	return ia->flags - ib->flags;
+}
+
+	// Lists each texture with every set of effects and flags the game could
+	// ask for it with. Whether a tile is drawn clamped, as sprites are, or
+	// repeating, as walls are, isn't known from the definitions, so tiles
+	// are prepared both ways.
+static void finditems(void)
+{
+	hicreplctyp *hr;
+	mdskinmap_t *sk;
+	md2model *m;
+	int i, j, e, effectsused = 1;
+
+	for (i = 0; i < MAXPALOOKUPS; i++) {
+		effectsused |= 1 << hictinting[i].f;
+	}
+
+	for (i = 0; i < MAXTILES; i++) {
+		for (hr = hicreplc[i]; hr; hr = hr->next) {
+			if (hr->flags & HIC_NOCOMPRESS) continue;
+			for (e = 0; e <= HICEFFECTMASK; e++) {
+				// Palette 0 replacements stand in for the palettes without
+				// one of their own, taking on their effects.
+				if (e && (hr->palnum || !(effectsused & (1 << e)))) continue;
+
+				if (!hr->ignore) {
+					additem(hr->filename, e, 0);
+					additem(hr->filename, e, PTH_CLAMPED);
+				}
+				if (hr->skybox && !hr->skybox->ignore) {
+					for (j = 0; j < 6; j++) additem(hr->skybox->face[j], e, PTH_CLAMPED | PTH_SKYBOX);
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < nextmodelid; i++) {
+		m = (md2model *)models[i];
+		if (m->mdnum < 2) continue;	// voxels have no skins
+
+		for (e = 0; e <= HICEFFECTMASK; e++) {
+			if (!(effectsused & (1 << e))) continue;
+
+			for (sk = m->skinmap; sk; sk = sk->next) {
+				if (e != hictinting[sk->palette].f && sk->palette) continue;
+				additem(sk->fn, e, PTH_CLAMPED);
+			}
+			if (m->mdnum == 2) {
+				for (j = 0; j < m->numskins; j++) additem(m->skinfn + j*64, e, PTH_CLAMPED);
+			}
+		}
+	}
+
+	if (numitems > 1) {
+		qsort(items, numitems, sizeof(itemtype), compareitems);
+		for (i = 1, j = 0; i < numitems; i++) {
+			if (compareitems(&items[j], &items[i])) items[++j] = items[i];
+		}
+		numitems = j + 1;
+	}
+}
+
+	// Returns when a file was last modified, going by its group file if it
+	// is in one, or the newest archive if it is in a ZIP. Returns -1 if it
+	// can't be found.
+static int filetime(const char *filename)
+{
+	struct stat st;
+	char *where = NULL;
+	int offset, t = -1;
+
+	if (kfilelocation(filename, 0, &where, &offset) == 0) {
+		if (Bstat(where, &st) == 0) t = (int)st.st_mtime;
+		free(where);
+	} else {
+		offset = kopen4load(filename, 0);
+		if (offset >= 0) {
+			kclose(offset);
+			t = archivetime;
+		}
+	}
+	return t;
+}
+
+static void bakeitem(void *ctx, int job)
+{
+	itemtype *it = &((itemtype *)ctx)[job];
+
+	if (!it->picdata) return;
+	it->err = PTM_BakeTextureFile(it->filename, it->picdata, it->picdatalen, it->flags, it->effects, &it->tdef);
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	const char *archives[MAXARCHIVES], *defsfile = NULL;
+	int numarchives = 0, threads = 0, rebuild = 0, verbose = 0, format = 0;
+	workpool *pool;
+	itemtype *it;
+	char *zfn;
+	struct stat st;
+	int i, j, batch, fil, t, starttime;
+	int prepared = 0, kept = 0, failed = 0, writefailed = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') {
+			if (defsfile) { usage(); return 1; }
+			defsfile = argv[i];
+			continue;
+		}
+		if (!argv[i][1] || argv[i][2]) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 'r': rebuild = 1; continue;
+			case 'v': verbose = 1; continue;
+		}
+		if (i+1 >= argc) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 'g':
+				if (numarchives == MAXARCHIVES) { usage(); return 1; }
+				archives[numarchives++] = argv[++i];
+				break;
+			case 'p':
+				if (addsearchpath(argv[++i]) < 0) {
+					buildprintf("Could not add %s to the search path\n", argv[i]);
+					return 1;
+				}
+				break;
+			case 'f':
+				i++;
+				if (!Bstrcasecmp(argv[i], "dxt")) format = 0;
+				else if (!Bstrcasecmp(argv[i], "etc1")) format = 1;
+				else { usage(); return 1; }
+				break;
+			case 'q': gltexcomprquality = atoi(argv[++i]); break;
+			case 'j': threads = atoi(argv[++i]); break;
+			default: usage(); return 1;
+		}
+	}
+	if (!defsfile || threads < 0 || gltexcomprquality < 0 || gltexcomprquality > 2) {
+		usage();
+		return 1;
+	}
+#if !GL_EXT_texture_compression_s3tc
+	if (format == 0) {
+		buildprintf("This build of the engine has no DXT support\n");
+		return 1;
+	}
+#endif
+#if !GL_OES_compressed_ETC1_RGB8_texture
+	if (format == 1) {
+		buildprintf("This build of the engine has no ETC1 support\n");
+		return 1;
+	}
+#endif
+
+	for (i = 0; i < numarchives; i++) {
+		if (initgroupfile(archives[i]) < 0) {
+			buildprintf("Could not open %s\n", archives[i]);
+			return 1;
+		}
+		if (findfrompath(archives[i], &zfn) == 0) {
+			if (Bstat(zfn, &st) == 0) archivetime = max(archivetime, (int)st.st_mtime);
+			free(zfn);
+		}
+	}
+
+	if (initengine()) {
+		buildprintf("initengine() failed: %s\n", engineerrstr);
+		return 1;
+	}
+	if (loaddefinitionsfile(defsfile)) {
+		buildprintf("Could not load %s\n", defsfile);
+		uninitengine();
+		return 1;
+	}
+	if (rebuild) {
+		PTCacheForceRebuild();
+	}
+
+	// Stand in for a driver offering the chosen formats. Each texture is
+	// compressed on the thread preparing it, rather than across the
+	// compressor's own pool.
+	glinfo.bgra = 1;
+	if (format == 0) glinfo.texcomprdxt1 = glinfo.texcomprdxt5 = 1;
+	else glinfo.texcompretc1 = 1;
+	gltexcomprthreads = 1;
+
+	finditems();
+
+	// Builds whose decoders share state can only use one thread.
+	pool = workpool_create(kpthreadsafe() ? threads : 1);
+	batch = 4 * (pool ? workpool_numthreads(pool) : 1);
+	buildprintf("%d textures to consider, preparing %d at a time on %d threads\n",
+		numitems, batch, pool ? workpool_numthreads(pool) : 1);
+
+	starttime = getticks();
+	for (i = 0; i < numitems && !writefailed; i += batch) {
+		batch = min(batch, numitems - i);
+
+		// The file system isn't safe to use from several threads, so the
+		// files are read here and only decoded on the pool.
+		for (j = i; j < i + batch; j++) {
+			it = &items[j];
+			it->mtime = t = filetime(it->filename);
+			if (t < 0) {
+				if (j == 0 || strcmp(items[j-1].filename, it->filename)) {
+					buildprintf("%s: not found\n", it->filename);
+				}
+				failed++;
+				continue;
+			}
+			if (!rebuild && t > 0 && PTCacheGetTileMtime(it->filename, it->effects, it->flags) == t) {
+				kept++;
+				continue;
+			}
+
+			fil = kopen4load(it->filename, 0);
+			if (fil >= 0) {
+				it->picdatalen = kfilelength(fil);
+				it->picdata = (char *)Bmalloc(max(1, it->picdatalen));
+				if (it->picdata && kread(fil, it->picdata, it->picdatalen) != it->picdatalen) {
+					Bfree(it->picdata);
+					it->picdata = NULL;
+				}
+				kclose(fil);
+			}
+			if (!it->picdata) {
+				buildprintf("%s: could not be read\n", it->filename);
+				failed++;
+			}
+		}
+
+		workpool_run(pool, bakeitem, &items[i], batch);
+
+		for (j = i; j < i + batch; j++) {
+			it = &items[j];
+			if (!it->picdata) continue;
+			Bfree(it->picdata);
+			it->picdata = NULL;
+
+			if (!it->tdef) {
+				buildprintf("%s (effects %d, flags %d): %s\n", it->filename, it->effects, it->flags & PTH_CLAMPED,
+					PTM_GetLoadTextureFileErrorString(it->err));
+				failed++;
+				continue;
+			}
+			if (verbose) {
+				buildprintf("%s (effects %d, flags %d): %dx%d\n", it->filename, it->effects, it->tdef->flags,
+					it->tdef->tsizx, it->tdef->tsizy);
+			}
+
+			it->tdef->mtime = it->mtime;
+			if (!writefailed && PTCacheWriteTile(it->tdef)) prepared++;
+			else writefailed = 1;
+			PTCacheFreeTile(it->tdef);
+			it->tdef = NULL;
+		}
+	}
+
+	buildprintf("%d prepared, %d already cached, %d failed, in %.2f sec\n",
+		prepared, kept, failed, (getticks() - starttime) / 1000.0);
+
+	workpool_destroy(pool);
+	Bfree(items);
+	uninitengine();
+	uninitgroupfile();
+
+	return writefailed;
+}
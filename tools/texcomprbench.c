@@ -0,0 +1,304 @@
+// Texture compression benchmark
+// Compresses a set of images and their mip levels with each format at each
+// quality setting, first a whole level at a time as the texture manager used
+// to and then in bands across the thread pool, checking the two agree to the
+// byte and reporting how long each took.
+// The images are PNGs from a directory, or made up if none is given.
+
+#include "compat.h"
+#include "build.h"
+#include "baselayer.h"
+#include "kplib.h"
+#include "polymosttexcompress.h"
+
+extern int gltexcomprquality, gltexcomprthreads;	// from polymost.c
+extern int texcomprref(void * bgra, int width, int height, unsigned char * output, int format, int quality);	// from texcomprref.cc
+
+	// Game-side symbols the engine expects to find
+int nextvoxid = 0;
+void faketimerhandler(void) { }
+
+#define MAXLEVELS 16
+
+typedef struct {
+	char *name;
+	ptcompressimage levels[MAXLEVELS];
+	int numlevels;
+} imagetype;
+
+static imagetype *images = NULL;
+static int numimages = 0, totalpixels = 0;
+static int width = 512, height = 512, count = 8, threads = 0, passes = 1, onlyquality = -1;
+
+static void usage(void)
+{
+	puts("texcomprbench [options] [directory]\n"
+		"  -r WxH      size of the made-up images (default 512x512)\n"
+		"  -i images   number of made-up images (default 8)\n"
+		"  -t threads  compression threads, 0 for one per processor (default 0)\n"
+		"  -q quality  only this gltexcomprquality, 0 to 2 (default all)\n"
+		"  -n passes   times to compress everything, keeping the best (default 1)"
+	);
+}
+
+	// Adds an image and its mip levels, halving each until 1x1.
+static int addimage(const char *name, const unsigned char *bgra, int xsiz, int ysiz)
+{
+	imagetype *img;
+	ptcompressimage *lev, *prev;
+	const unsigned char *s;
+	unsigned char *d;
+	int x, y, c, x1, y1;
+
+	images = (imagetype *)Brealloc(images, (numimages + 1) * sizeof(imagetype));
+	if (!images) return -1;
+	img = &images[numimages++];
+	memset(img, 0, sizeof(imagetype));
+	img->name = Bstrdup(name);
+
+	for (lev = img->levels; img->numlevels < MAXLEVELS; lev++) {
+		lev->width = xsiz;
+		lev->height = ysiz;
+		lev->bgra = Bmalloc(xsiz * ysiz * 4);
+		if (!lev->bgra) return -1;
+		if (img->numlevels == 0) {
+			memcpy(lev->bgra, bgra, xsiz * ysiz * 4);
+		} else {
+			prev = lev - 1;
+			d = (unsigned char *)lev->bgra;
+			for (y = 0; y < ysiz; y++) {
+				y1 = min(y * 2 + 1, prev->height - 1);
+				for (x = 0; x < xsiz; x++) {
+					x1 = min(x * 2 + 1, prev->width - 1);
+					s = (const unsigned char *)prev->bgra;
+					for (c = 0; c < 4; c++, d++) {
+						*d = (s[(y*2*prev->width + x*2)*4 + c] + s[(y*2*prev->width + x1)*4 + c] +
+							s[(y1*prev->width + x*2)*4 + c] + s[(y1*prev->width + x1)*4 + c] + 2) >> 2;
+					}
+				}
+			}
+		}
+		totalpixels += xsiz * ysiz;
+		img->numlevels++;
+
+		if (xsiz == 1 && ysiz == 1) break;
+		xsiz = max(1, xsiz >> 1);
+		ysiz = max(1, ysiz >> 1);
+	}
+	return 0;
+}
+
+	// Smooth gradients, hard edges and noise, with an alpha channel of cut-outs.
+static int makeimages(void)
+{
+	unsigned char *pic, *p;
+	char name[32];
+	int i, x, y;
+
+	pic = (unsigned char *)Bmalloc(width * height * 4);
+	if (!pic) return -1;
+
+	srand(1);
+	for (i = 0; i < count; i++) {
+		for (y = 0, p = pic; y < height; y++) {
+			for (x = 0; x < width; x++, p += 4) {
+				p[0] = (x * 255 / width + i * 37) & 255;
+				p[1] = (((x >> (3+(i&3))) ^ (y >> (3+(i&3)))) & 1) ? 200 : 40;
+				p[2] = (y * 255 / height + (rand() & 31)) & 255;
+				p[3] = ((((x + i * 11) >> 4) + (y >> 4)) % 5) ? 255 : 0;
+			}
+		}
+		Bsprintf(name, "made-up %d", i);
+		if (addimage(name, pic, width, height)) break;
+	}
+	Bfree(pic);
+	return (numimages == count) ? 0 : -1;
+}
+
+static int loadimages(const char *dir)
+{
+	BDIR *d;
+	struct Bdirent *de;
+	char path[BMAX_PATH];
+	FILE *fp;
+	char *buf;
+	unsigned char *pic;
+	int leng, xsiz, ysiz;
+
+	d = Bopendir(dir);
+	if (!d) return -1;
+
+	while ((de = Breaddir(d))) {
+		if ((de->mode & BS_IFDIR) || !Bwildmatch(de->name, "*.png")) continue;
+
+		Bsnprintf(path, sizeof(path), "%s/%s", dir, de->name);
+		fp = fopen(path, "rb");
+		if (!fp) continue;
+		fseek(fp, 0, SEEK_END);
+		leng = (int)ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		buf = (char *)Bmalloc(max(leng, 1));
+		if (leng < 16 || !buf || fread(buf, leng, 1, fp) != 1) {
+			fclose(fp);
+			Bfree(buf);
+			continue;
+		}
+		fclose(fp);
+
+		xsiz = ysiz = 0;
+		kpgetdim(buf, leng, &xsiz, &ysiz);
+		pic = (xsiz > 0 && ysiz > 0) ? (unsigned char *)Bmalloc(xsiz * ysiz * 4) : NULL;
+		if (pic && kprender(buf, leng, pic, xsiz * 4, xsiz, ysiz, 0, 0) >= 0) {
+			addimage(de->name, pic, xsiz, ysiz);
+		}
+		Bfree(pic);
+		Bfree(buf);
+	}
+	Bclosedir(d);
+
+	return numimages ? 0 : -1;
+}
+
+	// Compresses every level of every image in a single call each, returning
+	// the best time over the passes.
+static unsigned int compresswhole(int format, unsigned char *out)
+{
+	unsigned char *o;
+	unsigned int t, best = ~0u;
+	int i, j, k;
+
+	for (k = 0; k < passes; k++) {
+		t = getusecticks();
+		o = out;
+		for (i = 0; i < numimages; i++) {
+			for (j = 0; j < images[i].numlevels; j++) {
+				texcomprref(images[i].levels[j].bgra, images[i].levels[j].width, images[i].levels[j].height,
+					o, format, gltexcomprquality);
+				o += ptcompress_getstorage(images[i].levels[j].width, images[i].levels[j].height, format);
+			}
+		}
+		t = getusecticks() - t;
+		if (t < best) best = t;
+	}
+	return best;
+}
+
+	// Compresses every image, each as one batch of levels as the texture
+	// manager does, returning the best time over the passes.
+static unsigned int compressall(int format, unsigned char *out)
+{
+	ptcompressimage batch[MAXLEVELS];
+	unsigned char *o;
+	unsigned int t, best = ~0u;
+	int i, j, k;
+
+	for (k = 0; k < passes; k++) {
+		t = getusecticks();
+		o = out;
+		for (i = 0; i < numimages; i++) {
+			for (j = 0; j < images[i].numlevels; j++) {
+				batch[j] = images[i].levels[j];
+				batch[j].output = o;
+				o += ptcompress_getstorage(batch[j].width, batch[j].height, format);
+			}
+			ptcompress_compressmany(batch, images[i].numlevels, format, 1);
+		}
+		t = getusecticks() - t;
+		if (t < best) best = t;
+	}
+	return best;
+}
+
+int app_main(int argc, char const * const argv[])
+{
+	static const struct { int format; const char *name; } formats[] = {
+		{ PTCOMPRESS_DXT1, "DXT1" }, { PTCOMPRESS_DXT5, "DXT5" }, { PTCOMPRESS_ETC1, "ETC1" },
+	};
+	const char *dir = NULL;
+	unsigned char *whole, *banded;
+	unsigned int tw, tb;
+	int i, j, f, q, size, maxsize = 0, fails = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') {
+			if (dir) { usage(); return 1; }
+			dir = argv[i];
+			continue;
+		}
+		if (!argv[i][1] || argv[i][2] || i+1 >= argc) { usage(); return 1; }
+		switch (argv[i][1]) {
+			case 'r':
+				if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) { usage(); return 1; }
+				break;
+			case 'i': count = atoi(argv[++i]); break;
+			case 't': threads = atoi(argv[++i]); break;
+			case 'q': onlyquality = atoi(argv[++i]); break;
+			case 'n': passes = atoi(argv[++i]); break;
+			default: usage(); return 1;
+		}
+	}
+	if (width < 1 || height < 1 || count < 1 || threads < 0 || passes < 1 || onlyquality > 2) {
+		usage();
+		return 1;
+	}
+
+	if (dir ? loadimages(dir) : makeimages()) {
+		if (dir) buildprintf("No PNGs could be read from %s\n", dir);
+		else buildprintf("Out of memory\n");
+		return 1;
+	}
+
+	for (f = 0; f < (int)(sizeof(formats)/sizeof(formats[0])); f++) {
+		for (size = 0, i = 0; i < numimages; i++) {
+			for (j = 0; j < images[i].numlevels; j++) {
+				size += ptcompress_getstorage(images[i].levels[j].width, images[i].levels[j].height, formats[f].format);
+			}
+		}
+		maxsize = max(maxsize, size);
+	}
+	whole = (unsigned char *)Bmalloc(maxsize);
+	banded = (unsigned char *)Bmalloc(maxsize);
+	if (!whole || !banded) {
+		buildprintf("Out of memory\n");
+		return 1;
+	}
+
+	buildprintf("%d images, %d pixels with their mip levels, %d passes\n", numimages, totalpixels, passes);
+
+	for (q = 0; q <= 2; q++) {
+		if (onlyquality >= 0 && q != onlyquality) continue;
+		gltexcomprquality = q;
+
+		for (f = 0; f < (int)(sizeof(formats)/sizeof(formats[0])); f++) {
+			for (size = 0, i = 0; i < numimages; i++) {
+				for (j = 0; j < images[i].numlevels; j++) {
+					size += ptcompress_getstorage(images[i].levels[j].width, images[i].levels[j].height, formats[f].format);
+				}
+			}
+
+			tw = compresswhole(formats[f].format, whole);
+			gltexcomprthreads = threads;
+			tb = compressall(formats[f].format, banded);
+
+			if (memcmp(whole, banded, size)) {
+				buildprintf("  quality %d %s: the banded output differs from compressing whole levels\n", q, formats[f].name);
+				fails++;
+				continue;
+			}
+			buildprintf("  quality %d %s  whole %9.2f ms  banded %9.2f ms  %6.2f Mpixels/s  %.2fx\n",
+				q, formats[f].name, tw / 1000.0, tb / 1000.0,
+				tb ? (double)totalpixels / tb : 0.0, tb ? (double)tw / tb : 0.0);
+		}
+	}
+
+	ptcompress_uninit();
+	Bfree(banded);
+	Bfree(whole);
+	for (i = 0; i < numimages; i++) {
+		for (j = 0; j < images[i].numlevels; j++) Bfree(images[i].levels[j].bgra);
+		Bfree(images[i].name);
+	}
+	Bfree(images);
+
+	return fails != 0;
+}
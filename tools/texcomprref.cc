@@ -0,0 +1,78 @@
+// Reference texture compression for texcomprbench
+// Compresses an image in a single call, as the texture manager did before
+// it cut images into bands of block rows, so the banded output can be
+// checked against it.
+
+#include "compat.h"
+#include "build.h"
+#include "polymosttexcompress.h"
+
+#include "squish.h"
+#include "rg_etc1.h"
+
+extern "C" int texcomprref(void * bgra, int width, int height, unsigned char * output, int format, int quality);
+
+static void compressetc1(const uint8_t *bgra, int width, int height, uint8_t *out,
+	rg_etc1::etc1_pack_params &params)
+{
+	uint8_t block[4][4][4];
+	int x, y, s, t, xyoff, stride;
+
+	stride = width * 4;
+	for (y = 0; y < height; y += 4) {
+		for (x = 0; x < width; x += 4) {
+			xyoff = y * stride + x * 4;
+
+			// Copy the block of pixels to encode, byte swizzling to RGBA order.
+			for (t = 0; t < min(4, height - y); t++) {
+				for (s = 0; s < min(4, width - x); s++) {
+					block[t][s][0] = bgra[xyoff + t * stride + s * 4 + 2];
+					block[t][s][1] = bgra[xyoff + t * stride + s * 4 + 1];
+					block[t][s][2] = bgra[xyoff + t * stride + s * 4 + 0];
+					block[t][s][3] = 255;
+				}
+				// Repeat the final pixel to pad to 4.
+				for (; s < 4; s++) {
+					memcpy(&block[t][s][0], &block[t][s-1][0], 4);
+				}
+			}
+			// Repeat the final row to pad to 4.
+			for (; t < 4; t++) {
+				memcpy(&block[t][0][0], &block[t-1][0][0], 4 * 4);
+			}
+
+			rg_etc1::pack_etc1_block(out, (const uint32_t *)block, params);
+
+			out += 8;
+		}
+	}
+}
+
+	// Compresses a whole image at the given gltexcomprquality
+extern "C" int texcomprref(void * bgra, int width, int height, unsigned char * output, int format, int quality)
+{
+	static const bool initonce = (rg_etc1::pack_etc1_block_init(), true);
+	rg_etc1::etc1_pack_params params;
+	int flags;
+
+	(void)initonce;
+
+	switch (quality) {
+		case 2: flags = squish::kColourIterativeClusterFit; params.m_quality = rg_etc1::cHighQuality; break;
+		case 1: flags = squish::kColourClusterFit; params.m_quality = rg_etc1::cMediumQuality; break;
+		default: flags = squish::kColourRangeFit; params.m_quality = rg_etc1::cLowQuality; break;
+	}
+	flags |= squish::kSourceBGRA;
+
+	switch (format) {
+		case PTCOMPRESS_DXT1:
+		case PTCOMPRESS_DXT5:
+			flags |= (format == PTCOMPRESS_DXT1) ? squish::kDxt1 : squish::kDxt5;
+			squish::CompressImage((squish::u8 const *) bgra, width, height, output, flags);
+			return 0;
+		case PTCOMPRESS_ETC1:
+			compressetc1((const uint8_t *) bgra, width, height, output, params);
+			return 0;
+	}
+	return -1;
+}